@@ -0,0 +1,664 @@
+/**
+ * Copyright (c) 2018
+ * the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * @file main.cxx
+ */
+
+// Throughput benchmark for I3CLSimStepToPhotonConverterOpenCL.
+//
+// Unlike resources/scripts/benchmark.py, this does not need a tray, a GCD
+// file or Geant4. The geometry, the medium and the steps are all synthetic
+// and reproducible from the seed, so the numbers of different releases can
+// be compared on the same machine. Any OpenCL device works, including pocl
+// on a machine without a GPU.
+//
+// Run with --help for the options.
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+#include <inttypes.h>
+
+#include <icetray/I3Logging.h>
+#include <icetray/I3Units.h>
+#include <dataclasses/I3Constants.h>
+
+#include "phys-services/I3GSLRandomService.h"
+
+#include "clsim/I3CLSimStep.h"
+#include "clsim/I3CLSimMediumProperties.h"
+#include "clsim/I3CLSimSimpleGeometryUserConfigurable.h"
+#include "clsim/I3CLSimStepToPhotonConverterOpenCL.h"
+#include "clsim/I3CLSimOpenCLDevice.h"
+#include "clsim/I3CLSimModuleHelper.h"
+
+#include "clsim/function/I3CLSimFunctionConstant.h"
+#include "clsim/function/I3CLSimFunctionAbsLenIceCube.h"
+#include "clsim/function/I3CLSimFunctionScatLenIceCube.h"
+#include "clsim/function/I3CLSimFunctionRefIndexIceCube.h"
+#include "clsim/function/I3CLSimScalarFieldConstant.h"
+#include "clsim/function/I3CLSimVectorTransformConstant.h"
+#include "clsim/random_value/I3CLSimRandomValueMixed.h"
+#include "clsim/random_value/I3CLSimRandomValueSimplifiedLiu.h"
+#include "clsim/random_value/I3CLSimRandomValueHenyeyGreenstein.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+    struct Options
+    {
+        Options() :
+        device(0),
+        numBunches(20),
+        numWarmupBunches(2),
+        photonsPerStep(100.),
+        multiplicity("fixed"),
+        paretoShape(1.2),
+        direction("isotropic"),
+        position("volume"),
+        stepLength(1.*I3Units::m),
+        seed(12345),
+        numStrings(9),
+        numDOMsPerString(60),
+        stringSpacing(125.*I3Units::m),
+        domSpacing(17.*I3Units::m),
+        domOversize(5.),
+        approximateNumberOfWorkItems(0),
+        limitWorkgroupSize(0),
+        bufferRingDepth(2),
+        burstSize(0),
+        burstInterval(0.),
+        doublePrecision(false),
+        stopDetectedPhotons(false),
+        usePersistentThreads(false),
+        useCounterBasedRNG(false),
+        stepSplittingFactor(4.)
+        {}
+
+        std::size_t device;
+        std::size_t numBunches;
+        std::size_t numWarmupBunches;
+        double photonsPerStep;
+        std::string multiplicity;
+        double paretoShape;
+        std::string direction;
+        std::string position;
+        double stepLength;
+        uint32_t seed;
+        std::size_t numStrings;
+        std::size_t numDOMsPerString;
+        double stringSpacing;
+        double domSpacing;
+        double domOversize;
+        uint32_t approximateNumberOfWorkItems;
+        uint32_t limitWorkgroupSize;
+        uint32_t bufferRingDepth;
+        std::size_t burstSize;
+        double burstInterval;
+        bool doublePrecision;
+        bool stopDetectedPhotons;
+        bool usePersistentThreads;
+        bool useCounterBasedRNG;
+        double stepSplittingFactor;
+        std::string jsonFile;
+    };
+
+    void PrintUsage(const char *program)
+    {
+        std::cerr
+        << "usage: " << program << " [options]" << std::endl
+        << std::endl
+        << "  --list-devices                 list the OpenCL devices and exit" << std::endl
+        << "  --device <n>                   OpenCL device number (default: 0)" << std::endl
+        << "  --bunches <n>                  number of bunches of steps to time (default: 20)" << std::endl
+        << "  --warmup-bunches <n>           number of bunches before the timing starts (default: 2)" << std::endl
+        << "  --photons-per-step <x>         mean number of photons per step (default: 100)" << std::endl
+        << "  --multiplicity <d>             photons per step: fixed, uniform, exponential, pareto (default: fixed)" << std::endl
+        << "  --pareto-shape <x>             shape of the pareto multiplicity, > 1 (default: 1.2)" << std::endl
+        << "  --direction <d>                step directions: isotropic, down, up, horizontal (default: isotropic)" << std::endl
+        << "  --position <d>                 step positions: volume, cascade, track (default: volume)" << std::endl
+        << "  --step-length <m>              step length in meters (default: 1)" << std::endl
+        << "  --seed <n>                     random seed (default: 12345)" << std::endl
+        << "  --strings <n>                  number of strings on a square grid (default: 9)" << std::endl
+        << "  --doms-per-string <n>          number of DOMs per string (default: 60)" << std::endl
+        << "  --dom-oversize <x>             DOM oversize factor (default: 5)" << std::endl
+        << "  --work-items <n>               approximate number of work items per bunch (default: device setting)" << std::endl
+        << "  --limit-workgroup-size <n>     upper limit for the workgroup size (default: none)" << std::endl
+        << "  --buffer-ring-depth <n>        number of bunches in flight (default: 2)" << std::endl
+        << "  --burst-size <n>               enqueue the bunches in bursts of n, 0: all at once (default: 0)" << std::endl
+        << "  --burst-interval <ms>          pause between two bursts (default: 0)" << std::endl
+        << "  --double-precision             use double precision in the kernel" << std::endl
+        << "  --stop-detected-photons        stop photons at the first DOM they hit" << std::endl
+        << "  --persistent-threads           use persistent work items" << std::endl
+        << "  --counter-based-rng            use the counter-based random number generator" << std::endl
+        << "  --step-splitting-factor <x>    split steps above x times the median photons, 0: off (default: 4)" << std::endl
+        << "  --json <file>                  also write the results to <file> as JSON" << std::endl;
+    }
+
+    template <typename T>
+    bool ParseValue(int argc, char **argv, int &i, T &value)
+    {
+        if (i+1 >= argc) return false;
+        try {
+            value = boost::lexical_cast<T>(argv[++i]);
+        } catch (boost::bad_lexical_cast &) {
+            return false;
+        }
+        return true;
+    }
+
+    void ListDevices()
+    {
+        boost::shared_ptr<std::vector<I3CLSimOpenCLDevice> > devices = I3CLSimOpenCLDevice::GetAllDevices();
+        if (!devices) return;
+        for (std::size_t i=0;i<devices->size();++i)
+        {
+            const I3CLSimOpenCLDevice &device = (*devices)[i];
+            std::cout << i << ": " << device.GetPlatformName() << " / " << device.GetDeviceName()
+            << " (" << (device.IsGPU()?"GPU":(device.IsCPU()?"CPU":"other"))
+            << ", " << device.GetMaxComputeUnits() << " compute units)" << std::endl;
+        }
+    }
+
+    // Strings on a square grid around the origin, DOMs evenly spaced
+    // around z=0.
+    I3CLSimSimpleGeometryUserConfigurablePtr MakeGeometry(const Options &options)
+    {
+        const double omRadius = 0.16510*I3Units::m*options.domOversize;
+        const std::size_t numOMs = options.numStrings*options.numDOMsPerString;
+        I3CLSimSimpleGeometryUserConfigurablePtr geometry(new I3CLSimSimpleGeometryUserConfigurable(omRadius, numOMs));
+
+        const std::size_t gridSize = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(options.numStrings))));
+        const double gridOffset = (static_cast<double>(gridSize)-1.)*options.stringSpacing/2.;
+        const double domOffset = (static_cast<double>(options.numDOMsPerString)-1.)*options.domSpacing/2.;
+
+        for (std::size_t string=0;string<options.numStrings;++string)
+        {
+            for (std::size_t dom=0;dom<options.numDOMsPerString;++dom)
+            {
+                const std::size_t i = string*options.numDOMsPerString+dom;
+                geometry->SetStringID(i, static_cast<int32_t>(string+1));
+                geometry->SetDomID(i, static_cast<uint32_t>(dom+1));
+                geometry->SetPosX(i, static_cast<double>(string%gridSize)*options.stringSpacing - gridOffset);
+                geometry->SetPosY(i, static_cast<double>(string/gridSize)*options.stringSpacing - gridOffset);
+                geometry->SetPosZ(i, domOffset - static_cast<double>(dom)*options.domSpacing);
+                geometry->SetSubdetector(i, "IceCube");
+            }
+        }
+        return geometry;
+    }
+
+    // A homogeneous bulk ice with the wavelength dependence, the
+    // scattering function and the layer structure of the IceCube ice
+    // models (SPICE Lea parameters, without tilt and anisotropy).
+    I3CLSimMediumPropertiesPtr MakeMediumProperties()
+    {
+        const double alpha = 0.898608505726;
+        const double kappa = 1.084106802940;
+        const double A = 6954.090332031250;
+        const double B = 6617.754394531250;
+        const double D = std::pow(400., kappa);
+        const double E = 0.;
+        const double meanCosineTheta = 0.9;
+        const double liuScatteringFraction = 0.41;
+        const double b_e400 = 0.03;  // effective scattering coefficient in 1/m
+        const double a_dust400 = 0.01; // absorption coefficient in 1/m
+        const double deltaTau = 0.;
+
+        const uint32_t layersNum = 171;
+        const double layersHeight = 10.*I3Units::m;
+        I3CLSimMediumPropertiesPtr medium(new I3CLSimMediumProperties(0.9216*I3Units::g/I3Units::cm3,
+                                                                      layersNum,
+                                                                      -855.*I3Units::m,
+                                                                      layersHeight,
+                                                                      -870.*I3Units::m,
+                                                                      1940.*I3Units::m));
+        medium->SetForcedMinWlen(265.*I3Units::nanometer);
+        medium->SetForcedMaxWlen(675.*I3Units::nanometer);
+
+        medium->SetScatteringCosAngleDistribution(I3CLSimRandomValueConstPtr(new I3CLSimRandomValueMixed(liuScatteringFraction,
+            I3CLSimRandomValueConstPtr(new I3CLSimRandomValueSimplifiedLiu(meanCosineTheta)),
+            I3CLSimRandomValueConstPtr(new I3CLSimRandomValueHenyeyGreenstein(meanCosineTheta)))));
+        medium->SetDirectionalAbsorptionLengthCorrection(I3CLSimScalarFieldConstPtr(new I3CLSimScalarFieldConstant(1.)));
+        medium->SetPreScatterDirectionTransform(I3CLSimVectorTransformConstPtr(new I3CLSimVectorTransformConstant()));
+        medium->SetPostScatterDirectionTransform(I3CLSimVectorTransformConstPtr(new I3CLSimVectorTransformConstant()));
+        medium->SetIceTiltZShift(I3CLSimScalarFieldConstPtr(new I3CLSimScalarFieldConstant(0.)));
+
+        I3CLSimFunctionConstPtr phaseRefIndex(new I3CLSimFunctionRefIndexIceCube("phase"));
+        I3CLSimFunctionConstPtr groupRefIndex(new I3CLSimFunctionRefIndexIceCube("group"));
+        I3CLSimFunctionConstPtr absLen(new I3CLSimFunctionAbsLenIceCube(kappa, A, B, D, E, a_dust400, deltaTau));
+        I3CLSimFunctionConstPtr scatLen(new I3CLSimFunctionScatLenIceCube(alpha, b_e400/(1.-meanCosineTheta)));
+
+        for (uint32_t i=0;i<layersNum;++i)
+        {
+            medium->SetPhaseRefractiveIndex(i, phaseRefIndex);
+            medium->SetGroupRefractiveIndexOverride(i, groupRefIndex);
+            medium->SetAbsorptionLength(i, absLen);
+            medium->SetScatteringLength(i, scatLen);
+        }
+        return medium;
+    }
+
+    struct DirectionThetaPhi
+    {
+        double theta;
+        double phi;
+    };
+
+    DirectionThetaPhi RandomDirection(const Options &options, I3RandomService &rng)
+    {
+        DirectionThetaPhi dir;
+        dir.phi = rng.Uniform(0., 2.*M_PI);
+        if (options.direction == "isotropic") {
+            dir.theta = std::acos(rng.Uniform(-1., 1.));
+        } else if (options.direction == "down") {
+            dir.theta = 0.;
+        } else if (options.direction == "up") {
+            dir.theta = M_PI;
+        } else if (options.direction == "horizontal") {
+            dir.theta = M_PI/2.;
+        } else {
+            log_fatal("Unknown direction distribution \"%s\".", options.direction.c_str());
+        }
+        return dir;
+    }
+
+    uint32_t RandomNumberOfPhotons(const Options &options, I3RandomService &rng)
+    {
+        if (options.multiplicity == "fixed") {
+            return static_cast<uint32_t>(options.photonsPerStep);
+        } else if (options.multiplicity == "uniform") {
+            return static_cast<uint32_t>(rng.Uniform(0.5*options.photonsPerStep, 1.5*options.photonsPerStep));
+        } else if (options.multiplicity == "exponential") {
+            return static_cast<uint32_t>(rng.Exp(options.photonsPerStep));
+        } else if (options.multiplicity == "pareto") {
+            // heavy-tailed, with the scale chosen for a mean of photonsPerStep
+            const double scale = options.photonsPerStep*(options.paretoShape-1.)/options.paretoShape;
+            const double numPhotons = scale/std::pow(1.-rng.Uniform(0., 1.), 1./options.paretoShape);
+            return static_cast<uint32_t>(std::min(numPhotons, 1e9));
+        } else {
+            log_fatal("Unknown multiplicity distribution \"%s\".", options.multiplicity.c_str());
+        }
+        return 0;
+    }
+
+    // One bunch of steps. Cascades and tracks get a new vertex per bunch,
+    // such that each bunch looks like one light source.
+    I3CLSimStepSeriesPtr MakeBunch(const Options &options,
+                                   std::size_t numSteps,
+                                   double detectorHalfWidth,
+                                   double detectorHalfHeight,
+                                   I3RandomService &rng)
+    {
+        I3CLSimStepSeriesPtr steps(new I3CLSimStepSeries(numSteps));
+
+        const double vertexX = rng.Uniform(-detectorHalfWidth, detectorHalfWidth);
+        const double vertexY = rng.Uniform(-detectorHalfWidth, detectorHalfWidth);
+        const double vertexZ = rng.Uniform(-detectorHalfHeight, detectorHalfHeight);
+        const DirectionThetaPhi trackDir = RandomDirection(options, rng);
+
+        for (std::size_t i=0;i<numSteps;++i)
+        {
+            I3CLSimStep &step = (*steps)[i];
+
+            if (options.position == "volume") {
+                step.SetPosX(rng.Uniform(-detectorHalfWidth, detectorHalfWidth));
+                step.SetPosY(rng.Uniform(-detectorHalfWidth, detectorHalfWidth));
+                step.SetPosZ(rng.Uniform(-detectorHalfHeight, detectorHalfHeight));
+                step.SetTime(0.);
+            } else if (options.position == "cascade") {
+                step.SetPosX(vertexX + rng.Gaus(0., 1.*I3Units::m));
+                step.SetPosY(vertexY + rng.Gaus(0., 1.*I3Units::m));
+                step.SetPosZ(vertexZ + rng.Gaus(0., 1.*I3Units::m));
+                step.SetTime(0.);
+            } else if (options.position == "track") {
+                const double distance = static_cast<double>(i)*options.stepLength;
+                step.SetPosX(vertexX + distance*std::sin(trackDir.theta)*std::cos(trackDir.phi));
+                step.SetPosY(vertexY + distance*std::sin(trackDir.theta)*std::sin(trackDir.phi));
+                step.SetPosZ(vertexZ + distance*std::cos(trackDir.theta));
+                step.SetTime(distance/I3Constants::c);
+            } else {
+                log_fatal("Unknown position distribution \"%s\".", options.position.c_str());
+            }
+
+            if (options.position == "track") {
+                step.SetDirTheta(trackDir.theta);
+                step.SetDirPhi(trackDir.phi);
+            } else {
+                const DirectionThetaPhi dir = RandomDirection(options, rng);
+                step.SetDirTheta(dir.theta);
+                step.SetDirPhi(dir.phi);
+            }
+
+            step.SetLength(options.stepLength);
+            step.SetBeta(1.);
+            step.SetNumPhotons(RandomNumberOfPhotons(options, rng));
+            step.SetWeight(1.);
+            step.SetID(static_cast<uint32_t>(i));
+            step.SetSequenceNumber(static_cast<uint32_t>(i));
+            step.SetSourceType(0);
+            step.SetDummy1(0);
+            step.SetDummy2(0);
+        }
+
+        return steps;
+    }
+
+    struct Statistics
+    {
+        double deviceTime;
+        double deviceIdleTime;
+        double hostTime;
+        double hostConversionTime;
+        uint64_t kernelCalls;
+        uint64_t starvingKernelCalls;
+        uint64_t photonsGenerated;
+        uint64_t photonsAtDOMs;
+    };
+
+    Statistics GetStatistics(I3CLSimStepToPhotonConverterOpenCL &converter)
+    {
+        Statistics s;
+        s.deviceTime = converter.GetTotalDeviceTime();
+        s.deviceIdleTime = converter.GetTotalDeviceIdleTime();
+        s.hostTime = converter.GetTotalHostTime();
+        s.hostConversionTime = converter.GetTotalHostConversionTime();
+        s.kernelCalls = converter.GetNumKernelCalls();
+        s.starvingKernelCalls = converter.GetNumStarvingKernelCalls();
+        s.photonsGenerated = converter.GetTotalNumPhotonsGenerated();
+        s.photonsAtDOMs = converter.GetTotalNumPhotonsAtDOMs();
+        return s;
+    }
+
+    // Enqueues the bunches, in bursts with a pause in between if
+    // requested. Like Geant4 feeding the module, this runs in its own
+    // thread, such that the results are collected while it waits.
+    void Produce(I3CLSimStepToPhotonConverterOpenCL &converter,
+                 const std::vector<I3CLSimStepSeriesConstPtr> &bunches,
+                 std::size_t first, std::size_t last,
+                 std::size_t burstSize, double burstInterval)
+    {
+        for (std::size_t i=first;i<last;++i)
+        {
+            if ((burstSize > 0) && (i > first) && ((i-first)%burstSize == 0))
+                boost::this_thread::sleep(boost::posix_time::microseconds(static_cast<int64_t>(burstInterval*1e3)));
+            converter.EnqueueSteps(bunches[i], static_cast<uint32_t>(i));
+        }
+    }
+
+    // Enqueues the bunches and waits for all of their results.
+    // Returns the number of photons received.
+    uint64_t Run(I3CLSimStepToPhotonConverterOpenCL &converter,
+                 const std::vector<I3CLSimStepSeriesConstPtr> &bunches,
+                 std::size_t first, std::size_t last,
+                 std::size_t burstSize=0, double burstInterval=0.)
+    {
+        // Without bursts, the results are not read before everything has
+        // been enqueued. This keeps the converter busy, as the output queue
+        // is not bounded.
+        boost::thread producer;
+        if (burstSize == 0)
+            Produce(converter, bunches, first, last, burstSize, burstInterval);
+        else
+            producer = boost::thread(Produce, boost::ref(converter), boost::cref(bunches),
+                                     first, last, burstSize, burstInterval);
+
+        uint64_t numPhotons=0;
+        for (std::size_t i=first;i<last;++i)
+        {
+            I3CLSimStepToPhotonConverter::ConversionResult_t result = converter.GetConversionResult();
+            if (result.photons) numPhotons += result.photons->size();
+        }
+        if (producer.joinable()) producer.join();
+        return numPhotons;
+    }
+
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+
+    for (int i=1;i<argc;++i)
+    {
+        const std::string arg(argv[i]);
+        bool ok=true;
+
+        if (arg == "--help" || arg == "-h") {
+            PrintUsage(argv[0]);
+            return 0;
+        } else if (arg == "--list-devices") {
+            ListDevices();
+            return 0;
+        }
+        else if (arg == "--device") ok = ParseValue(argc, argv, i, options.device);
+        else if (arg == "--bunches") ok = ParseValue(argc, argv, i, options.numBunches);
+        else if (arg == "--warmup-bunches") ok = ParseValue(argc, argv, i, options.numWarmupBunches);
+        else if (arg == "--photons-per-step") ok = ParseValue(argc, argv, i, options.photonsPerStep);
+        else if (arg == "--multiplicity") ok = ParseValue(argc, argv, i, options.multiplicity);
+        else if (arg == "--pareto-shape") ok = ParseValue(argc, argv, i, options.paretoShape);
+        else if (arg == "--direction") ok = ParseValue(argc, argv, i, options.direction);
+        else if (arg == "--position") ok = ParseValue(argc, argv, i, options.position);
+        else if (arg == "--step-length") ok = ParseValue(argc, argv, i, options.stepLength);
+        else if (arg == "--seed") ok = ParseValue(argc, argv, i, options.seed);
+        else if (arg == "--strings") ok = ParseValue(argc, argv, i, options.numStrings);
+        else if (arg == "--doms-per-string") ok = ParseValue(argc, argv, i, options.numDOMsPerString);
+        else if (arg == "--dom-oversize") ok = ParseValue(argc, argv, i, options.domOversize);
+        else if (arg == "--work-items") ok = ParseValue(argc, argv, i, options.approximateNumberOfWorkItems);
+        else if (arg == "--limit-workgroup-size") ok = ParseValue(argc, argv, i, options.limitWorkgroupSize);
+        else if (arg == "--buffer-ring-depth") ok = ParseValue(argc, argv, i, options.bufferRingDepth);
+        else if (arg == "--burst-size") ok = ParseValue(argc, argv, i, options.burstSize);
+        else if (arg == "--burst-interval") ok = ParseValue(argc, argv, i, options.burstInterval);
+        else if (arg == "--double-precision") options.doublePrecision = true;
+        else if (arg == "--stop-detected-photons") options.stopDetectedPhotons = true;
+        else if (arg == "--persistent-threads") options.usePersistentThreads = true;
+        else if (arg == "--counter-based-rng") options.useCounterBasedRNG = true;
+        else if (arg == "--step-splitting-factor") ok = ParseValue(argc, argv, i, options.stepSplittingFactor);
+        else if (arg == "--json") ok = ParseValue(argc, argv, i, options.jsonFile);
+        else ok = false;
+
+        if (!ok) {
+            std::cerr << "invalid argument: " << arg << std::endl;
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.numBunches == 0) log_fatal("At least one bunch is needed.");
+    if ((options.numStrings == 0) || (options.numDOMsPerString == 0)) log_fatal("The geometry needs at least one DOM.");
+    if ((options.multiplicity == "pareto") && (options.paretoShape <= 1.)) log_fatal("The pareto shape needs to be larger than 1 for a finite mean.");
+
+    // select the device
+    boost::shared_ptr<std::vector<I3CLSimOpenCLDevice> > devices = I3CLSimOpenCLDevice::GetAllDevices();
+    if ((!devices) || (options.device >= devices->size()))
+        log_fatal("OpenCL device %zu does not exist. Use --list-devices to list the devices.", options.device);
+    I3CLSimOpenCLDevice device = (*devices)[options.device];
+    if (options.approximateNumberOfWorkItems > 0)
+        device.SetApproximateNumberOfWorkItems(options.approximateNumberOfWorkItems);
+
+    // set up the converter like I3CLSimModuleHelper::initializeOpenCL does
+    I3RandomServicePtr converterRandomService(new I3GSLRandomService(options.seed));
+    I3CLSimStepToPhotonConverterOpenCLPtr converter(new I3CLSimStepToPhotonConverterOpenCL(converterRandomService, device.GetUseNativeMath()));
+
+    I3CLSimMediumPropertiesPtr medium = MakeMediumProperties();
+    I3CLSimFunctionConstPtr wavelengthGenerationBias(new I3CLSimFunctionConstant(1.));
+    std::vector<I3CLSimRandomValueConstPtr> wavelengthGenerators;
+    wavelengthGenerators.push_back(I3CLSimModuleHelper::makeCherenkovWavelengthGenerator(wavelengthGenerationBias, false, medium));
+
+    converter->SetDevice(device);
+    converter->SetWlenGenerators(wavelengthGenerators);
+    converter->SetWlenBias(wavelengthGenerationBias);
+    converter->SetMediumProperties(medium);
+    converter->SetGeometry(MakeGeometry(options));
+    converter->SetBufferRingDepth(options.bufferRingDepth);
+    converter->SetDoublePrecision(options.doublePrecision);
+    converter->SetStopDetectedPhotons(options.stopDetectedPhotons);
+    converter->SetUsePersistentThreads(options.usePersistentThreads);
+    converter->SetUseCounterBasedRNG(options.useCounterBasedRNG);
+    converter->SetStepSplittingFactor(options.stepSplittingFactor);
+
+    const boost::posix_time::ptime compileStart(boost::posix_time::microsec_clock::universal_time());
+    converter->Compile();
+
+    std::size_t workgroupSize = converter->GetMaxWorkgroupSize();
+    if (options.limitWorkgroupSize != 0)
+        workgroupSize = std::min(static_cast<std::size_t>(options.limitWorkgroupSize), workgroupSize);
+    converter->SetWorkgroupSize(workgroupSize);
+    workgroupSize = converter->GetWorkgroupSize();
+
+    std::size_t maxNumWorkitems = (static_cast<std::size_t>(device.GetApproximateNumberOfWorkItems())/workgroupSize)*workgroupSize;
+    if (maxNumWorkitems == 0) maxNumWorkitems = workgroupSize;
+    converter->SetMaxNumWorkitems(maxNumWorkitems);
+
+    converter->Initialize();
+    const uint64_t kernelPrivateMemSize = converter->GetKernelPrivateMemSize();
+    const std::size_t maxNumStepsPerBunch = converter->GetMaxNumStepsPerBunch();
+    const double compileTime = static_cast<double>((boost::posix_time::microsec_clock::universal_time()-compileStart).total_microseconds())*1e-6;
+
+    // generate the steps up front, they are not part of the timing
+    const double detectorHalfWidth = (std::ceil(std::sqrt(static_cast<double>(options.numStrings)))*options.stringSpacing)/2.;
+    const double detectorHalfHeight = (static_cast<double>(options.numDOMsPerString)*options.domSpacing)/2.;
+
+    I3GSLRandomService stepRandomService(options.seed+1);
+    const std::size_t numBunchesTotal = options.numWarmupBunches+options.numBunches;
+    std::vector<I3CLSimStepSeriesConstPtr> bunches;
+    uint64_t numStepsTimed=0;
+    uint64_t numPhotonsInStepsTimed=0;
+
+    const boost::posix_time::ptime generationStart(boost::posix_time::microsec_clock::universal_time());
+    for (std::size_t i=0;i<numBunchesTotal;++i)
+    {
+        I3CLSimStepSeriesPtr bunch = MakeBunch(options, maxNumStepsPerBunch, detectorHalfWidth, detectorHalfHeight, stepRandomService);
+        if (i >= options.numWarmupBunches) {
+            numStepsTimed += bunch->size();
+            for (std::size_t j=0;j<bunch->size();++j) numPhotonsInStepsTimed += (*bunch)[j].GetNumPhotons();
+        }
+        bunches.push_back(bunch);
+    }
+    const double generationTime = static_cast<double>((boost::posix_time::microsec_clock::universal_time()-generationStart).total_microseconds())*1e-6;
+
+    // warm up, then time the remaining bunches
+    Run(*converter, bunches, 0, options.numWarmupBunches);
+    const Statistics before = GetStatistics(*converter);
+
+    const boost::posix_time::ptime runStart(boost::posix_time::microsec_clock::universal_time());
+    const uint64_t numPhotonsReceived = Run(*converter, bunches, options.numWarmupBunches, numBunchesTotal,
+                                            options.burstSize, options.burstInterval);
+    const double wallTime = static_cast<double>((boost::posix_time::microsec_clock::universal_time()-runStart).total_microseconds())*1e-6;
+
+    const Statistics after = GetStatistics(*converter);
+
+    const double kernelTime = (after.deviceTime-before.deviceTime)*1e-9;
+    const double deviceIdleTime = (after.deviceIdleTime-before.deviceIdleTime)*1e-9;
+    const double hostConversionTime = (after.hostConversionTime-before.hostConversionTime)*1e-9;
+    const uint64_t kernelCalls = after.kernelCalls-before.kernelCalls;
+    const uint64_t starvingKernelCalls = after.starvingKernelCalls-before.starvingKernelCalls;
+
+    const double photonsPerSecond = static_cast<double>(numPhotonsInStepsTimed)/wallTime;
+    const double stepsPerSecond = static_cast<double>(numStepsTimed)/wallTime;
+    const double kernelFraction = kernelTime/wallTime;
+    const double starvationFraction = ((kernelTime+deviceIdleTime)>0.)?deviceIdleTime/(kernelTime+deviceIdleTime):0.;
+
+    std::printf("device:                   %s / %s\n", device.GetPlatformName().c_str(), device.GetDeviceName().c_str());
+    std::printf("workgroup size:           %zu\n", workgroupSize);
+    std::printf("private memory:           %" PRIu64 " bytes/work item\n", kernelPrivateMemSize);
+    std::printf("steps per bunch:          %zu (of %zu work items)\n", maxNumStepsPerBunch, maxNumWorkitems);
+    std::printf("bunches:                  %zu (+%zu warm-up)\n", options.numBunches, options.numWarmupBunches);
+    std::printf("buffer ring depth:        %" PRIu32 "\n", options.bufferRingDepth);
+    if (options.burstSize > 0)
+        std::printf("bursts:                   %zu bunches every %.1f ms\n", options.burstSize, options.burstInterval);
+    std::printf("steps:                    %" PRIu64 "\n", numStepsTimed);
+    std::printf("photons generated:        %" PRIu64 "\n", numPhotonsInStepsTimed);
+    std::printf("photons at DOMs:          %" PRIu64 "\n", numPhotonsReceived);
+    std::printf("compile time:             %.3f s\n", compileTime);
+    std::printf("step generation time:     %.3f s\n", generationTime);
+    std::printf("wall time:                %.3f s\n", wallTime);
+    std::printf("kernel time:              %.3f s (%.1f%% of wall time)\n", kernelTime, kernelFraction*100.);
+    std::printf("host conversion time:     %.3f s\n", hostConversionTime);
+    std::printf("device idle time:         %.3f s\n", deviceIdleTime);
+    std::printf("starvation fraction:      %.3f (%" PRIu64 " of %" PRIu64 " kernel calls starving)\n", starvationFraction, starvingKernelCalls, kernelCalls);
+    std::printf("photons/s:                %.4g\n", photonsPerSecond);
+    std::printf("steps/s:                  %.4g\n", stepsPerSecond);
+    std::printf("kernel ns/photon:         %.4g\n", kernelTime*1e9/static_cast<double>(numPhotonsInStepsTimed));
+
+    if (!options.jsonFile.empty())
+    {
+        std::ofstream json(options.jsonFile.c_str());
+        if (!json) log_fatal("Could not open %s for writing.", options.jsonFile.c_str());
+
+        json.precision(10);
+        json << "{" << std::endl
+        << "  \"platform\": \"" << device.GetPlatformName() << "\"," << std::endl
+        << "  \"device\": \"" << device.GetDeviceName() << "\"," << std::endl
+        << "  \"configuration\": {" << std::endl
+        << "    \"workgroup_size\": " << workgroupSize << "," << std::endl
+        << "    \"steps_per_bunch\": " << maxNumStepsPerBunch << "," << std::endl
+        << "    \"max_num_workitems\": " << maxNumWorkitems << "," << std::endl
+        << "    \"bunches\": " << options.numBunches << "," << std::endl
+        << "    \"warmup_bunches\": " << options.numWarmupBunches << "," << std::endl
+        << "    \"photons_per_step\": " << options.photonsPerStep << "," << std::endl
+        << "    \"multiplicity\": \"" << options.multiplicity << "\"," << std::endl
+        << "    \"pareto_shape\": " << options.paretoShape << "," << std::endl
+        << "    \"direction\": \"" << options.direction << "\"," << std::endl
+        << "    \"position\": \"" << options.position << "\"," << std::endl
+        << "    \"step_length\": " << options.stepLength/I3Units::m << "," << std::endl
+        << "    \"seed\": " << options.seed << "," << std::endl
+        << "    \"strings\": " << options.numStrings << "," << std::endl
+        << "    \"doms_per_string\": " << options.numDOMsPerString << "," << std::endl
+        << "    \"dom_oversize\": " << options.domOversize << "," << std::endl
+        << "    \"buffer_ring_depth\": " << options.bufferRingDepth << "," << std::endl
+        << "    \"burst_size\": " << options.burstSize << "," << std::endl
+        << "    \"burst_interval\": " << options.burstInterval << "," << std::endl
+        << "    \"double_precision\": " << (options.doublePrecision?"true":"false") << "," << std::endl
+        << "    \"stop_detected_photons\": " << (options.stopDetectedPhotons?"true":"false") << "," << std::endl
+        << "    \"persistent_threads\": " << (options.usePersistentThreads?"true":"false") << "," << std::endl
+        << "    \"counter_based_rng\": " << (options.useCounterBasedRNG?"true":"false") << "," << std::endl
+        << "    \"step_splitting_factor\": " << options.stepSplittingFactor << std::endl
+        << "  }," << std::endl
+        << "  \"steps\": " << numStepsTimed << "," << std::endl
+        << "  \"photons_generated\": " << numPhotonsInStepsTimed << "," << std::endl
+        << "  \"photons_at_doms\": " << numPhotonsReceived << "," << std::endl
+        << "  \"kernel_private_mem_size\": " << kernelPrivateMemSize << "," << std::endl
+        << "  \"kernel_calls\": " << kernelCalls << "," << std::endl
+        << "  \"starving_kernel_calls\": " << starvingKernelCalls << "," << std::endl
+        << "  \"compile_time\": " << compileTime << "," << std::endl
+        << "  \"step_generation_time\": " << generationTime << "," << std::endl
+        << "  \"wall_time\": " << wallTime << "," << std::endl
+        << "  \"kernel_time\": " << kernelTime << "," << std::endl
+        << "  \"kernel_fraction\": " << kernelFraction << "," << std::endl
+        << "  \"host_conversion_time\": " << hostConversionTime << "," << std::endl
+        << "  \"device_idle_time\": " << deviceIdleTime << "," << std::endl
+        << "  \"starvation_fraction\": " << starvationFraction << "," << std::endl
+        << "  \"photons_per_second\": " << photonsPerSecond << "," << std::endl
+        << "  \"steps_per_second\": " << stepsPerSecond << std::endl
+        << "}" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+/**
+ * Copyright (c) 2018
+ * the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * @file queue.cxx
+ */
+
+// Contention benchmark for I3CLSimQueue and I3CLSimLockFreeQueue.
+//
+// A number of producer threads put shared pointers on a bounded queue
+// and a number of consumer threads take them off again, like the
+// feeder threads of the PPC converter or the Geant4 and OpenCL threads
+// do. The producers are varied from 1 to 16. Every item is counted on
+// the consumer side, so a lost or duplicated item is reported as an error.
+//
+// Run with --help for the options.
+
+#include <icetray/I3Logging.h>
+
+#include "clsim/I3CLSimQueue.h"
+#include "clsim/I3CLSimLockFreeQueue.h"
+
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+    struct Options
+    {
+        Options() :
+        numItems(1000000),
+        capacity(10),
+        numConsumers(1),
+        maxProducers(16),
+        batchSize(16)
+        {}
+
+        std::size_t numItems;
+        std::size_t capacity;
+        std::size_t numConsumers;
+        std::size_t maxProducers;
+        std::size_t batchSize;
+    };
+
+    void PrintUsage(const char *program)
+    {
+        std::cerr
+        << "usage: " << program << " [options]" << std::endl
+        << std::endl
+        << "  --items <n>                    number of items per run (default: 1000000)" << std::endl
+        << "  --capacity <n>                 maximum queue size (default: 10)" << std::endl
+        << "  --consumers <n>                number of consumer threads (default: 1)" << std::endl
+        << "  --max-producers <n>            runs with 1, 2, 4, .. up to n producers (default: 16)" << std::endl
+        << "  --batch-size <n>               items per PutBatch/GetBatch (default: 16)" << std::endl;
+    }
+
+    template <typename T>
+    bool ParseValue(int argc, char **argv, int &i, T &value)
+    {
+        if (i+1 >= argc) return false;
+        try {
+            value = boost::lexical_cast<T>(argv[++i]);
+        } catch (boost::bad_lexical_cast &) {
+            return false;
+        }
+        return true;
+    }
+
+    typedef boost::shared_ptr<uint64_t> Item_t;
+
+    // the same calls for both queues, batches only for the new one
+    template <typename Queue>
+    struct Operations
+    {
+        static void Put(Queue &queue, const std::vector<Item_t> &items)
+        {
+            for (std::size_t i=0;i<items.size();++i) queue.Put(items[i]);
+        }
+        static void Get(Queue &queue, std::vector<Item_t> &items, std::size_t num)
+        {
+            for (std::size_t i=0;i<num;++i) items.push_back(queue.Get());
+        }
+    };
+
+    template <typename T>
+    struct BatchOperations
+    {
+        typedef I3CLSimLockFreeQueue<T> Queue;
+        static void Put(Queue &queue, const std::vector<T> &items)
+        {
+            queue.PutBatch(items);
+        }
+        static void Get(Queue &queue, std::vector<T> &items, std::size_t num)
+        {
+            queue.GetBatch(items, num);
+        }
+    };
+
+    template <typename Queue, typename Ops>
+    void Producer(Queue &queue, uint64_t first, uint64_t num, std::size_t batchSize)
+    {
+        std::vector<Item_t> items;
+        for (uint64_t i=first;i<first+num;)
+        {
+            items.clear();
+            for (std::size_t j=0;(j<batchSize)&&(i<first+num);++j,++i)
+            {
+                items.push_back(Item_t(new uint64_t(i)));
+            }
+            Ops::Put(queue, items);
+        }
+    }
+
+    template <typename Queue, typename Ops>
+    void Consumer(Queue &queue, std::size_t batchSize, uint64_t &numReceived, uint64_t &sum)
+    {
+        std::vector<Item_t> items;
+        for (;;)
+        {
+            items.clear();
+            Ops::Get(queue, items, batchSize);
+            for (std::size_t j=0;j<items.size();++j)
+            {
+                // an empty pointer tells the consumer to stop,
+                // the ones after it are for the other consumers
+                if (!items[j]) {
+                    for (std::size_t k=j+1;k<items.size();++k) queue.Put(items[k]);
+                    return;
+                }
+                ++numReceived;
+                sum += *(items[j]);
+            }
+        }
+    }
+
+    // Returns the number of items per second. Aborts
+    // if the items received are not the ones sent.
+    template <typename Queue, typename Ops>
+    double Run(const Options &options, std::size_t numProducers, std::size_t batchSize)
+    {
+        Queue queue(options.capacity);
+
+        std::vector<uint64_t> numReceived(options.numConsumers, 0);
+        std::vector<uint64_t> sums(options.numConsumers, 0);
+
+        const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+        boost::thread_group consumers;
+        for (std::size_t i=0;i<options.numConsumers;++i)
+        {
+            consumers.create_thread(boost::bind(&Consumer<Queue, Ops>, boost::ref(queue), batchSize,
+                                                boost::ref(numReceived[i]), boost::ref(sums[i])));
+        }
+
+        boost::thread_group producers;
+        const uint64_t itemsPerProducer = options.numItems/numProducers;
+        for (std::size_t i=0;i<numProducers;++i)
+        {
+            const uint64_t first = i*itemsPerProducer;
+            const uint64_t num = (i==numProducers-1)?(options.numItems-first):itemsPerProducer;
+            producers.create_thread(boost::bind(&Producer<Queue, Ops>, boost::ref(queue), first, num, batchSize));
+        }
+        producers.join_all();
+
+        for (std::size_t i=0;i<options.numConsumers;++i) queue.Put(Item_t());
+        consumers.join_all();
+
+        const boost::posix_time::ptime stop = boost::posix_time::microsec_clock::universal_time();
+        const double seconds = static_cast<double>((stop-start).total_microseconds())*1e-6;
+
+        uint64_t totalReceived=0;
+        uint64_t totalSum=0;
+        for (std::size_t i=0;i<options.numConsumers;++i)
+        {
+            totalReceived += numReceived[i];
+            totalSum += sums[i];
+        }
+        const uint64_t n = options.numItems;
+        if ((totalReceived != n) || (totalSum != n*(n-1)/2))
+            log_fatal("Received %llu items with a sum of %llu, expected %llu items with a sum of %llu.",
+                      (unsigned long long)totalReceived, (unsigned long long)totalSum,
+                      (unsigned long long)n, (unsigned long long)(n*(n-1)/2));
+
+        return static_cast<double>(n)/seconds;
+    }
+
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+
+    for (int i=1;i<argc;++i)
+    {
+        const std::string arg(argv[i]);
+        bool ok=true;
+
+        if (arg == "--help" || arg == "-h") {
+            PrintUsage(argv[0]);
+            return 0;
+        }
+        else if (arg == "--items") ok = ParseValue(argc, argv, i, options.numItems);
+        else if (arg == "--capacity") ok = ParseValue(argc, argv, i, options.capacity);
+        else if (arg == "--consumers") ok = ParseValue(argc, argv, i, options.numConsumers);
+        else if (arg == "--max-producers") ok = ParseValue(argc, argv, i, options.maxProducers);
+        else if (arg == "--batch-size") ok = ParseValue(argc, argv, i, options.batchSize);
+        else ok = false;
+
+        if (!ok) {
+            std::cerr << "invalid argument: " << arg << std::endl;
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ((options.capacity == 0) || (options.numConsumers == 0) ||
+        (options.maxProducers == 0) || (options.batchSize == 0))
+        log_fatal("The capacity, consumers, producers and batch size must be > 0.");
+
+    typedef I3CLSimQueue<Item_t> MutexQueue;
+    typedef I3CLSimLockFreeQueue<Item_t> LockFreeQueue;
+
+    std::printf("%zu items, capacity %zu, %zu consumer(s), items per second:\n",
+                options.numItems, options.capacity, options.numConsumers);
+    std::printf("%10s %15s %15s %15s\n", "producers", "I3CLSimQueue", "lock-free", "lock-free batch");
+
+    for (std::size_t numProducers=1;numProducers<=options.maxProducers;numProducers*=2)
+    {
+        const double mutexRate = Run<MutexQueue, Operations<MutexQueue> >(options, numProducers, 1);
+        const double lockFreeRate = Run<LockFreeQueue, Operations<LockFreeQueue> >(options, numProducers, 1);
+        const double batchRate = Run<LockFreeQueue, BatchOperations<Item_t> >(options, numProducers, options.batchSize);
+
+        std::printf("%10zu %15.3g %15.3g %15.3g\n", numProducers, mutexRate, lockFreeRate, batchRate);
+    }
+
+    return 0;
+}
@@ -0,0 +1,296 @@
+/**
+ * Copyright (c) 2018
+ * the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * @file I3CLSimFrameCompletionTracker.cxx
+ */
+
+#include "icetray/I3Logging.h"
+
+#include "clsim/I3CLSimFrameCompletionTracker.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <algorithm>
+
+namespace {
+    struct FirstLightSourceLess
+    {
+        template <typename Frame>
+        bool operator()(uint32_t lightSource, const Frame &frame) const
+        {
+            return lightSource < frame.firstLightSource;
+        }
+    };
+}
+
+I3CLSimFrameCompletionTracker::I3CLSimFrameCompletionTracker(bool collectStatistics)
+:
+collectStatistics_(collectStatistics),
+firstFrameNumber_(0)
+{
+}
+
+uint64_t I3CLSimFrameCompletionTracker::AddFrame(uint32_t firstLightSource, uint32_t numLightSources)
+{
+    boost::unique_lock<boost::mutex> guard(mutex_);
+
+    if (!frames_.empty())
+    {
+        const Frame_t &last = frames_.back();
+        if (firstLightSource < last.firstLightSource+last.numLightSources)
+            log_fatal("Light source identifiers of frame %zu overlap with the ones of the frame before.",
+                      static_cast<std::size_t>(firstFrameNumber_+frames_.size()));
+    }
+    if (static_cast<uint64_t>(firstLightSource)+numLightSources > 0x100000000ULL)
+        log_fatal("Light source identifiers out of range.");
+
+    frames_.push_back(Frame_t());
+    Frame_t &frame = frames_.back();
+    frame.firstLightSource = firstLightSource;
+    frame.numLightSources = numLightSources;
+    frame.hasAllSteps = (numLightSources==0);
+
+    if (collectStatistics_)
+    {
+        frame.photonNumGenerated.assign(numLightSources, 0);
+        frame.photonWeightSumGenerated.assign(numLightSources, 0.);
+    }
+
+    return firstFrameNumber_+frames_.size()-1;
+}
+
+void I3CLSimFrameCompletionTracker::AddMarker()
+{
+    boost::unique_lock<boost::mutex> guard(mutex_);
+
+    markers_.push_back(firstFrameNumber_+frames_.size());
+}
+
+void I3CLSimFrameCompletionTracker::MarkerReached()
+{
+    {
+        boost::unique_lock<boost::mutex> guard(mutex_);
+
+        if (markers_.empty())
+            log_fatal("Internal error: a marker was reached, but none was enqueued.");
+
+        const uint64_t numFramesCovered = markers_.front();
+        markers_.pop_front();
+
+        // frames before firstFrameNumber_ are gone already
+        for (uint64_t n=firstFrameNumber_;n<numFramesCovered;++n)
+        {
+            frames_[n-firstFrameNumber_].hasAllSteps = true;
+        }
+    }
+
+    changed_.notify_all();
+}
+
+I3CLSimFrameCompletionTracker::Frame_t *
+I3CLSimFrameCompletionTracker::FindFrame(uint32_t lightSource, uint64_t &frameNumber)
+{
+    // the last frame starting at or before the light source
+    // that has any light sources (frames without any can
+    // have the same first identifier as the next one)
+    std::deque<Frame_t>::iterator it =
+        std::upper_bound(frames_.begin(), frames_.end(), lightSource, FirstLightSourceLess());
+
+    while (it != frames_.begin())
+    {
+        --it;
+        if (it->numLightSources == 0) continue;
+
+        if (lightSource - it->firstLightSource >= it->numLightSources) return NULL;
+
+        frameNumber = firstFrameNumber_ + static_cast<uint64_t>(it - frames_.begin());
+        return &(*it);
+    }
+
+    return NULL;
+}
+
+void I3CLSimFrameCompletionTracker::BunchSent(uint32_t bunchIdentifier,
+                                              std::size_t converterIndex,
+                                              uint64_t numPhotons,
+                                              const I3CLSimStepSeries &steps)
+{
+    {
+        boost::unique_lock<boost::mutex> guard(mutex_);
+
+        if (bunches_.count(bunchIdentifier) > 0)
+            log_fatal("Internal error: bunch %u is already in flight.",
+                      static_cast<unsigned int>(bunchIdentifier));
+
+        Bunch_t &bunch = bunches_[bunchIdentifier];
+        bunch.converterIndex = converterIndex;
+        bunch.numPhotons = numPhotons;
+
+        // steps of the same frame tend to come in runs
+        Frame_t *frame = NULL;
+        uint64_t frameNumber = 0;
+
+        for (std::size_t i=0;i<steps.size();++i)
+        {
+            const I3CLSimStep &step = steps[i];
+
+            // skip dummy steps
+            if ((step.identifier==0) || (step.weight<=0.) || (step.numPhotons<=0)) continue;
+
+            if ((!frame) ||
+                (step.identifier - frame->firstLightSource >= frame->numLightSources))
+            {
+                frame = FindFrame(step.identifier, frameNumber);
+                if (!frame)
+                    log_fatal("Internal error: unknown light source identifier %u in bunch.",
+                              static_cast<unsigned int>(step.identifier));
+
+                if (std::find(bunch.frames.begin(), bunch.frames.end(), frameNumber) == bunch.frames.end())
+                {
+                    bunch.frames.push_back(frameNumber);
+
+                    ++frame->numBunchesInFlight;
+                    if (frame->numBunchesInFlightPerConverter.size() <= converterIndex)
+                        frame->numBunchesInFlightPerConverter.resize(converterIndex+1, 0);
+                    ++frame->numBunchesInFlightPerConverter[converterIndex];
+                }
+            }
+
+            if (collectStatistics_)
+            {
+                const std::size_t index = step.identifier - frame->firstLightSource;
+                frame->photonNumGenerated[index] += step.numPhotons;
+                frame->photonWeightSumGenerated[index] += static_cast<double>(step.numPhotons)*step.weight;
+            }
+        }
+    }
+
+    changed_.notify_all();
+}
+
+bool I3CLSimFrameCompletionTracker::BunchReturned(uint32_t bunchIdentifier,
+                                                  std::size_t &converterIndex,
+                                                  uint64_t &numPhotons)
+{
+    boost::unique_lock<boost::mutex> guard(mutex_);
+
+    std::map<uint32_t, Bunch_t>::iterator it = bunches_.find(bunchIdentifier);
+    if (it == bunches_.end()) return false;
+
+    const Bunch_t &bunch = it->second;
+    converterIndex = bunch.converterIndex;
+    numPhotons = bunch.numPhotons;
+
+    for (std::size_t i=0;i<bunch.frames.size();++i)
+    {
+        if (bunch.frames[i] < firstFrameNumber_)
+            log_fatal("Internal error: a bunch returned for a frame that was already complete.");
+
+        Frame_t &frame = frames_[bunch.frames[i]-firstFrameNumber_];
+        --frame.numBunchesInFlight;
+        --frame.numBunchesInFlightPerConverter[bunch.converterIndex];
+    }
+
+    bunches_.erase(it);
+
+    return true;
+}
+
+std::size_t I3CLSimFrameCompletionTracker::GetNumFrames() const
+{
+    boost::unique_lock<boost::mutex> guard(mutex_);
+
+    return frames_.size();
+}
+
+uint64_t I3CLSimFrameCompletionTracker::GetNumFramesAdded() const
+{
+    boost::unique_lock<boost::mutex> guard(mutex_);
+
+    return firstFrameNumber_+frames_.size();
+}
+
+std::size_t I3CLSimFrameCompletionTracker::GetNumBunchesInFlight() const
+{
+    boost::unique_lock<boost::mutex> guard(mutex_);
+
+    return bunches_.size();
+}
+
+bool I3CLSimFrameCompletionTracker::FrameComplete(const Frame_t &frame) const
+{
+    return (frame.hasAllSteps) && (frame.numBunchesInFlight==0);
+}
+
+bool I3CLSimFrameCompletionTracker::HeadFrameHasAllSteps() const
+{
+    boost::unique_lock<boost::mutex> guard(mutex_);
+
+    if (frames_.empty()) return false;
+    return frames_.front().hasAllSteps;
+}
+
+bool I3CLSimFrameCompletionTracker::HeadFrameComplete() const
+{
+    boost::unique_lock<boost::mutex> guard(mutex_);
+
+    if (frames_.empty()) return false;
+    return FrameComplete(frames_.front());
+}
+
+bool I3CLSimFrameCompletionTracker::GetConverterToWaitFor(std::size_t &converterIndex) const
+{
+    boost::unique_lock<boost::mutex> guard(mutex_);
+
+    if (frames_.empty()) return false;
+
+    const std::vector<std::size_t> &numBunches = frames_.front().numBunchesInFlightPerConverter;
+    for (std::size_t i=0;i<numBunches.size();++i)
+    {
+        if (numBunches[i] > 0) {
+            converterIndex = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void I3CLSimFrameCompletionTracker::PopHeadFrame(std::vector<uint64_t> &photonNumGenerated,
+                                                 std::vector<double> &photonWeightSumGenerated)
+{
+    boost::unique_lock<boost::mutex> guard(mutex_);
+
+    if (frames_.empty())
+        log_fatal("There is no frame to pop.");
+    if (!FrameComplete(frames_.front()))
+        log_fatal("The head frame is not complete yet.");
+
+    photonNumGenerated.swap(frames_.front().photonNumGenerated);
+    photonWeightSumGenerated.swap(frames_.front().photonWeightSumGenerated);
+
+    frames_.pop_front();
+    ++firstFrameNumber_;
+}
+
+bool I3CLSimFrameCompletionTracker::WaitForChange(double timeout)
+{
+    boost::unique_lock<boost::mutex> guard(mutex_);
+
+    return changed_.timed_wait(guard,
+        boost::posix_time::microseconds(static_cast<int64_t>(timeout*1e6)));
+}
@@ -33,6 +33,8 @@
 
 #include <gsl/gsl_integration.h>
 
+#include <algorithm>
+
 namespace I3CLSimLightSourceToStepConverterUtils {
 #define H_TIMES_C 1.
     
@@ -206,5 +208,39 @@ namespace I3CLSimLightSourceToStepConverterUtils {
         return integralWithBias/integralUnbiased;
     }
 
+    double PredictedNumberOfPhotons(const I3CLSimLightSource &lightSource,
+                                    double meanPhotonsPerMeter,
+                                    double density)
+    {
+        if (lightSource.GetType() == I3CLSimLightSource::Flasher)
+            return std::max(0., lightSource.GetFlasherPulse().GetNumberOfPhotonsNoBias());
+
+        if (lightSource.GetType() != I3CLSimLightSource::Particle)
+            return 0.;
+
+        const I3Particle &particle = lightSource.GetParticle();
+        if (particle.IsNeutrino()) return 0.;
+
+        const double E = particle.GetEnergy()/I3Units::GeV;
+        if ((std::isnan(E)) || (E <= 0.)) return 0.;
+
+        if ((particle.GetType()==I3Particle::MuMinus) ||
+            (particle.GetType()==I3Particle::MuPlus) ||
+            (particle.GetType()==I3Particle::TauMinus) ||
+            (particle.GetType()==I3Particle::TauPlus))
+        {
+            // the same as I3CLSimLightSourceToStepConverterPPC
+            const double length = std::isnan(particle.GetLength())?(2000.*I3Units::m):(particle.GetLength());
+            const double logE = std::max(0., std::log(E));
+            const double extr = 1. + std::max(0.0, 0.1720+0.0324*logE);
+
+            return meanPhotonsPerMeter*(length/I3Units::m)*extr;
+        }
+
+        // cascades
+        const double nph=5.21*(0.924*I3Units::g/I3Units::cm3)/density;
+        return meanPhotonsPerMeter*nph*E;
+    }
+
 
 }
@@ -32,6 +32,7 @@
 #include "dataclasses/I3Constants.h"
 
 #include "clsim/I3CLSimStep.h"
+#include "clsim/I3CLSimLightSource.h"
 #include "clsim/function/I3CLSimFunction.h"
 
 #include <cmath>
@@ -46,6 +47,17 @@ namespace I3CLSimLightSourceToStepConverterUtils
     double PhotonNumberCorrectionFactorAfterBias(const I3CLSimFunction &unbiasedSpectrum,
                                                  const I3CLSimFunction &wavelengthGenerationBias,
                                                  double fromWlen, double toWlen);
+
+    // Mean number of photons the PPC parameterizations would generate
+    // for a light source, given the number of photons per meter
+    // (see NumberOfPhotonsPerMeter()) and the medium density.
+    // Used to estimate the load of a light source before converting it.
+    // Hadronic showers get the light yield of electromagnetic ones
+    // (an upper limit), flashers their unbiased number of photons
+    // and neutrinos none.
+    double PredictedNumberOfPhotons(const I3CLSimLightSource &lightSource,
+                                    double meanPhotonsPerMeter,
+                                    double density);
     
     inline uint64_t mwcRngInitState(I3RandomServicePtr randomService, uint32_t a)
     {
@@ -47,6 +47,7 @@
 #include "clsim/I3CLSimLightSourceToStepConverterGeant4.h"
 
 #include "clsim/I3CLSimModuleHelper.h"
+#include "clsim/I3CLSimLightSourceToStepConverterUtils.h"
 
 #include <limits>
 #include <set>
@@ -157,6 +158,64 @@ geometryIsConfigured_(false)
                  "A vector of I3CLSimOpenCLDevice objects, describing the devices to be used for simulation.",
                  openCLDeviceList_);
 
+    useCPUConverter_=false;
+    AddParameter("UseCPUConverter",
+                 "Propagate photons on the host using a pool of native threads instead of\n"
+                 "the OpenCL devices. The \"OpenCLDeviceList\" is not used in that case.\n"
+                 "Photon histories and \"SaveAllPhotons\" are not supported by the CPU converter.",
+                 useCPUConverter_);
+
+    numCPUThreads_=0;
+    AddParameter("NumCPUThreads",
+                 "The number of threads used if \"UseCPUConverter\" is set. 0 uses one thread\n"
+                 "per hardware thread.",
+                 numCPUThreads_);
+
+    scheduleBunchesByThroughput_=true;
+    AddParameter("ScheduleBunchesByThroughput",
+                 "Send each bunch of steps to the converter that is predicted to finish it first,\n"
+                 "using the photon throughput measured for each converter. If set to False,\n"
+                 "bunches are sent to the converter with the fewest queued bunches.\n"
+                 "Only makes a difference with more than one OpenCL device.",
+                 scheduleBunchesByThroughput_);
+
+    numPhotonConversionThreads_=0;
+    AddParameter("NumPhotonConversionThreads",
+                 "The number of threads converting the photons returned by the converters into\n"
+                 "I3Photons for the frames. 0 uses one thread per hardware thread. The output\n"
+                 "does not depend on the number of threads.",
+                 numPhotonConversionThreads_);
+
+    streamFrames_=false;
+    AddParameter("StreamFrames",
+                 "Push every frame as soon as all of its photons have returned from the converters\n"
+                 "and keep admitting new frames in the meantime, instead of waiting for all buffered\n"
+                 "frames at once. Up to \"MaxNumParallelEvents\" frames (or frames with a total energy\n"
+                 "of \"TotalEnergyToProcess\") are worked on at any time. This keeps the devices busy\n"
+                 "and holds fewer photons in memory, but partially filled bunches may be sent\n"
+                 "more often.",
+                 streamFrames_);
+
+    hostMemoryBudget_=0.;
+    AddParameter("HostMemoryBudget",
+                 "The memory (in bytes) the photons of all frames being worked on may take up\n"
+                 "when using \"StreamFrames\". New frames wait until their predicted number of photons\n"
+                 "fits, instead of being admitted by \"MaxNumParallelEvents\" or \"TotalEnergyToProcess\".\n"
+                 "The memory per predicted photon is measured from the frames pushed so far, so the\n"
+                 "budget only applies once a frame with photons has been pushed. A frame that does not\n"
+                 "fit on its own is still worked on alone. 0 disables the budget.",
+                 hostMemoryBudget_);
+
+    maxNumPhotonsPerChunk_=0.;
+    AddParameter("MaxNumPhotonsPerChunk",
+                 "Frames predicted to generate more photons than this are split into chunks of\n"
+                 "light sources that are simulated in separate flushes, one after the other. The\n"
+                 "photons of all chunks end up in the same I3PhotonSeriesMap. This keeps the memory\n"
+                 "needed by a flush bounded for very bright events. Frames before a split frame are\n"
+                 "flushed first. Not used with \"StreamFrames\", which converts the photons of a frame\n"
+                 "as they arrive anyway. 0 disables splitting.",
+                 maxNumPhotonsPerChunk_);
+
     DOMRadius_=0.16510*I3Units::m; // 13 inch diameter
     AddParameter("DOMRadius",
                  "The DOM radius used during photon tracking.",
@@ -249,6 +308,15 @@ geometryIsConfigured_(false)
                  "easy to observe.",
                  enableDoubleBuffering_);
 
+    bufferRingDepth_=0;
+    AddParameter("BufferRingDepth",
+                 "The number of buffer sets (command queues, input and output buffers) to cycle through.\n"
+                 "Up to this many bunches of steps can be in flight at the same time, such that steps\n"
+                 "are copied to the device while the kernels of the previous bunches are still running.\n"
+                 "1 disables buffering, 2 is the same as \"EnableDoubleBuffering\". If set to zero\n"
+                 "(the default), the depth is taken from \"EnableDoubleBuffering\".",
+                 bufferRingDepth_);
+
     doublePrecision_=false;
     AddParameter("DoublePrecision",
                  "Enables double-precision support in the kernel. This slows down calculations and\n"
@@ -277,7 +345,8 @@ geometryIsConfigured_(false)
     maxNumOutputPhotonsCorrectionFactor_ = 10000.;
     AddParameter("MaxNumOutputPhotonsCorrectionFactor",
                  "When saving all photons, multiply memory allocation by this factor. By default, this is set heuristically\n"
-                 "to 10000. In case of segmentation faults, try to vary this number.",
+                 "to 10000. In case of segmentation faults, try to vary this number. This only sets the initial size,\n"
+                 "the output buffers grow if bunches produce more hits and steps whose hits did not fit run again.",
                  maxNumOutputPhotonsCorrectionFactor_);
 
     simulateHoleIce_ = false;
@@ -314,6 +383,42 @@ geometryIsConfigured_(false)
                  "If set to zero (the default) the largest possible workgroup size will be chosen.",
                  limitWorkgroupSize_);
 
+    profileKernel_=false;
+    AddParameter("ProfileKernel",
+                 "Count how often the kernel runs through each of its phases (photon creation,\n"
+                 "propagation through the medium, ice layer walk, hole ice cylinder intersection,\n"
+                 "collision check and hit saving). On NVIDIA GPUs, the device clock ticks spent\n"
+                 "in each phase are recorded as well. The results are written to the summary service.\n"
+                 "This slows down the simulation and should only be used for benchmarking.",
+                 profileKernel_);
+
+    usePersistentThreads_=false;
+    AddParameter("UsePersistentThreads",
+                 "Launch a fixed number of persistent OpenCL work items that take ranges of\n"
+                 "photons from a work queue, instead of one work item per step. This balances\n"
+                 "the load when the number of photons per step varies a lot. Off by default\n"
+                 "until its throughput has been measured (see resources/scripts/benchmark.py\n"
+                 "--persistent-threads).",
+                 usePersistentThreads_);
+
+    numPersistentWorkItems_=0;
+    AddParameter("NumPersistentWorkItems",
+                 "The number of persistent work items if \"UsePersistentThreads\" is set.\n"
+                 "Has to be a multiple of the workgroup size. 0 selects a few work groups\n"
+                 "per compute unit of the device.",
+                 numPersistentWorkItems_);
+
+    stepSplittingFactor_=4.;
+    AddParameter("StepSplittingFactor",
+                 "Split steps with more photons than this factor times the median of their bunch\n"
+                 "into several work items on the OpenCL device. This keeps single steps with many\n"
+                 "photons from delaying the whole bunch. The factor is lowered while bunches take\n"
+                 "longer per photon than the fastest one so far. Bunches then have half as many\n"
+                 "steps as the device has work items, to leave room for the split steps.\n"
+                 "0 disables splitting.\n"
+                 "Not used with \"UsePersistentThreads\".",
+                 stepSplittingFactor_);
+
     closestDOMDistanceCutoff_=300.*I3Units::m;
     AddParameter("ClosestDOMDistanceCutoff",
                  "Do not even start light from sources that do not have any DOMs closer to\n"
@@ -324,6 +429,15 @@ geometryIsConfigured_(false)
     AddOutBox("OutBox");
 
     frameListPhysicsFrameCounter_=0;
+    frameListFirstEntry_=0;
+    lightSourceEnergyInFlight_=0.;
+    numFramesCoveredByFlush_=0;
+    predictedNumPhotonsInFlight_=0.;
+    predictedNumPhotonsPushed_=0.;
+    photonMemoryPushed_=0.;
+    maxPhotonsPerMeter_=0.;
+    chunkedFrameIsLastChunk_=false;
+    chunkedFrameNextPhotonId_=0;
 }
 
 I3CLSimModule::~I3CLSimModule()
@@ -422,6 +536,15 @@ void I3CLSimModule::Configure()
     GetParameter("ParameterizationList", parameterizationList_);
 
     GetParameter("OpenCLDeviceList", openCLDeviceList_);
+    GetParameter("UseCPUConverter", useCPUConverter_);
+    GetParameter("NumCPUThreads", numCPUThreads_);
+    GetParameter("ScheduleBunchesByThroughput", scheduleBunchesByThroughput_);
+    GetParameter("NumPhotonConversionThreads", numPhotonConversionThreads_);
+    photonConversionPool_ = boost::shared_ptr<photonConversionPool>
+    (new photonConversionPool((numPhotonConversionThreads_>0)?numPhotonConversionThreads_:boost::thread::hardware_concurrency()));
+    GetParameter("StreamFrames", streamFrames_);
+    GetParameter("HostMemoryBudget", hostMemoryBudget_);
+    GetParameter("MaxNumPhotonsPerChunk", maxNumPhotonsPerChunk_);
 
     GetParameter("DOMRadius", DOMRadius_);
     GetParameter("DOMOversizeFactor", DOMOversizeFactor_);
@@ -445,6 +568,7 @@ void I3CLSimModule::Configure()
     GetParameter("UseHardcodedDeepCoreSubdetector", useHardcodedDeepCoreSubdetector_);
 
     GetParameter("EnableDoubleBuffering", enableDoubleBuffering_);
+    GetParameter("BufferRingDepth", bufferRingDepth_);
     GetParameter("DoublePrecision", doublePrecision_);
     GetParameter("StopDetectedPhotons", stopDetectedPhotons_);
     GetParameter("SaveAllPhotons", saveAllPhotons_);
@@ -461,6 +585,12 @@ void I3CLSimModule::Configure()
 
     GetParameter("LimitWorkgroupSize", limitWorkgroupSize_);
 
+    GetParameter("ProfileKernel", profileKernel_);
+
+    GetParameter("UsePersistentThreads", usePersistentThreads_);
+    GetParameter("NumPersistentWorkItems", numPersistentWorkItems_);
+    GetParameter("StepSplittingFactor", stepSplittingFactor_);
+
     GetParameter("ClosestDOMDistanceCutoff", closestDOMDistanceCutoff_);
 
     if (pancakeFactor_ != DOMOversizeFactor_) {
@@ -480,6 +610,34 @@ void I3CLSimModule::Configure()
 
     if (!mediumProperties_) log_fatal("You have to specify the \"MediumProperties\" parameter!");
 
+    if ((std::isnan(hostMemoryBudget_)) || (hostMemoryBudget_ < 0.))
+        log_fatal("The \"HostMemoryBudget\" parameter must not be negative.");
+    if ((hostMemoryBudget_ > 0.) && (!streamFrames_))
+        log_fatal("The \"HostMemoryBudget\" parameter can only be used together with \"StreamFrames\".");
+
+    if ((std::isnan(maxNumPhotonsPerChunk_)) || (maxNumPhotonsPerChunk_ < 0.))
+        log_fatal("The \"MaxNumPhotonsPerChunk\" parameter must not be negative.");
+    if ((maxNumPhotonsPerChunk_ > 0.) && (streamFrames_)) {
+        log_warn("\"MaxNumPhotonsPerChunk\" is ignored with \"StreamFrames\".");
+        maxNumPhotonsPerChunk_ = 0.;
+    }
+
+    if ((hostMemoryBudget_ > 0.) || (maxNumPhotonsPerChunk_ > 0.))
+    {
+        // be conservative and assume the brightest layer for all light sources
+        maxPhotonsPerMeter_=0.;
+        for (uint32_t i=0;i<mediumProperties_->GetLayersNum();++i)
+        {
+            const double photonsPerMeter =
+            I3CLSimLightSourceToStepConverterUtils::NumberOfPhotonsPerMeter(*(mediumProperties_->GetPhaseRefractiveIndex(i)),
+                                                                            *wavelengthGenerationBias_,
+                                                                            mediumProperties_->GetMinWavelength(),
+                                                                            mediumProperties_->GetMaxWavelength());
+            maxPhotonsPerMeter_ = std::max(maxPhotonsPerMeter_, photonsPerMeter);
+        }
+        log_debug("predicting at most %f photons per meter", maxPhotonsPerMeter_);
+    }
+
     if ((totalEnergyToProcess_ > 0) && (!std::isnan(totalEnergyToProcess_)))
     {
         log_warn("Total Energy to Process mode! MaxNumParallelEvents is set to 1! "
@@ -497,8 +655,21 @@ void I3CLSimModule::Configure()
     maxNumParallelEventsSecondFlush_ = maxNumParallelEvents_;
 
 
-    if (openCLDeviceList_.empty())
+    if (useCPUConverter_) {
+        if (saveAllPhotons_)
+            log_fatal("The \"SaveAllPhotons\" option cannot be used with the CPU converter.");
+        if (photonHistoryEntries_ > 0)
+            log_fatal("Photon histories cannot be saved with the CPU converter.");
+        if (!std::isnan(fixedNumberOfAbsorptionLengths_))
+            log_fatal("The \"FixedNumberOfAbsorptionLengths\" option cannot be used with the CPU converter.");
+
+        if (!openCLDeviceList_.empty()) {
+            log_warn("The \"OpenCLDeviceList\" is ignored when \"UseCPUConverter\" is set.");
+            openCLDeviceList_.clear();
+        }
+    } else if (openCLDeviceList_.empty()) {
         log_fatal("You have to provide at least one OpenCL device using the \"OpenCLDeviceList\" parameter.");
+    }
 
     // fill wavelengthGenerators_[0] (index 0 is the Cherenkov generator)
     wavelengthGenerators_.clear();
@@ -528,11 +699,21 @@ void I3CLSimModule::Configure()
     }
 
     currentParticleCacheIndex_ = 1;
+    particleCache_.assign(1, particleCacheEntry()); // index 0 is never used
+    particleCacheFirstIndex_ = 0;
     geometryIsConfigured_ = false;
     totalSimulatedEnergyForFlush_ = 0.;
     totalSimulatedEnergy_ = 0;
     totalNumParticlesForFlush_ = 0;
 
+    if (streamFrames_) {
+        // particles are removed from the front, there is no entry 0
+        particleCache_.clear();
+        particleCacheFirstIndex_ = 1;
+
+        frameTracker_ = I3CLSimFrameCompletionTrackerPtr(new I3CLSimFrameCompletionTracker(collectStatistics_));
+    }
+
     if (parameterizationList_.size() > 0) {
         log_info("Using the following parameterizations:");
 
@@ -564,7 +745,8 @@ void I3CLSimModule::Configure()
 bool I3CLSimModule::Thread(boost::this_thread::disable_interruption &di)
 {
     // do some setup while the main thread waits..
-    numBunchesSentToOpenCL_.assign(openCLStepsToPhotonsConverters_.size(), 0);
+    numBunchesSentToOpenCL_.assign(stepsToPhotonsConverters_.size(), 0);
+    bunchScheduler_->StartRound();
 
     // notify the main thread that everything is set up
     {
@@ -576,24 +758,30 @@ bool I3CLSimModule::Thread(boost::this_thread::disable_interruption &di)
     // the main thread is running again
 
     uint32_t counter=0;
-    std::size_t lastDeviceIndexToUse=0;
 
     for (;;)
     {
         // retrieve steps from Geant4
         I3CLSimStepSeriesConstPtr steps;
         bool barrierWasJustReset=false;
+        bool markerWasReached=false;
 
         {
             boost::this_thread::restore_interruption ri(di);
             try {
-                steps = geant4ParticleToStepsConverter_->GetConversionResultWithBarrierInfo(barrierWasJustReset);
+                steps = geant4ParticleToStepsConverter_->GetConversionResultWithMarkerInfo(barrierWasJustReset, markerWasReached);
             } catch(boost::thread_interrupted &i) {
                 return false;
             }
         }
 
-        if (!steps)
+        if (markerWasReached)
+        {
+            // markers are only enqueued when streaming frames
+            log_trace("Geant4 marker has been reached.");
+            frameTracker_->MarkerReached();
+        }
+        else if (!steps)
         {
             log_debug("Got NULL I3CLSimStepSeriesConstPtr from Geant4.");
         }
@@ -608,7 +796,8 @@ bool I3CLSimModule::Thread(boost::this_thread::disable_interruption &di)
 
 
             // collect statistics if requested
-            if (collectStatistics_)
+            // (the frame tracker does this when streaming frames)
+            if ((collectStatistics_) && (!streamFrames_))
             {
                 BOOST_FOREACH(const I3CLSimStep &step, *steps)
                 {
@@ -620,39 +809,44 @@ bool I3CLSimModule::Thread(boost::this_thread::disable_interruption &di)
                     // sanity check
                     if (particleID==0) log_fatal("particleID==0, this should not happen (this index is never used)");
 
-                    (photonNumGeneratedPerParticle_.insert(std::make_pair(particleID, 0)).first->second)+=step.numPhotons;
-                    (photonWeightSumGeneratedPerParticle_.insert(std::make_pair(particleID, 0.)).first->second)+=static_cast<double>(step.numPhotons)*step.weight;
+                    if (particleID >= photonNumGeneratedPerParticle_.size()) {
+                        photonNumGeneratedPerParticle_.resize(particleID+1, 0);
+                        photonWeightSumGeneratedPerParticle_.resize(particleID+1, 0.);
+                    }
+
+                    photonNumGeneratedPerParticle_[particleID]+=step.numPhotons;
+                    photonWeightSumGeneratedPerParticle_[particleID]+=static_cast<double>(step.numPhotons)*step.weight;
                 }
             }
 
             // determine which OpenCL device to use
-            std::vector<std::size_t> fillLevels(openCLStepsToPhotonsConverters_.size());
-            for (std::size_t i=0;i<openCLStepsToPhotonsConverters_.size();++i)
+            std::vector<std::size_t> fillLevels(stepsToPhotonsConverters_.size());
+            for (std::size_t i=0;i<stepsToPhotonsConverters_.size();++i)
             {
-                fillLevels[i]=openCLStepsToPhotonsConverters_[i]->QueueSize();
+                fillLevels[i]=stepsToPhotonsConverters_[i]->QueueSize();
             }
 
-            std::size_t minimumFillLevel = fillLevels[0];
-            for (std::size_t i=1;i<openCLStepsToPhotonsConverters_.size();++i)
+            uint64_t numPhotonsInBunch=0;
+            BOOST_FOREACH(const I3CLSimStep &step, *steps)
             {
-                if (fillLevels[i] < minimumFillLevel)
-                {
-                    minimumFillLevel=fillLevels[i];
-                }
+                numPhotonsInBunch+=step.numPhotons;
             }
 
-            std::size_t deviceIndexToUse=lastDeviceIndexToUse;
-            do {
-                ++deviceIndexToUse;
-                if (deviceIndexToUse>=fillLevels.size()) deviceIndexToUse=0;
-            } while (fillLevels[deviceIndexToUse] != minimumFillLevel);
-            lastDeviceIndexToUse=deviceIndexToUse;
+            std::size_t deviceIndexToUse;
+            {
+                boost::unique_lock<boost::mutex> guard(bunchSchedulerMutex_);
+                deviceIndexToUse = bunchScheduler_->Assign(numPhotonsInBunch, fillLevels);
+            }
+
+            // the results may come back as soon as the steps are enqueued
+            if (streamFrames_)
+                frameTracker_->BunchSent(counter, deviceIndexToUse, numPhotonsInBunch, *steps);
 
             // send to OpenCL
             {
                 boost::this_thread::restore_interruption ri(di);
                 try {
-                    openCLStepsToPhotonsConverters_[deviceIndexToUse]->EnqueueSteps(steps, counter);
+                    stepsToPhotonsConverters_[deviceIndexToUse]->EnqueueSteps(steps, counter);
                 } catch(boost::thread_interrupted &i) {
                     return false;
                 }
@@ -761,10 +955,39 @@ void I3CLSimModule::DigestGeometry(I3FramePtr frame)
     log_info("Initializing CLSim..");
     // initialize OpenCL converters
     openCLStepsToPhotonsConverters_.clear();
+    cpuStepsToPhotonsConverter_.reset();
+    stepsToPhotonsConverters_.clear();
 
     uint64_t granularity=0;
     uint64_t maxBunchSize=0;
 
+    if (useCPUConverter_)
+    {
+        log_info(" -> native CPU converter");
+
+        cpuStepsToPhotonsConverter_ =
+        I3CLSimModuleHelper::initializeCPU(randomService_,
+                                           geometry_,
+                                           mediumProperties_,
+                                           wavelengthGenerationBias_,
+                                           wavelengthGenerators_,
+                                           stopDetectedPhotons_,
+                                           pancakeFactor_,
+                                           simulateHoleIce_,
+                                           holeIceCylinderPositions_,
+                                           holeIceCylinderRadii_,
+                                           holeIceCylinderScatteringLengths_,
+                                           holeIceCylinderAbsorptionLengths_,
+                                           numCPUThreads_);
+        if (!cpuStepsToPhotonsConverter_)
+            log_fatal("Could not initialize the CPU converter!");
+
+        stepsToPhotonsConverters_.push_back(cpuStepsToPhotonsConverter_);
+
+        granularity = cpuStepsToPhotonsConverter_->GetWorkgroupSize();
+        maxBunchSize = cpuStepsToPhotonsConverter_->GetMaxNumWorkitems();
+    }
+
     BOOST_FOREACH(const I3CLSimOpenCLDevice &openCLdevice, openCLDeviceList_)
     {
 #ifdef I3_LOG4CPLUS_LOGGING
@@ -802,7 +1025,12 @@ void I3CLSimModule::DigestGeometry(I3FramePtr frame)
                                                     holeIceCylinderPositions_,
                                                     holeIceCylinderRadii_,
                                                     holeIceCylinderScatteringLengths_,
-                                                    holeIceCylinderAbsorptionLengths_
+                                                    holeIceCylinderAbsorptionLengths_,
+                                                    profileKernel_,
+                                                    bufferRingDepth_,
+                                                    usePersistentThreads_,
+                                                    numPersistentWorkItems_,
+                                                    stepSplittingFactor_
                                                 } );
         if (!openCLStepsToPhotonsConverter)
             log_fatal("Could not initialize OpenCL!");
@@ -813,6 +1041,7 @@ void I3CLSimModule::DigestGeometry(I3FramePtr frame)
             log_fatal("Internal error: converter.GetMaxNumWorkitems()==0.");
 
         openCLStepsToPhotonsConverters_.push_back(openCLStepsToPhotonsConverter);
+        stepsToPhotonsConverters_.push_back(openCLStepsToPhotonsConverter);
 
         if (granularity==0) {
             granularity = openCLStepsToPhotonsConverter->GetWorkgroupSize();
@@ -834,10 +1063,11 @@ void I3CLSimModule::DigestGeometry(I3FramePtr frame)
             granularity=newGranularity;
         }
 
+        // leaves room to split steps, if enabled
         if (maxBunchSize==0) {
-            maxBunchSize = openCLStepsToPhotonsConverter->GetMaxNumWorkitems();
+            maxBunchSize = openCLStepsToPhotonsConverter->GetMaxNumStepsPerBunch();
         } else {
-            const uint64_t currentMaxBunchSize = openCLStepsToPhotonsConverter->GetMaxNumWorkitems();
+            const uint64_t currentMaxBunchSize = openCLStepsToPhotonsConverter->GetMaxNumStepsPerBunch();
             const uint64_t newMaxBunchSize = std::min(maxBunchSize, currentMaxBunchSize);
             const uint64_t newMaxBunchSizeWithGranularity = newMaxBunchSize - newMaxBunchSize%granularity;
 
@@ -861,6 +1091,27 @@ void I3CLSimModule::DigestGeometry(I3FramePtr frame)
     }
 
 
+    bunchScheduler_ = I3CLSimStepBunchSchedulerPtr(new I3CLSimStepBunchScheduler(stepsToPhotonsConverters_.size()));
+    bunchScheduler_->SetUseThroughput(scheduleBunchesByThroughput_);
+
+    if (streamFrames_)
+    {
+        // have all converters announce their results on one queue
+        convertersWithResults_ = boost::shared_ptr<I3CLSimQueue<std::size_t> >(new I3CLSimQueue<std::size_t>(0));
+        for (std::size_t i=0;i<stepsToPhotonsConverters_.size();++i)
+        {
+            if (!stepsToPhotonsConverters_[i]->SetResultAvailableCallback(
+                    boost::bind(&I3CLSimQueue<std::size_t>::Put, convertersWithResults_, i)))
+            {
+                log_debug("Converter %zu cannot announce its results, waiting for each converter separately.", i);
+                for (std::size_t j=0;j<i;++j)
+                    stepsToPhotonsConverters_[j]->SetResultAvailableCallback(I3CLSimStepToPhotonConverter::ResultAvailableCallback_t());
+                convertersWithResults_.reset();
+                break;
+            }
+        }
+    }
+
     log_info("Initializing Geant4..");
     // initialize Geant4 (will set bunch sizes according to the OpenCL settings)
     geant4ParticleToStepsConverter_ =
@@ -887,72 +1138,336 @@ namespace {
     }
 }
 
-void I3CLSimModule::AddPhotonsToFrames(const I3CLSimPhotonSeries &photons,
-                                       I3CLSimPhotonHistorySeriesConstPtr photonHistories,
-                                       const std::vector<I3PhotonSeriesMapPtr> &photonsForFrameList_,
-                                       std::vector<int32_t> &currentPhotonIdForFrame_,
-                                       const std::vector<I3FramePtr> &frameList_,
-                                       const std::map<uint32_t, particleCacheEntry> &particleCache_,
-                                       const std::vector<std::set<ModuleKey> > &maskedOMKeys_,
+namespace {
+    // a photon to be converted: the conversion result it is in,
+    // its position in that result and its ID in the frame
+    struct PhotonRef_t
+    {
+        uint32_t result;
+        uint32_t index;
+        int32_t id;
+    };
+
+    // below this number of photons in a flush, converting them
+    // is not worth starting threads for
+    const std::size_t minNumPhotonsForThreads = 10000;
+
+    inline std::size_t ShardIndexForKey(const ModuleKey &key, std::size_t numShardsPerFrame)
+    {
+        return (static_cast<std::size_t>(static_cast<uint16_t>(key.GetString()))*131 +
+                static_cast<std::size_t>(key.GetOM())) % numShardsPerFrame;
+    }
+}
+
+struct I3CLSimModule::photonShard
+{
+    std::size_t frameListEntry;
+    std::vector<PhotonRef_t> photons; // in the order they were received
+    I3PhotonSeriesMap output;
+};
+
+// The worker threads wait for a new generation of shards to convert,
+// the thread calling ConvertShards() converts shards along with them.
+struct I3CLSimModule::photonConversionPool
+{
+    explicit photonConversionPool(std::size_t numThreads);
+    ~photonConversionPool();
+
+    // converts all shards, using the worker threads if useWorkers is set.
+    // Returns the error of the first shard that failed or an empty string.
+    std::string ConvertShards(const std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> &results,
+                              const std::deque<particleCacheEntry> &particleCache,
+                              uint32_t particleCacheFirstIndex,
+                              bool useWorkers);
+
+    std::size_t numThreads_; // including the calling thread
+    std::vector<photonShard> shards_;
+
+private:
+    void WorkerThread();
+    void ConvertSomeShards();
+
+    boost::thread_group workers_;
+    boost::mutex mutex_;
+    boost::condition_variable workAvailable_;
+    boost::condition_variable workDone_;
+    uint64_t generation_;
+    bool shutdown_;
+    std::size_t numWorkersBusy_;
+
+    // the shards being converted, guarded by mutex_
+    const std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> *results_;
+    const std::deque<particleCacheEntry> *particleCache_;
+    uint32_t particleCacheFirstIndex_;
+    std::size_t nextShard_;
+    std::string error_;
+};
+
+I3CLSimModule::photonConversionPool::photonConversionPool(std::size_t numThreads)
+:
+numThreads_(std::max(numThreads, static_cast<std::size_t>(1))),
+generation_(0),
+shutdown_(false),
+numWorkersBusy_(0),
+results_(NULL),
+particleCache_(NULL),
+particleCacheFirstIndex_(0),
+nextShard_(0)
+{
+    for (std::size_t i=1;i<numThreads_;++i)
+    {
+        workers_.create_thread(boost::bind(&photonConversionPool::WorkerThread, this));
+    }
+}
+
+I3CLSimModule::photonConversionPool::~photonConversionPool()
+{
+    {
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        shutdown_=true;
+    }
+    workAvailable_.notify_all();
+    workers_.join_all();
+}
+
+std::string I3CLSimModule::photonConversionPool::ConvertShards(const std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> &results,
+                                                               const std::deque<particleCacheEntry> &particleCache,
+                                                               uint32_t particleCacheFirstIndex,
+                                                               bool useWorkers)
+{
+    {
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        results_ = &results;
+        particleCache_ = &particleCache;
+        particleCacheFirstIndex_ = particleCacheFirstIndex;
+        nextShard_ = 0;
+        error_.clear();
+
+        if ((useWorkers) && (workers_.size() > 0)) {
+            numWorkersBusy_ = workers_.size();
+            ++generation_;
+        } else {
+            useWorkers=false;
+        }
+    }
+    if (useWorkers) workAvailable_.notify_all();
+
+    ConvertSomeShards();
+
+    boost::unique_lock<boost::mutex> guard(mutex_);
+    while (numWorkersBusy_ > 0) workDone_.wait(guard);
+
+    results_ = NULL;
+    particleCache_ = NULL;
+    return error_;
+}
+
+void I3CLSimModule::photonConversionPool::WorkerThread()
+{
+    uint64_t lastGeneration=0;
+
+    for (;;)
+    {
+        {
+            boost::unique_lock<boost::mutex> guard(mutex_);
+            while ((!shutdown_) && (generation_ == lastGeneration)) workAvailable_.wait(guard);
+            if (shutdown_) return;
+            lastGeneration = generation_;
+        }
+
+        ConvertSomeShards();
+
+        {
+            boost::unique_lock<boost::mutex> guard(mutex_);
+            if (--numWorkersBusy_ == 0) workDone_.notify_all();
+        }
+    }
+}
+
+void I3CLSimModule::photonConversionPool::ConvertSomeShards()
+{
+    for (;;)
+    {
+        std::size_t shardIndex;
+        {
+            boost::unique_lock<boost::mutex> guard(mutex_);
+            if ((nextShard_ >= shards_.size()) || (!error_.empty())) return;
+            shardIndex = nextShard_++;
+        }
+
+        try {
+            ConvertPhotonShard(shards_[shardIndex], *results_, *particleCache_, particleCacheFirstIndex_);
+        } catch (std::exception &e) {
+            boost::unique_lock<boost::mutex> guard(mutex_);
+            if (error_.empty()) error_ = e.what();
+            return;
+        }
+    }
+}
+
+void I3CLSimModule::AddPhotonsToFrames(const std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> &results,
+                                       const std::deque<I3PhotonSeriesMapPtr> &photonsForFrameList_,
+                                       std::deque<int32_t> &currentPhotonIdForFrame_,
+                                       const std::deque<I3FramePtr> &frameList_,
+                                       std::size_t frameListFirstEntry,
+                                       const std::deque<particleCacheEntry> &particleCache_,
+                                       uint32_t particleCacheFirstIndex,
+                                       const std::deque<std::set<ModuleKey> > &maskedOMKeys_,
                                        bool collectStatistics_,
-                                       std::map<uint32_t, uint64_t> &photonNumAtOMPerParticle,
-                                       std::map<uint32_t, double> &photonWeightSumAtOMPerParticle
+                                       std::deque<uint64_t> &photonNumAtOMPerParticle,
+                                       std::deque<double> &photonWeightSumAtOMPerParticle,
+                                       photonConversionPool &pool
                                        )
 {
     if (photonsForFrameList_.size() != frameList_.size())
         log_fatal("Internal error: cache sizes differ. (1)");
     if (photonsForFrameList_.size() != currentPhotonIdForFrame_.size())
         log_fatal("Internal error: cache sizes differ. (2)");
+    if (photonsForFrameList_.size() != maskedOMKeys_.size())
+        log_fatal("Internal error: cache sizes differ. (3)");
+
+    // The photons of each frame are split into shards by DOM. Every
+    // shard keeps its photons in the order they were received, so the
+    // photons of a DOM end up in the same order no matter how many
+    // threads convert them. The shards of the last call are re-used
+    // (their photon lists keep their capacity).
+    const std::size_t numShardsPerFrame = pool.numThreads_;
+    std::vector<photonShard> &shards = pool.shards_;
+    shards.resize(photonsForFrameList_.size()*numShardsPerFrame);
+    for (std::size_t i=0;i<shards.size();++i)
+    {
+        shards[i].frameListEntry = i/numShardsPerFrame;
+        shards[i].photons.clear();
+        shards[i].output.clear();
+    }
 
-    if (photonHistories) {
-        if (photonHistories->size() != photons.size())
+    if (collectStatistics_)
+    {
+        if (photonNumAtOMPerParticle.size() < particleCache_.size())
+            photonNumAtOMPerParticle.resize(particleCache_.size(), 0);
+        if (photonWeightSumAtOMPerParticle.size() < particleCache_.size())
+            photonWeightSumAtOMPerParticle.resize(particleCache_.size(), 0.);
+    }
+
+    // assign the photons to shards and number them, in order
+    std::size_t totalNumPhotons=0;
+    for (std::size_t r=0;r<results.size();++r)
+    {
+        const I3CLSimPhotonSeries &photons = *(results[r].photons);
+        const I3CLSimPhotonHistorySeriesConstPtr &photonHistories = results[r].photonHistories;
+
+        if (photonHistories) {
+            if (photonHistories->size() != photons.size())
+            {
+                log_fatal("Error: photon history vector size (%zu) != photon vector size (%zu)",
+                          photonHistories->size(), photons.size());
+            }
+        }
+
+        for (std::size_t i=0;i<photons.size();++i)
         {
-            log_fatal("Error: photon history vector size (%zu) != photon vector size (%zu)",
-                      photonHistories->size(), photons.size());
+            const I3CLSimPhoton &photon = photons[i];
+
+            // find identifier in particle cache
+            if ((photon.identifier==0) ||
+                (photon.identifier < particleCacheFirstIndex) ||
+                (photon.identifier-particleCacheFirstIndex >= particleCache_.size()))
+                log_fatal("Internal error: unknown particle id from OpenCL: %" PRIu32,
+                          photon.identifier);
+            const std::size_t particleIndex = photon.identifier-particleCacheFirstIndex;
+            const particleCacheEntry &cacheEntry = particleCache_[particleIndex];
+
+            if ((cacheEntry.frameListEntry < frameListFirstEntry) ||
+                (cacheEntry.frameListEntry-frameListFirstEntry >= photonsForFrameList_.size()))
+                log_fatal("Internal error: particle cache entry uses invalid frame cache position");
+            const std::size_t frameIndex = cacheEntry.frameListEntry-frameListFirstEntry;
+
+            // generate the OMKey
+            const ModuleKey key = ModuleKeyFromOpenCLSimIDs(photon.stringID, photon.omID);
+
+            // get the OMKey mask
+            const std::set<ModuleKey> &keyMask = maskedOMKeys_[frameIndex];
+
+            if ((!keyMask.empty()) && (keyMask.count(key) > 0)) continue; // ignore masked DOMs
+
+            // get the current photon id
+            int32_t &currentPhotonId = currentPhotonIdForFrame_[frameIndex];
+
+            PhotonRef_t ref;
+            ref.result = static_cast<uint32_t>(r);
+            ref.index = static_cast<uint32_t>(i);
+            ref.id = currentPhotonId; // per-frame ID for every photon
+            shards[frameIndex*numShardsPerFrame + ShardIndexForKey(key, numShardsPerFrame)].photons.push_back(ref);
+
+            if (collectStatistics_)
+            {
+                // collect statistics
+                photonNumAtOMPerParticle[particleIndex]++;
+                photonWeightSumAtOMPerParticle[particleIndex]+=photon.GetWeight();
+            }
+
+            currentPhotonId++;
+            totalNumPhotons++;
         }
     }
 
+    // convert them to I3Photons
+    const std::string error = pool.ConvertShards(results, particleCache_, particleCacheFirstIndex,
+                                                 totalNumPhotons >= minNumPhotonsForThreads);
+    if (!error.empty()) log_fatal("%s", error.c_str());
 
-    for (std::size_t i=0;i<photons.size();++i)
+    // DOMs of different shards do not overlap, so the series
+    // can just be moved to the frame
+    for (std::size_t i=0;i<shards.size();++i)
     {
-        const I3CLSimPhoton &photon = photons[i];
+        I3PhotonSeriesMap &outputPhotonMap = *(photonsForFrameList_[shards[i].frameListEntry]);
 
-        // find identifier in particle cache
-        std::map<uint32_t, particleCacheEntry>::const_iterator it = particleCache_.find(photon.identifier);
-        if (it == particleCache_.end())
-            log_fatal("Internal error: unknown particle id from OpenCL: %" PRIu32,
-                      photon.identifier);
-        const particleCacheEntry &cacheEntry = it->second;
+        for (I3PhotonSeriesMap::iterator it=shards[i].output.begin();it!=shards[i].output.end();++it)
+        {
+            // this either inserts a new vector or retrieves an existing one
+            I3PhotonSeries &outputPhotonSeries = outputPhotonMap.insert(std::make_pair(it->first, I3PhotonSeries())).first->second;
 
-        if (cacheEntry.frameListEntry >= photonsForFrameList_.size())
-            log_fatal("Internal error: particle cache entry uses invalid frame cache position");
+            if (outputPhotonSeries.empty()) {
+                outputPhotonSeries.swap(it->second);
+            } else {
+                outputPhotonSeries.insert(outputPhotonSeries.end(), it->second.begin(), it->second.end());
+            }
+        }
+    }
+}
 
-        //I3FramePtr &frame = frameList_[cacheEntry.frameListEntry];
-        I3PhotonSeriesMap &outputPhotonMap = *(photonsForFrameList_[cacheEntry.frameListEntry]);
+void I3CLSimModule::ConvertPhotonShard(photonShard &shard,
+                                       const std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> &results,
+                                       const std::deque<particleCacheEntry> &particleCache_,
+                                       uint32_t particleCacheFirstIndex)
+{
+    I3PhotonSeries *outputPhotonSeries = NULL;
+    ModuleKey lastKey;
 
-        // get the current photon id
-        int32_t &currentPhotonId = currentPhotonIdForFrame_[cacheEntry.frameListEntry];
+    for (std::size_t n=0;n<shard.photons.size();++n)
+    {
+        const PhotonRef_t &ref = shard.photons[n];
+        const I3CLSimPhoton &photon = (*(results[ref.result].photons))[ref.index];
+        const particleCacheEntry &cacheEntry = particleCache_[photon.identifier-particleCacheFirstIndex];
 
         // generate the OMKey
         const ModuleKey key = ModuleKeyFromOpenCLSimIDs(photon.stringID, photon.omID);
 
-        // get the OMKey mask
-        const std::set<ModuleKey> &keyMask = maskedOMKeys_[cacheEntry.frameListEntry];
-
-        if (keyMask.count(key) > 0) continue; // ignore masked DOMs
-
         // this either inserts a new vector or retrieves an existing one
-        I3PhotonSeries &outputPhotonSeries = outputPhotonMap.insert(std::make_pair(key, I3PhotonSeries())).first->second;
+        if ((!outputPhotonSeries) || (!(key == lastKey))) {
+            outputPhotonSeries = &(shard.output.insert(std::make_pair(key, I3PhotonSeries())).first->second);
+            lastKey = key;
+        }
 
         // append a new I3Photon to the list
-        outputPhotonSeries.push_back(I3Photon());
+        outputPhotonSeries->push_back(I3Photon());
 
         // get a reference to the new photon
-        I3Photon &outputPhoton = outputPhotonSeries.back();
+        I3Photon &outputPhoton = outputPhotonSeries->back();
 
         // fill the photon data
         outputPhoton.SetTime(photon.GetTime() + cacheEntry.timeShift);
-        outputPhoton.SetID(currentPhotonId); // per-frame ID for every photon
+        outputPhoton.SetID(ref.id); // per-frame ID for every photon
         outputPhoton.SetWeight(photon.GetWeight());
         outputPhoton.SetParticleMinorID(cacheEntry.particleMinorID);
         outputPhoton.SetParticleMajorID(cacheEntry.particleMajorID);
@@ -979,8 +1494,8 @@ void I3CLSimModule::AddPhotonsToFrames(const I3CLSimPhotonSeries &photons,
 
         outputPhoton.SetDistanceInAbsorptionLengths(photon.GetDistInAbsLens());
 
-        if (photonHistories) {
-            const I3CLSimPhotonHistory &photonHistory = (*photonHistories)[i];
+        if (results[ref.result].photonHistories) {
+            const I3CLSimPhotonHistory &photonHistory = (*(results[ref.result].photonHistories))[ref.index];
 
             if (photonHistory.size() > photon.GetNumScatters())
                 log_fatal("Logic error: photonHistory.size() [==%zu] > photon.GetNumScatters() [==%zu]",
@@ -993,17 +1508,7 @@ void I3CLSimModule::AddPhotonsToFrames(const I3CLSimPhotonSeries &photons,
                                                              );
             }
         }
-
-        if (collectStatistics_)
-        {
-            // collect statistics
-            (photonNumAtOMPerParticle.insert(std::make_pair(photon.identifier, 0)).first->second)++;
-            (photonWeightSumAtOMPerParticle.insert(std::make_pair(photon.identifier, 0.)).first->second)+=photon.GetWeight();
-        }
-
-        currentPhotonId++;
     }
-
 }
 
 std::size_t I3CLSimModule::FlushFrameCache()
@@ -1040,17 +1545,17 @@ std::size_t I3CLSimModule::FlushFrameCache()
 
     // swap all frame cache objects with local versions
 
-    std::map<uint32_t, uint64_t> photonNumGeneratedPerParticle_old;
-    std::map<uint32_t, double> photonWeightSumGeneratedPerParticle_old;
+    std::vector<uint64_t> photonNumGeneratedPerParticle_old;
+    std::vector<double> photonWeightSumGeneratedPerParticle_old;
     photonNumGeneratedPerParticle_old.swap(photonNumGeneratedPerParticle_);
     photonWeightSumGeneratedPerParticle_old.swap(photonWeightSumGeneratedPerParticle_);
 
-    std::vector<I3PhotonSeriesMapPtr> photonsForFrameList_old;
-    std::vector<int32_t> currentPhotonIdForFrame_old;
-    std::vector<I3FramePtr> frameList_old;
-    std::map<uint32_t, particleCacheEntry> particleCache_old;
-    std::vector<std::set<ModuleKey> > maskedOMKeys_old;
-    std::vector<bool> frameIsBeingWorkedOn_old;
+    std::deque<I3PhotonSeriesMapPtr> photonsForFrameList_old;
+    std::deque<int32_t> currentPhotonIdForFrame_old;
+    std::deque<I3FramePtr> frameList_old;
+    std::deque<particleCacheEntry> particleCache_old;
+    std::deque<std::set<ModuleKey> > maskedOMKeys_old;
+    std::deque<bool> frameIsBeingWorkedOn_old;
 
     photonsForFrameList_old.swap(photonsForFrameList_);
     currentPhotonIdForFrame_old.swap(currentPhotonIdForFrame_);
@@ -1059,6 +1564,10 @@ std::size_t I3CLSimModule::FlushFrameCache()
     maskedOMKeys_old.swap(maskedOMKeys_);
     frameIsBeingWorkedOn_old.swap(frameIsBeingWorkedOn_);
 
+    // all particles of the new flush get new indices, starting at 1
+    currentParticleCacheIndex_ = 1;
+    particleCache_.assign(1, particleCacheEntry()); // index 0 is never used
+
     bool startThreadLater = false;
 
     // at this point, if we have frames in the secondary cache,
@@ -1074,8 +1583,8 @@ std::size_t I3CLSimModule::FlushFrameCache()
     }
 
     // now wait for OpenCL to finish; retrieve results
-    std::map<uint32_t, uint64_t> photonNumAtOMPerParticle;
-    std::map<uint32_t, double> photonWeightSumAtOMPerParticle;
+    std::deque<uint64_t> photonNumAtOMPerParticle;
+    std::deque<double> photonWeightSumAtOMPerParticle;
 
     std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> res_list;
     for (std::size_t deviceIndex=0;deviceIndex<numBunchesSentToOpenCL_.size();++deviceIndex)
@@ -1085,7 +1594,7 @@ std::size_t I3CLSimModule::FlushFrameCache()
         for (uint64_t i=0;i<numBunchesSentToOpenCL_[deviceIndex];++i)
         {
             I3CLSimStepToPhotonConverter::ConversionResult_t res =
-            openCLStepsToPhotonsConverters_[deviceIndex]->GetConversionResult();
+            stepsToPhotonsConverters_[deviceIndex]->GetConversionResult();
             if (!res.photons) log_fatal("Internal error: received NULL photon series from OpenCL.");
 
             res_list.push_back(res);
@@ -1094,6 +1603,21 @@ std::size_t I3CLSimModule::FlushFrameCache()
 
     log_debug("results fetched from OpenCL.");
 
+    // update the throughput estimates for the next round
+    for (std::size_t deviceIndex=0;deviceIndex<stepsToPhotonsConverters_.size();++deviceIndex)
+    {
+        uint64_t numPhotons;
+        double busyTime;
+        if (!stepsToPhotonsConverters_[deviceIndex]->GetThroughputStatistics(numPhotons, busyTime)) continue;
+
+        bunchScheduler_->SetCumulativeStatistics(deviceIndex, numPhotons, busyTime);
+
+        log_debug("converter %zu: predicted %fs for this round, estimated throughput now %g photons/s",
+                  deviceIndex,
+                  bunchScheduler_->GetPredictedCompletionTime(deviceIndex),
+                  bunchScheduler_->GetPhotonsPerSecond(deviceIndex));
+    }
+
     // new frames were already sent to Geant4, we can re-start the thread right now
     // since we are done with fetching results from OpenCL
     if (startThreadLater) {
@@ -1106,29 +1630,27 @@ std::size_t I3CLSimModule::FlushFrameCache()
 
     log_debug("Adding photons to frame.");
     std::size_t totalNumOutPhotons=0;
-
-    while (!res_list.empty())
+    for (std::size_t i=0;i<res_list.size();++i)
     {
-        const I3CLSimStepToPhotonConverter::ConversionResult_t &res =
-            res_list.front();
-
-        // convert to I3Photons and add to their respective frames
-        AddPhotonsToFrames(*(res.photons), res.photonHistories,
-                           photonsForFrameList_old,
-                           currentPhotonIdForFrame_old,
-                           frameList_old,
-                           particleCache_old,
-                           maskedOMKeys_old,
-                           collectStatistics_,
-                           photonNumAtOMPerParticle,
-                           photonWeightSumAtOMPerParticle
-                           );
-
-        totalNumOutPhotons += res.photons->size();
-
-        res_list.pop_front();
+        totalNumOutPhotons += res_list[i].photons->size();
     }
 
+    // convert to I3Photons and add to their respective frames
+    AddPhotonsToFrames(res_list,
+                       photonsForFrameList_old,
+                       currentPhotonIdForFrame_old,
+                       frameList_old,
+                       0, // frames are counted from the flush
+                       particleCache_old,
+                       0, // entry 0 is the unused one
+                       maskedOMKeys_old,
+                       collectStatistics_,
+                       photonNumAtOMPerParticle,
+                       photonWeightSumAtOMPerParticle,
+                       *photonConversionPool_
+                       );
+    res_list.clear();
+
 
     log_debug("Got %zu photons in total during flush.", totalNumOutPhotons);
 
@@ -1136,7 +1658,9 @@ std::size_t I3CLSimModule::FlushFrameCache()
     {
         std::vector<I3CLSimEventStatisticsPtr> eventStatisticsForFrame;
         for (std::size_t i=0;i<frameList_old.size();++i) {
-            if (frameIsBeingWorkedOn_old[i]) {
+            if ((frameList_old[i] == chunkedFrame_) && (chunkedFrameStatistics_)) {
+                eventStatisticsForFrame.push_back(chunkedFrameStatistics_); // summed up over all chunks
+            } else if (frameIsBeingWorkedOn_old[i]) {
                 eventStatisticsForFrame.push_back(I3CLSimEventStatisticsPtr(new I3CLSimEventStatistics()));
             } else {
                 eventStatisticsForFrame.push_back(I3CLSimEventStatisticsPtr()); // NULL pointer for non-physics(/DAQ)-frames
@@ -1144,79 +1668,37 @@ std::size_t I3CLSimModule::FlushFrameCache()
         }
 
 
-        // generated photons (count)
-        for(std::map<uint32_t, uint64_t>::const_iterator it=photonNumGeneratedPerParticle_old.begin();
-            it!=photonNumGeneratedPerParticle_old.end();++it)
+        // generated photons (count and weight sum)
+        for (std::size_t particleIndex=1;particleIndex<photonNumGeneratedPerParticle_old.size();++particleIndex)
         {
-            // find identifier in particle cache
-            std::map<uint32_t, particleCacheEntry>::iterator it_cache = particleCache_old.find(it->first);
-            if (it_cache == particleCache_old.end())
-                log_error("Internal error: unknown particle id from Geant4: %" PRIu32,
-                          it->first);
-            const particleCacheEntry &cacheEntry = it_cache->second;
-
-            if (cacheEntry.frameListEntry >= eventStatisticsForFrame.size())
-                log_fatal("Internal error: particle cache entry uses invalid frame cache position");
+            if (photonNumGeneratedPerParticle_old[particleIndex]==0) continue;
 
-            eventStatisticsForFrame[cacheEntry.frameListEntry]->AddNumPhotonsGeneratedWithWeights(it->second, 0.,
-                                                                                                  cacheEntry.particleMajorID,
-                                                                                                  cacheEntry.particleMinorID);
-        }
-
-        // generated photons (weight sum)
-        for(std::map<uint32_t, double>::const_iterator it=photonWeightSumGeneratedPerParticle_old.begin();
-            it!=photonWeightSumGeneratedPerParticle_old.end();++it)
-        {
-            // find identifier in particle cache
-            std::map<uint32_t, particleCacheEntry>::iterator it_cache = particleCache_old.find(it->first);
-            if (it_cache == particleCache_old.end())
-                log_fatal("Internal error: unknown particle id from Geant4: %" PRIu32,
-                          it->first);
-            const particleCacheEntry &cacheEntry = it_cache->second;
+            if (particleIndex >= particleCache_old.size())
+                log_fatal("Internal error: unknown particle id from Geant4: %zu",
+                          particleIndex);
+            const particleCacheEntry &cacheEntry = particleCache_old[particleIndex];
 
             if (cacheEntry.frameListEntry >= eventStatisticsForFrame.size())
                 log_fatal("Internal error: particle cache entry uses invalid frame cache position");
 
-            eventStatisticsForFrame[cacheEntry.frameListEntry]->AddNumPhotonsGeneratedWithWeights(0, it->second,
+            eventStatisticsForFrame[cacheEntry.frameListEntry]->AddNumPhotonsGeneratedWithWeights(photonNumGeneratedPerParticle_old[particleIndex],
+                                                                                                  photonWeightSumGeneratedPerParticle_old[particleIndex],
                                                                                                   cacheEntry.particleMajorID,
                                                                                                   cacheEntry.particleMinorID);
         }
 
-
-        // photons @ DOMs(count)
-        for(std::map<uint32_t, uint64_t>::const_iterator it=photonNumAtOMPerParticle.begin();
-            it!=photonNumAtOMPerParticle.end();++it)
+        // photons @ DOMs (count and weight sum)
+        for (std::size_t particleIndex=1;particleIndex<photonNumAtOMPerParticle.size();++particleIndex)
         {
-            // find identifier in particle cache
-            std::map<uint32_t, particleCacheEntry>::iterator it_cache = particleCache_old.find(it->first);
-            if (it_cache == particleCache_old.end())
-                log_fatal("Internal error: unknown particle id from Geant4: %" PRIu32,
-                          it->first);
-            const particleCacheEntry &cacheEntry = it_cache->second;
-
-            if (cacheEntry.frameListEntry >= eventStatisticsForFrame.size())
-                log_fatal("Internal error: particle cache entry uses invalid frame cache position");
-
-            eventStatisticsForFrame[cacheEntry.frameListEntry]->AddNumPhotonsAtDOMsWithWeights(it->second, 0.,
-                                                                                               cacheEntry.particleMajorID,
-                                                                                               cacheEntry.particleMinorID);
-        }
+            if (photonNumAtOMPerParticle[particleIndex]==0) continue;
 
-        // photons @ DOMs (weight sum)
-        for(std::map<uint32_t, double>::const_iterator it=photonWeightSumAtOMPerParticle.begin();
-            it!=photonWeightSumAtOMPerParticle.end();++it)
-        {
-            // find identifier in particle cache
-            std::map<uint32_t, particleCacheEntry>::iterator it_cache = particleCache_old.find(it->first);
-            if (it_cache == particleCache_old.end())
-                log_fatal("Internal error: unknown particle id from Geant4: %" PRIu32,
-                          it->first);
-            const particleCacheEntry &cacheEntry = it_cache->second;
+            const particleCacheEntry &cacheEntry = particleCache_old[particleIndex];
 
             if (cacheEntry.frameListEntry >= eventStatisticsForFrame.size())
                 log_fatal("Internal error: particle cache entry uses invalid frame cache position");
 
-            eventStatisticsForFrame[cacheEntry.frameListEntry]->AddNumPhotonsAtDOMsWithWeights(0, it->second,
+            eventStatisticsForFrame[cacheEntry.frameListEntry]->AddNumPhotonsAtDOMsWithWeights(photonNumAtOMPerParticle[particleIndex],
+                                                                                               photonWeightSumAtOMPerParticle[particleIndex],
                                                                                                cacheEntry.particleMajorID,
                                                                                                cacheEntry.particleMinorID);
         }
@@ -1225,6 +1707,8 @@ std::size_t I3CLSimModule::FlushFrameCache()
         // store statistics to frame
         for (std::size_t i=0;i<frameList_old.size();++i)
         {
+            if ((frameList_old[i] == chunkedFrame_) && (!chunkedFrameIsLastChunk_)) continue;
+
             if (frameIsBeingWorkedOn_old[i]) {
                 frameList_old[i]->Put(statisticsName_, eventStatisticsForFrame[i]);
             }
@@ -1237,6 +1721,12 @@ std::size_t I3CLSimModule::FlushFrameCache()
     std::size_t framesPushed=0;
     for (std::size_t identifier=0;identifier<frameList_old.size();++identifier)
     {
+        if ((frameList_old[identifier] == chunkedFrame_) && (!chunkedFrameIsLastChunk_)) {
+            // there are more chunks to come, keep the frame
+            chunkedFrameNextPhotonId_ = currentPhotonIdForFrame_old[identifier];
+            continue;
+        }
+
         if (frameIsBeingWorkedOn_old[identifier]) {
             log_debug("putting photons into frame %zu...", identifier);
             frameList_old[identifier]->Put(photonSeriesMapName_, photonsForFrameList_old[identifier]);
@@ -1250,6 +1740,252 @@ std::size_t I3CLSimModule::FlushFrameCache()
     return framesPushed;
 }
 
+bool I3CLSimModule::MemoryBudgetIsActive() const
+{
+    // only once the memory per predicted photon has been measured
+    return ((hostMemoryBudget_ > 0.) && (predictedNumPhotonsPushed_ > 0.) && (photonMemoryPushed_ > 0.));
+}
+
+bool I3CLSimModule::CanAdmitFrame(double lightSourceEnergy, double predictedNumPhotons) const
+{
+    // always work on at least one frame
+    if (frameList_.empty()) return true;
+
+    // let the particle indices start at 1 again before they can overflow
+    if (currentParticleCacheIndex_ >= 0x80000000) return false;
+
+    if (MemoryBudgetIsActive())
+        return ((predictedNumPhotonsInFlight_ + predictedNumPhotons)*photonMemoryPushed_/predictedNumPhotonsPushed_ <= hostMemoryBudget_);
+
+    if ((totalEnergyToProcess_ > 0) && (!std::isnan(totalEnergyToProcess_)))
+        return (lightSourceEnergyInFlight_ + lightSourceEnergy <= totalEnergyToProcess_);
+
+    // as many frames as both buffers hold in flush mode
+    return (frameList_.size() < maxNumParallelEvents_ + maxNumParallelEventsSecondFlush_);
+}
+
+void I3CLSimModule::RequestFlushForHeadFrame(bool force)
+{
+    if (frameList_.empty()) return;
+
+    // a flushing marker has already been enqueued after it
+    if (numFramesCoveredByFlush_ > frameListFirstEntry_) return;
+
+    if (frameTracker_->HeadFrameHasAllSteps()) return;
+
+    // Geant4 keeps steps until it has enough of them for a full bunch,
+    // so the steps of the head frame may sit there while new frames
+    // are being admitted. Flush them out once the window is half
+    // full, or right away if there is nothing else to wait for.
+    if (!force)
+    {
+        bool halfFull;
+        if (MemoryBudgetIsActive()) {
+            halfFull = (2.*predictedNumPhotonsInFlight_*photonMemoryPushed_/predictedNumPhotonsPushed_ >= hostMemoryBudget_);
+        } else if ((totalEnergyToProcess_ > 0) && (!std::isnan(totalEnergyToProcess_))) {
+            halfFull = (2.*lightSourceEnergyInFlight_ >= totalEnergyToProcess_);
+        } else {
+            halfFull = (2*frameList_.size() >= maxNumParallelEvents_ + maxNumParallelEventsSecondFlush_);
+        }
+        if (!halfFull) return;
+    }
+
+    log_debug("Requesting a flush of the Geant4 steps for frame %zu.", frameListFirstEntry_);
+
+    frameTracker_->AddMarker();
+    geant4ParticleToStepsConverter_->EnqueueMarker(true);
+    numFramesCoveredByFlush_ = frameTracker_->GetNumFramesAdded();
+}
+
+std::size_t I3CLSimModule::CollectResults(bool wait)
+{
+    std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> res_list;
+
+    // take whatever is there (only if the converters announce
+    // their results, MorePhotonsAvailable() of the CPU converter
+    // also counts pending work)
+    std::size_t readyIndex;
+    if (convertersWithResults_)
+    {
+        while (convertersWithResults_->GetNonBlocking(readyIndex))
+        {
+            res_list.push_back(stepsToPhotonsConverters_[readyIndex]->GetConversionResult());
+        }
+    }
+
+    if ((wait) && (res_list.empty()))
+    {
+        // allow other threads to access python
+        ScopedGILRelease scopedGIL;
+
+        if (frameTracker_->GetConverterToWaitFor(readyIndex))
+        {
+            // any result is progress, so take the first one that is ready
+            if (convertersWithResults_) readyIndex = convertersWithResults_->Get();
+
+            log_trace("Waiting for converter %zu..", readyIndex);
+            res_list.push_back(stepsToPhotonsConverters_[readyIndex]->GetConversionResult());
+        }
+        else
+        {
+            // the head frame is still in Geant4
+            RequestFlushForHeadFrame(true);
+            frameTracker_->WaitForChange(0.1);
+        }
+    }
+
+    if (res_list.empty()) return 0;
+
+    for (std::size_t i=0;i<res_list.size();++i)
+    {
+        if (!res_list[i].photons) log_fatal("Internal error: received NULL photon series from OpenCL.");
+
+        std::size_t deviceIndex;
+        uint64_t numPhotons;
+        if (!frameTracker_->BunchReturned(res_list[i].identifier, deviceIndex, numPhotons))
+            log_fatal("Internal error: received results for unknown bunch %" PRIu32 ".",
+                      res_list[i].identifier);
+
+        boost::unique_lock<boost::mutex> guard(bunchSchedulerMutex_);
+        bunchScheduler_->Release(deviceIndex, numPhotons);
+    }
+
+    // update the throughput estimates
+    for (std::size_t deviceIndex=0;deviceIndex<stepsToPhotonsConverters_.size();++deviceIndex)
+    {
+        uint64_t numPhotons;
+        double busyTime;
+        if (!stepsToPhotonsConverters_[deviceIndex]->GetThroughputStatistics(numPhotons, busyTime)) continue;
+
+        boost::unique_lock<boost::mutex> guard(bunchSchedulerMutex_);
+        bunchScheduler_->SetCumulativeStatistics(deviceIndex, numPhotons, busyTime);
+    }
+
+    // convert to I3Photons and add to their respective frames,
+    // the statistics go straight to the per-particle sums
+    AddPhotonsToFrames(res_list,
+                       photonsForFrameList_,
+                       currentPhotonIdForFrame_,
+                       frameList_,
+                       frameListFirstEntry_,
+                       particleCache_,
+                       particleCacheFirstIndex_,
+                       maskedOMKeys_,
+                       collectStatistics_,
+                       photonNumAtOMPerParticle_,
+                       photonWeightSumAtOMPerParticle_,
+                       *photonConversionPool_
+                       );
+
+    return res_list.size();
+}
+
+std::size_t I3CLSimModule::PushCompletedFrames()
+{
+    std::size_t framesPushed=0;
+
+    while (frameTracker_->HeadFrameComplete())
+    {
+        if (frameList_.empty())
+            log_fatal("Internal error: the frame tracker has more frames than the module.");
+
+        std::vector<uint64_t> photonNumGenerated;
+        std::vector<double> photonWeightSumGenerated;
+        frameTracker_->PopHeadFrame(photonNumGenerated, photonWeightSumGenerated);
+
+        // the particles of the head frame are at the front of the cache
+        std::size_t numParticles=0;
+        while ((numParticles < particleCache_.size()) &&
+               (particleCache_[numParticles].frameListEntry == frameListFirstEntry_))
+        {
+            ++numParticles;
+        }
+
+        I3FramePtr frame = frameList_.front();
+
+        if (frameIsBeingWorkedOn_.front())
+        {
+            if (collectStatistics_)
+            {
+                if (photonNumGenerated.size() != numParticles)
+                    log_fatal("Internal error: the frame tracker has statistics for %zu particles, expected %zu.",
+                              photonNumGenerated.size(), numParticles);
+
+                I3CLSimEventStatisticsPtr eventStatistics(new I3CLSimEventStatistics());
+
+                for (std::size_t i=0;i<numParticles;++i)
+                {
+                    const particleCacheEntry &cacheEntry = particleCache_[i];
+
+                    // generated photons (count and weight sum)
+                    if (photonNumGenerated[i] > 0)
+                        eventStatistics->AddNumPhotonsGeneratedWithWeights(photonNumGenerated[i],
+                                                                          photonWeightSumGenerated[i],
+                                                                          cacheEntry.particleMajorID,
+                                                                          cacheEntry.particleMinorID);
+
+                    // photons @ DOMs (count and weight sum)
+                    if ((i < photonNumAtOMPerParticle_.size()) && (photonNumAtOMPerParticle_[i] > 0))
+                        eventStatistics->AddNumPhotonsAtDOMsWithWeights(photonNumAtOMPerParticle_[i],
+                                                                       photonWeightSumAtOMPerParticle_[i],
+                                                                       cacheEntry.particleMajorID,
+                                                                       cacheEntry.particleMinorID);
+                }
+
+                frame->Put(statisticsName_, eventStatistics);
+            }
+
+            log_debug("putting photons into frame %zu...", frameListFirstEntry_);
+            frame->Put(photonSeriesMapName_, photonsForFrameList_.front());
+
+            if (predictedNumPhotonsForFrameList_.front() > 0.)
+            {
+                // learn how much memory the photons take up per predicted photon
+                std::size_t numPhotons=0;
+                for (I3PhotonSeriesMap::const_iterator it=photonsForFrameList_.front()->begin();
+                     it!=photonsForFrameList_.front()->end();++it)
+                {
+                    numPhotons += it->second.size();
+                }
+
+                predictedNumPhotonsPushed_ += predictedNumPhotonsForFrameList_.front();
+                photonMemoryPushed_ += static_cast<double>(numPhotons*sizeof(I3Photon));
+            }
+        }
+
+        // remove the particles of the frame
+        particleCache_.erase(particleCache_.begin(), particleCache_.begin()+numParticles);
+        particleCacheFirstIndex_ += static_cast<uint32_t>(numParticles);
+        const std::size_t numAtOMEntries = std::min(numParticles, photonNumAtOMPerParticle_.size());
+        photonNumAtOMPerParticle_.erase(photonNumAtOMPerParticle_.begin(), photonNumAtOMPerParticle_.begin()+numAtOMEntries);
+        photonWeightSumAtOMPerParticle_.erase(photonWeightSumAtOMPerParticle_.begin(), photonWeightSumAtOMPerParticle_.begin()+numAtOMEntries);
+
+        frameList_.pop_front();
+        photonsForFrameList_.pop_front();
+        currentPhotonIdForFrame_.pop_front();
+        frameIsBeingWorkedOn_.pop_front();
+        maskedOMKeys_.pop_front();
+
+        lightSourceEnergyInFlight_ -= lightSourceEnergyForFrameList_.front();
+        lightSourceEnergyForFrameList_.pop_front();
+        predictedNumPhotonsInFlight_ -= predictedNumPhotonsForFrameList_.front();
+        predictedNumPhotonsForFrameList_.pop_front();
+        if (frameList_.empty()) {
+            // no rounding errors piling up
+            lightSourceEnergyInFlight_ = 0.;
+            predictedNumPhotonsInFlight_ = 0.;
+        }
+
+        ++frameListFirstEntry_;
+
+        log_debug("pushing frame number %zu...", frameListFirstEntry_-1);
+        PushFrame(frame);
+        ++framesPushed;
+    }
+
+    return framesPushed;
+}
+
 namespace {
     bool ParticleHasMuonDaughter(const I3MCTree::const_iterator &particle_it, const I3MCTree &mcTree)
     {
@@ -1372,6 +2108,66 @@ void I3CLSimModule::Process()
         return;
     }
 
+    if (streamFrames_)
+    {
+        double lightSourceEnergy = 0.;
+        if ((totalEnergyToProcess_ > 0) && (!std::isnan(totalEnergyToProcess_)))
+        {
+            lightSourceEnergy = GetLightSourceEnergy(frame);
+            log_debug("Energy in Frame = %f GeV", lightSourceEnergy);
+        }
+
+        double predictedNumPhotons = 0.;
+        if (hostMemoryBudget_ > 0.)
+        {
+            predictedNumPhotons = GetPredictedNumPhotons(frame);
+            log_debug("Predicted photons in Frame = %g", predictedNumPhotons);
+        }
+
+        // make room for the new frame
+        while (!CanAdmitFrame(lightSourceEnergy, predictedNumPhotons))
+        {
+            CollectResults(true);
+            PushCompletedFrames();
+        }
+
+        if (frameList_.empty())
+        {
+            // nothing is in flight, start with new particle indices
+            currentParticleCacheIndex_ = 1;
+            particleCacheFirstIndex_ = 1;
+            particleCache_.clear();
+            photonNumAtOMPerParticle_.clear();
+            photonWeightSumAtOMPerParticle_.clear();
+        }
+
+        // frames that are not worked on are tracked, too,
+        // so frames are pushed in order
+        if (!DigestOtherFrame(frame))
+            frameTracker_->AddFrame(currentParticleCacheIndex_, 0);
+
+        lightSourceEnergyForFrameList_.push_back(lightSourceEnergy);
+        lightSourceEnergyInFlight_ += lightSourceEnergy;
+        predictedNumPhotonsForFrameList_.push_back(predictedNumPhotons);
+        predictedNumPhotonsInFlight_ += predictedNumPhotons;
+
+        if ((MemoryBudgetIsActive()) && (frameList_.size()==1) &&
+            (predictedNumPhotons*photonMemoryPushed_/predictedNumPhotonsPushed_ > hostMemoryBudget_))
+        {
+            log_warn("The photons of this frame are predicted to take up %g bytes, more than "
+                     "\"HostMemoryBudget\" (%g bytes). Working on it alone.",
+                     predictedNumPhotons*photonMemoryPushed_/predictedNumPhotonsPushed_,
+                     hostMemoryBudget_);
+        }
+
+        RequestFlushForHeadFrame(false);
+        CollectResults(false);
+        PushCompletedFrames();
+        return;
+    }
+
+    if ((maxNumPhotonsPerChunk_ > 0.) && (ProcessFrameInChunks(frame))) return;
+
     if ((totalEnergyToProcess_ > 0) && (!std::isnan(totalEnergyToProcess_)))
     {
         double totalLightEnergyInFrame = GetLightSourceEnergy(frame);
@@ -1488,14 +2284,148 @@ double I3CLSimModule::GetLightSourceEnergy(I3FramePtr frame)
     return totalLightSourceEnergy;
 }
 
+double I3CLSimModule::GetPredictedNumPhotons(I3FramePtr frame)
+{
+    // only frames we work on get photons
+    if (workOnTheseStops_set_.count(frame->GetStop()) == 0) return 0.;
+
+    I3MCTreeConstPtr MCTree;
+    I3CLSimFlasherPulseSeriesConstPtr flasherPulses;
+
+    if (MCTreeName_ != "")
+        MCTree = frame->Get<I3MCTreeConstPtr>(MCTreeName_);
+    if (flasherPulseSeriesName_ != "")
+        flasherPulses = frame->Get<I3CLSimFlasherPulseSeriesConstPtr>(flasherPulseSeriesName_);
+
+    std::deque<I3CLSimLightSource> lightSources;
+    std::deque<double> timeOffsets;
+    if (MCTree) ConvertMCTreeToLightSources(*MCTree, lightSources, timeOffsets);
+    if (flasherPulses) ConvertFlasherPulsesToLightSources(*flasherPulses, lightSources, timeOffsets);
+
+    double predictedNumPhotons = 0.;
+    for (std::size_t i=0;i<lightSources.size();++i)
+    {
+        predictedNumPhotons +=
+        I3CLSimLightSourceToStepConverterUtils::PredictedNumberOfPhotons(lightSources[i],
+                                                                         maxPhotonsPerMeter_,
+                                                                         mediumProperties_->GetMediumDensity());
+    }
+
+    return predictedNumPhotons;
+}
+
+bool I3CLSimModule::ProcessFrameInChunks(I3FramePtr frame)
+{
+    if (workOnTheseStops_set_.count(frame->GetStop()) == 0) return false;
+    if (!I3ConditionalModule::ShouldDoProcess(frame)) return false;
+
+    I3MCTreeConstPtr MCTree;
+    I3CLSimFlasherPulseSeriesConstPtr flasherPulses;
+
+    if (MCTreeName_ != "")
+        MCTree = frame->Get<I3MCTreeConstPtr>(MCTreeName_);
+    if (flasherPulseSeriesName_ != "")
+        flasherPulses = frame->Get<I3CLSimFlasherPulseSeriesConstPtr>(flasherPulseSeriesName_);
+
+    std::deque<I3CLSimLightSource> lightSources;
+    std::deque<double> timeOffsets;
+    if (MCTree) ConvertMCTreeToLightSources(*MCTree, lightSources, timeOffsets);
+    if (flasherPulses) ConvertFlasherPulsesToLightSources(*flasherPulses, lightSources, timeOffsets);
+
+    std::vector<double> predictedNumPhotons(lightSources.size());
+    double totalPredictedNumPhotons = 0.;
+    for (std::size_t i=0;i<lightSources.size();++i)
+    {
+        predictedNumPhotons[i] =
+        I3CLSimLightSourceToStepConverterUtils::PredictedNumberOfPhotons(lightSources[i],
+                                                                         maxPhotonsPerMeter_,
+                                                                         mediumProperties_->GetMediumDensity());
+        totalPredictedNumPhotons += predictedNumPhotons[i];
+    }
+
+    if (totalPredictedNumPhotons <= maxNumPhotonsPerChunk_) return false;
+
+    log_info("Frame is predicted to generate %g photons, splitting it into chunks of at most %g photons.",
+             totalPredictedNumPhotons, maxNumPhotonsPerChunk_);
+
+    // push all frames before this one
+    while (frameListPhysicsFrameCounter_ > 0)
+    {
+        frameListPhysicsFrameCounter_ -= FlushFrameCache();
+
+        for (std::size_t i=0;i<frameList2_.size();++i) {
+            DigestOtherFrame(frameList2_[i]);
+        }
+        frameList2_.clear();
+    }
+    if ((totalEnergyToProcess_ > 0) && (!std::isnan(totalEnergyToProcess_)))
+    {
+        totalSimulatedEnergy_ = 0.;
+        maxNumParallelEvents_ = 1;
+        maxNumParallelEventsSecondFlush_ = 1;
+    }
+
+    chunkedFrame_ = frame;
+    chunkedFramePhotons_ = I3PhotonSeriesMapPtr(new I3PhotonSeriesMap());
+    chunkedFrameNextPhotonId_ = 0;
+    if (collectStatistics_)
+        chunkedFrameStatistics_ = I3CLSimEventStatisticsPtr(new I3CLSimEventStatistics());
+
+    frameListPhysicsFrameCounter_++;
+
+    std::size_t firstLightSource = 0;
+    std::size_t numChunks = 0;
+    while (firstLightSource < lightSources.size())
+    {
+        // consecutive light sources, at least one per chunk
+        std::size_t lastLightSource = firstLightSource+1;
+        double numPhotonsInChunk = predictedNumPhotons[firstLightSource];
+        while ((lastLightSource < lightSources.size()) &&
+               (numPhotonsInChunk + predictedNumPhotons[lastLightSource] <= maxNumPhotonsPerChunk_))
+        {
+            numPhotonsInChunk += predictedNumPhotons[lastLightSource];
+            ++lastLightSource;
+        }
+
+        chunkLightSources_.assign(lightSources.begin()+firstLightSource, lightSources.begin()+lastLightSource);
+        chunkTimeOffsets_.assign(timeOffsets.begin()+firstLightSource, timeOffsets.begin()+lastLightSource);
+        chunkedFrameIsLastChunk_ = (lastLightSource == lightSources.size());
+
+        log_debug("Working on chunk %zu with light sources [%zu;%zu) (%g photons predicted).",
+                  numChunks, firstLightSource, lastLightSource, numPhotonsInChunk);
+
+        DigestOtherFrame(frame);
+        frameListPhysicsFrameCounter_ -= FlushFrameCache(); // pushes the frame after the last chunk
+
+        firstLightSource = lastLightSource;
+        ++numChunks;
+    }
+
+    log_debug("Frame was split into %zu chunks.", numChunks);
+
+    chunkedFrame_.reset();
+    chunkedFramePhotons_.reset();
+    chunkedFrameStatistics_.reset();
+    chunkedFrameIsLastChunk_ = false;
+    chunkedFrameNextPhotonId_ = 0;
+
+    return true;
+}
+
 bool I3CLSimModule::DigestOtherFrame(I3FramePtr frame, bool startThread)
 {
     log_trace("%s", __PRETTY_FUNCTION__);
 
     frameList_.push_back(frame);
-    photonsForFrameList_.push_back(I3PhotonSeriesMapPtr(new I3PhotonSeriesMap()));
-    currentPhotonIdForFrame_.push_back(0);
-    std::size_t currentFrameListIndex = frameList_.size()-1;
+    if (frame == chunkedFrame_) {
+        // continue where the previous chunk stopped
+        photonsForFrameList_.push_back(chunkedFramePhotons_);
+        currentPhotonIdForFrame_.push_back(chunkedFrameNextPhotonId_);
+    } else {
+        photonsForFrameList_.push_back(I3PhotonSeriesMapPtr(new I3PhotonSeriesMap()));
+        currentPhotonIdForFrame_.push_back(0);
+    }
+    std::size_t currentFrameListIndex = frameListFirstEntry_+frameList_.size()-1;
     maskedOMKeys_.push_back(std::set<ModuleKey>()); // insert an empty ModuleKey mask
 
     // check if we got a geometry before starting to work
@@ -1560,8 +2490,14 @@ bool I3CLSimModule::DigestOtherFrame(I3FramePtr frame, bool startThread)
 
     std::deque<I3CLSimLightSource> lightSources;
     std::deque<double> timeOffsets;
-    if (MCTree) ConvertMCTreeToLightSources(*MCTree, lightSources, timeOffsets);
-    if (flasherPulses) ConvertFlasherPulsesToLightSources(*flasherPulses, lightSources, timeOffsets);
+    if (frame == chunkedFrame_) {
+        // only the current chunk
+        lightSources.swap(chunkLightSources_);
+        timeOffsets.swap(chunkTimeOffsets_);
+    } else {
+        if (MCTree) ConvertMCTreeToLightSources(*MCTree, lightSources, timeOffsets);
+        if (flasherPulses) ConvertFlasherPulsesToLightSources(*flasherPulses, lightSources, timeOffsets);
+    }
 
     // support both vectors of OMKeys and vectors of ModuleKeys
 
@@ -1579,6 +2515,14 @@ bool I3CLSimModule::DigestOtherFrame(I3FramePtr frame, bool startThread)
         }
     }
 
+    if (streamFrames_)
+    {
+        if (static_cast<uint64_t>(currentParticleCacheIndex_)+lightSources.size() > 0xFFFFFFFFULL)
+            log_fatal("Too many light sources in a single frame.");
+
+        frameTracker_->AddFrame(currentParticleCacheIndex_, static_cast<uint32_t>(lightSources.size()));
+    }
+
     for (std::size_t i=0;i<lightSources.size();++i)
     {
         const I3CLSimLightSource &lightSource = lightSources[i];
@@ -1594,11 +2538,11 @@ bool I3CLSimModule::DigestOtherFrame(I3FramePtr frame, bool startThread)
 
         geant4ParticleToStepsConverter_->EnqueueLightSource(lightSource, currentParticleCacheIndex_);
 
-        if (particleCache_.find(currentParticleCacheIndex_) != particleCache_.end())
-            log_fatal("Internal error. Particle cache index already used.");
+        if (particleCacheFirstIndex_+particleCache_.size() != currentParticleCacheIndex_)
+            log_fatal("Internal error. Particle cache index out of sync.");
 
-        particleCacheEntry &cacheEntry =
-        particleCache_.insert(std::make_pair(currentParticleCacheIndex_, particleCacheEntry())).first->second;
+        particleCache_.push_back(particleCacheEntry());
+        particleCacheEntry &cacheEntry = particleCache_.back();
 
         cacheEntry.frameListEntry = currentFrameListIndex;
         cacheEntry.timeShift = timeOffset;
@@ -1610,10 +2554,18 @@ bool I3CLSimModule::DigestOtherFrame(I3FramePtr frame, bool startThread)
             cacheEntry.particleMinorID = 0;
         }
 
-        // make a new index. This will eventually overflow,
-        // but at that time, index 0 should be unused again.
+        // make a new index. The indices start again at 1 after
+        // every flush, so this only overflows if there are more than
+        // 2^32-1 light sources in a single flush.
         ++currentParticleCacheIndex_;
-        if (currentParticleCacheIndex_==0) ++currentParticleCacheIndex_; // never use index==0
+        if (currentParticleCacheIndex_==0) log_fatal("Too many light sources in a single flush.");
+    }
+
+    if ((streamFrames_) && (!lightSources.empty()))
+    {
+        // the frame has all of its steps once Geant4 reaches this
+        frameTracker_->AddMarker();
+        geant4ParticleToStepsConverter_->EnqueueMarker();
     }
 
     lightSources.clear();
@@ -1631,6 +2583,18 @@ void I3CLSimModule::Finish()
     totalSimulatedEnergyForFlush_=0.;
     totalNumParticlesForFlush_=0;
 
+    if (streamFrames_)
+    {
+        while (!frameList_.empty())
+        {
+            CollectResults(true);
+            PushCompletedFrames();
+        }
+
+        log_info("Flushing I3Tray..");
+        Flush();
+    }
+
     std::size_t framesPushed = 0;
     while (frameListPhysicsFrameCounter_ > 0) {
         framesPushed = FlushFrameCache();
@@ -1671,13 +2635,38 @@ void I3CLSimModule::Finish()
 
             (*summary)[prefix+"TotalDeviceTime"           +postfix] = totalDeviceTime;
             (*summary)[prefix+"TotalHostTime"             +postfix] = totalHostTime;
+            (*summary)[prefix+"TotalDeviceIdleTime"       +postfix] = static_cast<double>(openCLStepsToPhotonsConverters_[i]->GetTotalDeviceIdleTime())*I3Units::ns;
+            (*summary)[prefix+"TotalHostConversionTime"   +postfix] = static_cast<double>(openCLStepsToPhotonsConverters_[i]->GetTotalHostConversionTime())*I3Units::ns;
             (*summary)[prefix+"NumKernelCalls"            +postfix] = openCLStepsToPhotonsConverters_[i]->GetNumKernelCalls();
+            (*summary)[prefix+"NumStarvingKernelCalls"    +postfix] = openCLStepsToPhotonsConverters_[i]->GetNumStarvingKernelCalls();
             (*summary)[prefix+"TotalNumPhotonsGenerated"  +postfix] = totalNumPhotonsGenerated;
             (*summary)[prefix+"TotalNumPhotonsAtDOMs"     +postfix] = openCLStepsToPhotonsConverters_[i]->GetTotalNumPhotonsAtDOMs();
 
             (*summary)[prefix+"AverageDeviceTimePerPhoton"+postfix] = totalDeviceTime/totalNumPhotonsGenerated;
             (*summary)[prefix+"AverageHostTimePerPhoton"  +postfix] = totalHostTime/totalNumPhotonsGenerated;
             (*summary)[prefix+"DeviceUtilization"         +postfix] = totalDeviceTime/totalHostTime;
+
+            if (openCLStepsToPhotonsConverters_[i]->GetProfileKernel()) {
+                const std::vector<uint64_t> counts = openCLStepsToPhotonsConverters_[i]->GetKernelProfileCounts();
+                const std::vector<uint64_t> ticks = openCLStepsToPhotonsConverters_[i]->GetKernelProfileTicks();
+                const bool hasClock = openCLStepsToPhotonsConverters_[i]->GetKernelProfileHasClock();
+
+                for (std::size_t phase=0;phase<counts.size();++phase)
+                {
+                    const std::string phaseName =
+                        I3CLSimStepToPhotonConverterOpenCL::GetKernelProfilePhaseName(static_cast<I3CLSimStepToPhotonConverterOpenCL::KernelProfilePhase>(phase));
+
+                    (*summary)[prefix+"KernelProfile"+phaseName+"Count"+postfix] = counts[phase];
+                    if (hasClock)
+                        (*summary)[prefix+"KernelProfile"+phaseName+"Ticks"+postfix] = ticks[phase];
+                }
+            }
+        }
+
+        if (cpuStepsToPhotonsConverter_)
+        {
+            (*summary)[prefix+"TotalNumPhotonsGenerated"] = cpuStepsToPhotonsConverter_->GetTotalNumPhotonsGenerated();
+            (*summary)[prefix+"TotalNumPhotonsAtDOMs"] = cpuStepsToPhotonsConverter_->GetTotalNumPhotonsAtDOMs();
         }
 
     }
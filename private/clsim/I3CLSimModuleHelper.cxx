@@ -321,7 +321,16 @@ namespace I3CLSimModuleHelper {
     //         double fixedNumberOfAbsorptionLengths,
     //         double pancakeFactor,
     //         uint32_t photonHistoryEntries,
-    //         uint32_t limitWorkgroupSize
+    //         uint32_t limitWorkgroupSize,
+    //         I3Vector<I3Position> holeIceCylinderPositions,
+    //         I3Vector<float> holeIceCylinderRadii,
+    //         I3Vector<float> holeIceCylinderScatteringLengths,
+    //         I3Vector<float> holeIceCylinderAbsorptionLengths,
+    //         bool profileKernel,
+    //         uint32_t bufferRingDepth,
+    //         bool usePersistentThreads,
+    //         uint32_t numPersistentWorkItems,
+    //         double stepSplittingFactor
     //     }
     //
     //     The boost python bindings apparently do not support so many arguments
@@ -340,6 +349,10 @@ namespace I3CLSimModuleHelper {
         conv->SetGeometry(options.geometry);
 
         conv->SetEnableDoubleBuffering(options.enableDoubleBuffering);
+        if (options.bufferRingDepth>0) {
+            // overrides the double buffering setting
+            conv->SetBufferRingDepth(options.bufferRingDepth);
+        }
         conv->SetDoublePrecision(options.doublePrecision);
         conv->SetStopDetectedPhotons(options.stopDetectedPhotons);
         conv->SetSaveAllPhotons(options.saveAllPhotons);
@@ -360,6 +373,11 @@ namespace I3CLSimModuleHelper {
         conv->SetHoleIceCylinderScatteringLengths(options.holeIceCylinderScatteringLengths);
         conv->SetHoleIceCylinderAbsorptionLengths(options.holeIceCylinderAbsorptionLengths);
 
+        conv->SetProfileKernel(options.profileKernel);
+        conv->SetUsePersistentThreads(options.usePersistentThreads);
+        conv->SetNumPersistentWorkItems(options.numPersistentWorkItems);
+        conv->SetStepSplittingFactor(options.stepSplittingFactor);
+
         conv->Compile();
         //log_trace("%s", conv.GetFullSource().c_str());
 
@@ -390,6 +408,47 @@ namespace I3CLSimModuleHelper {
         return conv;
     }
 
+    I3CLSimStepToPhotonConverterCPUPtr initializeCPU(I3RandomServicePtr rng,
+                                                     I3CLSimSimpleGeometryFromI3GeometryPtr geometry,
+                                                     I3CLSimMediumPropertiesConstPtr medium,
+                                                     I3CLSimFunctionConstPtr wavelengthGenerationBias,
+                                                     const std::vector<I3CLSimRandomValueConstPtr> &wavelengthGenerators,
+                                                     bool stopDetectedPhotons,
+                                                     double pancakeFactor,
+                                                     bool simulateHoleIce,
+                                                     const I3Vector<I3Position> &holeIceCylinderPositions,
+                                                     const I3Vector<float> &holeIceCylinderRadii,
+                                                     const I3Vector<float> &holeIceCylinderScatteringLengths,
+                                                     const I3Vector<float> &holeIceCylinderAbsorptionLengths,
+                                                     uint32_t numThreads)
+    {
+        I3CLSimStepToPhotonConverterCPUPtr conv(new I3CLSimStepToPhotonConverterCPU(rng));
+
+        conv->SetWlenGenerators(wavelengthGenerators);
+        conv->SetWlenBias(wavelengthGenerationBias);
+
+        conv->SetMediumProperties(medium);
+        conv->SetGeometry(geometry);
+
+        conv->SetStopDetectedPhotons(stopDetectedPhotons);
+        conv->SetDOMPancakeFactor(pancakeFactor);
+
+        conv->SetSimulateHoleIce(simulateHoleIce);
+        conv->SetHoleIceCylinderPositions(holeIceCylinderPositions);
+        conv->SetHoleIceCylinderRadii(holeIceCylinderRadii);
+        conv->SetHoleIceCylinderScatteringLengths(holeIceCylinderScatteringLengths);
+        conv->SetHoleIceCylinderAbsorptionLengths(holeIceCylinderAbsorptionLengths);
+
+        conv->SetNumThreads(numThreads);
+
+        conv->Initialize();
+
+        log_info("using %zu CPU threads, maximum number of steps per bunch is %zu",
+                 conv->GetNumThreads(), conv->GetMaxNumWorkitems());
+
+        return conv;
+    }
+
     I3CLSimLightSourceToStepConverterGeant4Ptr initializeGeant4(I3RandomServicePtr rng,
                                                              I3CLSimMediumPropertiesConstPtr medium,
                                                              I3CLSimFunctionConstPtr wavelengthGenerationBias,
@@ -32,10 +32,32 @@
 #include <boost/static_assert.hpp>
 #include <boost/serialization/binary_object.hpp>
 
+#include <vector>
+#include <cstring>
+
 using namespace boost::archive;
 
 namespace {
-    const std::size_t blobSizeV0 = 48; // size of our structure in bytes
+    const std::size_t blobSizeV0 = 48; // size of our structure in bytes (without the sequence number)
+    const std::size_t blobSizeV1 = 52; // size of our structure in bytes
+
+    // version 0 blobs lack the sequence number, which follows the identifier
+    const std::size_t blobSizeV0Head = 44;
+    const std::size_t blobSizeV0Tail = blobSizeV0-blobSizeV0Head;
+
+    void LoadBlobV0(portable_binary_iarchive &ar, I3CLSimStep *steps, std::size_t num)
+    {
+        std::vector<char> blob(blobSizeV0*num);
+        if (num>0) ar >> make_nvp("blob", boost::serialization::make_binary_object(&(blob[0]), blobSizeV0*num));
+
+        for (std::size_t i=0;i<num;++i)
+        {
+            char *step = reinterpret_cast<char *>(&(steps[i]));
+            std::memcpy(step, &(blob[i*blobSizeV0]), blobSizeV0Head);
+            std::memcpy(step+blobSizeV0Head+sizeof(cl_uint), &(blob[i*blobSizeV0+blobSizeV0Head]), blobSizeV0Tail);
+            steps[i].SetSequenceNumber(0);
+        }
+    }
 }
 
 I3CLSimStep::~I3CLSimStep() { }
@@ -56,6 +78,7 @@ void I3CLSimStep::save(Archive &ar, unsigned version) const
     ar << make_nvp("num", numPhotons);
     ar << make_nvp("weight", weight);
     ar << make_nvp("id", identifier);
+    ar << make_nvp("sequenceNumber", sequenceNumber);
 
     ar << make_nvp("sourceType", sourceType);
     ar << make_nvp("dummy1", dummy1);
@@ -84,6 +107,11 @@ void I3CLSimStep::load(Archive &ar, unsigned version)
     ar >> make_nvp("num", temp_uint); numPhotons=temp_uint;
     ar >> make_nvp("weight", temp); weight=temp;
     ar >> make_nvp("id", temp_uint); identifier=temp_uint;
+    if (version >= 1) {
+        ar >> make_nvp("sequenceNumber", temp_uint); sequenceNumber=temp_uint;
+    } else {
+        sequenceNumber=0;
+    }
     ar >> make_nvp("sourceType", temp_uint8); sourceType=temp_uint8;
     ar >> make_nvp("dummy1", temp_uint8); dummy1=temp_uint8;
     ar >> make_nvp("dummy2", temp_uint16); dummy2=temp_uint16;
@@ -98,9 +126,9 @@ template <>
 void I3CLSimStep::save(portable_binary_oarchive &ar, unsigned version) const
 {
     // check an assumption we will make throughout the code
-    BOOST_STATIC_ASSERT((sizeof(I3CLSimStep) == blobSizeV0));
+    BOOST_STATIC_ASSERT((sizeof(I3CLSimStep) == blobSizeV1));
 
-    ar << make_nvp("blob", boost::serialization::make_binary_object((void *)this, blobSizeV0));
+    ar << make_nvp("blob", boost::serialization::make_binary_object((void *)this, blobSizeV1));
 }
 
 template <>
@@ -110,9 +138,13 @@ void I3CLSimStep::load(portable_binary_iarchive &ar, unsigned version)
         log_fatal("Attempting to read version %u from file but running version %u of I3CLSimStep class.",version,i3clsimstep_version_);
 
     // check an assumption we will make throughout the code
-    BOOST_STATIC_ASSERT((sizeof(I3CLSimStep) == blobSizeV0));
+    BOOST_STATIC_ASSERT((sizeof(I3CLSimStep) == blobSizeV1));
 
-    ar >> make_nvp("blob", boost::serialization::make_binary_object(this, blobSizeV0));
+    if (version == 0) {
+        LoadBlobV0(ar, this, 1);
+    } else {
+        ar >> make_nvp("blob", boost::serialization::make_binary_object(this, blobSizeV1));
+    }
 }
 
 template<>
@@ -122,15 +154,20 @@ void I3Vector<I3CLSimStep>::serialize(portable_binary_iarchive &ar, unsigned ver
     ar >> make_nvp("I3FrameObject", base_object<I3FrameObject>(*this));
     unsigned I3CLSimStep_version;
     ar >> make_nvp("I3CLSimStep_version", I3CLSimStep_version);
-    if (I3CLSimStep_version != i3clsimstep_version_)
-        log_fatal("This reader can only read I3Vector<I3CLSimStep> version %u, but %u was provided.",i3clsimstep_version_,I3CLSimStep_version);
+    if (I3CLSimStep_version > i3clsimstep_version_)
+        log_fatal("This reader can only read I3Vector<I3CLSimStep> up to version %u, but %u was provided.",i3clsimstep_version_,I3CLSimStep_version);
     uint64_t size;
     ar >> make_nvp("num", size);
 
     this->resize(size);
 
+    if (I3CLSimStep_version == 0) {
+        LoadBlobV0(ar, size>0 ? &((*this)[0]) : NULL, size);
+        return;
+    }
+
     // read the binary blob in one go..
-    ar >> make_nvp("blob", boost::serialization::make_binary_object( &((*this)[0]), blobSizeV0*size));
+    ar >> make_nvp("blob", boost::serialization::make_binary_object( &((*this)[0]), blobSizeV1*size));
 }
 
 template<>
@@ -141,7 +178,7 @@ void I3Vector<I3CLSimStep>::serialize(portable_binary_oarchive &ar, unsigned ver
     ar << make_nvp("I3CLSimStep_version", i3clsimstep_version_);
     uint64_t size = this->size();
     ar << make_nvp("num", size);
-    ar << make_nvp("blob", boost::serialization::make_binary_object( &((*this)[0]), blobSizeV0*size ));
+    ar << make_nvp("blob", boost::serialization::make_binary_object( &((*this)[0]), blobSizeV1*size ));
 }
 
 
@@ -0,0 +1,230 @@
+/**
+ * Copyright (c) 2018
+ * the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * @file I3CLSimStepBunchScheduler.cxx
+ */
+
+#include "icetray/I3Logging.h"
+
+#include "clsim/I3CLSimStepBunchScheduler.h"
+
+#include <algorithm>
+
+const double I3CLSimStepBunchScheduler::default_smoothingFactor=0.5;
+
+I3CLSimStepBunchScheduler::I3CLSimStepBunchScheduler(std::size_t numConverters)
+:
+useThroughput_(true),
+smoothingFactor_(default_smoothingFactor),
+lastIndex_(0),
+assignedPhotons_(numConverters, 0),
+photonsPerSecond_(numConverters, 0.),
+lastTotalNumPhotons_(numConverters, 0),
+lastTotalBusyTime_(numConverters, 0.)
+{
+    if (numConverters==0)
+        log_fatal("I3CLSimStepBunchScheduler needs at least one converter.");
+}
+
+std::size_t I3CLSimStepBunchScheduler::GetNumConverters() const
+{
+    return assignedPhotons_.size();
+}
+
+void I3CLSimStepBunchScheduler::SetUseThroughput(bool value)
+{
+    useThroughput_=value;
+}
+
+bool I3CLSimStepBunchScheduler::GetUseThroughput() const
+{
+    return useThroughput_;
+}
+
+void I3CLSimStepBunchScheduler::SetSmoothingFactor(double value)
+{
+    if ((value <= 0.) || (value > 1.))
+        log_fatal("The smoothing factor must be in (0,1], got %f.", value);
+
+    smoothingFactor_=value;
+}
+
+double I3CLSimStepBunchScheduler::GetSmoothingFactor() const
+{
+    return smoothingFactor_;
+}
+
+void I3CLSimStepBunchScheduler::StartRound()
+{
+    assignedPhotons_.assign(assignedPhotons_.size(), 0);
+}
+
+std::size_t I3CLSimStepBunchScheduler::Assign(uint64_t numPhotons, const std::vector<std::size_t> &queueSizes)
+{
+    if (queueSizes.size() != assignedPhotons_.size())
+        log_fatal("Got %zu queue sizes for %zu converters.",
+                  queueSizes.size(), assignedPhotons_.size());
+
+    std::size_t index;
+
+    if ((!useThroughput_) || (!HasThroughputEstimates()))
+    {
+        index = AssignRoundRobin(queueSizes);
+    }
+    else
+    {
+        // Choose the converter that finishes this bunch first.
+        // Start searching after the last converter used, so
+        // identical converters take turns.
+        index = lastIndex_;
+        double bestTime = -1.;
+        for (std::size_t n=0;n<assignedPhotons_.size();++n)
+        {
+            std::size_t i = lastIndex_+1+n;
+            if (i>=assignedPhotons_.size()) i-=assignedPhotons_.size();
+
+            const double completionTime =
+                static_cast<double>(assignedPhotons_[i]+numPhotons)/EffectivePhotonsPerSecond(i);
+
+            if ((bestTime < 0.) || (completionTime < bestTime))
+            {
+                bestTime=completionTime;
+                index=i;
+            }
+        }
+    }
+
+    lastIndex_=index;
+    assignedPhotons_[index]+=numPhotons;
+
+    return index;
+}
+
+void I3CLSimStepBunchScheduler::Release(std::size_t converterIndex, uint64_t numPhotons)
+{
+    if (converterIndex >= assignedPhotons_.size())
+        log_fatal("Invalid converter index %zu.", converterIndex);
+
+    // a new round may have started in the meantime
+    assignedPhotons_[converterIndex] -= std::min(numPhotons, assignedPhotons_[converterIndex]);
+}
+
+std::size_t I3CLSimStepBunchScheduler::AssignRoundRobin(const std::vector<std::size_t> &queueSizes)
+{
+    std::size_t minimumQueueSize = queueSizes[0];
+    for (std::size_t i=1;i<queueSizes.size();++i)
+    {
+        if (queueSizes[i] < minimumQueueSize)
+        {
+            minimumQueueSize=queueSizes[i];
+        }
+    }
+
+    std::size_t index=lastIndex_;
+    do {
+        ++index;
+        if (index>=queueSizes.size()) index=0;
+    } while (queueSizes[index] != minimumQueueSize);
+
+    return index;
+}
+
+void I3CLSimStepBunchScheduler::SetCumulativeStatistics(std::size_t converterIndex, uint64_t totalNumPhotons, double totalBusyTime)
+{
+    if (converterIndex >= photonsPerSecond_.size())
+        log_fatal("Invalid converter index %zu.", converterIndex);
+
+    // the statistics may have been reset
+    if ((totalNumPhotons < lastTotalNumPhotons_[converterIndex]) ||
+        (totalBusyTime < lastTotalBusyTime_[converterIndex]))
+    {
+        lastTotalNumPhotons_[converterIndex]=0;
+        lastTotalBusyTime_[converterIndex]=0.;
+    }
+
+    const uint64_t numPhotons = totalNumPhotons - lastTotalNumPhotons_[converterIndex];
+    const double busyTime = totalBusyTime - lastTotalBusyTime_[converterIndex];
+
+    if ((numPhotons == 0) || (busyTime <= 0.)) return;
+
+    lastTotalNumPhotons_[converterIndex]=totalNumPhotons;
+    lastTotalBusyTime_[converterIndex]=totalBusyTime;
+
+    const double measurement = static_cast<double>(numPhotons)/busyTime;
+
+    double &estimate = photonsPerSecond_[converterIndex];
+    if (estimate <= 0.) {
+        estimate = measurement;
+    } else {
+        estimate = smoothingFactor_*measurement + (1.-smoothingFactor_)*estimate;
+    }
+
+    log_trace("converter %zu: %g photons/s (measured %g photons/s)",
+              converterIndex, estimate, measurement);
+}
+
+bool I3CLSimStepBunchScheduler::HasThroughputEstimates() const
+{
+    for (std::size_t i=0;i<photonsPerSecond_.size();++i)
+    {
+        if (photonsPerSecond_[i] > 0.) return true;
+    }
+    return false;
+}
+
+double I3CLSimStepBunchScheduler::GetPhotonsPerSecond(std::size_t converterIndex) const
+{
+    if (converterIndex >= photonsPerSecond_.size())
+        log_fatal("Invalid converter index %zu.", converterIndex);
+
+    return photonsPerSecond_[converterIndex];
+}
+
+uint64_t I3CLSimStepBunchScheduler::GetAssignedPhotons(std::size_t converterIndex) const
+{
+    if (converterIndex >= assignedPhotons_.size())
+        log_fatal("Invalid converter index %zu.", converterIndex);
+
+    return assignedPhotons_[converterIndex];
+}
+
+double I3CLSimStepBunchScheduler::GetPredictedCompletionTime(std::size_t converterIndex) const
+{
+    if (converterIndex >= assignedPhotons_.size())
+        log_fatal("Invalid converter index %zu.", converterIndex);
+
+    if (!HasThroughputEstimates()) return 0.;
+
+    return static_cast<double>(assignedPhotons_[converterIndex])/EffectivePhotonsPerSecond(converterIndex);
+}
+
+double I3CLSimStepBunchScheduler::EffectivePhotonsPerSecond(std::size_t converterIndex) const
+{
+    if (photonsPerSecond_[converterIndex] > 0.) return photonsPerSecond_[converterIndex];
+
+    double sum=0.;
+    std::size_t num=0;
+    for (std::size_t i=0;i<photonsPerSecond_.size();++i)
+    {
+        if (photonsPerSecond_[i] <= 0.) continue;
+        sum += photonsPerSecond_[i];
+        ++num;
+    }
+
+    // only called if there is at least one estimate
+    return sum/static_cast<double>(num);
+}
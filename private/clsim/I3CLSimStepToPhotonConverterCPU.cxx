@@ -0,0 +1,1011 @@
+/**
+ * Copyright (c) 2018
+ * the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * @file I3CLSimStepToPhotonConverterCPU.cxx
+ */
+
+#include <icetray/I3Units.h>
+#include <dataclasses/I3Constants.h>
+#include <dataclasses/I3Direction.h>
+
+#include "clsim/I3CLSimStepToPhotonConverterCPU.h"
+
+#include "phys-services/I3GSLRandomService.h"
+
+#include "clsim/function/I3CLSimVectorTransform.h"
+
+#include "opencl/I3CLSimHelperGenerateHoleIceCylinderGrid.h"
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <cmath>
+#include <limits>
+#include <map>
+#include <algorithm>
+#include <iostream>
+
+// The medium propagation of the OpenCL kernel, compiled for the host.
+//
+// The kernel library in resources/kernels/lib/ is plain C with a few
+// OpenCL-isms that are provided here, like in the host unit tests
+// (see resources/kernels/lib/hole_ice/medium_changes_test.h). The
+// medium is not known at compile time, so the MEDIUM_* constants and
+// the length functions read it from a `medium` argument that is passed
+// along through MEDIUM_ARGS.
+//
+namespace {
+    namespace kernel {
+        typedef double floating_t;
+
+        struct floating4_t {
+            floating_t x;
+            floating_t y;
+            floating_t z;
+            floating_t w;
+        };
+
+        struct Medium_t {
+            int numLayers;
+            floating_t layerThickness;
+            floating_t layerBottomPos;
+            std::vector<const I3CLSimFunction *> scatteringLengths;
+            std::vector<const I3CLSimFunction *> absorptionLengths;
+        };
+
+        // On the host, there are no separate address spaces.
+        #define HOLE_ICE_MEMORY
+
+        #define MEDIUM_ARGS const Medium_t *medium,
+        #define MEDIUM_ARGS_TO_CALL medium,
+
+        #define ZERO 0.0
+        #define ONE 1.0
+
+        #define MEDIUM_LAYERS (medium->numLayers)
+        #define MEDIUM_LAYER_THICKNESS (medium->layerThickness)
+        #define MEDIUM_LAYER_BOTTOM_POS (medium->layerBottomPos)
+
+        inline floating_t my_sqrt(floating_t a) {return std::sqrt(a);}
+        inline floating_t sqr(floating_t a) {return a * a;}
+        inline floating_t my_nan() {return std::numeric_limits<floating_t>::quiet_NaN();}
+        inline bool my_is_nan(floating_t a) {return (a != a);}
+        inline int min(int a, int b) {return std::min(a, b);}
+        inline int max(int a, int b) {return std::max(a, b);}
+        inline floating_t min(floating_t a, floating_t b) {return std::min(a, b);}
+        inline floating_t max(floating_t a, floating_t b) {return std::max(a, b);}
+        inline floating_t dot(floating4_t a, floating4_t b)
+        {
+            return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+        }
+        inline floating_t my_divide(floating_t a, floating_t b) {return a / b;}
+        inline floating_t my_fabs(floating_t a) {return std::fabs(a);}
+
+        // same as in propagation_kernel.c.cl
+        inline int findLayerForGivenZPos(MEDIUM_ARGS floating_t posZ)
+        {
+            return static_cast<int>((posZ - MEDIUM_LAYER_BOTTOM_POS) / MEDIUM_LAYER_THICKNESS);
+        }
+        inline floating_t mediumLayerBoundary(MEDIUM_ARGS int layer)
+        {
+            return static_cast<floating_t>(layer) * MEDIUM_LAYER_THICKNESS + MEDIUM_LAYER_BOTTOM_POS;
+        }
+        inline floating_t getScatteringLength(MEDIUM_ARGS unsigned int layer, floating_t wlen)
+        {
+            return medium->scatteringLengths[layer]->GetValue(wlen);
+        }
+        inline floating_t getAbsorptionLength(MEDIUM_ARGS unsigned int layer, floating_t wlen)
+        {
+            return medium->absorptionLengths[layer]->GetValue(wlen);
+        }
+
+        #define HOLE_ICE
+        #include "../../resources/kernels/lib/propagation_through_media/propagation_through_media.c"
+        #undef HOLE_ICE
+
+        #undef MEDIUM_LAYER_BOTTOM_POS
+        #undef MEDIUM_LAYER_THICKNESS
+        #undef MEDIUM_LAYERS
+        #undef ONE
+        #undef ZERO
+        #undef MEDIUM_ARGS_TO_CALL
+        #undef MEDIUM_ARGS
+        #undef HOLE_ICE_MEMORY
+    }
+}
+
+struct I3CLSimStepToPhotonConverterCPU::WorkerContext_t
+{
+    kernel::Medium_t medium;
+
+    // hole ice cylinders in the layout of the kernel arguments (HOLE_ICE_ARGS)
+    unsigned int numberOfCylinders;
+    std::vector<kernel::floating4_t> cylinderPositionsAndRadii;
+    std::vector<kernel::floating_t> cylinderScatteringLengths;
+    std::vector<kernel::floating_t> cylinderAbsorptionLengths;
+    kernel::HoleIceCylinderGrid_t cylinderGrid;
+    std::vector<unsigned int> cylinderGridCellStartIndices;
+    std::vector<unsigned int> cylinderGridCylinderIndices;
+};
+
+namespace {
+    // see I3CLSimHelper::GenerateMediumPropertiesSource
+    double GetGroupVelocity(const I3CLSimMediumProperties &mediumProperties, double wlen)
+    {
+        const I3CLSimFunctionConstPtr groupRefIndex = mediumProperties.GetGroupRefractiveIndexOverride(0);
+        if (groupRefIndex) return I3Constants::c / groupRefIndex->GetValue(wlen);
+
+        const I3CLSimFunctionConstPtr phaseRefIndex = mediumProperties.GetPhaseRefractiveIndex(0);
+        const double n_inv = 1./phaseRefIndex->GetValue(wlen);
+        const double y = phaseRefIndex->GetDerivative(wlen);
+
+        return I3Constants::c * (1. + y*wlen*n_inv) * n_inv;
+    }
+
+    // see scatterDirectionByAngle() in propagation_kernel.c.cl
+    inline void ScatterDirectionByAngle(double cosa, double sina,
+                                        kernel::floating4_t &direction,
+                                        double randomNumber)
+    {
+        const double b = 2.*M_PI*randomNumber;
+        const double cosb = std::cos(b);
+        const double sinb = std::sin(b);
+
+        const double sinth = std::sqrt(std::max(0., 1.-direction.z*direction.z));
+
+        if (sinth > 0.) {
+            const kernel::floating4_t oldDir = direction;
+
+            direction.x = oldDir.x*cosa-((oldDir.y*cosb+oldDir.z*oldDir.x*sinb)*sina)/sinth;
+            direction.y = oldDir.y*cosa+((oldDir.x*cosb-oldDir.z*oldDir.y*sinb)*sina)/sinth;
+            direction.z = oldDir.z*cosa+sina*sinb*sinth;
+        } else {
+            direction.x = sina*cosb;
+            direction.y = sina*sinb;
+            direction.z = (direction.z < 0.) ? -cosa : cosa;
+        }
+
+        const double recip_length = 1./std::sqrt(direction.x*direction.x + direction.y*direction.y + direction.z*direction.z);
+        direction.x *= recip_length;
+        direction.y *= recip_length;
+        direction.z *= recip_length;
+    }
+
+    inline void TransformDirection(const I3CLSimVectorTransform &transform, kernel::floating4_t &direction)
+    {
+        std::vector<double> vec(3);
+        vec[0] = direction.x;
+        vec[1] = direction.y;
+        vec[2] = direction.z;
+
+        vec = transform.ApplyTransform(vec);
+
+        direction.x = vec[0];
+        direction.y = vec[1];
+        direction.z = vec[2];
+    }
+
+    inline double UniformCO(I3RandomService &rng) {return rng.Uniform();}
+    inline double UniformOC(I3RandomService &rng) {return 1.-rng.Uniform();}
+
+    // a simple 64 bit mixing function (splitmix64)
+    inline uint64_t MixSeed(uint64_t x)
+    {
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+}
+
+const std::size_t I3CLSimStepToPhotonConverterCPU::default_maxNumWorkitems=10240;
+const std::size_t I3CLSimStepToPhotonConverterCPU::default_numStepsPerChunk=64;
+
+I3CLSimStepToPhotonConverterCPU::I3CLSimStepToPhotonConverterCPU(I3RandomServicePtr randomService)
+:
+randomService_(randomService),
+randomSeed_(0),
+numBunchesEnqueued_(0),
+initialized_(false),
+numThreads_(0),
+maxNumWorkitems_(default_maxNumWorkitems),
+numStepsPerChunk_(default_numStepsPerChunk),
+stopDetectedPhotons_(false),
+pancakeFactor_(1.),
+simulateHoleIce_(false),
+omRadius_(NAN),
+statistics_total_num_photons_generated_(0),
+statistics_total_num_photons_atDOMs_(0),
+statistics_total_conversion_time_(0.)
+{
+    if (!randomService_) log_fatal("You need to supply a I3RandomService.");
+}
+
+I3CLSimStepToPhotonConverterCPU::~I3CLSimStepToPhotonConverterCPU()
+{
+    if (!workerThreads_.empty())
+    {
+        log_debug("Stopping the worker threads..");
+
+        BOOST_FOREACH(boost::shared_ptr<boost::thread> &thread, workerThreads_)
+        {
+            thread->interrupt();
+        }
+        BOOST_FOREACH(boost::shared_ptr<boost::thread> &thread, workerThreads_)
+        {
+            if (thread->joinable()) thread->join(); // wait for it indefinitely
+        }
+        workerThreads_.clear();
+
+        log_debug("Worker threads stopped.");
+    }
+}
+
+void I3CLSimStepToPhotonConverterCPU::Initialize()
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    if (wlenGenerators_.empty())
+        throw I3CLSimStepToPhotonConverter_exception("WlenGenerators not set!");
+
+    if (!wlenBias_)
+        throw I3CLSimStepToPhotonConverter_exception("WlenBias not set!");
+
+    if (!mediumProperties_)
+        throw I3CLSimStepToPhotonConverter_exception("MediumProperties not set!");
+
+    if (!geometry_)
+        throw I3CLSimStepToPhotonConverter_exception("Geometry not set!");
+
+    for (uint32_t i=0;i<mediumProperties_->GetLayersNum();++i)
+    {
+        if ((!mediumProperties_->GetScatteringLength(i)) ||
+            (!mediumProperties_->GetAbsorptionLength(i)) ||
+            (!mediumProperties_->GetPhaseRefractiveIndex(i)))
+            throw I3CLSimStepToPhotonConverter_exception("Medium properties are not set for all layers!");
+    }
+
+    if (!mediumProperties_->GetScatteringCosAngleDistribution())
+        throw I3CLSimStepToPhotonConverter_exception("Scattering angle distribution is not set!");
+
+    if ((!mediumProperties_->GetPreScatterDirectionTransform()) ||
+        (!mediumProperties_->GetPostScatterDirectionTransform()))
+        throw I3CLSimStepToPhotonConverter_exception("Scattering direction transformations are not set!");
+
+    if (simulateHoleIce_)
+    {
+        const std::size_t numberOfCylinders = holeIceCylinderPositions_.size();
+        if ((holeIceCylinderRadii_.size() != numberOfCylinders) ||
+            (holeIceCylinderScatteringLengths_.size() != numberOfCylinders) ||
+            (holeIceCylinderAbsorptionLengths_.size() != numberOfCylinders))
+            throw I3CLSimStepToPhotonConverter_exception("The hole ice cylinder vectors need to have the same size!");
+    }
+
+    BuildStringList();
+
+    // All random number streams are derived from this seed.
+    randomSeed_ = (static_cast<uint64_t>(randomService_->Integer(std::numeric_limits<uint32_t>::max())) << 32)
+                | static_cast<uint64_t>(randomService_->Integer(std::numeric_limits<uint32_t>::max()));
+
+    if (numThreads_==0) numThreads_ = boost::thread::hardware_concurrency();
+    if (numThreads_==0) numThreads_ = 1;
+
+    // keep a few chunks per thread ready, EnqueueSteps() blocks beyond that
+    queueToWorkers_ = boost::shared_ptr<I3CLSimLockFreeQueue<Chunk_t> >(new I3CLSimLockFreeQueue<Chunk_t>(numThreads_*4));
+    pendingBunches_ = boost::shared_ptr<I3CLSimQueue<BunchPtr> >(new I3CLSimQueue<BunchPtr>(0));
+
+    log_info("Starting %zu worker threads for the CPU photon propagation.", numThreads_);
+
+    for (std::size_t i=0;i<numThreads_;++i)
+    {
+        workerThreads_.push_back(boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&I3CLSimStepToPhotonConverterCPU::WorkerThread, this))));
+    }
+
+    initialized_=true;
+}
+
+void I3CLSimStepToPhotonConverterCPU::BuildStringList()
+{
+    omRadius_ = geometry_->GetOMRadius();
+
+    std::map<int32_t, std::vector<std::size_t> > domsPerString;
+    for (std::size_t i=0;i<geometry_->size();++i)
+    {
+        domsPerString[geometry_->GetStringID(i)].push_back(i);
+    }
+
+    strings_.clear();
+    for (std::map<int32_t, std::vector<std::size_t> >::const_iterator it=domsPerString.begin();
+         it!=domsPerString.end(); ++it)
+    {
+        const std::vector<std::size_t> &doms = it->second;
+
+        // sort the DOMs by z
+        std::vector<std::pair<double, std::size_t> > sortedDoms;
+        BOOST_FOREACH(std::size_t i, doms)
+        {
+            sortedDoms.push_back(std::make_pair(geometry_->GetPosZ(i), i));
+        }
+        std::sort(sortedDoms.begin(), sortedDoms.end());
+
+        String_t string;
+        string.posX = 0.;
+        string.posY = 0.;
+        for (std::size_t j=0;j<sortedDoms.size();++j)
+        {
+            const std::size_t i = sortedDoms[j].second;
+
+            string.domPosX.push_back(geometry_->GetPosX(i));
+            string.domPosY.push_back(geometry_->GetPosY(i));
+            string.domPosZ.push_back(geometry_->GetPosZ(i));
+            string.stringIDs.push_back(static_cast<int16_t>(geometry_->GetStringID(i)));
+            string.domIDs.push_back(static_cast<uint16_t>(geometry_->GetDomID(i)));
+
+            string.posX += geometry_->GetPosX(i);
+            string.posY += geometry_->GetPosY(i);
+        }
+        string.posX /= static_cast<double>(sortedDoms.size());
+        string.posY /= static_cast<double>(sortedDoms.size());
+        string.minZ = string.domPosZ.front();
+        string.maxZ = string.domPosZ.back();
+
+        string.maxRadius = 0.;
+        for (std::size_t j=0;j<string.domPosX.size();++j)
+        {
+            const double r = std::sqrt((string.domPosX[j]-string.posX)*(string.domPosX[j]-string.posX) +
+                                       (string.domPosY[j]-string.posY)*(string.domPosY[j]-string.posY));
+            string.maxRadius = std::max(string.maxRadius, r);
+        }
+        string.maxRadius += omRadius_;
+
+        strings_.push_back(string);
+    }
+
+    log_debug("Geometry has %zu DOMs on %zu strings.", geometry_->size(), strings_.size());
+}
+
+void I3CLSimStepToPhotonConverterCPU::WorkerThread()
+{
+    // do not interrupt this thread by default
+    boost::this_thread::disable_interruption di;
+
+    try {
+        WorkerThread_impl(di);
+    } catch(...) { // any exceptions?
+        std::cerr << "CPU photon propagation worker thread died unexpectedly.." << std::endl;
+        exit(0); // get out as quickly as possible, we probably just had a FATAL error anyway..
+        throw; // will never be reached
+    }
+}
+
+void I3CLSimStepToPhotonConverterCPU::WorkerThread_impl(boost::this_thread::disable_interruption &di)
+{
+    // Set up the medium and the hole ice for the kernel library.
+    WorkerContext_t context;
+
+    context.medium.numLayers = static_cast<int>(mediumProperties_->GetLayersNum());
+    context.medium.layerThickness = mediumProperties_->GetLayersHeight();
+    context.medium.layerBottomPos = mediumProperties_->GetLayersZStart();
+    for (uint32_t i=0;i<mediumProperties_->GetLayersNum();++i)
+    {
+        context.medium.scatteringLengths.push_back(mediumProperties_->GetScatteringLength(i).get());
+        context.medium.absorptionLengths.push_back(mediumProperties_->GetAbsorptionLength(i).get());
+    }
+
+    context.numberOfCylinders = 0;
+    context.cylinderGrid.startX = 0.;
+    context.cylinderGrid.startY = 0.;
+    context.cylinderGrid.widthX = 1.;
+    context.cylinderGrid.widthY = 1.;
+    context.cylinderGrid.numX = 1;
+    context.cylinderGrid.numY = 1;
+    context.cylinderGrid.maxRadius = 0.;
+    if ((simulateHoleIce_) && (!holeIceCylinderPositions_.empty()))
+    {
+        context.numberOfCylinders = holeIceCylinderPositions_.size();
+        for (std::size_t i=0;i<holeIceCylinderPositions_.size();++i)
+        {
+            const kernel::floating4_t positionAndRadius = {
+                holeIceCylinderPositions_[i].GetX(),
+                holeIceCylinderPositions_[i].GetY(),
+                holeIceCylinderPositions_[i].GetZ(),
+                holeIceCylinderRadii_[i]};
+            context.cylinderPositionsAndRadii.push_back(positionAndRadius);
+            context.cylinderScatteringLengths.push_back(holeIceCylinderScatteringLengths_[i]);
+            context.cylinderAbsorptionLengths.push_back(holeIceCylinderAbsorptionLengths_[i]);
+        }
+
+        const I3CLSimHelper::HoleIceCylinderGrid grid =
+            I3CLSimHelper::GenerateHoleIceCylinderGrid(holeIceCylinderPositions_, holeIceCylinderRadii_);
+        context.cylinderGrid.startX = grid.startX;
+        context.cylinderGrid.startY = grid.startY;
+        context.cylinderGrid.widthX = grid.widthX;
+        context.cylinderGrid.widthY = grid.widthY;
+        context.cylinderGrid.numX = grid.numX;
+        context.cylinderGrid.numY = grid.numY;
+        context.cylinderGrid.maxRadius = grid.maxRadius;
+        context.cylinderGridCellStartIndices = grid.cellStartIndices;
+        context.cylinderGridCylinderIndices = grid.cylinderIndices;
+    }
+
+    for (;;)
+    {
+        Chunk_t chunk;
+
+        {
+            boost::this_thread::restore_interruption ri(di);
+            try {
+                chunk = queueToWorkers_->Get();
+            } catch(boost::thread_interrupted &i) {
+                log_debug("CPU worker thread was interrupted. closing.");
+                return;
+            }
+        }
+
+        I3CLSimPhotonSeries photons;
+        const boost::posix_time::ptime startTime =
+            boost::posix_time::microsec_clock::universal_time();
+        ConvertChunk(chunk, context, photons);
+        const boost::posix_time::time_duration conversionTime =
+            boost::posix_time::microsec_clock::universal_time() - startTime;
+
+        {
+            boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+            statistics_total_conversion_time_ +=
+                static_cast<double>(conversionTime.total_microseconds())*1e-6;
+        }
+
+        {
+            boost::unique_lock<boost::mutex> guard(chunk.bunch->mutex);
+            chunk.bunch->photonsPerChunk[chunk.index].swap(photons);
+            --chunk.bunch->numChunksLeft;
+        }
+        chunk.bunch->finished.notify_all();
+    }
+}
+
+// This follows the propagation kernel (propagation_kernel.c.cl)
+// with STOP_PHOTONS_ON_DETECTION as configured, and without
+// SAVE_ALL_PHOTONS, SAVE_PHOTON_HISTORY and TABULATE.
+void I3CLSimStepToPhotonConverterCPU::ConvertChunk(const Chunk_t &chunk,
+                                                   const WorkerContext_t &context,
+                                                   I3CLSimPhotonSeries &photons)
+{
+    using kernel::floating4_t;
+
+    const double EPSILON = 0.00000001;
+    const double speedOfLight = I3Constants::c; // [m/ns]
+
+    // every chunk has its own random number stream
+    const uint64_t seed = MixSeed(MixSeed(randomSeed_ ^ chunk.bunch->sequenceNumber) ^ static_cast<uint64_t>(chunk.index));
+    I3RandomServicePtr rngPtr(new I3GSLRandomService(static_cast<unsigned long>(seed)));
+    I3RandomService &rng = *rngPtr;
+
+    const std::vector<double> noParameters;
+    const I3CLSimRandomValue &scatteringCosAngleDistribution = *(mediumProperties_->GetScatteringCosAngleDistribution());
+    const I3CLSimVectorTransformConstPtr preScatterDirectionTransform = mediumProperties_->GetPreScatterDirectionTransform();
+    const I3CLSimVectorTransformConstPtr postScatterDirectionTransform = mediumProperties_->GetPostScatterDirectionTransform();
+
+    const floating4_t *cylinderPositionsAndRadii = context.cylinderPositionsAndRadii.empty() ? NULL : &(context.cylinderPositionsAndRadii[0]);
+    const double *cylinderScatteringLengths = context.cylinderScatteringLengths.empty() ? NULL : &(context.cylinderScatteringLengths[0]);
+    const double *cylinderAbsorptionLengths = context.cylinderAbsorptionLengths.empty() ? NULL : &(context.cylinderAbsorptionLengths[0]);
+    const unsigned int *cylinderGridCellStartIndices = context.cylinderGridCellStartIndices.empty() ? NULL : &(context.cylinderGridCellStartIndices[0]);
+    const unsigned int *cylinderGridCylinderIndices = context.cylinderGridCylinderIndices.empty() ? NULL : &(context.cylinderGridCylinderIndices[0]);
+
+    uint64_t numPhotonsGenerated = 0;
+
+    // hits on a single propagation step:
+    // (distance, index into strings_, index of the DOM on the string)
+    std::vector<boost::tuple<double, std::size_t, std::size_t> > hits;
+
+    for (std::size_t stepIndex=chunk.firstStep; stepIndex<chunk.firstStep+chunk.numSteps; ++stepIndex)
+    {
+        const I3CLSimStep &step = (*(chunk.bunch->steps))[stepIndex];
+
+        const double stepTheta = step.GetDirTheta();
+        const double stepPhi = step.GetDirPhi();
+        const floating4_t stepDir = {
+            std::sin(stepTheta)*std::cos(stepPhi),
+            std::sin(stepTheta)*std::sin(stepPhi),
+            std::cos(stepTheta),
+            0.};
+
+        numPhotonsGenerated += step.GetNumPhotons();
+
+        for (uint32_t photonIndex=0; photonIndex<step.GetNumPhotons(); ++photonIndex)
+        {
+            // create a new photon (see createPhotonFromTrack())
+            floating4_t photonPosAndTime;
+            floating4_t photonDirAndWlen;
+            {
+                const double shiftMultiplied = step.GetLength()*UniformCO(rng);
+                const double inverseParticleSpeed = 1./(speedOfLight*step.GetBeta());
+
+                photonPosAndTime.x = step.GetPosX()+stepDir.x*shiftMultiplied;
+                photonPosAndTime.y = step.GetPosY()+stepDir.y*shiftMultiplied;
+                photonPosAndTime.z = step.GetPosZ()+stepDir.z*shiftMultiplied;
+                photonPosAndTime.w = step.GetTime()+inverseParticleSpeed*shiftMultiplied;
+
+                photonDirAndWlen = stepDir;
+
+                if (step.GetSourceType() == 0) {
+                    // Cherenkov light with the correct angle w.r.t. the particle/step
+                    const int layer = std::min(std::max(kernel::findLayerForGivenZPos(&context.medium, photonPosAndTime.z), 0), context.medium.numLayers-1);
+
+                    const double wavelength = wlenGenerators_[0]->SampleFromDistribution(rngPtr, noParameters);
+                    const double cosCherenkov = std::min(1., 1./(step.GetBeta()*mediumProperties_->GetPhaseRefractiveIndex(layer)->GetValue(wavelength)));
+                    const double sinCherenkov = std::sqrt(1.-cosCherenkov*cosCherenkov);
+
+                    photonDirAndWlen.w = wavelength;
+                    ScatterDirectionByAngle(cosCherenkov, sinCherenkov, photonDirAndWlen, UniformCO(rng));
+                } else {
+                    // flasher emissions do not need Cherenkov rotation
+                    if (step.GetSourceType() >= wlenGenerators_.size())
+                        log_fatal("Step with source type %u, but there are only %zu wavelength generators.",
+                                  static_cast<unsigned int>(step.GetSourceType()), wlenGenerators_.size());
+
+                    photonDirAndWlen.w = wlenGenerators_[step.GetSourceType()]->SampleFromDistribution(rngPtr, noParameters);
+                }
+            }
+
+            const floating4_t photonStartPosAndTime = photonPosAndTime;
+            const floating4_t photonStartDirAndWlen = photonDirAndWlen;
+            uint32_t photonNumScatters = 0;
+            double photonTotalPathLength = 0.;
+
+            const double inv_groupvel = 1./GetGroupVelocity(*mediumProperties_, photonDirAndWlen.w);
+
+            // the photon needs a lifetime (in units of absorption lengths)
+            const double abs_lens_initial = -std::log(UniformOC(rng));
+            double abs_lens_left = abs_lens_initial;
+
+            while (abs_lens_left >= EPSILON)
+            {
+                double sca_step_left = -std::log(UniformOC(rng));
+
+                double distancePropagated = 0.;
+                double distanceToAbsorption = 0.;
+
+                kernel::apply_propagation_through_different_media(
+                    &context.medium,
+                    photonPosAndTime,
+                    photonDirAndWlen,
+                    context.numberOfCylinders,
+                    cylinderPositionsAndRadii,
+                    cylinderScatteringLengths,
+                    cylinderAbsorptionLengths,
+                    context.cylinderGrid,
+                    cylinderGridCellStartIndices,
+                    cylinderGridCylinderIndices,
+                    &sca_step_left,
+                    &abs_lens_left,
+                    &distancePropagated,
+                    &distanceToAbsorption);
+
+                // Check for collisions on the way (see checkForCollision_OnString()).
+                // With stopDetectedPhotons_, only the closest hit is recorded and the
+                // photon is stopped there. Otherwise, all hits are recorded.
+                const double photonDirLenXYSqr = photonDirAndWlen.x*photonDirAndWlen.x + photonDirAndWlen.y*photonDirAndWlen.y;
+                const double endX = photonPosAndTime.x + photonDirAndWlen.x*distancePropagated;
+                const double endY = photonPosAndTime.y + photonDirAndWlen.y*distancePropagated;
+                const double endZ = photonPosAndTime.z + photonDirAndWlen.z*distancePropagated;
+
+                hits.clear();
+
+                for (std::size_t stringIndex=0; stringIndex<strings_.size(); ++stringIndex)
+                {
+                    const String_t &string = strings_[stringIndex];
+
+                    // the path does not come close to the string in x-y
+                    if ((string.posX + string.maxRadius < std::min(photonPosAndTime.x, endX)) ||
+                        (string.posX - string.maxRadius > std::max(photonPosAndTime.x, endX)) ||
+                        (string.posY + string.maxRadius < std::min(photonPosAndTime.y, endY)) ||
+                        (string.posY - string.maxRadius > std::max(photonPosAndTime.y, endY)))
+                        continue;
+
+                    if (photonDirLenXYSqr > 0.) {
+                        const double cross = (photonPosAndTime.x - string.posX)*photonDirAndWlen.y - (photonPosAndTime.y - string.posY)*photonDirAndWlen.x;
+                        if (cross*cross/photonDirLenXYSqr > string.maxRadius*string.maxRadius) continue;
+                    }
+
+                    // the path is above or below the string
+                    const double lowZ = std::min(photonPosAndTime.z, endZ) - omRadius_;
+                    const double highZ = std::max(photonPosAndTime.z, endZ) + omRadius_;
+                    if ((highZ < string.minZ) || (lowZ > string.maxZ)) continue;
+
+                    const std::size_t firstDom = std::lower_bound(string.domPosZ.begin(), string.domPosZ.end(), lowZ) - string.domPosZ.begin();
+                    for (std::size_t dom=firstDom; (dom<string.domPosZ.size()) && (string.domPosZ[dom] <= highZ); ++dom)
+                    {
+                        const double drX = string.domPosX[dom] - photonPosAndTime.x;
+                        const double drY = string.domPosY[dom] - photonPosAndTime.y;
+                        const double drZ = string.domPosZ[dom] - photonPosAndTime.z;
+                        const double dr2 = drX*drX + drY*drY + drZ*drZ;
+
+                        const double urdot = drX*photonDirAndWlen.x + drY*photonDirAndWlen.y + drZ*photonDirAndWlen.z;
+                        double discr = urdot*urdot - dr2 + omRadius_*omRadius_;
+
+                        if (discr < 0.) continue; // no intersection with this DOM
+
+                        discr = std::sqrt(discr)/pancakeFactor_;
+
+                        // distance from current point along the track to second intersection
+                        if (urdot + discr < 0.) continue;
+
+                        // distance from current point along the track to first intersection;
+                        // photons starting inside a DOM may leave (necessary for flashers)
+                        const double smin1 = urdot - discr;
+                        if (smin1 < 0.) continue;
+                        if (smin1 >= distancePropagated) continue;
+
+                        if (stopDetectedPhotons_) {
+                            // only keep the closest hit
+                            if ((!hits.empty()) && (boost::get<0>(hits[0]) <= smin1)) continue;
+                            hits.clear();
+                        }
+
+                        hits.push_back(boost::make_tuple(smin1, stringIndex, dom));
+                    }
+                }
+
+                // (record hits, see saveHit())
+                for (std::size_t i=0;i<hits.size();++i)
+                {
+                    const double hitDistance = boost::get<0>(hits[i]);
+                    const String_t &hitOnString = strings_[boost::get<1>(hits[i])];
+                    const std::size_t hitOnDom = boost::get<2>(hits[i]);
+
+                    I3CLSimPhoton photon;
+
+                    photon.SetPosX(photonPosAndTime.x+hitDistance*photonDirAndWlen.x);
+                    photon.SetPosY(photonPosAndTime.y+hitDistance*photonDirAndWlen.y);
+                    photon.SetPosZ(photonPosAndTime.z+hitDistance*photonDirAndWlen.z);
+                    photon.SetTime(photonPosAndTime.w+hitDistance*inv_groupvel);
+
+                    const I3Direction dir(photonDirAndWlen.x, photonDirAndWlen.y, photonDirAndWlen.z);
+                    photon.SetDirTheta(dir.CalcTheta());
+                    photon.SetDirPhi(dir.CalcPhi());
+                    photon.SetWavelength(photonDirAndWlen.w);
+
+                    photon.SetCherenkovDist(photonTotalPathLength+hitDistance);
+                    photon.SetNumScatters(photonNumScatters);
+                    photon.SetWeight(step.GetWeight() / wlenBias_->GetValue(photonDirAndWlen.w));
+                    photon.SetID(step.GetID());
+
+                    photon.SetStringID(hitOnString.stringIDs[hitOnDom]);
+                    photon.SetOMID(hitOnString.domIDs[hitOnDom]);
+
+                    photon.SetStartPosX(photonStartPosAndTime.x);
+                    photon.SetStartPosY(photonStartPosAndTime.y);
+                    photon.SetStartPosZ(photonStartPosAndTime.z);
+                    photon.SetStartTime(photonStartPosAndTime.w);
+
+                    const I3Direction startDir(photonStartDirAndWlen.x, photonStartDirAndWlen.y, photonStartDirAndWlen.z);
+                    photon.SetStartDirTheta(startDir.CalcTheta());
+                    photon.SetStartDirPhi(startDir.CalcPhi());
+
+                    photon.SetGroupVelocity(1./inv_groupvel);
+                    photon.SetDistInAbsLens(abs_lens_initial-abs_lens_left);
+
+                    photons.push_back(photon);
+                }
+
+                if ((stopDetectedPhotons_) && (!hits.empty()))
+                {
+                    // get rid of the photon if we detected it
+                    distancePropagated = boost::get<0>(hits[0]);
+                    abs_lens_left = 0.;
+                }
+
+                // update the track to its next position
+                photonPosAndTime.x += photonDirAndWlen.x*distancePropagated;
+                photonPosAndTime.y += photonDirAndWlen.y*distancePropagated;
+                photonPosAndTime.z += photonDirAndWlen.z*distancePropagated;
+                photonPosAndTime.w += inv_groupvel*distancePropagated;
+                photonTotalPathLength += distancePropagated;
+
+                // photon was absorbed, a new one will be generated
+                if (abs_lens_left < EPSILON) break;
+
+                // photon was NOT absorbed, scatter it
+                TransformDirection(*preScatterDirectionTransform, photonDirAndWlen);
+
+                const double cosScatAngle = scatteringCosAngleDistribution.SampleFromDistribution(rngPtr, noParameters);
+                const double sinScatAngle = std::sqrt(1. - cosScatAngle*cosScatAngle);
+                ScatterDirectionByAngle(cosScatAngle, sinScatAngle, photonDirAndWlen, UniformCO(rng));
+
+                TransformDirection(*postScatterDirectionTransform, photonDirAndWlen);
+
+                ++photonNumScatters;
+            }
+        }
+    }
+
+    {
+        boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+        statistics_total_num_photons_generated_ += numPhotonsGenerated;
+        statistics_total_num_photons_atDOMs_ += photons.size();
+    }
+}
+
+void I3CLSimStepToPhotonConverterCPU::EnqueueSteps(I3CLSimStepSeriesConstPtr steps, uint32_t identifier)
+{
+    if (!initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU is not initialized!");
+
+    if (!steps)
+        throw I3CLSimStepToPhotonConverter_exception("Steps pointer is (null)!");
+
+    if (steps->empty())
+        throw I3CLSimStepToPhotonConverter_exception("Steps are empty!");
+
+    if (steps->size() > maxNumWorkitems_)
+        throw I3CLSimStepToPhotonConverter_exception("Number of steps is greater than maximum number of work items!");
+
+    BunchPtr bunch(new Bunch_t);
+    bunch->identifier = identifier;
+    bunch->sequenceNumber = numBunchesEnqueued_++;
+    bunch->steps = steps;
+
+    const std::size_t numChunks = (steps->size() + numStepsPerChunk_ - 1) / numStepsPerChunk_;
+    bunch->photonsPerChunk.resize(numChunks);
+    bunch->numChunksLeft = numChunks;
+
+    pendingBunches_->Put(bunch);
+
+    for (std::size_t i=0;i<numChunks;++i)
+    {
+        Chunk_t chunk;
+        chunk.bunch = bunch;
+        chunk.index = i;
+        chunk.firstStep = i*numStepsPerChunk_;
+        chunk.numSteps = std::min(numStepsPerChunk_, steps->size()-chunk.firstStep);
+
+        queueToWorkers_->Put(chunk);
+    }
+}
+
+std::size_t I3CLSimStepToPhotonConverterCPU::QueueSize() const
+{
+    if (!initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU is not initialized!");
+
+    return queueToWorkers_->size();
+}
+
+bool I3CLSimStepToPhotonConverterCPU::MorePhotonsAvailable() const
+{
+    if (!initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU is not initialized!");
+
+    return (!pendingBunches_->empty());
+}
+
+I3CLSimStepToPhotonConverter::ConversionResult_t I3CLSimStepToPhotonConverterCPU::GetConversionResult()
+{
+    if (!initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU is not initialized!");
+
+    BunchPtr bunch = pendingBunches_->Get();
+
+    {
+        boost::unique_lock<boost::mutex> guard(bunch->mutex);
+        while (bunch->numChunksLeft > 0)
+        {
+            bunch->finished.wait(guard);
+        }
+    }
+
+    std::size_t numPhotons = 0;
+    BOOST_FOREACH(const I3CLSimPhotonSeries &chunkPhotons, bunch->photonsPerChunk)
+    {
+        numPhotons += chunkPhotons.size();
+    }
+
+    I3CLSimPhotonSeriesPtr photons(new I3CLSimPhotonSeries());
+    photons->reserve(numPhotons);
+    BOOST_FOREACH(const I3CLSimPhotonSeries &chunkPhotons, bunch->photonsPerChunk)
+    {
+        photons->insert(photons->end(), chunkPhotons.begin(), chunkPhotons.end());
+    }
+
+    return I3CLSimStepToPhotonConverter::ConversionResult_t(bunch->identifier, photons);
+}
+
+bool I3CLSimStepToPhotonConverterCPU::IsInitialized() const
+{
+    return initialized_;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetWlenGenerators(const std::vector<I3CLSimRandomValueConstPtr> &wlenGenerators)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    wlenGenerators_ = wlenGenerators;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetWlenBias(I3CLSimFunctionConstPtr wlenBias)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    wlenBias_ = wlenBias;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetMediumProperties(I3CLSimMediumPropertiesConstPtr mediumProperties)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    mediumProperties_ = mediumProperties;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetGeometry(I3CLSimSimpleGeometryConstPtr geometry)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    geometry_ = geometry;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetNumThreads(std::size_t val)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    numThreads_ = val;
+}
+
+std::size_t I3CLSimStepToPhotonConverterCPU::GetNumThreads() const
+{
+    return numThreads_;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetMaxNumWorkitems(std::size_t val)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    if (val == 0)
+        throw I3CLSimStepToPhotonConverter_exception("Invalid maximum number of work items (0)!");
+
+    maxNumWorkitems_ = val;
+}
+
+std::size_t I3CLSimStepToPhotonConverterCPU::GetMaxNumWorkitems() const
+{
+    return maxNumWorkitems_;
+}
+
+std::size_t I3CLSimStepToPhotonConverterCPU::GetWorkgroupSize() const
+{
+    return 1;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetNumStepsPerChunk(std::size_t val)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    if (val == 0)
+        throw I3CLSimStepToPhotonConverter_exception("Invalid number of steps per chunk (0)!");
+
+    numStepsPerChunk_ = val;
+}
+
+std::size_t I3CLSimStepToPhotonConverterCPU::GetNumStepsPerChunk() const
+{
+    return numStepsPerChunk_;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetStopDetectedPhotons(bool value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    stopDetectedPhotons_ = value;
+}
+
+bool I3CLSimStepToPhotonConverterCPU::GetStopDetectedPhotons() const
+{
+    return stopDetectedPhotons_;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetDOMPancakeFactor(double value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    pancakeFactor_ = value;
+}
+
+double I3CLSimStepToPhotonConverterCPU::GetDOMPancakeFactor() const
+{
+    return pancakeFactor_;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetSimulateHoleIce(bool value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    simulateHoleIce_ = value;
+}
+
+bool I3CLSimStepToPhotonConverterCPU::GetSimulateHoleIce() const
+{
+    return simulateHoleIce_;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetHoleIceCylinderPositions(const I3Vector<I3Position> &positions)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    holeIceCylinderPositions_ = positions;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetHoleIceCylinderRadii(const I3Vector<float> &radii)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    holeIceCylinderRadii_ = radii;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetHoleIceCylinderScatteringLengths(const I3Vector<float> &scatteringLengths)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    holeIceCylinderScatteringLengths_ = scatteringLengths;
+}
+
+void I3CLSimStepToPhotonConverterCPU::SetHoleIceCylinderAbsorptionLengths(const I3Vector<float> &absorptionLengths)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterCPU already initialized!");
+
+    holeIceCylinderAbsorptionLengths_ = absorptionLengths;
+}
+
+uint64_t I3CLSimStepToPhotonConverterCPU::GetTotalNumPhotonsGenerated() const
+{
+    boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+    return statistics_total_num_photons_generated_;
+}
+
+uint64_t I3CLSimStepToPhotonConverterCPU::GetTotalNumPhotonsAtDOMs() const
+{
+    boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+    return statistics_total_num_photons_atDOMs_;
+}
+
+bool I3CLSimStepToPhotonConverterCPU::GetThroughputStatistics(uint64_t &numPhotons, double &busyTime)
+{
+    if (!initialized_) return false;
+
+    boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+    if (statistics_total_conversion_time_ <= 0.) return false;
+
+    numPhotons = statistics_total_num_photons_generated_;
+    busyTime = statistics_total_conversion_time_/static_cast<double>(numThreads_);
+    return true;
+}
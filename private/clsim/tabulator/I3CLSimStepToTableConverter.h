@@ -28,7 +28,7 @@
 #define CLSIM_TABULATOR_STEPTOTABLECONVERTER_H_INCLUDED
 
 #include "clsim/I3CLSimStep.h"
-#include "clsim/I3CLSimQueue.h"
+#include "clsim/I3CLSimLockFreeQueue.h"
 #include "clsim/I3CLSimMediumProperties.h"
 #include "clsim/I3CLSimSpectrumTable.h"
 #include "clsim/random_value/I3CLSimRandomValue.h"
@@ -72,7 +72,7 @@ private:
 	size_t maxWorkgroupSize_, maxNumWorkitems_, entriesPerStream_;
 	
 	typedef std::pair<I3CLSimStepSeriesConstPtr, I3ParticleConstPtr> bunch_t;
-	I3CLSimQueue<bunch_t> stepQueue_;
+	I3CLSimLockFreeQueue<bunch_t> stepQueue_;
 	boost::thread harvesterThread_;
 	bool run_;
 	
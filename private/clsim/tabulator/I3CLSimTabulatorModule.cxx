@@ -35,6 +35,7 @@
 #include "clsim/I3CLSimLightSourceToStepConverter.h"
 #include "clsim/function/I3CLSimFunction.h"
 #include "clsim/I3CLSimModuleHelper.h"
+#include "clsim/I3CLSimQueue.h"
 #include "clsim/tabulator/I3CLSimStepToTableConverter.h"
 #include "clsim/tabulator/Axes.h"
 
@@ -86,6 +86,28 @@ const bool I3CLSimLightSourceToStepConverterGeant4::canUseGeant4=true;
 const bool I3CLSimLightSourceToStepConverterGeant4::canUseGeant4=false;
 #endif
 
+namespace {
+    // identifiers sent along with a NULL light source
+    // to tell the Geant4 thread what to do
+    const uint32_t barrierIdentifier=0;
+    const uint32_t markerIdentifier=1;
+    const uint32_t flushingMarkerIdentifier=2;
+
+    // the queue from Geant4 used to be an I3CLSimQueue, where 0 meant
+    // "no maximum size". The lock-free queue needs a bound, so 0 is
+    // mapped to a large one.
+    const uint32_t unboundedMaxQueueItems=1024;
+
+    std::size_t GetQueueFromGeant4Size(uint32_t maxQueueItems)
+    {
+        if (maxQueueItems>0) return maxQueueItems;
+
+        log_warn("maxQueueItems=0 (no maximum size) is not supported any more, using %u instead.",
+                 static_cast<unsigned int>(unboundedMaxQueueItems));
+        return unboundedMaxQueueItems;
+    }
+}
+
 
 I3CLSimLightSourceToStepConverterGeant4::I3CLSimLightSourceToStepConverterGeant4(std::string physicsListName,
                                                                            double maxBetaChangePerStep,
@@ -93,7 +115,7 @@ I3CLSimLightSourceToStepConverterGeant4::I3CLSimLightSourceToStepConverterGeant4
                                                                            uint32_t maxQueueItems)
 :
 queueToGeant4_(new I3CLSimQueue<ToGeant4Pair_t>(0)),
-queueFromGeant4_(new I3CLSimQueue<FromGeant4Pair_t>(maxQueueItems)),
+queueFromGeant4_(new I3CLSimLockFreeQueue<FromGeant4Pair_t>(GetQueueFromGeant4Size(maxQueueItems))),
 queueFromGeant4Messages_(new I3CLSimQueue<boost::shared_ptr<std::pair<const std::string, bool> > >(0)), // no maximum size
 physicsListName_(physicsListName),
 maxBetaChangePerStep_(maxBetaChangePerStep),
@@ -338,11 +360,19 @@ void I3CLSimLightSourceToStepConverterGeant4::Geant4Thread_impl(boost::this_thre
     // this thing stores all the steps generated by Geant4, sorted by the number
     // of Cherenkov photons they generate
     I3CLSimStepStorePtr stepStore(new I3CLSimStepStore( (std::isnan(maxNumPhotonsPerStep_)||(maxNumPhotonsPerStep_<0.))?0:(static_cast<uint32_t>(maxNumPhotonsPerStep_*1.5)) ));
+    // TrkCerenkov flushes a bunch once there are twice as many steps
+    stepStore->reserve(2*maxBunchSize_);
 
     // this stores all particles that will be ent to parametrizations
     boost::shared_ptr<std::deque<boost::tuple<I3CLSimLightSourceConstPtr, uint32_t, const I3CLSimLightSourceParameterization> > > sendToParameterizationQueue
     (new std::deque<boost::tuple<I3CLSimLightSourceConstPtr, uint32_t, const I3CLSimLightSourceParameterization> >());
     
+    // every step gets a sequence number when it is put into the store.
+    // The step identifiers start over with every flush, so this one does
+    // not, and it keys the counter-based random number streams of the
+    // steps together with the identifier.
+    uint32_t nextStepSequenceNumber=0;
+    
 #ifdef HAS_GEANT4
     // keep this around to "catch" G4Eceptions and throw real exceptions
     UserHookForAbortState *theUserHookForAbortState = new UserHookForAbortState();
@@ -390,6 +420,7 @@ void I3CLSimLightSourceToStepConverterGeant4::Geant4Thread_impl(boost::this_thre
                                                         this->GetLightSourceParameterizationSeries(),
                                                         queueFromGeant4_,
                                                         di,
+                                                        nextStepSequenceNumber,
                                                         maxRefractiveIndex);
     runManager->SetUserAction(theEventAction);      // runManager now owns this pointer
     
@@ -426,6 +457,9 @@ void I3CLSimLightSourceToStepConverterGeant4::Geant4Thread_impl(boost::this_thre
     // make a copy of the list of available parameterizations
     const I3CLSimLightSourceParameterizationSeries parameterizations = this->GetLightSourceParameterizationSeries();
 
+    // markers waiting for steps still in the store
+    uint32_t numPendingMarkers=0;
+
     // start the main loop
     for (;;)
     {
@@ -470,11 +504,32 @@ void I3CLSimLightSourceToStepConverterGeant4::Geant4Thread_impl(boost::this_thre
             if (interruptionOccured) break;
         }
         
+        // all steps of the particles before the pending
+        // markers have been sent if the store is empty
+        if ((numPendingMarkers>0) && (stepStore->empty())) {
+            if (!SendMarkers(numPendingMarkers, di)) break;
+        }
+        
+        if ((!lightSource) && (lightSourceIdentifier==markerIdentifier)) {
+            // the marker waits for the steps still in the store
+            ++numPendingMarkers;
+            if (stepStore->empty()) {
+                if (!SendMarkers(numPendingMarkers, di)) break;
+            }
+            continue;
+        }
         
         if (!lightSource) {
             //G4cout << "G4 thread got NULL! flushing " << stepStore->size() << " steps." << G4endl;
 
+            // either a barrier or a marker that flushes the store
+            const bool isBarrier = (lightSourceIdentifier==barrierIdentifier);
+            if (!isBarrier) ++numPendingMarkers;
+
             if (stepStore->empty()) {
+                if (!SendMarkers(numPendingMarkers, di)) break;
+                if (!isBarrier) continue;
+
                 // nothing to send. send an empty step vector along with
                 // the command to disable the barrier
                 
@@ -527,7 +582,7 @@ void I3CLSimLightSourceToStepConverterGeant4::Geant4Thread_impl(boost::this_thre
             // flush the rest (size < full bunch size)
             
             I3CLSimStepSeriesPtr steps(new I3CLSimStepSeries());
-            const std::size_t numStepsWithDummyFill = bunchSizeGranularity_>1?(((stepStore->size()/bunchSizeGranularity_)+1)*bunchSizeGranularity_):stepStore->size();
+            const std::size_t numStepsWithDummyFill = bunchSizeGranularity_>1?(((stepStore->size()+bunchSizeGranularity_-1)/bunchSizeGranularity_)*bunchSizeGranularity_):stepStore->size();
 
             //G4cout << " -> " << stepStore->size() << " steps left, padding to " << numStepsWithDummyFill << G4endl;
             
@@ -536,10 +591,25 @@ void I3CLSimLightSourceToStepConverterGeant4::Geant4Thread_impl(boost::this_thre
             if (!stepStore->empty())
                 log_fatal("Internal logic error. step store should be empty.");
             
+            // markers have to be sent before the barrier is reached
+            const bool sendBarrierSeparately = (isBarrier) && (numPendingMarkers>0);
+            
             {
                 boost::this_thread::restore_interruption ri(di);
                 try {
-                    queueFromGeant4_->Put(std::make_pair(steps, true /* this is the LAST reply before the barrier is reached! */));
+                    queueFromGeant4_->Put(std::make_pair(steps, (isBarrier) && (!sendBarrierSeparately) /* this is the LAST reply before the barrier is reached! */));
+                } catch(boost::thread_interrupted &i) {
+                    log_debug("G4 thread was interrupted. closing.");
+                    break;
+                }
+            }
+            
+            if (!SendMarkers(numPendingMarkers, di)) break;
+            
+            if (sendBarrierSeparately) {
+                boost::this_thread::restore_interruption ri(di);
+                try {
+                    queueFromGeant4_->Put(std::make_pair(I3CLSimStepSeriesPtr(new I3CLSimStepSeries()), true /* this is the LAST reply before the barrier is reached! */));
                 } catch(boost::thread_interrupted &i) {
                     log_debug("G4 thread was interrupted. closing.");
                     break;
@@ -687,7 +757,9 @@ void I3CLSimLightSourceToStepConverterGeant4::Geant4Thread_impl(boost::this_thre
                     // add steps from the parameterization to the step store
                     BOOST_FOREACH(const I3CLSimStep &step, *res)
                     {
-                        stepStore->insert_copy(step.GetNumPhotons(), step);
+                        I3CLSimStep &newStep = stepStore->insert_new(step.GetNumPhotons());
+                        newStep = step;
+                        newStep.SetSequenceNumber(nextStepSequenceNumber++);
                     }
                 }
                 
@@ -840,12 +912,49 @@ void I3CLSimLightSourceToStepConverterGeant4::EnqueueBarrier()
         barrier_is_enqueued_=true;
 
         // we use a NULL pointer as the barrier
-        queueToGeant4_->Put(std::make_pair(0, I3CLSimLightSourceConstPtr()));
+        queueToGeant4_->Put(std::make_pair(barrierIdentifier, I3CLSimLightSourceConstPtr()));
     }
     
     LogGeant4Messages();
 }
 
+void I3CLSimLightSourceToStepConverterGeant4::EnqueueMarker(bool flush)
+{
+    LogGeant4Messages();
+
+    if (!initialized_)
+        throw I3CLSimLightSourceToStepConverter_exception("I3CLSimLightSourceToStepConverterGeant4 is not initialized!");
+
+    {
+        boost::unique_lock<boost::mutex> guard(barrier_is_enqueued_mutex_);
+        if (barrier_is_enqueued_)
+            throw I3CLSimLightSourceToStepConverter_exception("A barrier is enqueued! You must receive all steps before enqueuing a marker.");
+    }
+
+    // markers are NULL pointers, too
+    queueToGeant4_->Put(std::make_pair(flush?flushingMarkerIdentifier:markerIdentifier, I3CLSimLightSourceConstPtr()));
+
+    LogGeant4Messages();
+}
+
+bool I3CLSimLightSourceToStepConverterGeant4::SendMarkers(uint32_t &numMarkers, boost::this_thread::disable_interruption &di)
+{
+    // a NULL step series that is not the last
+    // reply before a barrier is a marker
+    for (;numMarkers>0;--numMarkers)
+    {
+        boost::this_thread::restore_interruption ri(di);
+        try {
+            queueFromGeant4_->Put(std::make_pair(I3CLSimStepSeriesConstPtr(), false));
+        } catch(boost::thread_interrupted &i) {
+            log_debug("G4 thread was interrupted. closing.");
+            return false;
+        }
+    }
+
+    return true;
+}
+
 bool I3CLSimLightSourceToStepConverterGeant4::BarrierActive() const
 {
     LogGeant4Messages();
@@ -901,6 +1010,38 @@ I3CLSimStepSeriesConstPtr I3CLSimLightSourceToStepConverterGeant4::GetConversion
     return ret.first;
 }
 
+I3CLSimStepSeriesConstPtr I3CLSimLightSourceToStepConverterGeant4::GetConversionResultWithMarkerInfo(bool &barrierWasReset, bool &markerWasReached)
+{
+    LogGeant4Messages();
+
+    if (!initialized_)
+        throw I3CLSimLightSourceToStepConverter_exception("I3CLSimLightSourceToStepConverterGeant4 is not initialized!");
+
+    barrierWasReset=false;
+    markerWasReached=false;
+
+    const FromGeant4Pair_t ret = queueFromGeant4_->Get();
+
+    if (ret.second)
+    {
+        {
+            boost::unique_lock<boost::mutex> guard(barrier_is_enqueued_mutex_);
+            if (!barrier_is_enqueued_)
+                log_error("Internal logic error. Barrier is not set as enqueued, yet a finalization message was received.");
+            barrierWasReset=true;
+            barrier_is_enqueued_=false;
+        }
+    }
+    else if (!ret.first)
+    {
+        markerWasReached=true;
+    }
+
+    LogGeant4Messages();
+
+    return ret.first;
+}
+
 void I3CLSimLightSourceToStepConverterGeant4::LogGeant4Messages(bool allAsWarn) const
 {
     if (!queueFromGeant4Messages_) return;
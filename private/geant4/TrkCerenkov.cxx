@@ -214,6 +214,7 @@ TrkCerenkov::PostStepDoIt(const G4Track& aTrack, const G4Step& aStep)
         newStep.SetWeight(1.);
         newStep.SetBeta(beta);
         newStep.SetID(eventInformation->currentExternalParticleID);
+        newStep.SetSequenceNumber(eventInformation->nextStepSequenceNumber++);
         newStep.SetSourceType(0); // cherenkov emission
     }
     
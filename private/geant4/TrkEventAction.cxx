@@ -45,8 +45,9 @@ TrkEventAction::TrkEventAction(uint64_t maxBunchSize,
                                I3CLSimStepStorePtr stepStore,
                                boost::shared_ptr<std::deque<boost::tuple<I3CLSimLightSourceConstPtr, uint32_t, const I3CLSimLightSourceParameterization> > > sendToParameterizationQueue,
                                const I3CLSimLightSourceParameterizationSeries &parameterizationAvailable,
-                               boost::shared_ptr<I3CLSimQueue<I3CLSimLightSourceToStepConverterGeant4::FromGeant4Pair_t> > queueFromGeant4,
+                               boost::shared_ptr<I3CLSimLockFreeQueue<I3CLSimLightSourceToStepConverterGeant4::FromGeant4Pair_t> > queueFromGeant4,
                                boost::this_thread::disable_interruption &threadDisabledInterruptionState,
+                               uint32_t &nextStepSequenceNumber,
                                double maxRefractiveIndex)
 :
 abortRequested_(false),
@@ -56,6 +57,7 @@ sendToParameterizationQueue_(sendToParameterizationQueue),
 parameterizationAvailable_(parameterizationAvailable),
 queueFromGeant4_(queueFromGeant4),
 threadDisabledInterruptionState_(threadDisabledInterruptionState),
+nextStepSequenceNumber_(nextStepSequenceNumber),
 maxRefractiveIndex_(maxRefractiveIndex)
 {
 }
@@ -75,6 +77,7 @@ void TrkEventAction::BeginOfEventAction(const G4Event* anEvent)
                                 queueFromGeant4_,
                                 threadDisabledInterruptionState_,
                                 currentExternalParticleID_,
+                                nextStepSequenceNumber_,
                                 maxRefractiveIndex_);
 
     G4EventManager::GetEventManager()->SetUserInformation(eventInformation);
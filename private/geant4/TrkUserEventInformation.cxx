@@ -31,9 +31,10 @@ TrkUserEventInformation::TrkUserEventInformation(uint64_t maxBunchSize_,
                                                  I3CLSimStepStorePtr stepStore_,
                                                  boost::shared_ptr<std::deque<boost::tuple<I3CLSimLightSourceConstPtr, uint32_t, const I3CLSimLightSourceParameterization> > > sendToParameterizationQueue_,
                                                  const I3CLSimLightSourceParameterizationSeries &parameterizationAvailable_,
-                                                 boost::shared_ptr<I3CLSimQueue<I3CLSimLightSourceToStepConverterGeant4::FromGeant4Pair_t> > queueFromGeant4_,
+                                                 boost::shared_ptr<I3CLSimLockFreeQueue<I3CLSimLightSourceToStepConverterGeant4::FromGeant4Pair_t> > queueFromGeant4_,
                                                  boost::this_thread::disable_interruption &threadDisabledInterruptionState_,
                                                  uint32_t currentExternalParticleID_,
+                                                 uint32_t &nextStepSequenceNumber_,
                                                  double maxRefractiveIndex_)
 :
 abortRequested(false),
@@ -44,6 +45,7 @@ parameterizationAvailable(parameterizationAvailable_),
 queueFromGeant4(queueFromGeant4_),
 threadDisabledInterruptionState(threadDisabledInterruptionState_),
 currentExternalParticleID(currentExternalParticleID_),
+nextStepSequenceNumber(nextStepSequenceNumber_),
 maxRefractiveIndex(maxRefractiveIndex_)
 {
 }
@@ -32,7 +32,7 @@
 
 #include "clsim/I3CLSimStepStore.h"
 #include "clsim/I3CLSimStep.h"
-#include "clsim/I3CLSimQueue.h"
+#include "clsim/I3CLSimLockFreeQueue.h"
 #include "clsim/I3CLSimLightSourceToStepConverterGeant4.h"
 
 #include "clsim/I3CLSimLightSource.h"
@@ -56,9 +56,10 @@ public:
                             I3CLSimStepStorePtr stepStore_,
                             boost::shared_ptr<std::deque<boost::tuple<I3CLSimLightSourceConstPtr, uint32_t, const I3CLSimLightSourceParameterization> > > sendToParameterizationQueue_,
                             const I3CLSimLightSourceParameterizationSeries &parameterizationAvailable_,
-                            boost::shared_ptr<I3CLSimQueue<I3CLSimLightSourceToStepConverterGeant4::FromGeant4Pair_t> > queueFromGeant4_,
+                            boost::shared_ptr<I3CLSimLockFreeQueue<I3CLSimLightSourceToStepConverterGeant4::FromGeant4Pair_t> > queueFromGeant4_,
                             boost::this_thread::disable_interruption &threadDisabledInterruptionState_,
                             uint32_t currentExternalParticleID_,
+                            uint32_t &nextStepSequenceNumber_,
                             double maxRefractiveIndex_);
     virtual ~TrkUserEventInformation();
 
@@ -71,11 +72,14 @@ public:
 
     const I3CLSimLightSourceParameterizationSeries &parameterizationAvailable;
     
-    boost::shared_ptr<I3CLSimQueue<I3CLSimLightSourceToStepConverterGeant4::FromGeant4Pair_t> > queueFromGeant4;
+    boost::shared_ptr<I3CLSimLockFreeQueue<I3CLSimLightSourceToStepConverterGeant4::FromGeant4Pair_t> > queueFromGeant4;
     boost::this_thread::disable_interruption &threadDisabledInterruptionState;
     
     uint32_t currentExternalParticleID;
     
+    // counts all steps created by the Geant4 thread, see I3CLSimStep::sequenceNumber
+    uint32_t &nextStepSequenceNumber;
+    
     double maxRefractiveIndex;
     
     struct timeval start_wallclock_, end_wallclock_;
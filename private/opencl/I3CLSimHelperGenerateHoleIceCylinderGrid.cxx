@@ -0,0 +1,99 @@
+#include "opencl/I3CLSimHelperGenerateHoleIceCylinderGrid.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include <icetray/I3Logging.h>
+
+namespace I3CLSimHelper {
+
+namespace {
+    // upper limit for the number of grid cells per axis
+    const unsigned int maxCellsPerAxis = 256;
+
+    // do not let the cells become smaller than this (in meters)
+    const double minCellWidth = 1.;
+
+    unsigned int CellForPosition(double pos, double start, double width, unsigned int num)
+    {
+        const double cell = std::floor((pos-start)/width);
+        if (cell < 0.) return 0;
+        if (cell > static_cast<double>(num-1)) return num-1;
+        return static_cast<unsigned int>(cell);
+    }
+}
+
+HoleIceCylinderGrid GenerateHoleIceCylinderGrid(const I3Vector<I3Position> &cylinderPositions,
+                                                const I3Vector<float> &cylinderRadii)
+{
+    if (cylinderPositions.size() != cylinderRadii.size())
+        log_fatal("Got %zu hole ice cylinder positions but %zu radii.",
+                  cylinderPositions.size(), cylinderRadii.size());
+
+    const std::size_t numCylinders = cylinderPositions.size();
+
+    HoleIceCylinderGrid grid;
+    grid.maxRadius = 0.;
+
+    double minX=NAN, minY=NAN, maxX=NAN, maxY=NAN;
+    for (std::size_t i=0;i<numCylinders;++i)
+    {
+        const double x = cylinderPositions[i].GetX();
+        const double y = cylinderPositions[i].GetY();
+
+        if ((x < minX) || std::isnan(minX)) minX=x;
+        if ((y < minY) || std::isnan(minY)) minY=y;
+        if ((x > maxX) || std::isnan(maxX)) maxX=x;
+        if ((y > maxY) || std::isnan(maxY)) maxY=y;
+
+        grid.maxRadius = std::max(grid.maxRadius, static_cast<double>(cylinderRadii[i]));
+    }
+    if (numCylinders==0) {minX=0.; minY=0.; maxX=0.; maxY=0.;}
+
+    // Aim for about one cylinder per cell. Nested cylinders share the
+    // same center and will always end up in the same cell.
+    const unsigned int cellsPerAxis =
+        std::min(maxCellsPerAxis,
+                 std::max(1u, static_cast<unsigned int>(std::ceil(std::sqrt(static_cast<double>(numCylinders))))));
+
+    const double extentX = std::max(maxX-minX, minCellWidth);
+    const double extentY = std::max(maxY-minY, minCellWidth);
+
+    grid.numX = std::max(1u, std::min(cellsPerAxis, static_cast<unsigned int>(extentX/minCellWidth)));
+    grid.numY = std::max(1u, std::min(cellsPerAxis, static_cast<unsigned int>(extentY/minCellWidth)));
+    grid.startX = minX;
+    grid.startY = minY;
+    grid.widthX = extentX/static_cast<double>(grid.numX);
+    grid.widthY = extentY/static_cast<double>(grid.numY);
+
+    // counting sort of the cylinder indices by cell
+    const std::size_t numCells = static_cast<std::size_t>(grid.numX)*static_cast<std::size_t>(grid.numY);
+    std::vector<unsigned int> cellOfCylinder(numCylinders);
+    grid.cellStartIndices.assign(numCells+1, 0);
+
+    for (std::size_t i=0;i<numCylinders;++i)
+    {
+        const unsigned int cellX = CellForPosition(cylinderPositions[i].GetX(), grid.startX, grid.widthX, grid.numX);
+        const unsigned int cellY = CellForPosition(cylinderPositions[i].GetY(), grid.startY, grid.widthY, grid.numY);
+        cellOfCylinder[i] = cellY*grid.numX+cellX;
+        grid.cellStartIndices[cellOfCylinder[i]+1]++;
+    }
+    for (std::size_t c=0;c<numCells;++c)
+    {
+        grid.cellStartIndices[c+1] += grid.cellStartIndices[c];
+    }
+
+    grid.cylinderIndices.resize(numCylinders);
+    std::vector<unsigned int> fillPosition(grid.cellStartIndices.begin(), grid.cellStartIndices.end()-1);
+    for (std::size_t i=0;i<numCylinders;++i)
+    {
+        grid.cylinderIndices[fillPosition[cellOfCylinder[i]]++] = static_cast<unsigned int>(i);
+    }
+
+    log_debug("Hole ice cylinder grid: %ux%u cells of %gm x %gm, maximum cylinder radius %gm",
+              grid.numX, grid.numY, grid.widthX, grid.widthY, grid.maxRadius);
+
+    return grid;
+}
+
+}
@@ -0,0 +1,39 @@
+#ifndef CLSIM_HELPER_GENERATE_HOLE_ICE_CYLINDER_GRID_H_INCLUDED
+#define CLSIM_HELPER_GENERATE_HOLE_ICE_CYLINDER_GRID_H_INCLUDED
+
+#include <vector>
+
+#include "dataclasses/I3Vector.h"
+#include "dataclasses/I3Position.h"
+
+namespace I3CLSimHelper {
+
+/**
+ * A uniform 2D grid over the x/y extents of the hole-ice cylinders.
+ *
+ * Each cylinder is assigned to exactly one cell (the one containing
+ * its center). The cylinders of cell c are
+ *   cylinderIndices[cellStartIndices[c]] .. cylinderIndices[cellStartIndices[c+1]-1]
+ * in ascending order. The kernel widens its query by maxRadius, so it
+ * finds every cylinder whose footprint touches the photon path.
+ */
+struct HoleIceCylinderGrid
+{
+    double startX;
+    double startY;
+    double widthX;
+    double widthY;
+    unsigned int numX;
+    unsigned int numY;
+    double maxRadius;
+
+    std::vector<unsigned int> cellStartIndices; // numX*numY+1 entries
+    std::vector<unsigned int> cylinderIndices;  // one entry per cylinder
+};
+
+HoleIceCylinderGrid GenerateHoleIceCylinderGrid(const I3Vector<I3Position> &cylinderPositions,
+                                                const I3Vector<float> &cylinderRadii);
+
+}
+
+#endif // CLSIM_HELPER_GENERATE_HOLE_ICE_CYLINDER_GRID_H_INCLUDED
@@ -33,9 +33,11 @@
 
 #include <string>
 #include <sstream>
+#include <algorithm>
 #include <stdexcept>
 
 #include "dataclasses/I3Constants.h"
+#include "icetray/I3Units.h"
 
 #include <boost/lexical_cast.hpp>
 #include <boost/foreach.hpp>
@@ -204,7 +206,162 @@ namespace I3CLSimHelper
     }
     
     
-    std::string GenerateMediumPropertiesSource(const I3CLSimMediumProperties &mediumProperties)
+    // Appends one row of wavelengthBins values, equidistant in wavelength,
+    // for each distinct function of a layered property to table. Returns
+    // the row of each layer. Layers sharing the same function share a row.
+    std::vector<std::size_t> TabulateLayeredWlenDependentFunction(const std::vector<I3CLSimFunctionConstPtr> &layeredFunction,
+                                                                  const I3CLSimMediumProperties &mediumProperties,
+                                                                  std::size_t wavelengthBins,
+                                                                  const std::string &fullName,
+                                                                  std::vector<float> &table)
+    {
+        const double minWlen = mediumProperties.GetMinWavelength();
+        const double maxWlen = mediumProperties.GetMaxWavelength();
+
+        std::vector<I3CLSimFunctionConstPtr> functionsToGenerate;
+        std::vector<std::size_t> outputFunctionForLayer;
+
+        OptimizeLayeredValue(layeredFunction,
+                             functionsToGenerate,
+                             outputFunctionForLayer);
+
+        const std::size_t firstRow = table.size()/wavelengthBins;
+        for (std::size_t i=0;i<functionsToGenerate.size();++i)
+        {
+            I3CLSimFunctionConstPtr function = functionsToGenerate[i];
+            if (!function) log_fatal("%s function %zu is (null)", fullName.c_str(), i);
+
+            for (std::size_t bin=0;bin<wavelengthBins;++bin)
+            {
+                const double wlen = minWlen + (maxWlen-minWlen)*static_cast<double>(bin)/static_cast<double>(wavelengthBins-1);
+                table.push_back(static_cast<float>(function->GetValue(wlen)));
+            }
+        }
+
+        std::vector<std::size_t> rowForLayer;
+        BOOST_FOREACH(std::size_t function, outputFunctionForLayer)
+        {
+            rowForLayer.push_back(firstRow+function);
+        }
+        return rowForLayer;
+    }
+
+    std::string GenerateTabulatedLayeredWlenDependentFunction(const std::vector<std::size_t> &rowForLayer,
+                                                              const std::string &fullName,
+                                                              const std::string &functionName)
+    {
+        const bool dependsOnLayer =
+            (static_cast<std::size_t>(std::count(rowForLayer.begin(), rowForLayer.end(), rowForLayer[0])) != rowForLayer.size());
+
+        std::ostringstream code;
+
+        code << "///////////////// START " << fullName << " (tabulated) ////////////////\n";
+        code << "\n";
+
+        if (!dependsOnLayer)
+        {
+            code << "#define FUNCTION_" << functionName << "_DOES_NOT_DEPEND_ON_LAYER" << std::endl;
+        }
+        else
+        {
+            code << "// the row of each layer in mediumLengthTable\n";
+            code << "__constant unsigned short " << functionName << "_row[" << rowForLayer.size() << "] = {\n";
+            for (std::size_t i=0;i<rowForLayer.size();++i)
+            {
+                code << "    " << rowForLayer[i] << ",\n";
+            }
+            code << "};\n";
+            code << "\n";
+        }
+
+        code << "inline float " << functionName << "(MEDIUM_ARGS unsigned int layer, float wavelength);\n\n";
+        code << "inline float " << functionName << "(MEDIUM_ARGS unsigned int layer, float wavelength)\n";
+        code << "{\n";
+        if (!dependsOnLayer) {
+            code << "    // " << fullName << " does not have a layer structure\n";
+            code << "    return interpolateMediumLengthTable(mediumLengthTable + " << rowForLayer[0] << "*MEDIUM_LENGTH_TABLE_WLEN_BINS, wavelength);\n";
+        } else {
+            code << "    if (layer >= " << rowForLayer.size() << ") return 0.;\n";
+            code << "    return interpolateMediumLengthTable(mediumLengthTable + " << functionName << "_row[layer]*MEDIUM_LENGTH_TABLE_WLEN_BINS, wavelength);\n";
+        }
+        code << "}\n";
+        code << "\n";
+
+        code << "///////////////// END " << fullName << " (tabulated) ////////////////\n";
+        code << "\n";
+
+        return code.str();
+    }
+
+    std::vector<float> GenerateMediumLengthTable(const I3CLSimMediumProperties &mediumProperties,
+                                                 std::size_t lengthTableWavelengthBins)
+    {
+        std::vector<float> table;
+        if (lengthTableWavelengthBins == 0) return table;
+        if (lengthTableWavelengthBins < 2)
+            log_fatal("The scattering and absorption length tables need at least 2 wavelength bins, got %zu.",
+                      lengthTableWavelengthBins);
+
+        // the same order as in GenerateMediumPropertiesSource()
+        TabulateLayeredWlenDependentFunction(mediumProperties.GetScatteringLengths(),
+                                             mediumProperties,
+                                             lengthTableWavelengthBins,
+                                             "scattering length",
+                                             table);
+        TabulateLayeredWlenDependentFunction(mediumProperties.GetAbsorptionLengths(),
+                                             mediumProperties,
+                                             lengthTableWavelengthBins,
+                                             "absorption length",
+                                             table);
+        return table;
+    }
+
+    std::string GenerateCumulativeOpticalDepthTable(const std::vector<I3CLSimFunctionConstPtr> &layeredFunction,
+                                                    const I3CLSimMediumProperties &mediumProperties,
+                                                    std::size_t wavelengthBins,
+                                                    const std::string &fullName,
+                                                    const std::string &tableName)
+    {
+        const uint32_t numLayers = mediumProperties.GetLayersNum();
+        const double minWlen = mediumProperties.GetMinWavelength();
+        const double maxWlen = mediumProperties.GetMaxWavelength();
+        const double layerHeight = mediumProperties.GetLayersHeight();
+
+        std::ostringstream code;
+
+        code << "// cumulative " << fullName << " optical depth from the bottom of the\n";
+        code << "// layered region to each layer boundary, one row per wavelength\n";
+        code << "__constant float " << tableName << "[" << wavelengthBins*(numLayers+1) << "] = {\n";
+        for (std::size_t bin=0;bin<wavelengthBins;++bin)
+        {
+            const double wlen = minWlen + (maxWlen-minWlen)*static_cast<double>(bin)/static_cast<double>(wavelengthBins-1);
+
+            double depth=0.;
+            code << "    " << ToFloatString(depth) << ",";
+            for (uint32_t layer=0;layer<numLayers;++layer)
+            {
+                I3CLSimFunctionConstPtr function = layeredFunction[layer];
+                if (!function) log_fatal("%s function for layer %" PRIu32 " is (null)", fullName.c_str(), layer);
+
+                const double length = function->GetValue(wlen);
+                if (!(length > 0.))
+                    log_fatal("%s for layer %" PRIu32 " is not positive at %gnm. Cannot build an optical depth table.",
+                              fullName.c_str(), layer, wlen/I3Units::nanometer);
+
+                depth += layerHeight/length;
+                code << " " << ToFloatString(depth) << ",";
+            }
+            code << "\n";
+        }
+        code << "};\n";
+        code << "\n";
+
+        return code.str();
+    }
+
+    std::string GenerateMediumPropertiesSource(const I3CLSimMediumProperties &mediumProperties,
+                                               std::size_t opticalDepthTableWavelengthBins,
+                                               std::size_t lengthTableWavelengthBins)
     {
         std::ostringstream code;
         
@@ -307,17 +464,105 @@ namespace I3CLSimHelper
             code << "\n";        
         }
     
-        // scattering length
-        code << GenerateLayeredWlenDependentFunctions(mediumProperties.GetScatteringLengths(),
-                                                      "scattering length",
-                                                      "getScatteringLength");
-        
-        // absorption length
-        code << GenerateLayeredWlenDependentFunctions(mediumProperties.GetAbsorptionLengths(),
-                                                      "absorption length",
-                                                      "getAbsorptionLength");
+        if (lengthTableWavelengthBins > 0)
+        {
+            if (lengthTableWavelengthBins < 2)
+                log_fatal("The scattering and absorption length tables need at least 2 wavelength bins, got %zu.",
+                          lengthTableWavelengthBins);
+
+            // The values are not part of the source. They are passed to
+            // the kernel as a __global buffer, see GenerateMediumLengthTable().
+            // Every function that needs them takes the buffer through MEDIUM_ARGS.
+            code << "///////////////// START length tables ////////////////\n";
+            code << "\n";
+            code << "#define MEDIUM_LENGTH_TABLE\n";
+            code << "#define MEDIUM_LENGTH_TABLE_WLEN_BINS " << lengthTableWavelengthBins << "\n";
+            code << "#define MEDIUM_ARGS __global const float *mediumLengthTable,\n";
+            code << "#define MEDIUM_ARGS_TO_CALL mediumLengthTable,\n";
+            code << "\n";
+            code << "// interpolate linearly between the two closest wavelengths\n";
+            code << "inline float interpolateMediumLengthTable(__global const float *row, float wavelength);\n\n";
+            code << "inline float interpolateMediumLengthTable(__global const float *row, float wavelength)\n";
+            code << "{\n";
+            code << "    const float x = clamp((wavelength-" << ToFloatString(mediumProperties.GetMinWavelength()) << ")*" << ToFloatString(static_cast<double>(lengthTableWavelengthBins-1)/(mediumProperties.GetMaxWavelength()-mediumProperties.GetMinWavelength())) << ", 0.f, " << ToFloatString(static_cast<double>(lengthTableWavelengthBins-1)) << ");\n";
+            code << "    const uint bin = min(convert_uint(x), " << lengthTableWavelengthBins-2 << "u);\n";
+            code << "\n";
+            code << "    return mix(row[bin], row[bin+1], x-convert_float(bin));\n";
+            code << "}\n";
+            code << "\n";
+            code << "///////////////// END length tables ////////////////\n";
+            code << "\n";
+
+            // only the rows are needed here, in the same order as in GenerateMediumLengthTable()
+            std::vector<float> table;
+            const std::vector<std::size_t> scatteringRows =
+                TabulateLayeredWlenDependentFunction(mediumProperties.GetScatteringLengths(),
+                                                     mediumProperties,
+                                                     lengthTableWavelengthBins,
+                                                     "scattering length",
+                                                     table);
+            const std::vector<std::size_t> absorptionRows =
+                TabulateLayeredWlenDependentFunction(mediumProperties.GetAbsorptionLengths(),
+                                                     mediumProperties,
+                                                     lengthTableWavelengthBins,
+                                                     "absorption length",
+                                                     table);
+
+            // scattering length
+            code << GenerateTabulatedLayeredWlenDependentFunction(scatteringRows,
+                                                                  "scattering length",
+                                                                  "getScatteringLength");
+
+            // absorption length
+            code << GenerateTabulatedLayeredWlenDependentFunction(absorptionRows,
+                                                                  "absorption length",
+                                                                  "getAbsorptionLength");
+        }
+        else
+        {
+            code << "#define MEDIUM_ARGS\n";
+            code << "#define MEDIUM_ARGS_TO_CALL\n";
+            code << "\n";
+
+            // scattering length
+            code << GenerateLayeredWlenDependentFunctions(mediumProperties.GetScatteringLengths(),
+                                                          "scattering length",
+                                                          "getScatteringLength");
+
+            // absorption length
+            code << GenerateLayeredWlenDependentFunctions(mediumProperties.GetAbsorptionLengths(),
+                                                          "absorption length",
+                                                          "getAbsorptionLength");
+        }
         
         
+        // cumulative optical depth tables, used by the kernel instead of
+        // walking through the layers one by one
+        if (opticalDepthTableWavelengthBins > 0)
+        {
+            if (opticalDepthTableWavelengthBins < 2)
+                log_fatal("The optical depth table needs at least 2 wavelength bins, got %zu.",
+                          opticalDepthTableWavelengthBins);
+
+            code << "///////////////// START optical depth tables ////////////////\n";
+            code << "\n";
+            code << "#define MEDIUM_OPTICAL_DEPTH_TABLE\n";
+            code << "#define MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS " << opticalDepthTableWavelengthBins << "\n";
+            code << "\n";
+            code << GenerateCumulativeOpticalDepthTable(mediumProperties.GetScatteringLengths(),
+                                                        mediumProperties,
+                                                        opticalDepthTableWavelengthBins,
+                                                        "scattering length",
+                                                        "mediumScatteringOpticalDepth");
+            code << GenerateCumulativeOpticalDepthTable(mediumProperties.GetAbsorptionLengths(),
+                                                        mediumProperties,
+                                                        opticalDepthTableWavelengthBins,
+                                                        "absorption length",
+                                                        "mediumAbsorptionOpticalDepth");
+            code << "///////////////// END optical depth tables ////////////////\n";
+            code << "\n";
+        }
+
         // scattering angle distribution
         {
             code << "///////////////// START scattering angle distribution ////////////////\n";
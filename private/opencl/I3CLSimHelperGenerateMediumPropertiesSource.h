@@ -28,6 +28,7 @@
 #define I3CLSIMHELPERGENERATEMEDIUMPROPERTIESSOURCE_H_INCLUDED
 
 #include <string>
+#include <vector>
 
 #include "clsim/I3CLSimMediumProperties.h"
 
@@ -35,8 +36,31 @@ namespace I3CLSimHelper
 {
     /**
      * generates the OpenCL source code for a given mediumProperties object.
+     *
+     * If opticalDepthTableWavelengthBins is non-zero, cumulative optical
+     * depth tables for scattering and absorption are generated as well,
+     * with this many rows between the minimum and maximum wavelength.
+     * This also defines MEDIUM_OPTICAL_DEPTH_TABLE for the kernel.
+     *
+     * If lengthTableWavelengthBins is non-zero, getScatteringLength()
+     * and getAbsorptionLength() interpolate in tables with this many
+     * values per layer instead of evaluating the functions. The values
+     * are not part of the source, they are passed to the kernel in a
+     * __global buffer filled from GenerateMediumLengthTable(). The
+     * source defines MEDIUM_LENGTH_TABLE, and MEDIUM_ARGS and
+     * MEDIUM_ARGS_TO_CALL to take and pass the buffer.
      */
-    std::string GenerateMediumPropertiesSource(const I3CLSimMediumProperties &mediumProperties);
+    std::string GenerateMediumPropertiesSource(const I3CLSimMediumProperties &mediumProperties,
+                                               std::size_t opticalDepthTableWavelengthBins=0,
+                                               std::size_t lengthTableWavelengthBins=0);
+
+    /**
+     * generates the scattering and absorption length tables for the
+     * source from GenerateMediumPropertiesSource() with the same
+     * lengthTableWavelengthBins. Empty if lengthTableWavelengthBins is 0.
+     */
+    std::vector<float> GenerateMediumLengthTable(const I3CLSimMediumProperties &mediumProperties,
+                                                 std::size_t lengthTableWavelengthBins);
     
     std::string GenerateWavelengthGeneratorSource(const std::vector<I3CLSimRandomValueConstPtr>&);
 
@@ -54,6 +54,7 @@
 #include "opencl/I3CLSimHelperLoadProgramSource.h"
 #include "opencl/I3CLSimHelperGenerateMediumPropertiesSource.h"
 #include "opencl/I3CLSimHelperGenerateGeometrySource.h"
+#include "opencl/I3CLSimHelperGenerateHoleIceCylinderGrid.h"
 
 #include "opencl/mwcrng_init.h"
 
@@ -64,6 +65,20 @@ using namespace I3CLSimHelper;
 
 const bool I3CLSimStepToPhotonConverterOpenCL::default_useNativeMath=true;
 
+// each persistent work item takes about this many work units per bunch
+const std::size_t I3CLSimStepToPhotonConverterOpenCL::workUnitsPerPersistentWorkItem=8;
+
+// the output buffers have room for this many times the most hits per step seen so far
+const double I3CLSimStepToPhotonConverterOpenCL::outputPhotonsHeadroom=1.5;
+
+// Steps are split further while a bunch takes longer than 1/0.9 of the
+// fastest kernel time per photon seen so far, down to 1/1024 of the
+// configured factor (see OpenCLThread_impl_adaptStepSplittingFactor()).
+// The factor recovers by 2^(1/4) per bunch that is fast enough.
+const double I3CLSimStepToPhotonConverterOpenCL::stepSplittingTargetOccupancy=0.9;
+const double I3CLSimStepToPhotonConverterOpenCL::minStepSplittingFactorScale=1./1024.;
+const double I3CLSimStepToPhotonConverterOpenCL::stepSplittingFactorRecovery=1.189207115;
+
 
 I3CLSimStepToPhotonConverterOpenCL::I3CLSimStepToPhotonConverterOpenCL(I3RandomServicePtr randomService,
                                                                        bool useNativeMath)
@@ -73,15 +88,20 @@ statistics_total_host_duration_in_nanoseconds_(0),
 statistics_total_kernel_calls_(0),
 statistics_total_num_photons_generated_(0),
 statistics_total_num_photons_atDOMs_(0),
+statistics_total_device_idle_time_in_nanoseconds_(0),
+statistics_total_starving_kernel_calls_(0),
+statistics_total_host_conversion_time_in_nanoseconds_(0),
+statistics_kernel_profile_counts_(KernelProfileNumPhases, 0),
+statistics_kernel_profile_ticks_(KernelProfileNumPhases, 0),
 openCLStarted_(false),
-queueToOpenCL_(new I3CLSimQueue<ToOpenCLPair_t>(5)),
+queueToOpenCL_(new I3CLSimLockFreeQueue<ToOpenCLPair_t>(5)),
 queueFromOpenCL_(new I3CLSimQueue<I3CLSimStepToPhotonConverter::ConversionResult_t>(0)),
 randomService_(randomService),
 initialized_(false),
 compiled_(false),
 useNativeMath_(useNativeMath),
 deviceIsSelected_(false),
-disableDoubleBuffering_(true),
+bufferRingDepth_(1),
 doublePrecision_(false),
 stopDetectedPhotons_(false),
 saveAllPhotons_(false),
@@ -90,12 +110,34 @@ maxNumOutputPhotonsCorrectionFactor_(10000.),
 simulateHoleIce_(false),
 holeIceScatteringLengthFactor_(0.6),
 holeIceAbsorptionLengthFactor_(0.6),
+holeIceCylindersInConstantMemory_(false),
+opticalDepthTableWavelengthBins_(0),
+lengthTableWavelengthBins_(0),
+useCounterBasedRNG_(false),
+profileKernel_(false),
+profileKernelHasClock_(false),
+usePersistentThreads_(false),
+numPersistentWorkItems_(0),
+stepSplittingFactor_(4.),
+counterBasedRNGKey0_(0),
+counterBasedRNGKey1_(0),
 fixedNumberOfAbsorptionLengths_(NAN),
 pancakeFactor_(1.),
 photonHistoryEntries_(0),
+holeIceFirstKernelArg_(0),
+outputPhotonsFirstKernelArg_(0),
+rngFirstKernelArg_(0),
 maxWorkgroupSize_(0),
+kernelPrivateMemSize_(0),
 workgroupSize_(0),
-maxNumWorkitems_(10240)
+maxNumWorkitems_(10240),
+maxNumDeviceWorkitems_(0),
+maxNumStepsPerBunch_(0),
+currentStepSplittingFactor_(0.),
+minKernelTimePerPhoton_(0.),
+maxNumOutputPhotons_(0),
+maxNumOutputPhotonsLimit_(0),
+maxHitsPerStep_(0.)
 {
     if (!randomService_) log_fatal("You need to supply a I3RandomService.");
 
@@ -105,6 +147,8 @@ maxNumWorkitems_(10240)
 
     try {
         mwcrngKernelSource_ = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/mwcrng_kernel.cl");
+        counterBasedRNGKernelSource_ = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/philox_kernel.cl");
+        boost::replace_all(counterBasedRNGKernelSource_, "__CLSIM_DIR__", (I3_SRC + "/clsim"));
     } catch (std::runtime_error &e) {
         throw I3CLSimStepToPhotonConverter_exception((std::string("Could not load kernel: ") + e.what()).c_str());
     }
@@ -140,6 +184,13 @@ I3CLSimStepToPhotonConverterOpenCL::~I3CLSimStepToPhotonConverterOpenCL()
 
     deviceBuffer_GeoLayerToOMNumIndexPerStringSet.reset();
 
+    deviceBuffer_HoleIceCylinderPositionsAndRadii.clear();
+    deviceBuffer_HoleIceCylinderScatteringLengths.clear();
+    deviceBuffer_HoleIceCylinderAbsorptionLengths.clear();
+    deviceBuffer_HoleIceCylinderGridGeometry.clear();
+    deviceBuffer_HoleIceCylinderGridCellStartIndices.clear();
+    deviceBuffer_HoleIceCylinderGridCylinderIndices.clear();
+
     // reset pointers
     compiled_=false;
     context_.reset();
@@ -159,6 +210,14 @@ uint64_t I3CLSimStepToPhotonConverterOpenCL::GetMaxWorkgroupSize() const
     return maxWorkgroupSize_;
 }
 
+uint64_t I3CLSimStepToPhotonConverterOpenCL::GetKernelPrivateMemSize() const
+{
+    if (!compiled_)
+        throw I3CLSimStepToPhotonConverter_exception("You need to compile the kernel first. Call Compile().");
+
+    return kernelPrivateMemSize_;
+}
+
 void I3CLSimStepToPhotonConverterOpenCL::SetDevice(const I3CLSimOpenCLDevice &device)
 {
     if (initialized_)
@@ -217,6 +276,14 @@ std::size_t I3CLSimStepToPhotonConverterOpenCL::GetMaxNumWorkitems() const
     return maxNumWorkitems_;
 }
 
+std::size_t I3CLSimStepToPhotonConverterOpenCL::GetMaxNumStepsPerBunch() const
+{
+    if (!initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL is not initialized!");
+
+    return maxNumStepsPerBunch_;
+}
+
 
 void I3CLSimStepToPhotonConverterOpenCL::Initialize()
 {
@@ -236,6 +303,42 @@ void I3CLSimStepToPhotonConverterOpenCL::Initialize()
     if (maxNumWorkitems_%workgroupSize_ != 0)
         throw I3CLSimStepToPhotonConverter_exception("The maximum number of work items (" + boost::lexical_cast<std::string>(maxNumWorkitems_) + ") must be a multiple of the workgroup size (" + boost::lexical_cast<std::string>(workgroupSize_) + ").");
 
+    if (usePersistentThreads_) {
+        // Use a few work groups per compute unit if no number
+        // of persistent work items has been configured.
+        if (numPersistentWorkItems_==0) {
+            const std::size_t workgroupsPerComputeUnit = 4;
+            const std::size_t numComputeUnits = static_cast<std::size_t>((device_->GetDeviceHandle())->getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>());
+
+            numPersistentWorkItems_ = std::min(numComputeUnits*workgroupsPerComputeUnit*workgroupSize_, maxNumWorkitems_);
+            numPersistentWorkItems_ -= numPersistentWorkItems_%workgroupSize_;
+            if (numPersistentWorkItems_==0) numPersistentWorkItems_=workgroupSize_;
+        }
+
+        if (numPersistentWorkItems_%workgroupSize_ != 0)
+            throw I3CLSimStepToPhotonConverter_exception("The number of persistent work items (" + boost::lexical_cast<std::string>(numPersistentWorkItems_) + ") must be a multiple of the workgroup size (" + boost::lexical_cast<std::string>(workgroupSize_) + ").");
+        if (numPersistentWorkItems_ > maxNumWorkitems_)
+            throw I3CLSimStepToPhotonConverter_exception("The number of persistent work items (" + boost::lexical_cast<std::string>(numPersistentWorkItems_) + ") must not exceed the maximum number of work items (" + boost::lexical_cast<std::string>(maxNumWorkitems_) + ").");
+
+        log_debug("Using %zu persistent work items.", numPersistentWorkItems_);
+    }
+
+    // Split steps (see SplitLargeSteps()) need more work items than
+    // the bunch has steps. Ask for bunches of half the work items, so
+    // a full bunch can be split into up to twice as many steps.
+    maxNumDeviceWorkitems_ = maxNumWorkitems_;
+    maxNumStepsPerBunch_ = maxNumWorkitems_;
+    currentStepSplittingFactor_ = stepSplittingFactor_;
+    minKernelTimePerPhoton_ = 0.;
+    if ((stepSplittingFactor_ > 0.) && (!usePersistentThreads_)) {
+        maxNumStepsPerBunch_ = maxNumWorkitems_/2;
+        maxNumStepsPerBunch_ -= maxNumStepsPerBunch_%workgroupSize_;
+        if (maxNumStepsPerBunch_==0) maxNumStepsPerBunch_=workgroupSize_;
+
+        log_debug("Splitting large steps of bunches of up to %zu steps into up to %zu work items.",
+                  maxNumStepsPerBunch_, maxNumDeviceWorkitems_);
+    }
+
     log_debug("basic OpenCL setup done.");
 
     if (!saveAllPhotons_) {
@@ -255,35 +358,77 @@ void I3CLSimStepToPhotonConverterOpenCL::Initialize()
         log_debug("maxNumOutputPhotons_: %u", maxNumOutputPhotons_);
     }
 
+    // the output buffers can grow up to the largest allocation the device allows
+    {
+        const uint64_t maxMemAllocSize = (device_->GetDeviceHandle())->getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+        const uint64_t bytesPerPhoton = std::max(static_cast<uint64_t>(sizeof(I3CLSimPhoton)),
+                                                 static_cast<uint64_t>(photonHistoryEntries_)*sizeof(cl_float4));
+        maxNumOutputPhotonsLimit_ = static_cast<uint32_t>(std::min(maxMemAllocSize/bytesPerPhoton,
+                                                                   static_cast<uint64_t>(std::numeric_limits<uint32_t>::max())));
+        maxNumOutputPhotonsLimit_ = std::max(maxNumOutputPhotonsLimit_, maxNumOutputPhotons_);
+    }
+    maxHitsPerStep_ = 0.;
+
     // set up rng
-    log_debug("Setting up RNG for %zu workitems.", maxNumWorkitems_);
+    if (useCounterBasedRNG_) {
+        // The counter-based generator only needs a key. Everything
+        // else is derived from the steps in the kernel.
+        counterBasedRNGKey0_ = static_cast<uint32_t>(randomService_->Integer(0xffffffff));
+        counterBasedRNGKey1_ = static_cast<uint32_t>(randomService_->Integer(0xffffffff));
 
-    MWC_RNG_x.resize(maxNumWorkitems_);
-    MWC_RNG_a.resize(maxNumWorkitems_);
+        log_debug("Counter-based RNG key is 0x%08x%08x.", counterBasedRNGKey1_, counterBasedRNGKey0_);
+    } else {
+        log_debug("Setting up RNG for %zu workitems.", maxNumDeviceWorkitems_);
 
-    if (init_MWC_RNG(&(MWC_RNG_x[0]), &(MWC_RNG_a[0]), maxNumWorkitems_, randomService_)!=0)
-        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+        MWC_RNG_x.resize(maxNumDeviceWorkitems_);
+        MWC_RNG_a.resize(maxNumDeviceWorkitems_);
+
+        if (init_MWC_RNG(&(MWC_RNG_x[0]), &(MWC_RNG_a[0]), maxNumDeviceWorkitems_, randomService_)!=0)
+            throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
 
-    log_debug("RNG is set up..");
+        log_debug("RNG is set up..");
+    }
 
     log_debug("Setting up device buffers..");
 
     // reset all buffers first
     deviceBuffer_MWC_RNG_x.reset();
     deviceBuffer_MWC_RNG_a.reset();
+    deviceBuffer_MWC_RNG_x_AtKernelStart.clear();
+    deviceBuffer_MWC_RNG_a_AtKernelStart.clear();
+    deviceBuffer_MWC_RNG_x_Rerun.reset();
+    deviceBuffer_MWC_RNG_a_Rerun.reset();
     deviceBuffer_InputSteps.clear();
     deviceBuffer_OutputPhotons.clear();
+    deviceBuffer_OutputPhotonSteps.clear();
+    deviceBuffer_OverflowedSteps.clear();
     deviceBuffer_PhotonHistory.clear();
     deviceBuffer_CurrentNumOutputPhotons.clear();
+    deviceBuffer_KernelProfile.clear();
+    deviceBuffer_WorkQueue.clear();
+    deviceBuffer_WorkUnits.clear();
     deviceBuffer_GeoLayerToOMNumIndexPerStringSet.reset();
+    deviceBuffer_MediumLengthTable.reset();
+    workQueue_.clear();
+    workUnits_.clear();
+    maxNumOutputPhotonsPerBuffer_.clear();
+    noOverflowedSteps_.assign(maxNumDeviceWorkitems_, 0);
 
 
     // set up device buffers from existing host buffers
-    deviceBuffer_MWC_RNG_x = boost::shared_ptr<cl::Buffer>
-    (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, MWC_RNG_x.size() * sizeof(uint64_t), &(MWC_RNG_x[0])));
+    if (!useCounterBasedRNG_) {
+        deviceBuffer_MWC_RNG_x = boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, MWC_RNG_x.size() * sizeof(uint64_t), &(MWC_RNG_x[0])));
+
+        deviceBuffer_MWC_RNG_a = boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, MWC_RNG_a.size() * sizeof(uint32_t), &(MWC_RNG_a[0])));
 
-    deviceBuffer_MWC_RNG_a = boost::shared_ptr<cl::Buffer>
-    (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, MWC_RNG_a.size() * sizeof(uint32_t), &(MWC_RNG_a[0])));
+        deviceBuffer_MWC_RNG_x_Rerun = boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(*context_, CL_MEM_READ_WRITE, MWC_RNG_x.size() * sizeof(uint64_t), NULL));
+
+        deviceBuffer_MWC_RNG_a_Rerun = boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(*context_, CL_MEM_READ_WRITE, MWC_RNG_a.size() * sizeof(uint32_t), NULL));
+    }
 
     if (!saveAllPhotons_) {
         // no need for a geometry buffer if all photons are saved and no
@@ -292,30 +437,64 @@ void I3CLSimStepToPhotonConverterOpenCL::Initialize()
         (new cl::Buffer(*context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, geoLayerToOMNumIndexPerStringSetInfo_.size() * sizeof(unsigned short), &(geoLayerToOMNumIndexPerStringSetInfo_[0])));
     }
 
-    const unsigned int numBuffers = disableDoubleBuffering_?1:2;
+    if (lengthTableWavelengthBins_ > 0) {
+        // the same layout as the source from GetMediumPropertiesSource()
+        std::vector<float> mediumLengthTable = I3CLSimHelper::GenerateMediumLengthTable(*mediumProperties_, lengthTableWavelengthBins_);
+        deviceBuffer_MediumLengthTable = boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(*context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, mediumLengthTable.size() * sizeof(float), &(mediumLengthTable[0])));
+    }
+
+    const unsigned int numBuffers = bufferRingDepth_;
 
     // allocate empty buffers on the device
     for (unsigned int i=0;i<numBuffers;++i)
     {
         deviceBuffer_InputSteps.push_back(boost::shared_ptr<cl::Buffer>
-        (new cl::Buffer(*context_, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, maxNumWorkitems_*sizeof(I3CLSimStep), NULL)));
+        (new cl::Buffer(*context_, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, maxNumDeviceWorkitems_*sizeof(I3CLSimStep), NULL)));
+
+        // the output photons (and their histories) are allocated by AllocateOutputPhotonBuffers()
+        deviceBuffer_OutputPhotons.push_back(boost::shared_ptr<cl::Buffer>());
+        deviceBuffer_OutputPhotonSteps.push_back(boost::shared_ptr<cl::Buffer>());
+        maxNumOutputPhotonsPerBuffer_.push_back(0);
+
+        deviceBuffer_OverflowedSteps.push_back(boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, maxNumDeviceWorkitems_*sizeof(cl_uint), NULL)));
 
-        deviceBuffer_OutputPhotons.push_back(boost::shared_ptr<cl::Buffer>
-        (new cl::Buffer(*context_, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, maxNumOutputPhotons_*sizeof(I3CLSimPhoton), NULL)));
+        if (!useCounterBasedRNG_) {
+            deviceBuffer_MWC_RNG_x_AtKernelStart.push_back(boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(*context_, CL_MEM_READ_WRITE, MWC_RNG_x.size() * sizeof(uint64_t), NULL)));
+
+            deviceBuffer_MWC_RNG_a_AtKernelStart.push_back(boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(*context_, CL_MEM_READ_WRITE, MWC_RNG_a.size() * sizeof(uint32_t), NULL)));
+        }
 
         deviceBuffer_CurrentNumOutputPhotons.push_back(boost::shared_ptr<cl::Buffer>
         (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(uint32_t), NULL)));
 
+        if (profileKernel_) {
+            // ticks and counts of all phases for each work item
+            deviceBuffer_KernelProfile.push_back(boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(*context_, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, maxNumDeviceWorkitems_*2*KernelProfileNumPhases*sizeof(cl_ulong), NULL)));
+        }
+
+        if (usePersistentThreads_) {
+            // Each step yields one more work unit than its share
+            // of the photons at most, see OpenCLThread_impl_uploadSteps().
+            const std::size_t maxNumWorkUnits = maxNumWorkitems_ + numPersistentWorkItems_*workUnitsPerPersistentWorkItem;
+
+            deviceBuffer_WorkQueue.push_back(boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, 2*sizeof(cl_uint), NULL)));
+
+            deviceBuffer_WorkUnits.push_back(boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(*context_, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, maxNumWorkUnits*sizeof(cl_uint4), NULL)));
+
+            workQueue_.push_back(std::vector<cl_uint>(2, 0));
+            workUnits_.push_back(std::vector<cl_uint4>());
+            workUnits_.back().reserve(maxNumWorkUnits);
+        }
+
         if (photonHistoryEntries_>0) {
-            deviceBuffer_PhotonHistory.push_back
-            (boost::shared_ptr<cl::Buffer>
-             (new cl::Buffer(*context_,
-                             CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
-                             static_cast<std::size_t>(maxNumOutputPhotons_)*static_cast<std::size_t>(photonHistoryEntries_)*sizeof(cl_float4),
-                             NULL
-                            )
-             )
-            );
+            deviceBuffer_PhotonHistory.push_back(boost::shared_ptr<cl::Buffer>());
         }
     }
 
@@ -334,15 +513,53 @@ void I3CLSimStepToPhotonConverterOpenCL::Initialize()
         }
 
         kernel_[i]->setArg(argN++, *(deviceBuffer_InputSteps[i]));                  // the input steps
-        kernel_[i]->setArg(argN++, *(deviceBuffer_OutputPhotons[i]));               // the output photons
 
-        if (photonHistoryEntries_>0) {
-            kernel_[i]->setArg(argN++, *(deviceBuffer_PhotonHistory[i]));           // the photon history (the last N points where the photon scattered)
+        // the output photons, their histories and their steps are set by AllocateOutputPhotonBuffers()
+        outputPhotonsFirstKernelArg_ = argN;
+        argN += (photonHistoryEntries_>0)?3:2;
+
+        kernel_[i]->setArg(argN++, *(deviceBuffer_OverflowedSteps[i]));             // flags for steps that did not fit into the output buffer
+
+        rngFirstKernelArg_ = argN;
+        if (useCounterBasedRNG_) {
+            kernel_[i]->setArg(argN++, counterBasedRNGKey0_);                   // rng key
+            kernel_[i]->setArg(argN++, counterBasedRNGKey1_);                   // rng key
+        } else {
+            kernel_[i]->setArg(argN++, *deviceBuffer_MWC_RNG_x);                // rng state
+            kernel_[i]->setArg(argN++, *deviceBuffer_MWC_RNG_a);                // rng state
         }
 
-        kernel_[i]->setArg(argN++, *deviceBuffer_MWC_RNG_x);                    // rng state
-        kernel_[i]->setArg(argN++, *deviceBuffer_MWC_RNG_a);                    // rng state
+        if (profileKernel_) {
+            kernel_[i]->setArg(argN++, *(deviceBuffer_KernelProfile[i]));           // per-phase profile of each work item
+        }
 
+        if (usePersistentThreads_) {
+            kernel_[i]->setArg(argN++, *(deviceBuffer_WorkQueue[i]));               // next work unit and number of work units
+            kernel_[i]->setArg(argN++, *(deviceBuffer_WorkUnits[i]));               // the work units
+        }
+
+        if (deviceBuffer_MediumLengthTable) {
+            kernel_[i]->setArg(argN++, *deviceBuffer_MediumLengthTable);            // scattering and absorption length tables
+        }
+
+        // the hole ice cylinders are the last arguments, see UploadHoleIceCylinders()
+        holeIceFirstKernelArg_ = argN;
+
+        AllocateOutputPhotonBuffers(i, maxNumOutputPhotons_);
+    }
+
+    if (simulateHoleIce_) {
+        boost::unique_lock<boost::mutex> guard(holeIceCylinders_mutex_);
+        deviceBuffer_HoleIceCylinderPositionsAndRadii.assign(kernel_.size(), boost::shared_ptr<cl::Buffer>());
+        deviceBuffer_HoleIceCylinderScatteringLengths.assign(kernel_.size(), boost::shared_ptr<cl::Buffer>());
+        deviceBuffer_HoleIceCylinderAbsorptionLengths.assign(kernel_.size(), boost::shared_ptr<cl::Buffer>());
+        deviceBuffer_HoleIceCylinderGridGeometry.assign(kernel_.size(), boost::shared_ptr<cl::Buffer>());
+        deviceBuffer_HoleIceCylinderGridCellStartIndices.assign(kernel_.size(), boost::shared_ptr<cl::Buffer>());
+        deviceBuffer_HoleIceCylinderGridCylinderIndices.assign(kernel_.size(), boost::shared_ptr<cl::Buffer>());
+        holeIceCylindersChanged_.assign(kernel_.size(), true);
+
+        for (unsigned int i=0;i<kernel_.size();++i)
+            UploadHoleIceCylinders(i);
     }
     log_debug("Kernel configured.");
 
@@ -393,6 +610,32 @@ std::string I3CLSimStepToPhotonConverterOpenCL::GetPreambleSource()
     }
 
 
+    // use a counter-based random number generator instead of
+    // per-work-item MWC generator states?
+    if (useCounterBasedRNG_) {
+        preamble = preamble + "#define COUNTER_BASED_RNG\n";
+    }
+
+    // profile the phases of the kernel?
+    if (profileKernel_) {
+        preamble = preamble + "#define PROFILE_KERNEL\n";
+
+        // The clock can only be read on nvidia devices so far (using inline PTX).
+        // Everywhere else, only the counts are recorded.
+        profileKernelHasClock_ = device_->IsGPU() &&
+            (device_->GetPlatformName().find("NVIDIA") != std::string::npos);
+        if (profileKernelHasClock_) {
+            preamble = preamble + "#define PROFILE_KERNEL_PTX_CLOCK\n";
+        } else {
+            log_info("No device clock available for kernel profiling, only counting the phases.");
+        }
+    }
+
+    // launch persistent work items that take their photons from a work queue?
+    if (usePersistentThreads_) {
+        preamble = preamble + "#define PERSISTENT_THREADS\n";
+    }
+
     // should the photon history be saved?
     if (photonHistoryEntries_>0) {
         preamble = preamble + "#define SAVE_PHOTON_HISTORY\n";
@@ -411,80 +654,14 @@ std::string I3CLSimStepToPhotonConverterOpenCL::GetPreambleSource()
             + boost::lexical_cast<std::string>(holeIceAbsorptionLengthFactor_)
             + ";\n";
 
-        // Hole ice cylinder geometry.
-        //
-        // To define the hole ice positions in the kernel,
-        // produce some kernel code like this:
-        //
-        //     #define NUMBER_OF_CYLINDERS 2
-        //     __constant const unsigned int numberOfCylinders = 2;
-        //     __constant floating4_t cylinderPositionsAndRadii[numberOfCylinders] = {
-        //       {0, 1.2, 3.4, 18.0},
-        //       {0, -1.2, -3.4, 18.0}
-        //     };
-        //     __constant floating_t cylinderScatteringLengths[numberOfCylinders] =
-        //       {0.001, 100.0};
-        //     __constant floating_t cylinderAbsorptionLengths[numberOfCylinders] =
-        //       {100.0, 0.0};
-        //
-        preamble += "#define NUMBER_OF_CYLINDERS "
-            + boost::lexical_cast<std::string>(holeIceCylinderPositions_.size())
-            + "\n";
-
-        preamble += "__constant const unsigned int numberOfCylinders = "
-            + boost::lexical_cast<std::string>(holeIceCylinderPositions_.size())
-            + ";\n";
-
-        preamble += "__constant floating4_t cylinderPositionsAndRadii["
-            + boost::lexical_cast<std::string>(holeIceCylinderPositions_.size())
-            + "] = {";
-
-        for (int i = 0; i < holeIceCylinderPositions_.size(); i++)
-        {
-            std::string cylinder_position_and_radius_str = "{"
-                + boost::lexical_cast<std::string>(holeIceCylinderPositions_.at(i).GetX())
-                + ", "
-                + boost::lexical_cast<std::string>(holeIceCylinderPositions_.at(i).GetY())
-                + ", "
-                + boost::lexical_cast<std::string>(holeIceCylinderPositions_.at(i).GetZ())
-                + ", "
-                + boost::lexical_cast<std::string>(holeIceCylinderRadii_.at(i))
-                + "}";
-            log_info("Hole ice cylinder at {x,y,z,radius}: %s \n",
-                cylinder_position_and_radius_str.c_str());
-
-            preamble += cylinder_position_and_radius_str;
-            if (i < holeIceCylinderPositions_.size() - 1)
-                preamble += ", ";
-        }
-
-        preamble += "};\n";
-
-        std::string cylinder_scattering_lengths_str = "";
-        for (int i = 0; i < holeIceCylinderPositions_.size(); i++) {
-          cylinder_scattering_lengths_str +=
-              boost::lexical_cast<std::string>(holeIceCylinderScatteringLengths_[i]);
-          if (i < holeIceCylinderPositions_.size() - 1) cylinder_scattering_lengths_str += ", ";
-        }
-        log_info("Hole ice cylinder scattering lengths: %s\n", cylinder_scattering_lengths_str.c_str());
-        preamble += "__constant floating_t cylinderScatteringLengths["
-            + boost::lexical_cast<std::string>(holeIceCylinderPositions_.size())
-            + "] = {"
-            + cylinder_scattering_lengths_str
-            + "};\n";
-
-        std::string cylinder_absorption_lengths_str = "";
-        for (int i = 0; i < holeIceCylinderPositions_.size(); i++) {
-          cylinder_absorption_lengths_str +=
-              boost::lexical_cast<std::string>(holeIceCylinderAbsorptionLengths_[i]);
-          if (i < holeIceCylinderPositions_.size() - 1) cylinder_absorption_lengths_str += ", ";
+        // The hole ice cylinders are not part of the source. They are
+        // passed to the kernel as buffer arguments, see UploadHoleIceCylinders().
+        // Only their address space is fixed at compile time.
+        if (holeIceCylindersInConstantMemory_) {
+            preamble += "#define HOLE_ICE_MEMORY __constant\n";
+        } else {
+            preamble += "#define HOLE_ICE_MEMORY __global\n";
         }
-        log_info("Hole ice cylinder absorption lengths: %s\n", cylinder_absorption_lengths_str.c_str());
-        preamble += "__constant floating_t cylinderAbsorptionLengths["
-            + boost::lexical_cast<std::string>(holeIceCylinderPositions_.size())
-            + "] = {"
-            + cylinder_absorption_lengths_str
-            + "};\n";
     }
 
     // Instead of sampling the number of absorption lengths from an
@@ -522,7 +699,9 @@ std::string I3CLSimStepToPhotonConverterOpenCL::GetWlenBiasSource()
 
 std::string I3CLSimStepToPhotonConverterOpenCL::GetMediumPropertiesSource()
 {
-    return I3CLSimHelper::GenerateMediumPropertiesSource(*mediumProperties_);
+    return I3CLSimHelper::GenerateMediumPropertiesSource(*mediumProperties_,
+                                                         opticalDepthTableWavelengthBins_,
+                                                         lengthTableWavelengthBins_);
 }
 
 std::string I3CLSimStepToPhotonConverterOpenCL::GetGeometrySource()
@@ -612,7 +791,7 @@ std::string I3CLSimStepToPhotonConverterOpenCL::GetFullSource()
     std::ostringstream code;
 
     code << prependSource_;
-    code << mwcrngKernelSource_;
+    code << (useCounterBasedRNG_ ? counterBasedRNGKernelSource_ : mwcrngKernelSource_);
     code << wlenGeneratorSource_;
     code << wlenBiasSource_;
     code << mediumPropertiesSource_;
@@ -689,6 +868,14 @@ void I3CLSimStepToPhotonConverterOpenCL::SetupQueueAndKernel(const cl::Platform
         log_debug("      ->                    CL_DEVICE_VENDOR: %s", boost::lexical_cast<std::string>(device.getInfo<CL_DEVICE_VENDOR>()).c_str());
         log_debug("      ->                   CL_DEVICE_VERSION: %s", boost::lexical_cast<std::string>(device.getInfo<CL_DEVICE_VERSION>()).c_str());
         log_debug("      ->                CL_DEVICE_EXTENSIONS: %s", boost::lexical_cast<std::string>(device.getInfo<CL_DEVICE_EXTENSIONS>()).c_str());
+
+        // the optical depth tables are kept in __constant memory, the length
+        // tables are in deviceBuffer_MediumLengthTable
+        const uint64_t mediumTablesSize =
+            static_cast<uint64_t>(mediumProperties_->GetLayersNum()+1)*opticalDepthTableWavelengthBins_*2*sizeof(float);
+        if (mediumTablesSize > device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>())
+            log_warn("The optical depth tables need %" PRIu64 " bytes, but the device only has %" PRIu64 " bytes of constant memory. Consider using fewer wavelength bins.",
+                     mediumTablesSize, static_cast<uint64_t>(device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>()));
     }
 
     log_debug("Compiling..");
@@ -732,7 +919,7 @@ void I3CLSimStepToPhotonConverterOpenCL::SetupQueueAndKernel(const cl::Platform
         // compiler issues (as found on OSX 10.11 for example)
         std::string combined_source;
         combined_source += prependSource_ + "\n";
-        combined_source += mwcrngKernelSource_ + "\n";
+        combined_source += (useCounterBasedRNG_ ? counterBasedRNGKernelSource_ : mwcrngKernelSource_) + "\n";
         combined_source += wlenGeneratorSource_ + "\n";
         combined_source += wlenBiasSource_ + "\n";
         combined_source += mediumPropertiesSource_ + "\n";
@@ -783,7 +970,7 @@ void I3CLSimStepToPhotonConverterOpenCL::SetupQueueAndKernel(const cl::Platform
     }
     log_debug("code compiled.");
 
-    const unsigned int numBuffers = disableDoubleBuffering_?1:2;
+    const unsigned int numBuffers = bufferRingDepth_;
 
     // instantiate the command queue
     log_debug("Initializing..");
@@ -814,13 +1001,18 @@ void I3CLSimStepToPhotonConverterOpenCL::SetupQueueAndKernel(const cl::Platform
 
         maxWorkgroupSize_ = kernel_[0]->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
 
-        if (!disableDoubleBuffering_) {
-            if (kernel_[1]->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device) != maxWorkgroupSize_) {
-                log_fatal("created two identical kernels and got different maximum work group sizes.");
+        for (unsigned int i=1;i<numBuffers;++i)
+        {
+            if (kernel_[i]->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device) != maxWorkgroupSize_) {
+                log_fatal("created identical kernels and got different maximum work group sizes.");
             }
         }
 
         log_debug("Maximum workgroup sizes for the kernel is %" PRIu64, maxWorkgroupSize_);
+
+        // private memory spills reduce the occupancy, so keep an eye on it
+        kernelPrivateMemSize_ = kernel_[0]->getWorkGroupInfo<CL_KERNEL_PRIVATE_MEM_SIZE>(device);
+        log_info("Kernel uses %" PRIu64 " bytes of private memory per work item.", kernelPrivateMemSize_);
     } catch (cl::Error &err) {
         kernel_.clear(); // throw away command queue.
         queue_.clear(); // throw away command queue.
@@ -876,6 +1068,16 @@ namespace {
         cl::Event::waitForEvents(events);
     }
 
+    inline bool isOpenCLEventComplete(cl::Event &event)
+    {
+        return (event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() == CL_COMPLETE);
+    }
+
+    inline void yieldOpenCLThread()
+    {
+        boost::this_thread::sleep(boost::posix_time::microseconds(YIELD_TIME_MICROSECONDS));
+    }
+
     inline void waitForOpenCLEventYield(cl::Event &event)
     {
         for (;;)
@@ -894,6 +1096,10 @@ namespace {
     }
 
 #undef YIELD_TIME_MILLISECONDS
+
+    // The number of output photons is reset by a non-blocking copy.
+    // Its source has to stay around until the copy has finished.
+    const uint32_t zeroCounterBufferSource=0;
 }
 
 bool I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_uploadSteps(boost::this_thread::disable_interruption &di,
@@ -902,6 +1108,7 @@ bool I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_uploadSteps(boost::th
                                                                        uint32_t &out_stepsIdentifier,
                                                                        uint64_t &out_totalNumberOfPhotons,
                                                                        std::size_t &out_numberOfInputSteps,
+                                                                       I3CLSimStepSeriesConstPtr &out_steps,
                                                                        bool blocking
                                                                        )
 {
@@ -910,9 +1117,6 @@ bool I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_uploadSteps(boost::th
     uint32_t stepsIdentifier=0;
     I3CLSimStepSeriesConstPtr steps;
 
-    const uint32_t zeroCounterBufferSource=0;
-    VECTOR_CLASS<cl::Event> bufferWriteEvents(2);
-
     while (!steps)
     {
         // we need to fetch new steps
@@ -956,6 +1160,20 @@ bool I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_uploadSteps(boost::th
     out_stepsIdentifier = stepsIdentifier;
 
 #ifdef DUMP_STATISTICS
+    const boost::posix_time::ptime conversion_start(boost::posix_time::microsec_clock::universal_time());
+#endif //DUMP_STATISTICS
+
+    // The kernel reads dummy1/dummy2 as the photon offset of the
+    // counter-based generator, so only the splitter may set them.
+    if ((stepSplittingFactor_ > 0.) && (!usePersistentThreads_)) {
+        steps = SplitLargeSteps(steps, currentStepSplittingFactor_, workgroupSize_,
+                                maxNumDeviceWorkitems_);
+    } else if (useCounterBasedRNG_) {
+        steps = ClearSubStepFields(steps);
+    }
+
+#ifdef DUMP_STATISTICS
+
     uint64_t totalNumberOfPhotons=0;
     BOOST_FOREACH(const I3CLSimStep &step, *steps)
     {
@@ -967,38 +1185,134 @@ bool I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_uploadSteps(boost::th
 #endif //DUMP_STATISTICS
 
     log_trace("[%u] copy steps to device", bufferIndex);
-    // copy steps to device
+    // Copy steps to device. This does not wait for the copy to finish,
+    // the kernel is enqueued on the same (in-order) queue right after it.
+    // The caller keeps the steps around until the kernel has finished.
     try {
-        queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_CurrentNumOutputPhotons[bufferIndex], CL_FALSE, 0, sizeof(uint32_t), &zeroCounterBufferSource, NULL, &(bufferWriteEvents[0]));
-        queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_InputSteps[bufferIndex], CL_FALSE, 0, steps->size()*sizeof(I3CLSimStep), &((*steps)[0]), NULL, &(bufferWriteEvents[1]));
-        queue_[bufferIndex]->flush(); // make sure it starts executing on the device
+        queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_CurrentNumOutputPhotons[bufferIndex], CL_FALSE, 0, sizeof(uint32_t), &zeroCounterBufferSource);
+        queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_InputSteps[bufferIndex], CL_FALSE, 0, steps->size()*sizeof(I3CLSimStep), &((*steps)[0]));
+        queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_OverflowedSteps[bufferIndex], CL_FALSE, 0, steps->size()*sizeof(cl_uint), &(noOverflowedSteps_[0]));
 
-        log_trace("[%u] waiting for copy to finish", bufferIndex);
-        waitForOpenCLEventsYield(bufferWriteEvents);
+        if (usePersistentThreads_) OpenCLThread_impl_uploadWorkUnits(bufferIndex, *steps);
+
+        queue_[bufferIndex]->flush(); // make sure it starts executing on the device
     } catch (cl::Error &err) {
         log_fatal("[%u] OpenCL ERROR (memcpy to device): %s (%i)", bufferIndex, err.what(), err.err());
     }
-    log_trace("[%u] copied steps to device", bufferIndex);
+    log_trace("[%u] copying steps to device", bufferIndex);
+
+#ifdef DUMP_STATISTICS
+    {
+        const boost::posix_time::time_duration conversion_duration =
+            boost::posix_time::microsec_clock::universal_time() - conversion_start;
+        boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+        statistics_total_host_conversion_time_in_nanoseconds_ += conversion_duration.total_nanoseconds();
+    }
+#endif
 
     out_numberOfInputSteps = steps->size();
+    out_steps = steps;
 
     return true;
 }
 
+// Copies the work units of the steps to the device, for
+// persistent work items. Does not catch OpenCL errors.
+void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_uploadWorkUnits(unsigned int bufferIndex,
+                                                                           const I3CLSimStepSeries &steps)
+{
+    // The kernel that used these work units last has finished,
+    // the OpenCL thread waits for it before re-using the buffer.
+    std::vector<cl_uint4> &workUnits = workUnits_[bufferIndex];
+
+    // each persistent work item takes several work units
+    MakeWorkUnits(steps, numPersistentWorkItems_*workUnitsPerPersistentWorkItem, workUnits);
+
+    std::vector<cl_uint> &workQueue = workQueue_[bufferIndex];
+    workQueue[0] = 0;                                           // the next work unit
+    workQueue[1] = static_cast<cl_uint>(workUnits.size());      // the number of work units
+
+    queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_WorkQueue[bufferIndex], CL_FALSE, 0, workQueue.size()*sizeof(cl_uint), &(workQueue[0]));
+    if (!workUnits.empty())
+        queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_WorkUnits[bufferIndex], CL_FALSE, 0, workUnits.size()*sizeof(cl_uint4), &(workUnits[0]));
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::MakeWorkUnits(const I3CLSimStepSeries &steps,
+                                                       uint64_t numWorkUnits,
+                                                       std::vector<cl_uint4> &workUnits)
+{
+    workUnits.clear();
+    if (numWorkUnits==0) numWorkUnits=1;
+
+    // Split the photons into work units of the same size.
+    uint64_t numberOfPhotons=0;
+    BOOST_FOREACH(const I3CLSimStep &step, steps)
+    {
+        numberOfPhotons+=step.numPhotons;
+    }
+    const uint64_t photonsPerWorkUnit = std::max(static_cast<uint64_t>(1), (numberOfPhotons+numWorkUnits-1)/numWorkUnits);
+
+    for (std::size_t i=0;i<steps.size();++i)
+    {
+        const uint32_t stepNumPhotons = steps[i].numPhotons;
+        for (uint64_t firstPhoton=0;firstPhoton<stepNumPhotons;firstPhoton+=photonsPerWorkUnit)
+        {
+            cl_uint4 workUnit;
+            workUnit.s[0] = static_cast<cl_uint>(i);
+            workUnit.s[1] = static_cast<cl_uint>(firstPhoton);
+            workUnit.s[2] = static_cast<cl_uint>(std::min(photonsPerWorkUnit, stepNumPhotons-firstPhoton));
+            workUnit.s[3] = 0;
+            workUnits.push_back(workUnit);
+        }
+    }
+}
+
 void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_runKernel(unsigned int bufferIndex,
                                                                      cl::Event &kernelFinishEvent,
-                                                                     std::size_t numberOfInputSteps)
+                                                                     std::size_t numberOfInputSteps,
+                                                                     const cl::Event *previousKernelFinishEvent)
 {
+    // Replace the hole ice cylinders of this buffer if they have been
+    // updated in the meantime. The other buffers keep theirs until their
+    // next kernel, so steps that are run again see the same cylinders.
+    if (simulateHoleIce_) {
+        boost::unique_lock<boost::mutex> guard(holeIceCylinders_mutex_);
+        if (holeIceCylindersChanged_[bufferIndex]) {
+            log_debug("[%u] re-uploading hole ice cylinders..", bufferIndex);
+            UploadHoleIceCylinders(bufferIndex);
+        }
+    }
+
     // run the kernel
     log_trace("[%u] enqueuing kernel..", bufferIndex);
 
     try {
+        // The kernels of all buffers share the state of the MWC random number
+        // generator, so they have to run one after the other. The counter-based
+        // generator has no state, and its kernels may overlap. The copies to this
+        // buffer are already ordered by its (in-order) queue.
+        VECTOR_CLASS<cl::Event> waitForEvents;
+        if ((previousKernelFinishEvent) && (!useCounterBasedRNG_))
+            waitForEvents.push_back(*previousKernelFinishEvent);
+
+        if (!useCounterBasedRNG_) {
+            // Keep the state this kernel starts with. Steps that overflow
+            // the output buffer are run again from there.
+            const std::size_t numberOfWorkItems = OpenCLThread_impl_numberOfWorkItems(numberOfInputSteps);
+            queue_[bufferIndex]->enqueueCopyBuffer(*deviceBuffer_MWC_RNG_x, *deviceBuffer_MWC_RNG_x_AtKernelStart[bufferIndex],
+                                                   0, 0, numberOfWorkItems*sizeof(uint64_t),
+                                                   waitForEvents.empty()?NULL:&waitForEvents);
+            queue_[bufferIndex]->enqueueCopyBuffer(*deviceBuffer_MWC_RNG_a, *deviceBuffer_MWC_RNG_a_AtKernelStart[bufferIndex],
+                                                   0, 0, numberOfWorkItems*sizeof(uint32_t),
+                                                   waitForEvents.empty()?NULL:&waitForEvents);
+        }
+
         // configure which input buffers to use
         queue_[bufferIndex]->enqueueNDRangeKernel(*(kernel_[bufferIndex]),
                                                   cl::NullRange,    // current implementations force this to be NULL
-                                                  cl::NDRange(numberOfInputSteps),  // number of work items
+                                                  cl::NDRange(OpenCLThread_impl_numberOfWorkItems(numberOfInputSteps)),  // number of work items
                                                   cl::NDRange(workgroupSize_),
-                                                  NULL, //&(bufferWriteEvents),  // wait for buffers to be filled
+                                                  waitForEvents.empty()?NULL:&waitForEvents,  // wait for the previous kernel (MWC only)
                                                   &kernelFinishEvent); // signal when finished
         queue_[bufferIndex]->flush(); // make sure it begins executing on the device
     } catch (cl::Error &err) {
@@ -1008,6 +1322,314 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_runKernel(unsigned in
     log_trace("[%u] kernel in queue..", bufferIndex);
 }
 
+// Runs the kernel of a buffer again for the steps that overflowed its
+// output buffer (all others have no photons) and waits for it. The steps
+// stay where they were, so work items start from the same generator state
+// and produce the same photons. Persistent work items only do so with the
+// counter-based generator. Does not catch OpenCL errors.
+void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_rerunSteps(unsigned int bufferIndex,
+                                                                      const I3CLSimStepSeries &steps)
+{
+    // this only returns once the kernel is done, so the sources of the copies stay around
+    const uint32_t zeroCounterBufferSource=0;
+
+    queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_CurrentNumOutputPhotons[bufferIndex], CL_FALSE, 0, sizeof(uint32_t), &zeroCounterBufferSource);
+    queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_InputSteps[bufferIndex], CL_FALSE, 0, steps.size()*sizeof(I3CLSimStep), &(steps[0]));
+    queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_OverflowedSteps[bufferIndex], CL_FALSE, 0, steps.size()*sizeof(cl_uint), &(noOverflowedSteps_[0]));
+
+    if (usePersistentThreads_) OpenCLThread_impl_uploadWorkUnits(bufferIndex, steps);
+
+    const std::size_t numberOfWorkItems = OpenCLThread_impl_numberOfWorkItems(steps.size());
+
+    if (!useCounterBasedRNG_) {
+        // Later kernels have moved on with the shared state, use a copy
+        // of the one this buffer started with.
+        queue_[bufferIndex]->enqueueCopyBuffer(*deviceBuffer_MWC_RNG_x_AtKernelStart[bufferIndex], *deviceBuffer_MWC_RNG_x_Rerun,
+                                               0, 0, numberOfWorkItems*sizeof(uint64_t));
+        queue_[bufferIndex]->enqueueCopyBuffer(*deviceBuffer_MWC_RNG_a_AtKernelStart[bufferIndex], *deviceBuffer_MWC_RNG_a_Rerun,
+                                               0, 0, numberOfWorkItems*sizeof(uint32_t));
+
+        kernel_[bufferIndex]->setArg(rngFirstKernelArg_, *deviceBuffer_MWC_RNG_x_Rerun);
+        kernel_[bufferIndex]->setArg(rngFirstKernelArg_+1, *deviceBuffer_MWC_RNG_a_Rerun);
+    }
+
+    cl::Event kernelFinishEvent;
+    queue_[bufferIndex]->enqueueNDRangeKernel(*(kernel_[bufferIndex]),
+                                              cl::NullRange,
+                                              cl::NDRange(numberOfWorkItems),
+                                              cl::NDRange(workgroupSize_),
+                                              NULL,
+                                              &kernelFinishEvent);
+    queue_[bufferIndex]->flush(); // make sure it begins executing on the device
+
+    if (!useCounterBasedRNG_) {
+        // the kernel has captured its arguments
+        kernel_[bufferIndex]->setArg(rngFirstKernelArg_, *deviceBuffer_MWC_RNG_x);
+        kernel_[bufferIndex]->setArg(rngFirstKernelArg_+1, *deviceBuffer_MWC_RNG_a);
+    }
+
+    waitForOpenCLEventYield(kernelFinishEvent);
+
+#ifdef DUMP_STATISTICS
+    // The device time of the re-run counts towards the bunch, its
+    // photons have already been counted with the first kernel.
+    uint64_t timeStart, timeEnd;
+    kernelFinishEvent.getProfilingInfo(CL_PROFILING_COMMAND_START, &timeStart);
+    kernelFinishEvent.getProfilingInfo(CL_PROFILING_COMMAND_END, &timeEnd);
+
+    const uint64_t kernel_duration_in_nanoseconds = (timeStart==timeEnd)?
+        static_cast<uint64_t>((device_->GetDeviceHandle())->getInfo<CL_DEVICE_PROFILING_TIMER_RESOLUTION>()):(timeEnd-timeStart);
+
+    {
+        boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+
+        statistics_total_device_duration_in_nanoseconds_ += kernel_duration_in_nanoseconds;
+        statistics_total_kernel_calls_++;
+    }
+#endif
+}
+
+// Adapts the factor SplitLargeSteps() uses to the kernel time of the
+// bunch that has just finished. The kernel time per photon of the
+// fastest bunch so far is the reference. A bunch that took much longer
+// than its photons would at this rate is waiting for a few long work
+// items, so steps are split further. Otherwise the factor slowly goes
+// back up to the configured one.
+void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_adaptStepSplittingFactor(const cl::Event &kernelFinishEvent,
+                                                                                    const I3CLSimStepSeries &steps)
+{
+#ifdef DUMP_STATISTICS
+    uint64_t totalNumPhotons=0;
+    BOOST_FOREACH(const I3CLSimStep &step, steps)
+    {
+        totalNumPhotons+=step.numPhotons;
+    }
+    if (totalNumPhotons==0) return;
+
+    uint64_t timeStart, timeEnd;
+    kernelFinishEvent.getProfilingInfo(CL_PROFILING_COMMAND_START, &timeStart);
+    kernelFinishEvent.getProfilingInfo(CL_PROFILING_COMMAND_END, &timeEnd);
+    if (timeEnd<=timeStart) return; // below the timer resolution
+
+    const double kernelTime = static_cast<double>(timeEnd-timeStart);
+    const double kernelTimePerPhoton = kernelTime/static_cast<double>(totalNumPhotons);
+    if ((minKernelTimePerPhoton_==0.) || (kernelTimePerPhoton < minKernelTimePerPhoton_))
+        minKernelTimePerPhoton_ = kernelTimePerPhoton;
+
+    const double occupancy = minKernelTimePerPhoton_/kernelTimePerPhoton;
+    if (occupancy < stepSplittingTargetOccupancy) {
+        currentStepSplittingFactor_ = std::max(currentStepSplittingFactor_/2., stepSplittingFactor_*minStepSplittingFactorScale);
+    } else {
+        currentStepSplittingFactor_ = std::min(currentStepSplittingFactor_*stepSplittingFactorRecovery, stepSplittingFactor_);
+    }
+
+    log_trace("Kernel took %g ns for %" PRIu64 " photons (%.0f%% of the best rate), splitting steps above %g times the median.",
+              kernelTime, totalNumPhotons, occupancy*100., currentStepSplittingFactor_);
+#endif
+}
+
+// Grows the output buffers if a bunch with the most hits per step seen
+// so far would not fit with some room to spare. The buffers of the ring
+// are re-allocated by the OpenCL thread once their kernels are done.
+void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_adaptOutputBufferSize(uint64_t numberOfHits,
+                                                                                 std::size_t numberOfSteps)
+{
+    if (numberOfSteps==0) return;
+
+    const double hitsPerStep = static_cast<double>(numberOfHits)/static_cast<double>(numberOfSteps);
+    if (hitsPerStep <= maxHitsPerStep_) return;
+    maxHitsPerStep_ = hitsPerStep;
+
+    const double wantedNumOutputPhotons =
+        std::ceil(outputPhotonsHeadroom*hitsPerStep*static_cast<double>(maxNumDeviceWorkitems_));
+    if (wantedNumOutputPhotons <= static_cast<double>(maxNumOutputPhotons_)) return;
+    if (maxNumOutputPhotons_ >= maxNumOutputPhotonsLimit_) return;
+
+    const uint32_t newMaxNumOutputPhotons =
+        static_cast<uint32_t>(std::min(wantedNumOutputPhotons, static_cast<double>(maxNumOutputPhotonsLimit_)));
+
+    log_info("Growing the output buffers from %" PRIu32 " to %" PRIu32 " photons (%g hits per step).",
+             maxNumOutputPhotons_, newMaxNumOutputPhotons, hitsPerStep);
+    maxNumOutputPhotons_ = newMaxNumOutputPhotons;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_downloadKernelProfile(unsigned int bufferIndex,
+                                                                                 std::size_t numberOfInputSteps)
+{
+    // each work item has written the ticks and then the counts of all phases
+    const std::size_t numberOfWorkItems = OpenCLThread_impl_numberOfWorkItems(numberOfInputSteps);
+    std::vector<cl_ulong> workItemProfiles(numberOfWorkItems*2*KernelProfileNumPhases);
+    if (workItemProfiles.empty()) return;
+
+    try {
+        cl::Event copyComplete;
+        queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_KernelProfile[bufferIndex], CL_FALSE, 0, workItemProfiles.size()*sizeof(cl_ulong), &(workItemProfiles[0]), NULL, &copyComplete);
+        queue_[bufferIndex]->flush(); // make sure it starts executing on the device
+        waitForOpenCLEventYield(copyComplete);
+    } catch (cl::Error &err) {
+        log_fatal("OpenCL ERROR (memcpy from device): %s (%i)", err.what(), err.err());
+    }
+
+    std::vector<uint64_t> ticks(KernelProfileNumPhases, 0);
+    std::vector<uint64_t> counts(KernelProfileNumPhases, 0);
+    for (std::size_t i=0;i<numberOfWorkItems;++i)
+    {
+        const cl_ulong *workItemProfile = &(workItemProfiles[i*2*KernelProfileNumPhases]);
+        for (std::size_t phase=0;phase<KernelProfileNumPhases;++phase)
+        {
+            ticks[phase] += workItemProfile[phase];
+            counts[phase] += workItemProfile[KernelProfileNumPhases+phase];
+        }
+    }
+
+    boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+    for (std::size_t phase=0;phase<KernelProfileNumPhases;++phase)
+    {
+        statistics_kernel_profile_ticks_[phase] += ticks[phase];
+        statistics_kernel_profile_counts_[phase] += counts[phase];
+    }
+}
+
+std::size_t I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_numberOfWorkItems(std::size_t numberOfInputSteps) const
+{
+    // Persistent work items do not depend on the number of steps.
+    if (usePersistentThreads_) return numPersistentWorkItems_;
+
+    return numberOfInputSteps;
+}
+
+// Sub-step j of a split step has at most 2^b photons and stores
+// b in dummy1 and j in dummy2. The kernel adds j<<b to the photon
+// index of the counter-based random number generator, such that
+// the sub-steps together use the same random numbers as the
+// original step (see counterBasedRNGPhotonOffset()). Whatever the
+// caller left in these fields is ignored, all steps that are not
+// split are passed on with both set to zero.
+I3CLSimStepSeriesConstPtr I3CLSimStepToPhotonConverterOpenCL::SplitLargeSteps(const I3CLSimStepSeriesConstPtr &steps,
+                                                                              double stepSplittingFactor,
+                                                                              std::size_t workgroupSize,
+                                                                              std::size_t maxNumDeviceWorkitems)
+{
+    std::vector<uint32_t> numPhotons;
+    numPhotons.reserve(steps->size());
+    uint32_t maxNumPhotons=0;
+    BOOST_FOREACH(const I3CLSimStep &step, *steps)
+    {
+        if (step.numPhotons==0) continue; // dummy step
+
+        numPhotons.push_back(step.numPhotons);
+        maxNumPhotons=std::max(maxNumPhotons, step.numPhotons);
+    }
+    if (numPhotons.empty()) return ClearSubStepFields(steps);
+
+    const std::size_t numDummySteps = steps->size()-numPhotons.size();
+
+    std::nth_element(numPhotons.begin(), numPhotons.begin()+numPhotons.size()/2, numPhotons.end());
+    const uint64_t medianNumPhotons = numPhotons[numPhotons.size()/2];
+
+    const uint64_t threshold = std::max(static_cast<uint64_t>(1),
+        static_cast<uint64_t>(stepSplittingFactor*static_cast<double>(medianNumPhotons)));
+
+    // Use the largest sub-step size 2^b <= threshold for which the
+    // split bunch still fits onto the device.
+    unsigned int bits=0;
+    while ((bits<31) && ((static_cast<uint64_t>(1)<<(bits+1)) <= threshold)) ++bits;
+
+    std::size_t numSteps=0;
+    for (;bits<32;++bits)
+    {
+        if (maxNumPhotons <= threshold) break; // nothing to split
+
+        const uint64_t subStepSize = static_cast<uint64_t>(1)<<bits;
+        if ((static_cast<uint64_t>(maxNumPhotons)+subStepSize-1)/subStepSize > static_cast<uint64_t>(std::numeric_limits<uint16_t>::max())+1)
+            continue; // too many sub-steps for dummy2
+
+        numSteps=0;
+        for (std::size_t i=0;i<numPhotons.size();++i)
+        {
+            if (numPhotons[i] <= threshold) {
+                ++numSteps;
+            } else {
+                numSteps += (static_cast<uint64_t>(numPhotons[i])+subStepSize-1)/subStepSize;
+            }
+        }
+        numSteps += (workgroupSize - numSteps%workgroupSize)%workgroupSize;
+
+        if (numSteps <= maxNumDeviceWorkitems) break;
+    }
+    const bool splitSteps = (maxNumPhotons > threshold) && (bits < 32);
+
+    // only rebuild the bunch if there is something to gain
+    if ((!splitSteps) && (numDummySteps < workgroupSize)) return ClearSubStepFields(steps);
+
+    I3CLSimStep dummyStep;
+    dummyStep.SetPos(I3Position(0.,0.,0.));
+    dummyStep.SetDir(I3Direction(0.,0.,-1.));
+    dummyStep.SetTime(0.);
+    dummyStep.SetLength(0.);
+    dummyStep.SetNumPhotons(0);
+    dummyStep.SetWeight(0.);
+    dummyStep.SetBeta(1.);
+    dummyStep.SetID(0);
+    dummyStep.SetSequenceNumber(0);
+    dummyStep.SetSourceType(0);
+    dummyStep.SetDummy1(0);
+    dummyStep.SetDummy2(0);
+
+    I3CLSimStepSeriesPtr newSteps(new I3CLSimStepSeries());
+    newSteps->reserve(splitSteps?numSteps:steps->size());
+    BOOST_FOREACH(const I3CLSimStep &step, *steps)
+    {
+        if (step.numPhotons==0) continue;
+
+        if ((!splitSteps) || (step.numPhotons <= threshold)) {
+            newSteps->push_back(step);
+            newSteps->back().SetDummy1(0);
+            newSteps->back().SetDummy2(0);
+            continue;
+        }
+
+        const uint64_t subStepSize = static_cast<uint64_t>(1)<<bits;
+        uint16_t subStepIndex=0;
+        for (uint64_t firstPhoton=0;firstPhoton<step.numPhotons;firstPhoton+=subStepSize)
+        {
+            newSteps->push_back(step);
+            I3CLSimStep &subStep = newSteps->back();
+            subStep.SetNumPhotons(static_cast<uint32_t>(std::min(subStepSize, step.numPhotons-firstPhoton)));
+            subStep.SetDummy1(static_cast<uint8_t>(bits));
+            subStep.SetDummy2(subStepIndex);
+            ++subStepIndex;
+        }
+    }
+
+    while (newSteps->size()%workgroupSize != 0)
+        newSteps->push_back(dummyStep);
+
+    log_trace("Split %zu steps (median %" PRIu64 " photons) into %zu steps of up to %" PRIu64 " photons.",
+              steps->size(), medianNumPhotons, newSteps->size(),
+              splitSteps?(static_cast<uint64_t>(1)<<bits):static_cast<uint64_t>(maxNumPhotons));
+
+    return newSteps;
+}
+
+I3CLSimStepSeriesConstPtr I3CLSimStepToPhotonConverterOpenCL::ClearSubStepFields(const I3CLSimStepSeriesConstPtr &steps)
+{
+    bool hasSubStepFields=false;
+    BOOST_FOREACH(const I3CLSimStep &step, *steps)
+    {
+        if ((step.GetDummy1()!=0) || (step.GetDummy2()!=0)) {hasSubStepFields=true; break;}
+    }
+    if (!hasSubStepFields) return steps;
+
+    I3CLSimStepSeriesPtr newSteps(new I3CLSimStepSeries(*steps));
+    BOOST_FOREACH(I3CLSimStep &step, *newSteps)
+    {
+        step.SetDummy1(0);
+        step.SetDummy2(0);
+    }
+    return newSteps;
+}
+
 namespace {
     // converts from the internal photon history fromat (flat array of float4)
     // to a vector of I3CLSimPhotonHistory objects. The output stores photons
@@ -1069,80 +1691,159 @@ namespace {
 void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_downloadPhotons(boost::this_thread::disable_interruption &di,
                                                                            bool &shouldBreak,
                                                                            unsigned int bufferIndex,
-                                                                           uint32_t stepsIdentifier)
+                                                                           uint32_t stepsIdentifier,
+                                                                           const I3CLSimStepSeriesConstPtr &steps)
 {
     shouldBreak=false;
 
-    I3CLSimPhotonSeriesPtr photons;
+#ifdef DUMP_STATISTICS
+    const boost::posix_time::ptime conversion_start(boost::posix_time::microsec_clock::universal_time());
+#endif
+
+    I3CLSimPhotonSeriesPtr photons(new I3CLSimPhotonSeries());
     I3CLSimPhotonHistorySeriesPtr photonHistories;
-    boost::shared_ptr<std::vector<cl_float4> > photonHistoriesRaw;
+    std::vector<cl_float4> photonHistoriesRaw;
+
+    // Steps that lost hits because the output buffer was full are run
+    // again until all of their hits fit (see saveHit() in the kernel).
+    // The copy only keeps the photons of the ones still to be run.
+    I3CLSimStepSeries stepsToRerun;
+    const I3CLSimStepSeries *currentSteps = steps.get();
 
     try {
-        uint32_t numberOfGeneratedPhotons;
+        for (;;)
         {
-            cl::Event copyComplete;
-            queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_CurrentNumOutputPhotons[bufferIndex], CL_FALSE, 0, sizeof(uint32_t), &numberOfGeneratedPhotons, NULL, &copyComplete);
-            queue_[bufferIndex]->flush(); // make sure it starts executing on the device
-            waitForOpenCLEventYield(copyComplete);
-        }
+            uint32_t numberOfGeneratedPhotons;
+            {
+                cl::Event copyComplete;
+                queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_CurrentNumOutputPhotons[bufferIndex], CL_FALSE, 0, sizeof(uint32_t), &numberOfGeneratedPhotons, NULL, &copyComplete);
+                queue_[bufferIndex]->flush(); // make sure it starts executing on the device
+                waitForOpenCLEventYield(copyComplete);
+            }
 
 #ifdef I3_LOG4CPLUS_LOGGING
-        LOG_IMPL(INFO, "Num photons to copy (buffer %u): %" PRIu32, bufferIndex, numberOfGeneratedPhotons);
+            LOG_IMPL(INFO, "Num photons to copy (buffer %u): %" PRIu32, bufferIndex, numberOfGeneratedPhotons);
 #else
-        log_info("Num photons to copy (buffer %u): %" PRIu32, bufferIndex, numberOfGeneratedPhotons);
+            log_info("Num photons to copy (buffer %u): %" PRIu32, bufferIndex, numberOfGeneratedPhotons);
 #endif
 
-#ifdef DUMP_STATISTICS
-        {
-            boost::unique_lock<boost::mutex> guard(statistics_mutex_);
-            statistics_total_num_photons_atDOMs_ += numberOfGeneratedPhotons;
-        }
-#endif
+            // the counter includes the hits that did not fit
+            std::size_t numberOfSteps=0;
+            BOOST_FOREACH(const I3CLSimStep &step, *currentSteps)
+            {
+                if (step.numPhotons>0) ++numberOfSteps;
+            }
+            OpenCLThread_impl_adaptOutputBufferSize(numberOfGeneratedPhotons, numberOfSteps);
 
-        if (numberOfGeneratedPhotons > maxNumOutputPhotons_)
-        {
-            log_error("Maximum number of photons exceeded, only receiving %" PRIu32 " of %" PRIu32 " photons",
-                      maxNumOutputPhotons_, numberOfGeneratedPhotons);
-            numberOfGeneratedPhotons = maxNumOutputPhotons_;
-        }
+            const uint32_t maxNumOutputPhotons = maxNumOutputPhotonsPerBuffer_[bufferIndex];
+            const bool overflowed = (numberOfGeneratedPhotons > maxNumOutputPhotons);
+            const uint32_t numberOfStoredPhotons = std::min(numberOfGeneratedPhotons, maxNumOutputPhotons);
+            const std::size_t firstPhoton = photons->size();
 
-        if (numberOfGeneratedPhotons>0)
-        {
-            VECTOR_CLASS<cl::Event> copyComplete((photonHistoryEntries_>0)?2:1);
+            if (numberOfStoredPhotons>0)
+            {
+                VECTOR_CLASS<cl::Event> copyComplete((photonHistoryEntries_>0)?2:1);
 
-            // allocate the result vector while waiting for the mapping operation to complete
-            photons = I3CLSimPhotonSeriesPtr(new I3CLSimPhotonSeries(numberOfGeneratedPhotons));
-            if (photonHistoryEntries_>0) {
-                photonHistoriesRaw = boost::shared_ptr<std::vector<cl_float4> >(new std::vector<cl_float4>(numberOfGeneratedPhotons*static_cast<std::size_t>(photonHistoryEntries_)));
+                photons->resize(firstPhoton+numberOfStoredPhotons);
+                queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_OutputPhotons[bufferIndex], CL_FALSE, 0, numberOfStoredPhotons*sizeof(I3CLSimPhoton), &((*photons)[firstPhoton]), NULL, &copyComplete[0]);
+
+                if (photonHistoryEntries_>0) {
+                    photonHistoriesRaw.resize((firstPhoton+numberOfStoredPhotons)*static_cast<std::size_t>(photonHistoryEntries_));
+                    queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_PhotonHistory[bufferIndex], CL_FALSE, 0, numberOfStoredPhotons*static_cast<std::size_t>(photonHistoryEntries_)*sizeof(cl_float4), &(photonHistoriesRaw[firstPhoton*static_cast<std::size_t>(photonHistoryEntries_)]), NULL, &copyComplete[1]);
+                }
+
+                queue_[bufferIndex]->flush(); // make sure it starts executing on the device
+                waitForOpenCLEventsYield(copyComplete); // wait for the buffer(s) to be copied
             }
 
-            queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_OutputPhotons[bufferIndex], CL_FALSE, 0, numberOfGeneratedPhotons*sizeof(I3CLSimPhoton), &((*photons)[0]), NULL, &copyComplete[0]);
+            if (!overflowed) break;
 
-            if (photonHistoryEntries_>0) {
-                queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_PhotonHistory[bufferIndex], CL_FALSE, 0, numberOfGeneratedPhotons*static_cast<std::size_t>(photonHistoryEntries_)*sizeof(cl_float4), &((*photonHistoriesRaw)[0]), NULL, &copyComplete[1]);
+            // find out which steps lost hits and which step each stored hit belongs to
+            std::vector<cl_uint> overflowedSteps(currentSteps->size());
+            std::vector<cl_uint> photonSteps(numberOfStoredPhotons);
+            {
+                VECTOR_CLASS<cl::Event> copyComplete((numberOfStoredPhotons>0)?2:1);
+
+                queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_OverflowedSteps[bufferIndex], CL_FALSE, 0, overflowedSteps.size()*sizeof(cl_uint), &(overflowedSteps[0]), NULL, &copyComplete[0]);
+                if (numberOfStoredPhotons>0)
+                    queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_OutputPhotonSteps[bufferIndex], CL_FALSE, 0, photonSteps.size()*sizeof(cl_uint), &(photonSteps[0]), NULL, &copyComplete[1]);
+
+                queue_[bufferIndex]->flush(); // make sure it starts executing on the device
+                waitForOpenCLEventsYield(copyComplete);
             }
 
-            queue_[bufferIndex]->flush(); // make sure it starts executing on the device
-            waitForOpenCLEventsYield(copyComplete); // wait for the buffer(s) to be copied
+            // drop the hits of these steps, they are all produced again
+            std::size_t numberOfKeptPhotons = firstPhoton;
+            for (std::size_t i=0;i<numberOfStoredPhotons;++i)
+            {
+                if (photonSteps[i] >= overflowedSteps.size())
+                    log_fatal("Internal error: photon from step %u, but there are only %zu steps.",
+                              static_cast<unsigned int>(photonSteps[i]), overflowedSteps.size());
+                if (overflowedSteps[photonSteps[i]]) continue;
+
+                if (numberOfKeptPhotons != firstPhoton+i) {
+                    (*photons)[numberOfKeptPhotons] = (*photons)[firstPhoton+i];
+                    if (photonHistoryEntries_>0) {
+                        std::copy(photonHistoriesRaw.begin()+(firstPhoton+i)*photonHistoryEntries_,
+                                  photonHistoriesRaw.begin()+(firstPhoton+i+1)*photonHistoryEntries_,
+                                  photonHistoriesRaw.begin()+numberOfKeptPhotons*photonHistoryEntries_);
+                    }
+                }
+                ++numberOfKeptPhotons;
+            }
+            photons->resize(numberOfKeptPhotons);
+            if (photonHistoryEntries_>0) photonHistoriesRaw.resize(numberOfKeptPhotons*photonHistoryEntries_);
 
-            // convert the histories to the external representation
-            if (photonHistoriesRaw) {
-                photonHistories = ConvertPhotonHistories(*photonHistoriesRaw, *photons, photonHistoryEntries_);
+            if (currentSteps != &stepsToRerun) {
+                stepsToRerun = *currentSteps;
+                currentSteps = &stepsToRerun;
             }
-        }
-        else
-        {
-            // empty vector(s)
-            photons = I3CLSimPhotonSeriesPtr(new I3CLSimPhotonSeries());
-            if (photonHistoryEntries_>0) {
-                photonHistories = I3CLSimPhotonHistorySeriesPtr(new I3CLSimPhotonHistorySeries());
+            std::size_t numberOfOverflowedSteps=0;
+            for (std::size_t i=0;i<stepsToRerun.size();++i)
+            {
+                if (overflowedSteps[i]) {
+                    ++numberOfOverflowedSteps;
+                } else {
+                    stepsToRerun[i].SetNumPhotons(0);
+                }
             }
-        }
 
+            // they would not fit again
+            const bool canGrow = (maxNumOutputPhotons < maxNumOutputPhotons_);
+            if ((numberOfOverflowedSteps==numberOfSteps) && (!canGrow))
+                log_fatal("%zu steps produce %" PRIu32 " hits, but the output buffer cannot hold more than %" PRIu32 ".",
+                          numberOfSteps, numberOfGeneratedPhotons, maxNumOutputPhotons);
+
+            log_info("Output buffer %u overflowed (%" PRIu32 " hits, room for %" PRIu32 "), running %zu of %zu steps again.",
+                     bufferIndex, numberOfGeneratedPhotons, maxNumOutputPhotons, numberOfOverflowedSteps, numberOfSteps);
+
+            if (canGrow) AllocateOutputPhotonBuffers(bufferIndex, maxNumOutputPhotons_);
+
+            OpenCLThread_impl_rerunSteps(bufferIndex, stepsToRerun);
+        }
     } catch (cl::Error &err) {
         log_fatal("OpenCL ERROR (memcpy from device): %s (%i)", err.what(), err.err());
     }
 
+    // convert the histories to the external representation
+    if (photonHistoryEntries_>0) {
+        photonHistories = ConvertPhotonHistories(photonHistoriesRaw, *photons, photonHistoryEntries_);
+    }
+
+    // the next bunch of this buffer gets the grown buffers
+    if (maxNumOutputPhotonsPerBuffer_[bufferIndex] < maxNumOutputPhotons_)
+        AllocateOutputPhotonBuffers(bufferIndex, maxNumOutputPhotons_);
+
+#ifdef DUMP_STATISTICS
+    {
+        const boost::posix_time::time_duration conversion_duration =
+            boost::posix_time::microsec_clock::universal_time() - conversion_start;
+        boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+        statistics_total_num_photons_atDOMs_ += photons->size();
+        statistics_total_host_conversion_time_in_nanoseconds_ += conversion_duration.total_nanoseconds();
+    }
+#endif
+
     // we finished simulating.
     // signal the caller by putting it's id on the
     // output queue.
@@ -1157,12 +1858,21 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_downloadPhotons(boost
         }
     }
 
+    // tell anyone waiting on several converters that this one has a result
+    ResultAvailableCallback_t callback;
+    {
+        boost::unique_lock<boost::mutex> guard(resultAvailableCallback_mutex_);
+        callback = resultAvailableCallback_;
+    }
+    if (callback) callback(stepsIdentifier);
+
 
 }
 
 boost::posix_time::ptime
 I3CLSimStepToPhotonConverterOpenCL::DumpStatistics(const cl::Event &kernelFinishEvent,
                                                    const boost::posix_time::ptime &last_timestamp,
+                                                   uint64_t &last_kernel_end_in_nanoseconds,
                                                    uint64_t totalNumberOfPhotons,
                                                    bool starving,
                                                    const std::string &platformName,
@@ -1182,12 +1892,20 @@ I3CLSimStepToPhotonConverterOpenCL::DumpStatistics(const cl::Event &kernelFinish
 
     const uint64_t kernel_duration_in_nanoseconds = (timeStart==timeEnd)?deviceProfilingResolution:(timeEnd-timeStart);
 
+    // All buffers live on the same device, so their kernel timestamps can be compared.
+    // The time before the very first kernel does not count as idle time.
+    const uint64_t idle_duration_in_nanoseconds =
+        ((last_kernel_end_in_nanoseconds>0) && (timeStart>last_kernel_end_in_nanoseconds))?(timeStart-last_kernel_end_in_nanoseconds):0;
+    last_kernel_end_in_nanoseconds = timeEnd;
+
     {
         boost::unique_lock<boost::mutex> guard(statistics_mutex_);
 
         statistics_total_device_duration_in_nanoseconds_ += kernel_duration_in_nanoseconds;
+        statistics_total_device_idle_time_in_nanoseconds_ += idle_duration_in_nanoseconds;
         statistics_total_host_duration_in_nanoseconds_ += host_duration_in_nanoseconds;
         statistics_total_kernel_calls_++;
+        if (starving) statistics_total_starving_kernel_calls_++;
         statistics_total_num_photons_generated_ += totalNumberOfPhotons;
     }
 
@@ -1195,19 +1913,21 @@ I3CLSimStepToPhotonConverterOpenCL::DumpStatistics(const cl::Event &kernelFinish
 
 #ifdef I3_LOG4CPLUS_LOGGING
     // use LOG_IMPL here to make it log this even when in Release build mode.
-    LOG_IMPL(INFO, "kernel statistics: %s%g nanoseconds/photon, %lu photons (util: %.0f%%) (%s %s) %s",
+    LOG_IMPL(INFO, "kernel statistics: %s%g nanoseconds/photon, %lu photons (util: %.0f%%, idle before: %" PRIu64 "ns) (%s %s) %s",
              (timeStart==timeEnd)?"<=":"",
              static_cast<double>(kernel_duration_in_nanoseconds)/static_cast<double>(totalNumberOfPhotons),
              totalNumberOfPhotons,
              utilization*100.,
+             idle_duration_in_nanoseconds,
              platformName.c_str(), deviceName.c_str(),
              (starving?"[starving]":""));
 #else
-    log_info("kernel statistics: %s%g nanoseconds/photon, %lu photons (util: %.0f%%) (%s %s) %s",
+    log_info("kernel statistics: %s%g nanoseconds/photon, %lu photons (util: %.0f%%, idle before: %" PRIu64 "ns) (%s %s) %s",
              (timeStart==timeEnd)?"<=":"",
              static_cast<double>(kernel_duration_in_nanoseconds)/static_cast<double>(totalNumberOfPhotons),
              totalNumberOfPhotons,
              utilization*100.,
+             idle_duration_in_nanoseconds,
              platformName.c_str(), deviceName.c_str(),
              (starving?"[starving]":""));
 #endif
@@ -1221,10 +1941,10 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl(boost::this_thread::d
     // set things up here
     if (!context_) log_fatal("Internal error: context is (null)");
 
-    const std::size_t numBuffers = disableDoubleBuffering_?1:2;
+    const std::size_t numBuffers = bufferRingDepth_;
 
-    if (queue_.size() != numBuffers) log_fatal("Internal error: queue_.size() != 2!");
-    if (kernel_.size() != numBuffers) log_fatal("Internal error: kernel_.size() != 2!");
+    if (queue_.size() != numBuffers) log_fatal("Internal error: queue_.size() != %zu!", numBuffers);
+    if (kernel_.size() != numBuffers) log_fatal("Internal error: kernel_.size() != %zu!", numBuffers);
 
     BOOST_FOREACH(boost::shared_ptr<cl::CommandQueue> &ptr, queue_) {
         if (!ptr) log_fatal("Internal error: queue_[] is (null)");
@@ -1233,11 +1953,11 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl(boost::this_thread::d
         if (!ptr) log_fatal("Internal error: kernel_[] is (null)");
     }
 
-    if (deviceBuffer_InputSteps.size() != numBuffers) log_fatal("Internal error: deviceBuffer_InputSteps.size() != 2!");
-    if (deviceBuffer_OutputPhotons.size() != numBuffers) log_fatal("Internal error: deviceBuffer_OutputPhotons.size() != 2!");
-    if (deviceBuffer_CurrentNumOutputPhotons.size() != numBuffers) log_fatal("Internal error: deviceBuffer_CurrentNumOutputPhotons.size() != 2!");
+    if (deviceBuffer_InputSteps.size() != numBuffers) log_fatal("Internal error: deviceBuffer_InputSteps.size() != %zu!", numBuffers);
+    if (deviceBuffer_OutputPhotons.size() != numBuffers) log_fatal("Internal error: deviceBuffer_OutputPhotons.size() != %zu!", numBuffers);
+    if (deviceBuffer_CurrentNumOutputPhotons.size() != numBuffers) log_fatal("Internal error: deviceBuffer_CurrentNumOutputPhotons.size() != %zu!", numBuffers);
     if (photonHistoryEntries_ > 0) {
-        if (deviceBuffer_PhotonHistory.size() != numBuffers) log_fatal("Internal error: deviceBuffer_PhotonHistory.size() != 2!");
+        if (deviceBuffer_PhotonHistory.size() != numBuffers) log_fatal("Internal error: deviceBuffer_PhotonHistory.size() != %zu!", numBuffers);
     }
 
     BOOST_FOREACH(boost::shared_ptr<cl::Buffer> &ptr, deviceBuffer_InputSteps) {
@@ -1259,8 +1979,15 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl(boost::this_thread::d
     if (!saveAllPhotons_) {
         if (!deviceBuffer_GeoLayerToOMNumIndexPerStringSet) log_fatal("Internal error: deviceBuffer_GeoLayerToOMNumIndexPerStringSet is (null)");
     }
-    if (!deviceBuffer_MWC_RNG_x) log_fatal("Internal error: deviceBuffer_MWC_RNG_x is (null)");
-    if (!deviceBuffer_MWC_RNG_a) log_fatal("Internal error: deviceBuffer_MWC_RNG_a is (null)");
+    if (profileKernel_) {
+        BOOST_FOREACH(boost::shared_ptr<cl::Buffer> &ptr, deviceBuffer_KernelProfile) {
+            if (!ptr) log_fatal("Internal error: deviceBuffer_KernelProfile[] is (null)");
+        }
+    }
+    if (!useCounterBasedRNG_) {
+        if (!deviceBuffer_MWC_RNG_x) log_fatal("Internal error: deviceBuffer_MWC_RNG_x is (null)");
+        if (!deviceBuffer_MWC_RNG_a) log_fatal("Internal error: deviceBuffer_MWC_RNG_a is (null)");
+    }
 
     // notify the main thread that everything is set up
     {
@@ -1269,81 +1996,74 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl(boost::this_thread::d
     }
     openCLStarted_cond_.notify_all();
 
+    // the state of each buffer in the ring
     std::vector<uint32_t> stepsIdentifier(numBuffers, 0);
     std::vector<uint64_t> totalNumberOfPhotons(numBuffers, 0);
     std::vector<std::size_t> numberOfSteps(numBuffers, 0);
+    std::vector<I3CLSimStepSeriesConstPtr> steps(numBuffers); // keeps the steps around until their results are in
+    std::vector<cl::Event> kernelFinishEvents(numBuffers);
+    std::vector<bool> starving(numBuffers, false);
 
 #ifdef DUMP_STATISTICS
     boost::posix_time::ptime last_timestamp(boost::posix_time::microsec_clock::universal_time());
+    uint64_t last_kernel_end_in_nanoseconds=0;
 #endif
 
-    unsigned int thisBuffer=0;
-    unsigned int otherBuffer=1;
-    bool otherBufferHasBeenCopied=false;
-
-    if (!disableDoubleBuffering_) {
-        // swap buffers once to swap them back just a few lines later
-        std::swap(thisBuffer, otherBuffer);
-    }
+    // The buffers in flight (steps copied and kernel enqueued, but
+    // results not yet received) are the ones starting at oldestBuffer,
+    // wrapping around at the end of the ring.
+    unsigned int oldestBuffer=0;
+    unsigned int numBuffersInFlight=0;
 
     // start the main loop
     for (;;)
     {
-        if (!disableDoubleBuffering_) {
-            // swap buffers
-            std::swap(thisBuffer, otherBuffer);
-        }
+        bool shouldBreak=false; // shouldBreak is true if this thread has been signalled to terminate
 
-        log_trace("buffers indices now: this==%u, other==%u", thisBuffer, otherBuffer);
-
-        bool starving=false;
-        if ((!otherBufferHasBeenCopied) || (disableDoubleBuffering_)) {
-            if (!disableDoubleBuffering_) starving=true;
-            log_trace("[%u] starting \"this\" buffer copy (need to block)..", thisBuffer);
-            {
-                bool shouldBreak=false; // shouldBreak is true if this thread has been signalled to terminate
-                OpenCLThread_impl_uploadSteps(di, shouldBreak, thisBuffer, stepsIdentifier[thisBuffer], totalNumberOfPhotons[thisBuffer], numberOfSteps[thisBuffer]);
-                if (shouldBreak) break; // is thread termination being requested?
-            }
-            log_trace("[%u] this buffer has been copied..", thisBuffer);
-        } else {
-            // else: this buffer is already there!
-            log_trace("[%u] buffer is already there!", thisBuffer);
-        }
+        // fill all free buffers with whatever is on the queue
+        while (numBuffersInFlight < numBuffers)
+        {
+            const unsigned int thisBuffer = (oldestBuffer+numBuffersInFlight)%numBuffers;
 
-        // reset the "has-been-copied" flag
-        otherBufferHasBeenCopied=false;
+            // only block if there is nothing else to do
+            const bool blocking = (numBuffersInFlight==0);
 
+            log_trace("[%u] starting buffer copy (%s)..", thisBuffer, blocking?"need to block":"non-blocking");
+            const bool gotSomething = OpenCLThread_impl_uploadSteps(di, shouldBreak, thisBuffer, stepsIdentifier[thisBuffer], totalNumberOfPhotons[thisBuffer], numberOfSteps[thisBuffer], steps[thisBuffer], blocking);
+            if (shouldBreak) break; // is thread termination being requested?
 
-        // start the kernel
-        cl::Event kernelFinishEvent;
-        OpenCLThread_impl_runKernel(thisBuffer, kernelFinishEvent, numberOfSteps[thisBuffer]);
+            if (!gotSomething) {
+                log_trace("[%u] buffer copy: queue empty!", thisBuffer);
+                break;
+            }
 
-        if (!disableDoubleBuffering_)
-        {
-            // if there already is a new buffer available, copy it now, while the kernel is running
-            log_trace("[%u] Starting copy (other buffer)..", otherBuffer);
+            // the device ran out of work if we had to wait for this one
+            starving[thisBuffer] = blocking && (numBuffers>1);
 
-            bool shouldBreak=false; // shouldBreak is true if this thread has been signalled to terminate
-            bool gotSomething = OpenCLThread_impl_uploadSteps(di, shouldBreak, otherBuffer, stepsIdentifier[otherBuffer], totalNumberOfPhotons[otherBuffer], numberOfSteps[otherBuffer], false);
-            if (shouldBreak) break;
+            // start the kernel (with the MWC generator after the kernel of the previous buffer, if that is still in flight)
+            const cl::Event *previousKernelFinishEvent =
+                (numBuffersInFlight>0)?&(kernelFinishEvents[(thisBuffer+numBuffers-1)%numBuffers]):NULL;
+            OpenCLThread_impl_runKernel(thisBuffer, kernelFinishEvents[thisBuffer], numberOfSteps[thisBuffer], previousKernelFinishEvent);
 
-            if (!gotSomething) {
-                log_trace("[%u] copy (other buffer): queue empty!", otherBuffer);
-                // nothing on the queue
-                otherBufferHasBeenCopied=false;
-            } else {
-                log_trace("[%u] copy (other buffer):  done!", otherBuffer);
-                otherBufferHasBeenCopied=true;
-            }
+            ++numBuffersInFlight;
+            log_trace("[%u] buffer is in flight (%u of %zu buffers in flight)", thisBuffer, numBuffersInFlight, numBuffers);
         }
+        if (shouldBreak) break;
 
-
-        log_trace("[%u] waiting for kernel..", thisBuffer);
+        const unsigned int thisBuffer = oldestBuffer;
 
         try {
+            // If there are free buffers left, keep looking for new steps
+            // while the kernel is running instead of just waiting for it.
+            if ((numBuffersInFlight < numBuffers) && (!isOpenCLEventComplete(kernelFinishEvents[thisBuffer]))) {
+                yieldOpenCLThread();
+                continue;
+            }
+
+            log_trace("[%u] waiting for kernel..", thisBuffer);
+
             // wait for the kernel to finish
-            waitForOpenCLEventYield(kernelFinishEvent);
+            waitForOpenCLEventYield(kernelFinishEvents[thisBuffer]);
         } catch (cl::Error &err) {
             log_fatal("[%u] OpenCL ERROR (running kernel): %s (%i)", thisBuffer, err.what(), err.err());
         }
@@ -1353,15 +2073,20 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl(boost::this_thread::d
 #ifdef DUMP_STATISTICS
         log_trace("[%u] dumping statistics..", thisBuffer);
 
-        last_timestamp = DumpStatistics(kernelFinishEvent,
+        last_timestamp = DumpStatistics(kernelFinishEvents[thisBuffer],
                                         last_timestamp,
+                                        last_kernel_end_in_nanoseconds,
                                         totalNumberOfPhotons[thisBuffer],
-                                        starving,
+                                        starving[thisBuffer],
                                         device_->GetPlatformName(),
                                         device_->GetDeviceName(),
                                         (device_->GetDeviceHandle())->getInfo<CL_DEVICE_PROFILING_TIMER_RESOLUTION>() );
 #endif
 
+        if ((stepSplittingFactor_ > 0.) && (!usePersistentThreads_)) {
+            OpenCLThread_impl_adaptStepSplittingFactor(kernelFinishEvents[thisBuffer], *(steps[thisBuffer]));
+        }
+
         log_trace("[%u] waiting for queue..", thisBuffer);
 
         try {
@@ -1373,15 +2098,25 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl(boost::this_thread::d
 
         log_trace("[%u] queue finished!", thisBuffer);
 
+        if (profileKernel_) {
+            log_trace("[%u] receiving kernel profile..", thisBuffer);
+            OpenCLThread_impl_downloadKernelProfile(thisBuffer, numberOfSteps[thisBuffer]);
+        }
+
         // receive results
         log_trace("[%u] receiving results..!", thisBuffer);
         {
-            bool shouldBreak;
-            OpenCLThread_impl_downloadPhotons(di, shouldBreak, thisBuffer, stepsIdentifier[thisBuffer]);
+            OpenCLThread_impl_downloadPhotons(di, shouldBreak, thisBuffer, stepsIdentifier[thisBuffer], steps[thisBuffer]);
             if (shouldBreak) break; // is thread termination being requested?
         }
         log_trace("[%u] results received.", thisBuffer);
 
+        // the steps are kept until here in case some of them have to run again
+        steps[thisBuffer].reset();
+
+        // this buffer is free again
+        oldestBuffer = (oldestBuffer+1)%numBuffers;
+        --numBuffersInFlight;
     }
 
     log_debug("OpenCL thread terminating...");
@@ -1405,12 +2140,32 @@ void I3CLSimStepToPhotonConverterOpenCL::SetEnableDoubleBuffering(bool value)
     kernel_.clear();
     queue_.clear();
 
-    disableDoubleBuffering_=(!value);
+    bufferRingDepth_=value?2:1;
 }
 
 bool I3CLSimStepToPhotonConverterOpenCL::GetEnableDoubleBuffering() const
 {
-    return (!disableDoubleBuffering_);
+    return (bufferRingDepth_>1);
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetBufferRingDepth(std::size_t value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+
+    if (value==0)
+        throw I3CLSimStepToPhotonConverter_exception("The buffer ring depth must be at least 1!");
+
+    compiled_=false;
+    kernel_.clear();
+    queue_.clear();
+
+    bufferRingDepth_=value;
+}
+
+std::size_t I3CLSimStepToPhotonConverterOpenCL::GetBufferRingDepth() const
+{
+    return bufferRingDepth_;
 }
 
 
@@ -1601,6 +2356,8 @@ double I3CLSimStepToPhotonConverterOpenCL::GetDOMPancakeFactor() const
 
 void I3CLSimStepToPhotonConverterOpenCL::SetHoleIceCylinderPositions(I3Vector<I3Position> holeIceCylinderPositions)
 {
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized! Use UpdateHoleIceCylinders() instead.");
     holeIceCylinderPositions_ = holeIceCylinderPositions;
 }
 
@@ -1611,6 +2368,8 @@ I3Vector<I3Position> I3CLSimStepToPhotonConverterOpenCL::GetHoleIceCylinderPosit
 
 void I3CLSimStepToPhotonConverterOpenCL::SetHoleIceCylinderRadii(I3Vector<float> holeIceCylinderRadii)
 {
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized! Use UpdateHoleIceCylinders() instead.");
     holeIceCylinderRadii_ = holeIceCylinderRadii;
 }
 
@@ -1621,6 +2380,8 @@ I3Vector<float> I3CLSimStepToPhotonConverterOpenCL::GetHoleIceCylinderRadii()
 
 void I3CLSimStepToPhotonConverterOpenCL::SetHoleIceCylinderScatteringLengths(I3Vector<float> holeIceCylinderScatteringLengths)
 {
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized! Use UpdateHoleIceCylinders() instead.");
     holeIceCylinderScatteringLengths_ = holeIceCylinderScatteringLengths;
 }
 
@@ -1631,6 +2392,8 @@ I3Vector<float> I3CLSimStepToPhotonConverterOpenCL::GetHoleIceCylinderScattering
 
 void I3CLSimStepToPhotonConverterOpenCL::SetHoleIceCylinderAbsorptionLengths(I3Vector<float> holeIceCylinderAbsorptionLengths)
 {
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized! Use UpdateHoleIceCylinders() instead.");
     holeIceCylinderAbsorptionLengths_ = holeIceCylinderAbsorptionLengths;
 }
 
@@ -1639,6 +2402,313 @@ I3Vector<float> I3CLSimStepToPhotonConverterOpenCL::GetHoleIceCylinderAbsorption
     return holeIceCylinderAbsorptionLengths_;
 }
 
+void I3CLSimStepToPhotonConverterOpenCL::UpdateHoleIceCylinders(const I3Vector<I3Position> &holeIceCylinderPositions,
+                                                                const I3Vector<float> &holeIceCylinderRadii,
+                                                                const I3Vector<float> &holeIceCylinderScatteringLengths,
+                                                                const I3Vector<float> &holeIceCylinderAbsorptionLengths)
+{
+    if (!simulateHoleIce_)
+        throw I3CLSimStepToPhotonConverter_exception("Hole ice simulation is not enabled. Call SetSimulateHoleIce(true) before Initialize().");
+
+    if ((holeIceCylinderRadii.size() != holeIceCylinderPositions.size()) ||
+        (holeIceCylinderScatteringLengths.size() != holeIceCylinderPositions.size()) ||
+        (holeIceCylinderAbsorptionLengths.size() != holeIceCylinderPositions.size()))
+        throw I3CLSimStepToPhotonConverter_exception("All hole ice cylinder vectors need to have the same size!");
+
+    boost::unique_lock<boost::mutex> guard(holeIceCylinders_mutex_);
+
+    holeIceCylinderPositions_ = holeIceCylinderPositions;
+    holeIceCylinderRadii_ = holeIceCylinderRadii;
+    holeIceCylinderScatteringLengths_ = holeIceCylinderScatteringLengths;
+    holeIceCylinderAbsorptionLengths_ = holeIceCylinderAbsorptionLengths;
+
+    // picked up by Initialize() or by the next kernel launch of each buffer
+    holeIceCylindersChanged_.assign(holeIceCylindersChanged_.size(), true);
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetHoleIceCylindersInConstantMemory(bool value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+
+    if (value != holeIceCylindersInConstantMemory_) compiled_=false;
+    holeIceCylindersInConstantMemory_ = value;
+}
+
+bool I3CLSimStepToPhotonConverterOpenCL::GetHoleIceCylindersInConstantMemory() const
+{
+    return holeIceCylindersInConstantMemory_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetOpticalDepthTableWavelengthBins(std::size_t value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+
+    if (value == 1)
+        throw I3CLSimStepToPhotonConverter_exception("The optical depth table needs at least 2 wavelength bins (or 0 to disable it).");
+
+    if (value != opticalDepthTableWavelengthBins_) compiled_=false;
+    opticalDepthTableWavelengthBins_ = value;
+}
+
+std::size_t I3CLSimStepToPhotonConverterOpenCL::GetOpticalDepthTableWavelengthBins() const
+{
+    return opticalDepthTableWavelengthBins_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetLengthTableWavelengthBins(std::size_t value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+
+    if (value == 1)
+        throw I3CLSimStepToPhotonConverter_exception("The scattering and absorption length tables need at least 2 wavelength bins (or 0 to disable them).");
+
+    if (value != lengthTableWavelengthBins_) compiled_=false;
+    lengthTableWavelengthBins_ = value;
+}
+
+std::size_t I3CLSimStepToPhotonConverterOpenCL::GetLengthTableWavelengthBins() const
+{
+    return lengthTableWavelengthBins_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetUseCounterBasedRNG(bool value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+
+    if (value != useCounterBasedRNG_) compiled_=false;
+    useCounterBasedRNG_ = value;
+}
+
+bool I3CLSimStepToPhotonConverterOpenCL::GetUseCounterBasedRNG() const
+{
+    return useCounterBasedRNG_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetProfileKernel(bool value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+
+    if (value != profileKernel_) compiled_=false;
+    profileKernel_ = value;
+}
+
+bool I3CLSimStepToPhotonConverterOpenCL::GetProfileKernel() const
+{
+    return profileKernel_;
+}
+
+bool I3CLSimStepToPhotonConverterOpenCL::GetKernelProfileHasClock() const
+{
+    return profileKernelHasClock_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetUsePersistentThreads(bool value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+
+    if (value != usePersistentThreads_) compiled_=false;
+    usePersistentThreads_ = value;
+}
+
+bool I3CLSimStepToPhotonConverterOpenCL::GetUsePersistentThreads() const
+{
+    return usePersistentThreads_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetNumPersistentWorkItems(std::size_t value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+
+    numPersistentWorkItems_ = value;
+}
+
+std::size_t I3CLSimStepToPhotonConverterOpenCL::GetNumPersistentWorkItems() const
+{
+    return numPersistentWorkItems_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetStepSplittingFactor(double value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+
+    if (value < 0.)
+        throw I3CLSimStepToPhotonConverter_exception("The step splitting factor must not be negative!");
+
+    stepSplittingFactor_ = value;
+}
+
+double I3CLSimStepToPhotonConverterOpenCL::GetStepSplittingFactor() const
+{
+    return stepSplittingFactor_;
+}
+
+std::string I3CLSimStepToPhotonConverterOpenCL::GetKernelProfilePhaseName(KernelProfilePhase phase)
+{
+    switch (phase) {
+        case KernelProfilePhotonCreation: return "PhotonCreation";
+        case KernelProfileMediumPropagation: return "MediumPropagation";
+        case KernelProfileLayerWalk: return "LayerWalk";
+        case KernelProfileCylinderIntersection: return "CylinderIntersection";
+        case KernelProfileCollisionCheck: return "CollisionCheck";
+        case KernelProfileHitSaving: return "HitSaving";
+        default: break;
+    }
+    throw I3CLSimStepToPhotonConverter_exception("Unknown kernel profile phase!");
+}
+
+namespace {
+    // creates a read-only buffer holding `values` in the floating point
+    // precision the kernel has been compiled with
+    boost::shared_ptr<cl::Buffer> MakeFloatingPointBuffer(cl::Context &context,
+                                                          const std::vector<double> &values,
+                                                          bool doublePrecision)
+    {
+        // OpenCL does not allow empty buffers
+        const std::size_t size = std::max<std::size_t>(values.size(), 1);
+
+        if (doublePrecision) {
+            std::vector<cl_double> hostBuffer(size, 0.);
+            std::copy(values.begin(), values.end(), hostBuffer.begin());
+            return boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size * sizeof(cl_double), &(hostBuffer[0])));
+        } else {
+            std::vector<cl_float> hostBuffer(size, 0.f);
+            std::copy(values.begin(), values.end(), hostBuffer.begin());
+            return boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size * sizeof(cl_float), &(hostBuffer[0])));
+        }
+    }
+
+    boost::shared_ptr<cl::Buffer> MakeUIntBuffer(cl::Context &context,
+                                                 const std::vector<unsigned int> &values)
+    {
+        // OpenCL does not allow empty buffers
+        std::vector<cl_uint> hostBuffer(std::max<std::size_t>(values.size(), 1), 0);
+        std::copy(values.begin(), values.end(), hostBuffer.begin());
+        return boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, hostBuffer.size() * sizeof(cl_uint), &(hostBuffer[0])));
+    }
+}
+
+// expects holeIceCylinders_mutex_ to be locked
+// Each buffer of the ring has its own copy of the cylinders.
+void I3CLSimStepToPhotonConverterOpenCL::UploadHoleIceCylinders(unsigned int bufferIndex)
+{
+    const std::size_t numberOfCylinders = holeIceCylinderPositions_.size();
+
+    if ((holeIceCylinderRadii_.size() != numberOfCylinders) ||
+        (holeIceCylinderScatteringLengths_.size() != numberOfCylinders) ||
+        (holeIceCylinderAbsorptionLengths_.size() != numberOfCylinders))
+        log_fatal("Got %zu hole ice cylinder positions, but %zu radii, %zu scattering lengths and %zu absorption lengths.",
+                  numberOfCylinders, holeIceCylinderRadii_.size(),
+                  holeIceCylinderScatteringLengths_.size(), holeIceCylinderAbsorptionLengths_.size());
+
+    // {x, y, z, radius} per cylinder
+    std::vector<double> positionsAndRadii;
+    positionsAndRadii.reserve(numberOfCylinders*4);
+    for (std::size_t i = 0; i < numberOfCylinders; i++)
+    {
+        positionsAndRadii.push_back(holeIceCylinderPositions_[i].GetX());
+        positionsAndRadii.push_back(holeIceCylinderPositions_[i].GetY());
+        positionsAndRadii.push_back(holeIceCylinderPositions_[i].GetZ());
+        positionsAndRadii.push_back(holeIceCylinderRadii_[i]);
+
+        if (bufferIndex==0) log_info("Hole ice cylinder at {x,y,z,radius}: {%g, %g, %g, %g}, scattering length %g, absorption length %g",
+                 holeIceCylinderPositions_[i].GetX(), holeIceCylinderPositions_[i].GetY(),
+                 holeIceCylinderPositions_[i].GetZ(), holeIceCylinderRadii_[i],
+                 holeIceCylinderScatteringLengths_[i], holeIceCylinderAbsorptionLengths_[i]);
+    }
+    const std::vector<double> scatteringLengths(holeIceCylinderScatteringLengths_.begin(), holeIceCylinderScatteringLengths_.end());
+    const std::vector<double> absorptionLengths(holeIceCylinderAbsorptionLengths_.begin(), holeIceCylinderAbsorptionLengths_.end());
+
+    // Spatial grid over the cylinders. This allows the kernel to only
+    // look at the cylinders near the photon path instead of testing
+    // all of them in each scattering step.
+    const I3CLSimHelper::HoleIceCylinderGrid cylinderGrid =
+        I3CLSimHelper::GenerateHoleIceCylinderGrid(holeIceCylinderPositions_, holeIceCylinderRadii_);
+
+    std::vector<double> gridGeometry;
+    gridGeometry.push_back(cylinderGrid.startX);
+    gridGeometry.push_back(cylinderGrid.startY);
+    gridGeometry.push_back(cylinderGrid.widthX);
+    gridGeometry.push_back(cylinderGrid.widthY);
+    gridGeometry.push_back(cylinderGrid.maxRadius);
+
+    try {
+        deviceBuffer_HoleIceCylinderPositionsAndRadii[bufferIndex] = MakeFloatingPointBuffer(*context_, positionsAndRadii, doublePrecision_);
+        deviceBuffer_HoleIceCylinderScatteringLengths[bufferIndex] = MakeFloatingPointBuffer(*context_, scatteringLengths, doublePrecision_);
+        deviceBuffer_HoleIceCylinderAbsorptionLengths[bufferIndex] = MakeFloatingPointBuffer(*context_, absorptionLengths, doublePrecision_);
+        deviceBuffer_HoleIceCylinderGridGeometry[bufferIndex] = MakeFloatingPointBuffer(*context_, gridGeometry, doublePrecision_);
+        deviceBuffer_HoleIceCylinderGridCellStartIndices[bufferIndex] = MakeUIntBuffer(*context_, cylinderGrid.cellStartIndices);
+        deviceBuffer_HoleIceCylinderGridCylinderIndices[bufferIndex] = MakeUIntBuffer(*context_, cylinderGrid.cylinderIndices);
+
+        // Kernel arguments are captured when a kernel is enqueued, so
+        // a kernel that is already running keeps the old buffers.
+        unsigned argN = holeIceFirstKernelArg_;
+
+        kernel_[bufferIndex]->setArg(argN++, static_cast<cl_uint>(numberOfCylinders));
+        kernel_[bufferIndex]->setArg(argN++, *deviceBuffer_HoleIceCylinderPositionsAndRadii[bufferIndex]);
+        kernel_[bufferIndex]->setArg(argN++, *deviceBuffer_HoleIceCylinderScatteringLengths[bufferIndex]);
+        kernel_[bufferIndex]->setArg(argN++, *deviceBuffer_HoleIceCylinderAbsorptionLengths[bufferIndex]);
+        kernel_[bufferIndex]->setArg(argN++, *deviceBuffer_HoleIceCylinderGridGeometry[bufferIndex]);
+        kernel_[bufferIndex]->setArg(argN++, static_cast<cl_uint>(cylinderGrid.numX));
+        kernel_[bufferIndex]->setArg(argN++, static_cast<cl_uint>(cylinderGrid.numY));
+        kernel_[bufferIndex]->setArg(argN++, *deviceBuffer_HoleIceCylinderGridCellStartIndices[bufferIndex]);
+        kernel_[bufferIndex]->setArg(argN++, *deviceBuffer_HoleIceCylinderGridCylinderIndices[bufferIndex]);
+
+        holeIceCylindersChanged_[bufferIndex] = false;
+    } catch (cl::Error &err) {
+        log_fatal("OpenCL ERROR (uploading hole ice cylinders): %s (%i)", err.what(), err.err());
+    }
+}
+
+// The kernel of this buffer must not be running.
+void I3CLSimStepToPhotonConverterOpenCL::AllocateOutputPhotonBuffers(unsigned int bufferIndex, uint32_t maxNumOutputPhotons)
+{
+    try {
+        // release the old buffers first, they may be large
+        deviceBuffer_OutputPhotons[bufferIndex].reset();
+        deviceBuffer_OutputPhotonSteps[bufferIndex].reset();
+        if (photonHistoryEntries_>0) deviceBuffer_PhotonHistory[bufferIndex].reset();
+
+        deviceBuffer_OutputPhotons[bufferIndex] = boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(*context_, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, static_cast<std::size_t>(maxNumOutputPhotons)*sizeof(I3CLSimPhoton), NULL));
+
+        deviceBuffer_OutputPhotonSteps[bufferIndex] = boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(*context_, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, static_cast<std::size_t>(maxNumOutputPhotons)*sizeof(cl_uint), NULL));
+
+        if (photonHistoryEntries_>0) {
+            deviceBuffer_PhotonHistory[bufferIndex] = boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(*context_,
+                            CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                            static_cast<std::size_t>(maxNumOutputPhotons)*static_cast<std::size_t>(photonHistoryEntries_)*sizeof(cl_float4),
+                            NULL));
+        }
+
+        unsigned argN = outputPhotonsFirstKernelArg_;
+
+        kernel_[bufferIndex]->setArg(1, maxNumOutputPhotons);                                       // maximum number of possible hits
+        kernel_[bufferIndex]->setArg(argN++, *(deviceBuffer_OutputPhotons[bufferIndex]));           // the output photons
+        if (photonHistoryEntries_>0) {
+            kernel_[bufferIndex]->setArg(argN++, *(deviceBuffer_PhotonHistory[bufferIndex]));       // the photon history (the last N points where the photon scattered)
+        }
+        kernel_[bufferIndex]->setArg(argN++, *(deviceBuffer_OutputPhotonSteps[bufferIndex]));       // the step of each output photon
+    } catch (cl::Error &err) {
+        log_fatal("OpenCL ERROR (allocating output buffers for %" PRIu32 " photons): %s (%i)",
+                  maxNumOutputPhotons, err.what(), err.err());
+    }
+
+    maxNumOutputPhotonsPerBuffer_[bufferIndex] = maxNumOutputPhotons;
+}
+
 
 void I3CLSimStepToPhotonConverterOpenCL::SetWlenGenerators(const std::vector<I3CLSimRandomValueConstPtr> &wlenGenerators)
 {
@@ -1783,3 +2853,24 @@ I3CLSimStepToPhotonConverter::ConversionResult_t I3CLSimStepToPhotonConverterOpe
 
     return result;
 }
+
+bool I3CLSimStepToPhotonConverterOpenCL::SetResultAvailableCallback(const ResultAvailableCallback_t &callback)
+{
+    boost::unique_lock<boost::mutex> guard(resultAvailableCallback_mutex_);
+    resultAvailableCallback_ = callback;
+    return true;
+}
+
+bool I3CLSimStepToPhotonConverterOpenCL::GetThroughputStatistics(uint64_t &numPhotons, double &busyTime)
+{
+#ifdef DUMP_STATISTICS
+    boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+    if (statistics_total_kernel_calls_==0) return false;
+
+    numPhotons = statistics_total_num_photons_generated_;
+    busyTime = static_cast<double>(statistics_total_device_duration_in_nanoseconds_)*1e-9;
+    return true;
+#else
+    return false;
+#endif
+}
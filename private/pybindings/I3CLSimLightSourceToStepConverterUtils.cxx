@@ -44,6 +44,7 @@ void register_I3CLSimLightSourceToStepConverterUtils()
     // this can be used for testing purposes
     bp::def("NumberOfPhotonsPerMeter", &I3CLSimLightSourceToStepConverterUtils::NumberOfPhotonsPerMeter);
     bp::def("PhotonNumberCorrectionFactorAfterBias", &I3CLSimLightSourceToStepConverterUtils::PhotonNumberCorrectionFactorAfterBias);
+    bp::def("PredictedNumberOfPhotons", &I3CLSimLightSourceToStepConverterUtils::PredictedNumberOfPhotons);
     bp::def("gammaDistributedNumber", gammaDistributedNumber_smartPtr);
 
     //bp::def("scatterDirectionByAngle", &I3CLSimLightSourceToStepConverterUtils::scatterDirectionByAngle);
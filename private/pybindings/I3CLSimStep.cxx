@@ -30,6 +30,7 @@
 #include <dataclasses/physics/I3Particle.h>
 
 #include <clsim/I3CLSimStep.h>
+#include <clsim/I3CLSimStepStore.h>
 #include <boost/preprocessor/seq.hpp>
 
 #include <icetray/python/list_indexing_suite.hpp>
@@ -55,6 +56,7 @@ i3clsimstep_prettyprint(const I3CLSimStep& s)
         << "             num : " << s.GetNumPhotons() << std::endl
         << "          weight : " << s.GetWeight() << std::endl
         << "            beta : " << s.GetBeta() << std::endl
+        << "  sequenceNumber : " << s.GetSequenceNumber() << std::endl
         << "      sourceType : " << s.GetSourceType() << std::endl
         << "          dummy1 : " << s.GetDummy1() << std::endl
         << "          dummy2 : " << s.GetDummy2() << std::endl
@@ -73,6 +75,29 @@ struct ConstPtr_to_python
     }
 };
 
+static I3CLSimStepSeriesPtr
+i3clsimstepstore_pop_bunch(I3CLSimStepStore &store, std::size_t size)
+{
+    I3CLSimStepSeriesPtr steps(new I3CLSimStepSeries());
+    store.pop_bunch_to_vector(size, *steps);
+    return steps;
+}
+
+static I3CLSimStepSeriesPtr
+i3clsimstepstore_pop_bunch_with_template(I3CLSimStepStore &store, std::size_t size, const I3CLSimStep &temp)
+{
+    I3CLSimStepSeriesPtr steps(new I3CLSimStepSeries());
+    store.pop_bunch_to_vector(size, *steps, temp);
+    return steps;
+}
+
+// returns a copy of the new step, which stays in the store
+static I3CLSimStep
+i3clsimstepstore_insert_new(I3CLSimStepStore &store, std::size_t index)
+{
+    return store.insert_new(index);
+}
+
 void register_I3CLSimStep()
 {
     {
@@ -94,6 +119,7 @@ void register_I3CLSimStep()
         .add_property("num", &I3CLSimStep::GetNumPhotons, &I3CLSimStep::SetNumPhotons)
         .add_property("weight", &I3CLSimStep::GetWeight, &I3CLSimStep::SetWeight)
         .add_property("id", &I3CLSimStep::GetID, &I3CLSimStep::SetID)
+        .add_property("sequenceNumber", &I3CLSimStep::GetSequenceNumber, &I3CLSimStep::SetSequenceNumber)
         .add_property("sourceType", &I3CLSimStep::GetSourceType, &I3CLSimStep::SetSourceType)
 
         .add_property("dummy1", &I3CLSimStep::GetDummy1, &I3CLSimStep::SetDummy1)
@@ -126,4 +152,19 @@ void register_I3CLSimStep()
     // make python accept boost::shared_ptr<const blah>.. this is slightly evil bacause it uses const_cast:
     bp::to_python_converter<I3CLSimStepSeriesConstPtr, ConstPtr_to_python<I3CLSimStepSeries> >();
 
+    bp::class_<I3CLSimStepStore, I3CLSimStepStorePtr, boost::noncopyable>
+        ("I3CLSimStepStore", bp::init<std::size_t, bp::optional<std::size_t> >(bp::args("initialSize", "blockSize")))
+    .def(bp::init<>())
+    .def("insert_copy", &I3CLSimStepStore::insert_copy, bp::args("index", "step"))
+    .def("insert_new", &i3clsimstepstore_insert_new, bp::args("index"))
+    .def("pop_bunch", &i3clsimstepstore_pop_bunch, bp::args("size"))
+    .def("pop_bunch", &i3clsimstepstore_pop_bunch_with_template, bp::args("size", "template"))
+    .def("reserve", &I3CLSimStepStore::reserve, bp::args("numEntries"))
+    .def("size", &I3CLSimStepStore::size)
+    .def("empty", &I3CLSimStepStore::empty)
+    .def("num_blocks", &I3CLSimStepStore::num_blocks)
+    .def("block_size", &I3CLSimStepStore::block_size)
+    .def("__len__", &I3CLSimStepStore::size)
+    ;
+
 }
@@ -28,6 +28,9 @@
 
 #include <clsim/I3CLSimStepToPhotonConverter.h>
 #include <clsim/I3CLSimStepToPhotonConverterOpenCL.h>
+#include <clsim/I3CLSimStepToPhotonConverterCPU.h>
+#include <clsim/I3CLSimStepBunchScheduler.h>
+#include <clsim/I3CLSimFrameCompletionTracker.h>
 
 #include <boost/preprocessor/seq.hpp>
 
@@ -57,8 +60,111 @@ struct I3CLSimStepToPhotonConverterWrapper : I3CLSimStepToPhotonConverter, bp::w
     virtual std::size_t QueueSize() const {utils::python_gil_holder gil; return this->get_override("QueueSize")();}
     virtual bool MorePhotonsAvailable() const {utils::python_gil_holder gil; return this->get_override("MorePhotonsAvailable")();}
     virtual I3CLSimStepToPhotonConverter::ConversionResult_t GetConversionResult() {utils::python_gil_holder gil; return this->get_override("GetConversionResult")();}
+
+    // optional, returns None or a tuple (numPhotons, busyTime) in python
+    virtual bool GetThroughputStatistics(uint64_t &numPhotons, double &busyTime)
+    {
+        utils::python_gil_holder gil;
+        bp::override f = this->get_override("GetThroughputStatistics");
+        if (!f) return I3CLSimStepToPhotonConverter::GetThroughputStatistics(numPhotons, busyTime);
+
+        bp::object result = f();
+        if (result.ptr() == Py_None) return false;
+
+        numPhotons = bp::extract<uint64_t>(result[0]);
+        busyTime = bp::extract<double>(result[1]);
+        return true;
+    }
 };
 
+static bp::object
+I3CLSimStepToPhotonConverter_GetThroughputStatistics(I3CLSimStepToPhotonConverter &converter)
+{
+    uint64_t numPhotons;
+    double busyTime;
+    if (!converter.GetThroughputStatistics(numPhotons, busyTime)) return bp::object();
+
+    return bp::make_tuple(numPhotons, busyTime);
+}
+
+// returns a copy, the steps are shared with the caller otherwise
+static I3CLSimStepSeriesPtr
+I3CLSimStepToPhotonConverterOpenCL_SplitLargeSteps(const I3CLSimStepSeries &steps,
+                                                   double stepSplittingFactor,
+                                                   std::size_t workgroupSize,
+                                                   std::size_t maxNumDeviceWorkitems)
+{
+    I3CLSimStepSeriesConstPtr splitSteps =
+    I3CLSimStepToPhotonConverterOpenCL::SplitLargeSteps(I3CLSimStepSeriesConstPtr(new I3CLSimStepSeries(steps)),
+                                                        stepSplittingFactor, workgroupSize,
+                                                        maxNumDeviceWorkitems);
+
+    return I3CLSimStepSeriesPtr(new I3CLSimStepSeries(*splitSteps));
+}
+
+// returns a list of (step index, first photon, number of photons) tuples
+static bp::list
+I3CLSimStepToPhotonConverterOpenCL_MakeWorkUnits(const I3CLSimStepSeries &steps, uint64_t numWorkUnits)
+{
+    std::vector<cl_uint4> workUnits;
+    I3CLSimStepToPhotonConverterOpenCL::MakeWorkUnits(steps, numWorkUnits, workUnits);
+
+    bp::list result;
+    BOOST_FOREACH(const cl_uint4 &workUnit, workUnits)
+    {
+        result.append(bp::make_tuple(workUnit.s[0], workUnit.s[1], workUnit.s[2]));
+    }
+    return result;
+}
+
+static std::size_t
+I3CLSimStepBunchScheduler_Assign(I3CLSimStepBunchScheduler &scheduler, uint64_t numPhotons, bp::object queueSizes)
+{
+    std::vector<std::size_t> queueSizesVector;
+    for (bp::ssize_t i=0;i<bp::len(queueSizes);++i)
+    {
+        queueSizesVector.push_back(bp::extract<std::size_t>(queueSizes[i]));
+    }
+
+    return scheduler.Assign(numPhotons, queueSizesVector);
+}
+
+// returns None for unknown bunches or a tuple (converterIndex, numPhotons)
+static bp::object
+I3CLSimFrameCompletionTracker_BunchReturned(I3CLSimFrameCompletionTracker &tracker, uint32_t bunchIdentifier)
+{
+    std::size_t converterIndex;
+    uint64_t numPhotons;
+    if (!tracker.BunchReturned(bunchIdentifier, converterIndex, numPhotons)) return bp::object();
+
+    return bp::make_tuple(converterIndex, numPhotons);
+}
+
+// returns None or the converter index
+static bp::object
+I3CLSimFrameCompletionTracker_GetConverterToWaitFor(const I3CLSimFrameCompletionTracker &tracker)
+{
+    std::size_t converterIndex;
+    if (!tracker.GetConverterToWaitFor(converterIndex)) return bp::object();
+
+    return bp::object(converterIndex);
+}
+
+// returns a tuple of lists (photonNumGenerated, photonWeightSumGenerated)
+static bp::object
+I3CLSimFrameCompletionTracker_PopHeadFrame(I3CLSimFrameCompletionTracker &tracker)
+{
+    std::vector<uint64_t> photonNumGenerated;
+    std::vector<double> photonWeightSumGenerated;
+    tracker.PopHeadFrame(photonNumGenerated, photonWeightSumGenerated);
+
+    bp::list num, weightSum;
+    for (std::size_t i=0;i<photonNumGenerated.size();++i) num.append(photonNumGenerated[i]);
+    for (std::size_t i=0;i<photonWeightSumGenerated.size();++i) weightSum.append(photonWeightSumGenerated[i]);
+
+    return bp::make_tuple(num, weightSum);
+}
+
 struct I3CLSimStepToPhotonConverterOpenCLWrapper : I3CLSimStepToPhotonConverterOpenCL, bp::wrapper<I3CLSimStepToPhotonConverterOpenCL> {
     I3CLSimStepToPhotonConverterOpenCLWrapper(I3RandomServicePtr rng, bool nm)
         : I3CLSimStepToPhotonConverterOpenCL(rng, nm) {}
@@ -95,6 +201,7 @@ void register_I3CLSimStepToPhotonConverter()
         .def("QueueSize", bp::pure_virtual(&I3CLSimStepToPhotonConverter::QueueSize))
         .def("MorePhotonsAvailable", bp::pure_virtual(&I3CLSimStepToPhotonConverter::MorePhotonsAvailable))
         .def("GetConversionResult", bp::pure_virtual(&I3CLSimStepToPhotonConverter::GetConversionResult))
+        .def("GetThroughputStatistics", &I3CLSimStepToPhotonConverter_GetThroughputStatistics)
         ;
 
 
@@ -153,14 +260,19 @@ void register_I3CLSimStepToPhotonConverter()
         .def("SetDevice", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetDevice)
         .def("GetMaxWorkgroupSize", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetMaxWorkgroupSize)
         .add_property("maxWorkgroupSize", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetMaxWorkgroupSize)
+        .def("GetKernelPrivateMemSize", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetKernelPrivateMemSize)
+        .add_property("kernelPrivateMemSize", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetKernelPrivateMemSize)
 
         .def("GetWorkgroupSize", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetWorkgroupSize)
         .def("SetWorkgroupSize", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetWorkgroupSize)
         .def("GetMaxNumWorkitems", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetMaxNumWorkitems)
         .def("SetMaxNumWorkitems", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetMaxNumWorkitems)
+        .def("GetMaxNumStepsPerBunch", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetMaxNumStepsPerBunch)
 
         .def("SetEnableDoubleBuffering", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetEnableDoubleBuffering)
         .def("GetEnableDoubleBuffering", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetEnableDoubleBuffering)
+        .def("SetBufferRingDepth", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetBufferRingDepth)
+        .def("GetBufferRingDepth", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetBufferRingDepth)
 
         .def("SetDoublePrecision", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetDoublePrecision)
         .def("GetDoublePrecision", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetDoublePrecision)
@@ -186,6 +298,38 @@ void register_I3CLSimStepToPhotonConverter()
         .def("SetHoleIceAbsorptionLengthFactor", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetHoleIceAbsorptionLengthFactor)
         .def("GetHoleIceAbsorptionLengthFactor", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetHoleIceAbsorptionLengthFactor)
 
+        .def("SetHoleIceCylindersInConstantMemory", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetHoleIceCylindersInConstantMemory)
+        .def("GetHoleIceCylindersInConstantMemory", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetHoleIceCylindersInConstantMemory)
+
+        .def("SetOpticalDepthTableWavelengthBins", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetOpticalDepthTableWavelengthBins)
+        .def("GetOpticalDepthTableWavelengthBins", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetOpticalDepthTableWavelengthBins)
+
+        .def("SetLengthTableWavelengthBins", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetLengthTableWavelengthBins)
+        .def("GetLengthTableWavelengthBins", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetLengthTableWavelengthBins)
+        .def("SetUseCounterBasedRNG", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetUseCounterBasedRNG)
+        .def("GetUseCounterBasedRNG", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetUseCounterBasedRNG)
+
+        .def("SetProfileKernel", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetProfileKernel)
+        .def("GetProfileKernel", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetProfileKernel)
+        .def("GetKernelProfileHasClock", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetKernelProfileHasClock)
+
+        .def("SetUsePersistentThreads", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetUsePersistentThreads)
+        .def("GetUsePersistentThreads", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetUsePersistentThreads)
+        .def("SetNumPersistentWorkItems", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetNumPersistentWorkItems)
+        .def("GetNumPersistentWorkItems", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetNumPersistentWorkItems)
+        .def("SetStepSplittingFactor", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetStepSplittingFactor)
+        .def("GetStepSplittingFactor", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetStepSplittingFactor)
+        .def("SplitLargeSteps", &I3CLSimStepToPhotonConverterOpenCL_SplitLargeSteps,
+             (bp::arg("steps"), bp::arg("stepSplittingFactor"), bp::arg("workgroupSize"),
+              bp::arg("maxNumDeviceWorkitems")))
+        .staticmethod("SplitLargeSteps")
+        .def("MakeWorkUnits", &I3CLSimStepToPhotonConverterOpenCL_MakeWorkUnits,
+             (bp::arg("steps"), bp::arg("numWorkUnits")))
+        .staticmethod("MakeWorkUnits")
+
+        .def("UpdateHoleIceCylinders", &I3CLSimStepToPhotonConverterOpenCLWrapper::UpdateHoleIceCylinders,
+             (bp::arg("positions"), bp::arg("radii"), bp::arg("scatteringLengths"), bp::arg("absorptionLengths")))
+
         .def("SetPhotonHistoryEntries", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetPhotonHistoryEntries)
         .def("GetPhotonHistoryEntries", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetPhotonHistoryEntries)
 
@@ -199,6 +343,7 @@ void register_I3CLSimStepToPhotonConverter()
         .add_property("workgroupSize", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetWorkgroupSize, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetWorkgroupSize)
         .add_property("maxNumWorkitems", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetMaxNumWorkitems, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetMaxNumWorkitems)
         .add_property("enableDoubleBuffering", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetEnableDoubleBuffering, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetEnableDoubleBuffering)
+        .add_property("bufferRingDepth", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetBufferRingDepth, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetBufferRingDepth)
         .add_property("doublePrecision", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetDoublePrecision, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetDoublePrecision)
         .add_property("stopDetectedPhotons", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetStopDetectedPhotons, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetStopDetectedPhotons)
         .add_property("saveAllPhotons", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetSaveAllPhotons, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetSaveAllPhotons)
@@ -210,6 +355,11 @@ void register_I3CLSimStepToPhotonConverter()
         .add_property("photonHistoryEntries", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetPhotonHistoryEntries, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetPhotonHistoryEntries)
         .add_property("fixedNumberOfAbsorptionLengths", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetFixedNumberOfAbsorptionLengths, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetFixedNumberOfAbsorptionLengths)
         .add_property("DOMPancakeFactor", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetDOMPancakeFactor, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetDOMPancakeFactor)
+        .add_property("useCounterBasedRNG", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetUseCounterBasedRNG, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetUseCounterBasedRNG)
+        .add_property("profileKernel", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetProfileKernel, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetProfileKernel)
+        .add_property("usePersistentThreads", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetUsePersistentThreads, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetUsePersistentThreads)
+        .add_property("numPersistentWorkItems", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetNumPersistentWorkItems, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetNumPersistentWorkItems)
+        .add_property("stepSplittingFactor", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetStepSplittingFactor, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetStepSplittingFactor)
         ;
     }
 
@@ -217,4 +367,135 @@ void register_I3CLSimStepToPhotonConverter()
     bp::implicitly_convertible<boost::shared_ptr<I3CLSimStepToPhotonConverterOpenCLWrapper>, boost::shared_ptr<I3CLSimStepToPhotonConverter> >();
     bp::implicitly_convertible<boost::shared_ptr<I3CLSimStepToPhotonConverterOpenCLWrapper>, boost::shared_ptr<const I3CLSimStepToPhotonConverter> >();
 
+
+
+    // I3CLSimStepToPhotonConverterCPU
+    {
+        bp::class_<
+        I3CLSimStepToPhotonConverterCPU,
+        boost::shared_ptr<I3CLSimStepToPhotonConverterCPU>,
+        bases<I3CLSimStepToPhotonConverter>,
+        boost::noncopyable
+        >
+        (
+         "I3CLSimStepToPhotonConverterCPU",
+         bp::init<
+         I3RandomServicePtr
+         >(
+           (
+            bp::arg("RandomService")
+           )
+          )
+        )
+        .def("GetNumThreads", &I3CLSimStepToPhotonConverterCPU::GetNumThreads)
+        .def("SetNumThreads", &I3CLSimStepToPhotonConverterCPU::SetNumThreads)
+        .def("GetMaxNumWorkitems", &I3CLSimStepToPhotonConverterCPU::GetMaxNumWorkitems)
+        .def("SetMaxNumWorkitems", &I3CLSimStepToPhotonConverterCPU::SetMaxNumWorkitems)
+        .def("GetWorkgroupSize", &I3CLSimStepToPhotonConverterCPU::GetWorkgroupSize)
+        .def("GetNumStepsPerChunk", &I3CLSimStepToPhotonConverterCPU::GetNumStepsPerChunk)
+        .def("SetNumStepsPerChunk", &I3CLSimStepToPhotonConverterCPU::SetNumStepsPerChunk)
+
+        .def("SetStopDetectedPhotons", &I3CLSimStepToPhotonConverterCPU::SetStopDetectedPhotons)
+        .def("GetStopDetectedPhotons", &I3CLSimStepToPhotonConverterCPU::GetStopDetectedPhotons)
+        .def("SetDOMPancakeFactor", &I3CLSimStepToPhotonConverterCPU::SetDOMPancakeFactor)
+        .def("GetDOMPancakeFactor", &I3CLSimStepToPhotonConverterCPU::GetDOMPancakeFactor)
+
+        .def("SetSimulateHoleIce", &I3CLSimStepToPhotonConverterCPU::SetSimulateHoleIce)
+        .def("GetSimulateHoleIce", &I3CLSimStepToPhotonConverterCPU::GetSimulateHoleIce)
+        .def("SetHoleIceCylinderPositions", &I3CLSimStepToPhotonConverterCPU::SetHoleIceCylinderPositions)
+        .def("SetHoleIceCylinderRadii", &I3CLSimStepToPhotonConverterCPU::SetHoleIceCylinderRadii)
+        .def("SetHoleIceCylinderScatteringLengths", &I3CLSimStepToPhotonConverterCPU::SetHoleIceCylinderScatteringLengths)
+        .def("SetHoleIceCylinderAbsorptionLengths", &I3CLSimStepToPhotonConverterCPU::SetHoleIceCylinderAbsorptionLengths)
+
+        .def("GetTotalNumPhotonsGenerated", &I3CLSimStepToPhotonConverterCPU::GetTotalNumPhotonsGenerated)
+        .def("GetTotalNumPhotonsAtDOMs", &I3CLSimStepToPhotonConverterCPU::GetTotalNumPhotonsAtDOMs)
+
+        .add_property("numThreads", &I3CLSimStepToPhotonConverterCPU::GetNumThreads, &I3CLSimStepToPhotonConverterCPU::SetNumThreads)
+        .add_property("maxNumWorkitems", &I3CLSimStepToPhotonConverterCPU::GetMaxNumWorkitems, &I3CLSimStepToPhotonConverterCPU::SetMaxNumWorkitems)
+        .add_property("workgroupSize", &I3CLSimStepToPhotonConverterCPU::GetWorkgroupSize)
+        .add_property("numStepsPerChunk", &I3CLSimStepToPhotonConverterCPU::GetNumStepsPerChunk, &I3CLSimStepToPhotonConverterCPU::SetNumStepsPerChunk)
+        .add_property("stopDetectedPhotons", &I3CLSimStepToPhotonConverterCPU::GetStopDetectedPhotons, &I3CLSimStepToPhotonConverterCPU::SetStopDetectedPhotons)
+        .add_property("DOMPancakeFactor", &I3CLSimStepToPhotonConverterCPU::GetDOMPancakeFactor, &I3CLSimStepToPhotonConverterCPU::SetDOMPancakeFactor)
+        .add_property("simulateHoleIce", &I3CLSimStepToPhotonConverterCPU::GetSimulateHoleIce, &I3CLSimStepToPhotonConverterCPU::SetSimulateHoleIce)
+        ;
+    }
+
+    bp::implicitly_convertible<boost::shared_ptr<I3CLSimStepToPhotonConverterCPU>, boost::shared_ptr<const I3CLSimStepToPhotonConverterCPU> >();
+    bp::implicitly_convertible<boost::shared_ptr<I3CLSimStepToPhotonConverterCPU>, boost::shared_ptr<I3CLSimStepToPhotonConverter> >();
+    bp::implicitly_convertible<boost::shared_ptr<I3CLSimStepToPhotonConverterCPU>, boost::shared_ptr<const I3CLSimStepToPhotonConverter> >();
+
+
+
+    // I3CLSimStepBunchScheduler
+    {
+        bp::class_<
+        I3CLSimStepBunchScheduler,
+        boost::shared_ptr<I3CLSimStepBunchScheduler>,
+        boost::noncopyable
+        >
+        (
+         "I3CLSimStepBunchScheduler",
+         bp::init<
+         std::size_t
+         >(
+           (
+            bp::arg("numConverters")
+           )
+          )
+        )
+        .def("GetNumConverters", &I3CLSimStepBunchScheduler::GetNumConverters)
+        .def("SetUseThroughput", &I3CLSimStepBunchScheduler::SetUseThroughput)
+        .def("GetUseThroughput", &I3CLSimStepBunchScheduler::GetUseThroughput)
+        .def("SetSmoothingFactor", &I3CLSimStepBunchScheduler::SetSmoothingFactor)
+        .def("GetSmoothingFactor", &I3CLSimStepBunchScheduler::GetSmoothingFactor)
+        .def("StartRound", &I3CLSimStepBunchScheduler::StartRound)
+        .def("Release", &I3CLSimStepBunchScheduler::Release, (bp::arg("converterIndex"), bp::arg("numPhotons")))
+        .def("Assign", &I3CLSimStepBunchScheduler_Assign, (bp::arg("numPhotons"), bp::arg("queueSizes")))
+        .def("SetCumulativeStatistics", &I3CLSimStepBunchScheduler::SetCumulativeStatistics,
+             (bp::arg("converterIndex"), bp::arg("totalNumPhotons"), bp::arg("totalBusyTime")))
+        .def("HasThroughputEstimates", &I3CLSimStepBunchScheduler::HasThroughputEstimates)
+        .def("GetPhotonsPerSecond", &I3CLSimStepBunchScheduler::GetPhotonsPerSecond)
+        .def("GetAssignedPhotons", &I3CLSimStepBunchScheduler::GetAssignedPhotons)
+        .def("GetPredictedCompletionTime", &I3CLSimStepBunchScheduler::GetPredictedCompletionTime)
+
+        .add_property("numConverters", &I3CLSimStepBunchScheduler::GetNumConverters)
+        .add_property("useThroughput", &I3CLSimStepBunchScheduler::GetUseThroughput, &I3CLSimStepBunchScheduler::SetUseThroughput)
+        .add_property("smoothingFactor", &I3CLSimStepBunchScheduler::GetSmoothingFactor, &I3CLSimStepBunchScheduler::SetSmoothingFactor)
+        ;
+    }
+
+    // I3CLSimFrameCompletionTracker
+    {
+        bp::class_<
+        I3CLSimFrameCompletionTracker,
+        boost::shared_ptr<I3CLSimFrameCompletionTracker>,
+        boost::noncopyable
+        >
+        (
+         "I3CLSimFrameCompletionTracker",
+         bp::init<
+         bool
+         >(
+           (
+            bp::arg("collectStatistics")=false
+           )
+          )
+        )
+        .def("AddFrame", &I3CLSimFrameCompletionTracker::AddFrame, (bp::arg("firstLightSource"), bp::arg("numLightSources")))
+        .def("AddMarker", &I3CLSimFrameCompletionTracker::AddMarker)
+        .def("MarkerReached", &I3CLSimFrameCompletionTracker::MarkerReached)
+        .def("BunchSent", &I3CLSimFrameCompletionTracker::BunchSent,
+             (bp::arg("bunchIdentifier"), bp::arg("converterIndex"), bp::arg("numPhotons"), bp::arg("steps")))
+        .def("BunchReturned", &I3CLSimFrameCompletionTracker_BunchReturned, bp::arg("bunchIdentifier"))
+        .def("GetNumFrames", &I3CLSimFrameCompletionTracker::GetNumFrames)
+        .def("GetNumFramesAdded", &I3CLSimFrameCompletionTracker::GetNumFramesAdded)
+        .def("GetNumBunchesInFlight", &I3CLSimFrameCompletionTracker::GetNumBunchesInFlight)
+        .def("HeadFrameHasAllSteps", &I3CLSimFrameCompletionTracker::HeadFrameHasAllSteps)
+        .def("HeadFrameComplete", &I3CLSimFrameCompletionTracker::HeadFrameComplete)
+        .def("GetConverterToWaitFor", &I3CLSimFrameCompletionTracker_GetConverterToWaitFor)
+        .def("PopHeadFrame", &I3CLSimFrameCompletionTracker_PopHeadFrame)
+        .def("WaitForChange", &I3CLSimFrameCompletionTracker::WaitForChange, bp::arg("timeout"))
+        ;
+    }
+
 }
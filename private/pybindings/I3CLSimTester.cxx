@@ -212,14 +212,15 @@ void register_I3CLSimTester()
         bases<I3CLSimTesterBase>,
         boost::noncopyable>
         ("I3CLSimMediumPropertiesTester",
-         bp::init<const I3CLSimOpenCLDevice &, uint64_t, uint64_t, I3CLSimMediumPropertiesConstPtr, I3RandomServicePtr>
+         bp::init<const I3CLSimOpenCLDevice &, uint64_t, uint64_t, I3CLSimMediumPropertiesConstPtr, I3RandomServicePtr, std::size_t>
          (
           (
            bp::arg("device"),
            bp::arg("workgroupSize"),
            bp::arg("workItemsPerIteration"),
            bp::arg("mediumProperties"),
-           bp::arg("randomService") = I3RandomServicePtr()
+           bp::arg("randomService") = I3RandomServicePtr(),
+           bp::arg("lengthTableWavelengthBins") = 0
            )
           )
          )
@@ -42,14 +42,16 @@ I3CLSimMediumPropertiesTester::I3CLSimMediumPropertiesTester
  uint64_t workgroupSize_,
  uint64_t workItemsPerIteration_,
  I3CLSimMediumPropertiesConstPtr mediumProperties,
- I3RandomServicePtr randomService)
+ I3RandomServicePtr randomService,
+ std::size_t lengthTableWavelengthBins)
 :
 I3CLSimTesterBase(),
 mediumProperties_(mediumProperties),
-randomService_(randomService)
+randomService_(randomService),
+lengthTableWavelengthBins_(lengthTableWavelengthBins)
 {
     std::vector<std::string> source;
-    FillSource(source, mediumProperties);
+    FillSource(source, mediumProperties, lengthTableWavelengthBins);
     
     const bool hasDispersion = mediumProperties->GetPhaseRefractiveIndices()[0]->HasDerivative();
 
@@ -63,7 +65,8 @@ randomService_(randomService)
 }
 
 void I3CLSimMediumPropertiesTester::FillSource(std::vector<std::string> &source,
-                                               I3CLSimMediumPropertiesConstPtr mediumProperties)
+                                               I3CLSimMediumPropertiesConstPtr mediumProperties,
+                                               std::size_t lengthTableWavelengthBins)
 {
     source.clear();
     
@@ -73,7 +76,9 @@ void I3CLSimMediumPropertiesTester::FillSource(std::vector<std::string> &source,
     
     std::string mwcrngSource = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/mwcrng_kernel.cl");
 
-    std::string mediumPropertiesSource = I3CLSimHelper::GenerateMediumPropertiesSource(*mediumProperties);
+    // with lengthTableWavelengthBins>0, the scattering and absorption lengths
+    // are interpolated in tables, see I3CLSimStepToPhotonConverterOpenCL::SetLengthTableWavelengthBins()
+    std::string mediumPropertiesSource = I3CLSimHelper::GenerateMediumPropertiesSource(*mediumProperties, 0, lengthTableWavelengthBins);
 
     std::string testKernelHeader = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/medium_properties_test_kernel.h.cl");
     std::string testKernelSource = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/medium_properties_test_kernel.c.cl");
@@ -116,6 +121,10 @@ void I3CLSimMediumPropertiesTester::InitBuffers(I3RandomServicePtr randomService
     // allocate empty buffers on the device
     deviceBuffer_results = boost::shared_ptr<cl::Buffer>(new cl::Buffer(*context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, workItemsPerIteration*sizeof(float), NULL));
     deviceBuffer_inputs = boost::shared_ptr<cl::Buffer>(new cl::Buffer(*context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, workItemsPerIteration*sizeof(float), NULL));
+    if (lengthTableWavelengthBins_ > 0) {
+        std::vector<float> mediumLengthTable = I3CLSimHelper::GenerateMediumLengthTable(*mediumProperties_, lengthTableWavelengthBins_);
+        deviceBuffer_MediumLengthTable = boost::shared_ptr<cl::Buffer>(new cl::Buffer(*context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, mediumLengthTable.size()*sizeof(float), &(mediumLengthTable[0])));
+    }
     log_debug("Device buffers are set up.");
     
     log_debug("Configuring kernel.");
@@ -124,6 +133,9 @@ void I3CLSimMediumPropertiesTester::InitBuffers(I3RandomServicePtr randomService
         kernel->setArg(1, *deviceBuffer_MWC_RNG_a);        // rng state
         kernel->setArg(2, *deviceBuffer_inputs);            // input data
         kernel->setArg(3, *deviceBuffer_results);          // output data
+        // 4 and 5 are set in EvaluateIt()
+        if (deviceBuffer_MediumLengthTable)
+            kernel->setArg(6, *deviceBuffer_MediumLengthTable); // scattering and absorption length tables
     }
     log_debug("Kernel configured.");
 }
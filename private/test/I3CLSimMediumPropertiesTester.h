@@ -41,7 +41,8 @@ public:
                                   uint64_t workgroupSize_,
                                   uint64_t workItemsPerIteration_,
                                   I3CLSimMediumPropertiesConstPtr mediumProperties,
-                                  I3RandomServicePtr randomService = I3RandomServicePtr());
+                                  I3RandomServicePtr randomService = I3RandomServicePtr(),
+                                  std::size_t lengthTableWavelengthBins = 0);
 
     // evaluates the function using an OpenCL kernel
     I3VectorFloatPtr EvaluatePhaseRefIndex(I3VectorFloatConstPtr xValues, uint32_t layer);
@@ -55,7 +56,8 @@ private:
 
     
     void FillSource(std::vector<std::string> &source,
-                    I3CLSimMediumPropertiesConstPtr wlenDependentValue);
+                    I3CLSimMediumPropertiesConstPtr wlenDependentValue,
+                    std::size_t lengthTableWavelengthBins);
 
     void InitBuffers(I3RandomServicePtr randomService);
 
@@ -64,9 +66,11 @@ private:
 
     boost::shared_ptr<cl::Buffer> deviceBuffer_results;
     boost::shared_ptr<cl::Buffer> deviceBuffer_inputs;
+    boost::shared_ptr<cl::Buffer> deviceBuffer_MediumLengthTable;
 
     I3CLSimMediumPropertiesConstPtr mediumProperties_;
     I3RandomServicePtr randomService_;
+    std::size_t lengthTableWavelengthBins_;
 };
 
 
@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2018
+ * the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * @file I3CLSimFrameCompletionTracker.h
+ */
+
+#ifndef I3CLSIMFRAMECOMPLETIONTRACKER_H_INCLUDED
+#define I3CLSIMFRAMECOMPLETIONTRACKER_H_INCLUDED
+
+#include "icetray/I3PointerTypedefs.h"
+
+#include "clsim/I3CLSimStep.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <stdint.h>
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <cstddef>
+
+/**
+ * @brief Keeps track of the frames I3CLSimModule is working on
+ * when frames are streamed instead of flushed all at once.
+ *
+ * Every frame owns a consecutive range of light source identifiers.
+ * A frame is complete once
+ *  - a marker enqueued after its light sources has been reached,
+ *    i.e. all of its steps have been returned by the light source
+ *    to step converter, and
+ *  - all bunches containing any of these steps have returned
+ *    from the step to photon converters.
+ *
+ * Frames leave the tracker in the order they were added, so the
+ * head frame is the only one that can be popped.
+ *
+ * While it is looking at every step anyway, the tracker also sums
+ * up the photons generated for each light source if requested.
+ *
+ * All methods are thread-safe. The thread passing steps to the
+ * converters calls MarkerReached() and BunchSent(), everything
+ * else is called by the module.
+ */
+class I3CLSimFrameCompletionTracker : private boost::noncopyable
+{
+public:
+    I3CLSimFrameCompletionTracker(bool collectStatistics=false);
+
+    /**
+     * Adds a frame whose light sources have the identifiers
+     * [firstLightSource, firstLightSource+numLightSources).
+     * The ranges must not overlap and must increase from frame
+     * to frame as long as there are frames in the tracker.
+     * Frames without light sources have all of their steps.
+     * Must be called before the light sources are enqueued.
+     *
+     * Returns the number of the frame (counting from 0).
+     */
+    uint64_t AddFrame(uint32_t firstLightSource, uint32_t numLightSources);
+
+    /**
+     * Records that a marker was enqueued after the light sources
+     * of all frames added so far. Must be called before the
+     * marker is enqueued.
+     */
+    void AddMarker();
+
+    /**
+     * The oldest marker has been reached. All frames added before
+     * it have all of their steps now.
+     */
+    void MarkerReached();
+
+    /**
+     * Records a bunch of steps sent to a converter. Must be called
+     * before it is enqueued, so its results cannot be returned first.
+     * Steps with the identifier 0, no photons or no weight are
+     * padding and do not belong to any frame.
+     */
+    void BunchSent(uint32_t bunchIdentifier,
+                   std::size_t converterIndex,
+                   uint64_t numPhotons,
+                   const I3CLSimStepSeries &steps);
+
+    /**
+     * Records that the results of a bunch have been retrieved and
+     * returns the converter and the number of photons it was sent
+     * with. Returns false if the bunch is unknown.
+     */
+    bool BunchReturned(uint32_t bunchIdentifier,
+                       std::size_t &converterIndex,
+                       uint64_t &numPhotons);
+
+    /**
+     * Returns the number of frames in the tracker.
+     */
+    std::size_t GetNumFrames() const;
+
+    /**
+     * Returns the number of frames ever added, i.e. the
+     * number the next frame will get.
+     */
+    uint64_t GetNumFramesAdded() const;
+
+    /**
+     * Returns the number of bunches that have not returned yet.
+     */
+    std::size_t GetNumBunchesInFlight() const;
+
+    /**
+     * Returns true if the head frame has all of its steps,
+     * false if there is no frame.
+     */
+    bool HeadFrameHasAllSteps() const;
+
+    /**
+     * Returns true if the head frame is complete,
+     * false if there is no frame.
+     */
+    bool HeadFrameComplete() const;
+
+    /**
+     * Finds a converter the head frame is waiting for, i.e. one
+     * with bunches of the head frame that have not returned yet.
+     * Returns false if there is none.
+     */
+    bool GetConverterToWaitFor(std::size_t &converterIndex) const;
+
+    /**
+     * Removes the head frame, which needs to be complete. If
+     * statistics are collected, the photons generated for each of
+     * its light sources (count and weight sum) are returned,
+     * otherwise the vectors are empty.
+     */
+    void PopHeadFrame(std::vector<uint64_t> &photonNumGenerated,
+                      std::vector<double> &photonWeightSumGenerated);
+
+    /**
+     * Waits until a marker is reached or a bunch is sent,
+     * for at most timeout seconds. Returns false on timeout.
+     */
+    bool WaitForChange(double timeout);
+
+private:
+    struct Frame_t
+    {
+        Frame_t() : firstLightSource(0), numLightSources(0), hasAllSteps(false), numBunchesInFlight(0) {;}
+
+        uint32_t firstLightSource;
+        uint32_t numLightSources;
+        bool hasAllSteps;
+        std::size_t numBunchesInFlight;
+        std::vector<std::size_t> numBunchesInFlightPerConverter;
+
+        std::vector<uint64_t> photonNumGenerated;
+        std::vector<double> photonWeightSumGenerated;
+    };
+
+    struct Bunch_t
+    {
+        std::size_t converterIndex;
+        uint64_t numPhotons;
+        std::vector<uint64_t> frames;
+    };
+
+    // the frame with the light source, or NULL
+    Frame_t *FindFrame(uint32_t lightSource, uint64_t &frameNumber);
+
+    bool FrameComplete(const Frame_t &frame) const;
+
+    mutable boost::mutex mutex_;
+    boost::condition_variable changed_;
+
+    bool collectStatistics_;
+
+    std::deque<Frame_t> frames_;
+    uint64_t firstFrameNumber_;
+
+    // the number of frames each pending marker was enqueued after
+    std::deque<uint64_t> markers_;
+
+    std::map<uint32_t, Bunch_t> bunches_;
+};
+
+I3_POINTER_TYPEDEFS(I3CLSimFrameCompletionTracker);
+
+#endif //I3CLSIMFRAMECOMPLETIONTRACKER_H_INCLUDED
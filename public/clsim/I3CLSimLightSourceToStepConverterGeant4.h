@@ -35,6 +35,7 @@
 #include <boost/thread/locks.hpp>
 
 #include "clsim/I3CLSimQueue.h"
+#include "clsim/I3CLSimLockFreeQueue.h"
 
 #include <map>
 #include <string>
@@ -58,6 +59,12 @@ public:
     static const uint32_t default_maxQueueItems;
     static const bool canUseGeant4;
     
+    /**
+     * maxQueueItems is the number of step bunches that can wait
+     * for the caller before Geant4 blocks. 0 used to mean
+     * "no maximum size"; it is now replaced by a bound of 1024
+     * bunches (with a warning).
+     */
     I3CLSimLightSourceToStepConverterGeant4(std::string physicsListName=default_physicsListName,
                                          double maxBetaChangePerStep=default_maxBetaChangePerStep,
                                          uint32_t maxNumPhotonsPerStep=default_maxNumPhotonsPerStep,
@@ -145,6 +152,20 @@ public:
      * Will throw if not initialized.
      */
     virtual bool BarrierActive() const;
+
+    /**
+     * Adds a "marker" to the particle queue. It is reported by
+     * GetConversionResultWithMarkerInfo() once all steps of the
+     * particles enqueued before it have been returned.
+     * Unlike a barrier, a marker does not keep new particles from
+     * being enqueued. A partially filled bunch of steps is only sent
+     * early for it if "flush" is set, otherwise the marker waits
+     * until the steps of the particles before it have been sent
+     * anyway (or until the next flush).
+     *
+     * Will throw if not initialized.
+     */
+    void EnqueueMarker(bool flush=false);
     
     /**
      * Returns true if more steps are available for the current particle.
@@ -168,10 +189,25 @@ public:
      * Will throw if not initialized.
      */
     virtual I3CLSimStepSeriesConstPtr GetConversionResultWithBarrierInfo(bool &barrierWasReset, double timeout=NAN);
+
+    /**
+     * Like GetConversionResultWithBarrierInfo(), but also reports
+     * markers (see EnqueueMarker()). If markerWasReached is set,
+     * no steps are returned.
+     *
+     * Blocks if no steps are available.
+     *
+     * Will throw if not initialized.
+     */
+    I3CLSimStepSeriesConstPtr GetConversionResultWithMarkerInfo(bool &barrierWasReset, bool &markerWasReached);
     
 private:
     void LogGeant4Messages(bool allAsWarn=false) const;
 
+    // sends numMarkers markers and resets it to 0. Returns false
+    // if the thread was interrupted.
+    bool SendMarkers(uint32_t &numMarkers, boost::this_thread::disable_interruption &di);
+
     typedef std::pair<uint32_t, I3CLSimLightSourceConstPtr> ToGeant4Pair_t;
 
     void Geant4Thread();
@@ -185,7 +221,7 @@ private:
     bool barrier_is_enqueued_;
 
     boost::shared_ptr<I3CLSimQueue<ToGeant4Pair_t> > queueToGeant4_;
-    boost::shared_ptr<I3CLSimQueue<FromGeant4Pair_t> > queueFromGeant4_;
+    boost::shared_ptr<I3CLSimLockFreeQueue<FromGeant4Pair_t> > queueFromGeant4_;
     mutable boost::shared_ptr<I3CLSimQueue<boost::shared_ptr<std::pair<const std::string, bool> > > > queueFromGeant4Messages_;
     
     I3RandomServicePtr randomService_;
@@ -30,7 +30,7 @@
 #include "clsim/I3CLSimLightSourceToStepConverter.h"
 #include "dataclasses/physics/I3Particle.h"
 
-#include "clsim/I3CLSimQueue.h"
+#include "clsim/I3CLSimLockFreeQueue.h"
 
 #include <map>
 #include <string>
@@ -215,7 +215,7 @@ private:
         typedef std::vector<std::pair<std::pair<double, double>, double> > queueVector_t;
         boost::shared_ptr<queueVector_t> currentVector_;
         
-        I3CLSimQueue<boost::shared_ptr<queueVector_t> > queueFromFeederThreads_;
+        I3CLSimLockFreeQueue<boost::shared_ptr<queueVector_t> > queueFromFeederThreads_;
         std::vector<boost::shared_ptr<boost::thread> > feederThreads_;
         
         void FeederThread(unsigned int threadId, uint64_t initialRngState, uint32_t rngA);
@@ -0,0 +1,381 @@
+/**
+ * Copyright (c) 2018
+ * the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * @file I3CLSimLockFreeQueue.h
+ */
+
+#ifndef I3CLSIMLOCKFREEQUEUE_H_INCLUDED
+#define I3CLSIMLOCKFREEQUEUE_H_INCLUDED
+
+#include "icetray/I3Logging.h"
+
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+
+/**
+ * @brief A thread-safe, bounded queue for several producers and
+ * consumers, storing objects of type T. It can be used in place of
+ * I3CLSimQueue where the queue has a maximum size.
+ *
+ * The objects are kept in a ring buffer. Each slot has a sequence
+ * number that tells producers and consumers whether it is free or
+ * filled for their position, so Put() and Get() only need a single
+ * compare-and-swap on the position and do not take a lock.
+ * PutBatch() and GetBatch() claim several consecutive slots with
+ * a single compare-and-swap.
+ *
+ * If the queue is full (on Put) or empty (on Get), the thread spins
+ * for a short while and then sleeps on a condition variable until
+ * another thread makes progress. Threads are only woken if there
+ * are sleeping threads, so the lock is not touched as long as
+ * the queue is neither full nor empty. As with I3CLSimQueue,
+ * waiting threads can be interrupted with boost::thread::interrupt().
+ *
+ * T will be copied around, so make it light-weight.
+ * (Use a shared pointer for example.)
+ */
+
+template <typename T>
+class I3CLSimLockFreeQueue : private boost::noncopyable
+{
+public:
+    I3CLSimLockFreeQueue(std::size_t max_size)
+    :
+    max_size_(max_size),
+    cells_(max_size),
+    enqueuePos_(0),
+    dequeuePos_(0),
+    numSleepingProducers_(0),
+    numSleepingConsumers_(0)
+    {
+        if (max_size_==0)
+            log_fatal("I3CLSimLockFreeQueue needs a maximum size > 0.");
+
+        for (std::size_t i=0;i<max_size_;++i)
+        {
+            cells_[i].sequence.store(2*i, boost::memory_order_relaxed);
+        }
+    }
+
+    ~I3CLSimLockFreeQueue() {;}
+
+    void Put(const T &msg)
+    {
+        for (unsigned int spins=0;;++spins)
+        {
+            if (TryPut(&msg, 1)==1) {
+                WakeSleepers(numSleepingConsumers_, notEmpty_);
+                return;
+            }
+            if (spins < numSpins) {
+                boost::this_thread::yield();
+                continue;
+            }
+            SleepWhile(numSleepingProducers_, notFull_, &I3CLSimLockFreeQueue::IsFull);
+        }
+    }
+
+    /**
+     * Puts all values on the queue, in order. Blocks as long
+     * as there is no space for the remaining values. The values
+     * may be interleaved with the ones from other producers.
+     */
+    void PutBatch(const std::vector<T> &msgs)
+    {
+        std::size_t numPut=0;
+        for (unsigned int spins=0;numPut<msgs.size();++spins)
+        {
+            const std::size_t num = TryPut(&(msgs[numPut]), msgs.size()-numPut);
+            if (num>0) {
+                numPut+=num;
+                spins=0;
+                WakeSleepers(numSleepingConsumers_, notEmpty_);
+                continue;
+            }
+            if (spins < numSpins) {
+                boost::this_thread::yield();
+                continue;
+            }
+            SleepWhile(numSleepingProducers_, notFull_, &I3CLSimLockFreeQueue::IsFull);
+        }
+    }
+
+    T Get()
+    {
+        T msg;
+        for (unsigned int spins=0;;++spins)
+        {
+            if (TryGet(&msg, 1)==1) {
+                WakeSleepers(numSleepingProducers_, notFull_);
+                return msg;
+            }
+            if (spins < numSpins) {
+                boost::this_thread::yield();
+                continue;
+            }
+            SleepWhile(numSleepingConsumers_, notEmpty_, &I3CLSimLockFreeQueue::IsEmpty);
+        }
+    }
+
+    /**
+     * Blocks until at least one value is available and then
+     * appends up to maxNum values to the vector. Returns the
+     * number of values appended.
+     */
+    std::size_t GetBatch(std::vector<T> &msgs, std::size_t maxNum)
+    {
+        if (maxNum==0) return 0;
+
+        const std::size_t oldSize = msgs.size();
+        msgs.resize(oldSize+maxNum);
+
+        for (unsigned int spins=0;;++spins)
+        {
+            const std::size_t num = TryGet(&(msgs[oldSize]), maxNum);
+            if (num>0) {
+                msgs.resize(oldSize+num);
+                WakeSleepers(numSleepingProducers_, notFull_);
+                return num;
+            }
+            if (spins < numSpins) {
+                boost::this_thread::yield();
+                continue;
+            }
+
+            try {
+                SleepWhile(numSleepingConsumers_, notEmpty_, &I3CLSimLockFreeQueue::IsEmpty);
+            } catch (...) {
+                msgs.resize(oldSize);
+                throw;
+            }
+        }
+    }
+
+    bool GetNonBlocking(T &value)
+    {
+        if (TryGet(&value, 1)==0) return false;
+
+        WakeSleepers(numSleepingProducers_, notFull_);
+        return true;
+    }
+
+    T Get(double timeout, T returnOnTimeout) // timeout in seconds
+    {
+        const boost::system_time deadline = boost::get_system_time() +
+            boost::posix_time::milliseconds(static_cast<long>(timeout*1000.));
+
+        T msg;
+        for (unsigned int spins=0;;++spins)
+        {
+            if (TryGet(&msg, 1)==1) {
+                WakeSleepers(numSleepingProducers_, notFull_);
+                return msg;
+            }
+            if (spins < numSpins) {
+                boost::this_thread::yield();
+                continue;
+            }
+
+            SleepingGuard sleeping(numSleepingConsumers_);
+            boost::unique_lock<boost::mutex> guard(mutex_);
+            while (IsEmpty())
+            {
+                if (!notEmpty_.timed_wait(guard, deadline)) {
+                    // timeout reached, return dummy
+                    if (IsEmpty()) return returnOnTimeout;
+                }
+            }
+        }
+    }
+
+    bool empty() const
+    {
+        return size()==0;
+    }
+
+    std::size_t size() const
+    {
+        // only a snapshot while other threads use the queue
+        const std::size_t dequeuePos = dequeuePos_.load(boost::memory_order_acquire);
+        const std::size_t enqueuePos = enqueuePos_.load(boost::memory_order_acquire);
+        if (enqueuePos <= dequeuePos) return 0;
+        const std::size_t num = enqueuePos-dequeuePos;
+        return (num > max_size_)?max_size_:num;
+    }
+
+    inline std::size_t max_size() const
+    {
+        return max_size_;
+    }
+
+private:
+    static const unsigned int numSpins = 16;
+
+    struct Cell_t
+    {
+        Cell_t() : sequence(0) {;}
+        Cell_t(const Cell_t &other) : sequence(other.sequence.load()), value(other.value) {;}
+
+        // 2*pos:   free for the producer at position pos
+        // 2*pos+1: filled by the producer at position pos
+        // (this also works for a queue with a single slot)
+        boost::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    // keeps the count of sleeping threads right if the wait is interrupted
+    struct SleepingGuard
+    {
+        SleepingGuard(boost::atomic<std::size_t> &num) : num_(num) {num_.fetch_add(1, boost::memory_order_seq_cst);}
+        ~SleepingGuard() {num_.fetch_sub(1, boost::memory_order_seq_cst);}
+        boost::atomic<std::size_t> &num_;
+    };
+
+    // Claims up to num consecutive free slots and copies the values there.
+    // Returns the number of values put on the queue.
+    std::size_t TryPut(const T *msgs, std::size_t num)
+    {
+        std::size_t pos = enqueuePos_.load(boost::memory_order_relaxed);
+        for (;;)
+        {
+            std::size_t numFree=0;
+            while ((numFree<num) && (numFree<max_size_) &&
+                   (cells_[(pos+numFree)%max_size_].sequence.load(boost::memory_order_acquire) == 2*(pos+numFree)))
+            {
+                ++numFree;
+            }
+
+            if (numFree==0) {
+                const std::size_t sequence = cells_[pos%max_size_].sequence.load(boost::memory_order_acquire);
+                if (sequence < 2*pos) return 0; // full
+                pos = enqueuePos_.load(boost::memory_order_relaxed); // another producer was faster
+                continue;
+            }
+
+            if (enqueuePos_.compare_exchange_weak(pos, pos+numFree, boost::memory_order_relaxed))
+            {
+                for (std::size_t i=0;i<numFree;++i)
+                {
+                    Cell_t &cell = cells_[(pos+i)%max_size_];
+                    cell.value = msgs[i];
+                    cell.sequence.store(2*(pos+i)+1, boost::memory_order_release);
+                }
+                return numFree;
+            }
+            // pos has been updated by compare_exchange_weak
+        }
+    }
+
+    // Claims up to num consecutive filled slots and copies the values out.
+    // Returns the number of values taken off the queue.
+    std::size_t TryGet(T *msgs, std::size_t num)
+    {
+        std::size_t pos = dequeuePos_.load(boost::memory_order_relaxed);
+        for (;;)
+        {
+            std::size_t numFilled=0;
+            while ((numFilled<num) && (numFilled<max_size_) &&
+                   (cells_[(pos+numFilled)%max_size_].sequence.load(boost::memory_order_acquire) == 2*(pos+numFilled)+1))
+            {
+                ++numFilled;
+            }
+
+            if (numFilled==0) {
+                const std::size_t sequence = cells_[pos%max_size_].sequence.load(boost::memory_order_acquire);
+                if (sequence < 2*pos+1) return 0; // empty
+                pos = dequeuePos_.load(boost::memory_order_relaxed); // another consumer was faster
+                continue;
+            }
+
+            if (dequeuePos_.compare_exchange_weak(pos, pos+numFilled, boost::memory_order_relaxed))
+            {
+                for (std::size_t i=0;i<numFilled;++i)
+                {
+                    Cell_t &cell = cells_[(pos+i)%max_size_];
+                    msgs[i] = cell.value;
+                    cell.value = T(); // do not keep the object alive
+                    cell.sequence.store(2*(pos+i+max_size_), boost::memory_order_release);
+                }
+                return numFilled;
+            }
+            // pos has been updated by compare_exchange_weak
+        }
+    }
+
+    bool IsFull() const
+    {
+        const std::size_t pos = enqueuePos_.load(boost::memory_order_relaxed);
+        return cells_[pos%max_size_].sequence.load(boost::memory_order_acquire) < 2*pos;
+    }
+
+    bool IsEmpty() const
+    {
+        const std::size_t pos = dequeuePos_.load(boost::memory_order_relaxed);
+        return cells_[pos%max_size_].sequence.load(boost::memory_order_acquire) < 2*pos+1;
+    }
+
+    // The sleeping thread registers itself before checking the condition
+    // again, and the waking thread checks for sleeping threads after
+    // making progress, so one of them always sees the other.
+    void SleepWhile(boost::atomic<std::size_t> &numSleeping,
+                    boost::condition_variable_any &cond,
+                    bool (I3CLSimLockFreeQueue::*condition)() const)
+    {
+        SleepingGuard sleeping(numSleeping);
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        while ((this->*condition)())
+        {
+            cond.wait(guard);
+        }
+    }
+
+    void WakeSleepers(boost::atomic<std::size_t> &numSleeping,
+                      boost::condition_variable_any &cond)
+    {
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if (numSleeping.load(boost::memory_order_relaxed)==0) return;
+
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        cond.notify_all();
+    }
+
+    std::size_t max_size_;
+    std::vector<Cell_t> cells_;
+
+    // keep the positions on different cache lines
+    char padding0_[64];
+    boost::atomic<std::size_t> enqueuePos_;
+    char padding1_[64];
+    boost::atomic<std::size_t> dequeuePos_;
+    char padding2_[64];
+
+    boost::atomic<std::size_t> numSleepingProducers_;
+    boost::atomic<std::size_t> numSleepingConsumers_;
+    boost::mutex mutex_;
+    boost::condition_variable_any notFull_;
+    boost::condition_variable_any notEmpty_;
+};
+
+
+#endif //I3CLSIMLOCKFREEQUEUE_H_INCLUDED
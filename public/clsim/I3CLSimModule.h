@@ -50,6 +50,10 @@
 #include "clsim/I3CLSimSimpleGeometryFromI3Geometry.h"
 
 #include "clsim/I3CLSimStepToPhotonConverterOpenCL.h"
+#include "clsim/I3CLSimStepToPhotonConverterCPU.h"
+#include "clsim/I3CLSimStepBunchScheduler.h"
+#include "clsim/I3CLSimFrameCompletionTracker.h"
+#include "clsim/I3CLSimQueue.h"
 #include "clsim/I3CLSimLightSourceToStepConverterGeant4.h"
 
 #include "clsim/I3CLSimLightSourceParameterization.h"
@@ -64,6 +68,7 @@
 #include <boost/thread/locks.hpp>
 
 #include <vector>
+#include <deque>
 #include <set>
 #include <map>
 #include <string>
@@ -131,6 +136,20 @@ private:
      */
     double GetLightSourceEnergy(I3FramePtr frame);
 
+    /**
+     * Predicts the number of photons that will be generated
+     * for a frame (see "HostMemoryBudget")
+     */
+    double GetPredictedNumPhotons(I3FramePtr frame);
+
+    /**
+     * Works on a frame predicted to generate more than
+     * "MaxNumPhotonsPerChunk" photons in several flushes, after
+     * pushing all frames before it. Returns false if the frame
+     * does not need to be split.
+     */
+    bool ProcessFrameInChunks(I3FramePtr frame);
+
     // parameters
 
     /// Parameter: work on MCTrees found in the stream types ("stops") specified in this list
@@ -169,6 +188,34 @@ private:
     /// Parameter: A vector of I3CLSimOpenCLDevice objects, describing the devices to be used for simulation.
     I3CLSimOpenCLDeviceSeries openCLDeviceList_;
 
+    /// Parameter: Propagate photons on the host with I3CLSimStepToPhotonConverterCPU instead of
+    ///   using the OpenCL devices.
+    bool useCPUConverter_;
+
+    /// Parameter: The number of threads used by the CPU converter. 0 uses one per hardware thread.
+    uint32_t numCPUThreads_;
+
+    /// Parameter: Send bunches of steps to the converter that is predicted to finish them first,
+    ///   based on the measured photon throughput of each converter, instead of the one with the
+    ///   fewest queued bunches.
+    bool scheduleBunchesByThroughput_;
+
+    /// Parameter: The number of threads converting the photons returned by the converters
+    ///   into I3Photons for the frames. 0 uses one per hardware thread.
+    uint32_t numPhotonConversionThreads_;
+
+    /// Parameter: Push every frame as soon as all of its photons have returned and keep
+    ///   admitting new frames, instead of collecting all buffered frames at once.
+    bool streamFrames_;
+
+    /// Parameter: The memory in bytes the photons of the frames being worked on may take up
+    ///   when streaming frames. Frames are admitted by their predicted number of photons.
+    double hostMemoryBudget_;
+
+    /// Parameter: Split the light sources of frames predicted to generate more photons than
+    ///   this into chunks that are simulated in separate flushes.
+    double maxNumPhotonsPerChunk_;
+
     /// Parameter: The DOM radius used during photon tracking.
     double DOMRadius_;
 
@@ -240,6 +287,11 @@ private:
     ///   easy to observe.
     bool enableDoubleBuffering_;
 
+    /// Parameter: The number of buffer sets to cycle through. Up to this many bunches of steps
+    ///   can be in flight at the same time. If set to zero (the default), the depth is taken
+    ///   from "EnableDoubleBuffering".
+    uint32_t bufferRingDepth_;
+
     /// Parmeter: Enables double-precision support in the kernel. This slows down calculations and
     ///   requires more memory. The performance hit is minimal on CPUs but up to an order
     ///   of magnitude on GPUs.
@@ -297,6 +349,21 @@ private:
     ///   If set to zero (the default) the largest possible workgroup size will be chosen.
     uint32_t limitWorkgroupSize_;
 
+    /// Parmeter: Count how often the kernel runs through each of its phases and, on NVIDIA GPUs,
+    ///   how many device clock ticks are spent there. The results are written to the summary service.
+    bool profileKernel_;
+
+    /// Parmeter: Launch a fixed number of persistent OpenCL work items that take ranges of
+    ///   photons from a work queue, instead of one work item per step.
+    bool usePersistentThreads_;
+
+    /// Parmeter: The number of persistent work items. 0 selects a few work groups per compute unit.
+    uint32_t numPersistentWorkItems_;
+
+    /// Parmeter: Split steps with more photons than this factor times the median of their bunch
+    ///   into several work items. 0 disables splitting.
+    double stepSplittingFactor_;
+
     /// Parameter: do not even start light from sources that do not have any DOMs closer to
     ///   to them than this distance. (default is 300m)
     double closestDOMDistanceCutoff_;
@@ -329,6 +396,13 @@ private:
 
     // helper functions
     std::size_t FlushFrameCache();
+
+    // used instead of FlushFrameCache() if frames are streamed
+    bool CanAdmitFrame(double lightSourceEnergy, double predictedNumPhotons) const;
+    bool MemoryBudgetIsActive() const;
+    void RequestFlushForHeadFrame(bool force);
+    std::size_t CollectResults(bool wait);
+    std::size_t PushCompletedFrames();
     void ConvertMCTreeToLightSources(const I3MCTree &mcTree,
                                      std::deque<I3CLSimLightSource> &lightSources,
                                      std::deque<double> &timeOffsets);
@@ -337,9 +411,9 @@ private:
                                             std::deque<double> &timeOffsets);
 
 
-    // statistics will be collected here:
-    std::map<uint32_t, uint64_t> photonNumGeneratedPerParticle_;
-    std::map<uint32_t, double> photonWeightSumGeneratedPerParticle_;
+    // statistics will be collected here (indexed by particle cache index):
+    std::vector<uint64_t> photonNumGeneratedPerParticle_;
+    std::vector<double> photonWeightSumGeneratedPerParticle_;
 
 
 
@@ -356,16 +430,66 @@ private:
 
     I3CLSimSimpleGeometryFromI3GeometryPtr geometry_;
     std::vector<I3CLSimStepToPhotonConverterOpenCLPtr> openCLStepsToPhotonsConverters_;
+    I3CLSimStepToPhotonConverterCPUPtr cpuStepsToPhotonsConverter_;
+    // all converters steps are sent to, either the OpenCL ones or the CPU one
+    std::vector<I3CLSimStepToPhotonConverterPtr> stepsToPhotonsConverters_;
+    // decides which of the converters a bunch of steps is sent to
+    I3CLSimStepBunchSchedulerPtr bunchScheduler_;
     I3CLSimLightSourceToStepConverterGeant4Ptr geant4ParticleToStepsConverter_;
 
     // list of all currently held frames, in order
     std::size_t frameListPhysicsFrameCounter_;
-    std::vector<I3FramePtr> frameList_;
+    std::deque<I3FramePtr> frameList_;
     std::deque<I3FramePtr> frameList2_;
-    std::vector<I3PhotonSeriesMapPtr> photonsForFrameList_;
-    std::vector<int32_t> currentPhotonIdForFrame_;
-    std::vector<bool> frameIsBeingWorkedOn_;
-    std::vector<std::set<ModuleKey> > maskedOMKeys_;
+    std::deque<I3PhotonSeriesMapPtr> photonsForFrameList_;
+    std::deque<int32_t> currentPhotonIdForFrame_;
+    std::deque<bool> frameIsBeingWorkedOn_;
+    std::deque<std::set<ModuleKey> > maskedOMKeys_;
+
+    // the frame list entry of frameList_.front(). Always 0 unless
+    // frames are streamed, then frames are counted from the start.
+    std::size_t frameListFirstEntry_;
+
+    // when streaming frames: the light source energy of each frame
+    // and their sum (only used with "TotalEnergyToProcess")
+    std::deque<double> lightSourceEnergyForFrameList_;
+    double lightSourceEnergyInFlight_;
+
+    // when streaming frames with a memory budget: the predicted
+    // number of photons of each frame and their sum, and the
+    // memory the photons of pushed frames took up per predicted photon
+    std::deque<double> predictedNumPhotonsForFrameList_;
+    double predictedNumPhotonsInFlight_;
+    double predictedNumPhotonsPushed_;
+    double photonMemoryPushed_;
+    // the most photons per meter of track in any ice layer
+    double maxPhotonsPerMeter_;
+
+    // the frame being worked on in chunks, if any (see ProcessFrameInChunks()).
+    // Its photon map, photon IDs and statistics carry over from one flush
+    // to the next, it is only pushed after the last chunk.
+    I3FramePtr chunkedFrame_;
+    bool chunkedFrameIsLastChunk_;
+    I3PhotonSeriesMapPtr chunkedFramePhotons_;
+    int32_t chunkedFrameNextPhotonId_;
+    I3CLSimEventStatisticsPtr chunkedFrameStatistics_;
+    std::deque<I3CLSimLightSource> chunkLightSources_;
+    std::deque<double> chunkTimeOffsets_;
+
+    // when streaming frames: keeps track of the steps and bunches of
+    // each frame. Frames before this one will get all of their steps
+    // without another flushing marker.
+    I3CLSimFrameCompletionTrackerPtr frameTracker_;
+    uint64_t numFramesCoveredByFlush_;
+
+    // when streaming frames: the converters announce each of their
+    // results here, so the module can wait for any of them. NULL if
+    // the converters do not support this.
+    boost::shared_ptr<I3CLSimQueue<std::size_t> > convertersWithResults_;
+
+    // Thread() assigns bunches while the main thread books them off
+    // when streaming frames
+    boost::mutex bunchSchedulerMutex_;
 
     struct particleCacheEntry
     {
@@ -376,21 +500,50 @@ private:
     };
 
     // list of all particles (with pointrs to their frames)
-    // currently being simulated
-    std::map<uint32_t, particleCacheEntry> particleCache_;
-
-    static void AddPhotonsToFrames(const I3CLSimPhotonSeries &photons,
-                                   I3CLSimPhotonHistorySeriesConstPtr photonHistories,
-                                   const std::vector<I3PhotonSeriesMapPtr> &photonsForFrameList_,
-                                   std::vector<int32_t> &currentPhotonIdForFrame_,
-                                   const std::vector<I3FramePtr> &frameList_,
-                                   const std::map<uint32_t, particleCacheEntry> &particleCache_,
-                                   const std::vector<std::set<ModuleKey> > &maskedOMKeys_,
+    // currently being simulated. The particle cache index is
+    // the identifier of the steps and photons of the particle.
+    // It starts at 1 after every flush, entry 0 is never used.
+    // When streaming frames, the particles of pushed frames are
+    // removed from the front and the indices only start at 1 again
+    // once there are no frames left.
+    std::deque<particleCacheEntry> particleCache_;
+    uint32_t particleCacheFirstIndex_; // the index of particleCache_.front()
+
+    // when streaming frames: photons at the DOMs (count and weight
+    // sum) per particle, in the same order as particleCache_
+    std::deque<uint64_t> photonNumAtOMPerParticle_;
+    std::deque<double> photonWeightSumAtOMPerParticle_;
+
+    // the photons of one frame for some of its DOMs (see AddPhotonsToFrames)
+    struct photonShard;
+
+    // the threads and shards of AddPhotonsToFrames, kept from one
+    // call to the next
+    struct photonConversionPool;
+    boost::shared_ptr<photonConversionPool> photonConversionPool_;
+
+    // the photon statistics are added to photonNumAtOMPerParticle
+    // and photonWeightSumAtOMPerParticle, which are grown to the
+    // size of the particle cache if necessary
+    static void AddPhotonsToFrames(const std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> &results,
+                                   const std::deque<I3PhotonSeriesMapPtr> &photonsForFrameList_,
+                                   std::deque<int32_t> &currentPhotonIdForFrame_,
+                                   const std::deque<I3FramePtr> &frameList_,
+                                   std::size_t frameListFirstEntry,
+                                   const std::deque<particleCacheEntry> &particleCache_,
+                                   uint32_t particleCacheFirstIndex,
+                                   const std::deque<std::set<ModuleKey> > &maskedOMKeys_,
                                    bool collectStatistics_,
-                                   std::map<uint32_t, uint64_t> &photonNumAtOMPerParticle,
-                                   std::map<uint32_t, double> &photonWeightSumAtOMPerParticle
+                                   std::deque<uint64_t> &photonNumAtOMPerParticle,
+                                   std::deque<double> &photonWeightSumAtOMPerParticle,
+                                   photonConversionPool &pool
                                    );
 
+    static void ConvertPhotonShard(photonShard &shard,
+                                   const std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> &results,
+                                   const std::deque<particleCacheEntry> &particleCache_,
+                                   uint32_t particleCacheFirstIndex);
+
     SET_LOGGER("I3CLSimModule");
 };
 
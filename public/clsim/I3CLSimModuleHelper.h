@@ -37,6 +37,7 @@
 #include "clsim/I3CLSimSimpleGeometryFromI3Geometry.h"
 
 #include "clsim/I3CLSimStepToPhotonConverterOpenCL.h"
+#include "clsim/I3CLSimStepToPhotonConverterCPU.h"
 #include "clsim/I3CLSimLightSourceToStepConverterGeant4.h"
 
 #include "clsim/I3CLSimLightSourceParameterization.h"
@@ -72,11 +73,31 @@ namespace I3CLSimModuleHelper {
         I3Vector<float> holeIceCylinderRadii;
         I3Vector<float> holeIceCylinderScatteringLengths;
         I3Vector<float> holeIceCylinderAbsorptionLengths;
+        bool profileKernel;
+        uint32_t bufferRingDepth;
+        bool usePersistentThreads;
+        uint32_t numPersistentWorkItems;
+        double stepSplittingFactor;
     };
 
     I3CLSimStepToPhotonConverterOpenCLPtr
     initializeOpenCL(OpenCLInitOptions options);
 
+    I3CLSimStepToPhotonConverterCPUPtr
+    initializeCPU(I3RandomServicePtr rng,
+                  I3CLSimSimpleGeometryFromI3GeometryPtr geometry,
+                  I3CLSimMediumPropertiesConstPtr medium,
+                  I3CLSimFunctionConstPtr wavelengthGenerationBias,
+                  const std::vector<I3CLSimRandomValueConstPtr> &wavelengthGenerators,
+                  bool stopDetectedPhotons,
+                  double pancakeFactor,
+                  bool simulateHoleIce,
+                  const I3Vector<I3Position> &holeIceCylinderPositions,
+                  const I3Vector<float> &holeIceCylinderRadii,
+                  const I3Vector<float> &holeIceCylinderScatteringLengths,
+                  const I3Vector<float> &holeIceCylinderAbsorptionLengths,
+                  uint32_t numThreads);
+
     I3CLSimLightSourceToStepConverterGeant4Ptr
     initializeGeant4(I3RandomServicePtr rng,
                      I3CLSimMediumPropertiesConstPtr medium,
@@ -69,8 +69,9 @@ public:
         // add the message to the queue
         queue_.push(msg);
         
-        // notify the consumer thread
-        cond_.notify_one();
+        // notify the consumer thread (producers and consumers share
+        // the condition, so wake all of them or the wrong one might get it)
+        cond_.notify_all();
     }
     
     
@@ -92,7 +93,7 @@ public:
         queue_.pop();
         
         // notify the producer that there is space on the queue now
-        cond_.notify_one();
+        cond_.notify_all();
         
         return msg;
     }
@@ -112,7 +113,7 @@ public:
         queue_.pop();
         
         // notify the producer that there is space on the queue now
-        cond_.notify_one();
+        cond_.notify_all();
         
         return true;
     }
@@ -141,7 +142,7 @@ public:
         queue_.pop();
         
         // notify the producer that there is space on the queue now
-        cond_.notify_one();
+        cond_.notify_all();
         
         return msg;
     }
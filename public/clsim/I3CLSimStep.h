@@ -63,14 +63,16 @@
  * typically produced by a full particle tracker
  * like Geant4.
  */
-static const unsigned i3clsimstep_version_ = 0;
+static const unsigned i3clsimstep_version_ = 1;
 
 struct I3CLSimStep 
 {
     
 public:
     
-    I3CLSimStep() {;}
+    // The sub-step fields are read by the OpenCL converter, so they
+    // must not be left uninitialized like the rest of the step.
+    I3CLSimStep() : sequenceNumber(0), dummy1(0), dummy2(0) {;}
     
     ~I3CLSimStep();
 
@@ -86,6 +88,7 @@ public:
     inline uint32_t GetNumPhotons() const {return numPhotons;}
     inline float GetWeight() const {return weight;}
     inline uint32_t GetID() const {return identifier;}
+    inline uint32_t GetSequenceNumber() const {return sequenceNumber;}
     inline uint8_t GetSourceType() const {return sourceType;}
     inline uint8_t GetDummy1() const {return dummy1;}
     inline uint16_t GetDummy2() const {return dummy2;}
@@ -112,6 +115,7 @@ public:
     inline void SetNumPhotons(const uint32_t &val) {numPhotons=val;}
     inline void SetWeight(const float &val) {weight=val;}
     inline void SetID(const uint32_t &val) {identifier=val;}
+    inline void SetSequenceNumber(const uint32_t &val) {sequenceNumber=val;}
     inline void SetSourceType(const uint8_t &val) {sourceType=val;}
     inline void SetDummy1(const uint8_t &val) {dummy1=val;}
     inline void SetDummy2(const uint16_t &val) {dummy2=val;}
@@ -140,9 +144,10 @@ public:
     cl_uint numPhotons;
     cl_float weight;
     cl_uint identifier;
+    cl_uint sequenceNumber; // number of the step, counted by the light source to step converter that created it
     cl_uchar sourceType;
-    cl_uchar dummy1;
-    cl_ushort dummy2;
+    cl_uchar dummy1;  // log2 of the sub-step size of steps split by I3CLSimStepToPhotonConverterOpenCL
+    cl_ushort dummy2; // sub-step index of steps split by I3CLSimStepToPhotonConverterOpenCL
 
 private:
     friend class boost::serialization::access;
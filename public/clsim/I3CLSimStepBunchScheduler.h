@@ -0,0 +1,162 @@
+/**
+ * Copyright (c) 2018
+ * the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * @file I3CLSimStepBunchScheduler.h
+ */
+
+#ifndef I3CLSIMSTEPBUNCHSCHEDULER_H_INCLUDED
+#define I3CLSIMSTEPBUNCHSCHEDULER_H_INCLUDED
+
+#include "icetray/I3PointerTypedefs.h"
+
+#include <stdint.h>
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * @brief Decides which of several step-to-photon converters
+ * a bunch of steps is sent to.
+ *
+ * Each converter has a throughput estimate in photons per second
+ * of busy time, measured from its own statistics (see
+ * I3CLSimStepToPhotonConverter::GetThroughputStatistics()).
+ * A bunch goes to the converter that is predicted to finish it
+ * first, given the photons already assigned to it in the current
+ * round. A round ends when all results are collected
+ * (i.e. in I3CLSimModule::FlushFrameCache()). If results are
+ * collected continuously instead, Release() books off the photons
+ * of every bunch that has returned, so the prediction is based on
+ * the photons still in flight.
+ *
+ * As long as no converter has reported a throughput, bunches are
+ * distributed round-robin among the converters with the lowest
+ * queue size, which is what I3CLSimModule did before.
+ * Converters without a measurement are assumed to be as fast
+ * as the average of the others.
+ *
+ * This class only does the bookkeeping and is not thread-safe.
+ */
+class I3CLSimStepBunchScheduler
+{
+public:
+    static const double default_smoothingFactor;
+
+    I3CLSimStepBunchScheduler(std::size_t numConverters);
+
+    /**
+     * Returns the number of converters.
+     */
+    std::size_t GetNumConverters() const;
+
+    /**
+     * Enables or disables the throughput-based assignment.
+     * If disabled, the queue size round-robin is always used.
+     */
+    void SetUseThroughput(bool value);
+
+    /**
+     * Returns true if the throughput-based assignment is enabled.
+     */
+    bool GetUseThroughput() const;
+
+    /**
+     * Sets the weight of a new measurement in the exponential
+     * moving average of the throughput. 1 only uses the latest
+     * measurement. Must be in (0,1].
+     */
+    void SetSmoothingFactor(double value);
+
+    /**
+     * Returns the smoothing factor.
+     */
+    double GetSmoothingFactor() const;
+
+    /**
+     * Starts a new round, i.e. forgets about all photons
+     * assigned so far. Call this once all results of
+     * the previous round have been retrieved.
+     */
+    void StartRound();
+
+    /**
+     * Chooses the converter for a bunch with numPhotons photons
+     * and books the photons for it. queueSizes holds the
+     * current QueueSize() of each converter and is only used
+     * by the round-robin fallback.
+     */
+    std::size_t Assign(uint64_t numPhotons, const std::vector<std::size_t> &queueSizes);
+
+    /**
+     * Books off the photons of a bunch once its results have
+     * been retrieved from the converter it was assigned to.
+     */
+    void Release(std::size_t converterIndex, uint64_t numPhotons);
+
+    /**
+     * Updates the throughput estimate of a converter from its
+     * cumulative statistics: the total number of photons
+     * generated and the total busy time in seconds.
+     * Only the difference to the previous call is used for
+     * the estimate. Calls without progress are ignored.
+     */
+    void SetCumulativeStatistics(std::size_t converterIndex, uint64_t totalNumPhotons, double totalBusyTime);
+
+    /**
+     * Returns true if at least one converter has
+     * a throughput estimate.
+     */
+    bool HasThroughputEstimates() const;
+
+    /**
+     * Returns the throughput estimate of a converter in photons
+     * per second, or 0 if there was no measurement yet.
+     */
+    double GetPhotonsPerSecond(std::size_t converterIndex) const;
+
+    /**
+     * Returns the photons assigned to a converter in this round.
+     */
+    uint64_t GetAssignedPhotons(std::size_t converterIndex) const;
+
+    /**
+     * Returns the predicted time in seconds until the converter
+     * finishes the photons assigned to it in this round, or 0
+     * if there are no throughput estimates.
+     */
+    double GetPredictedCompletionTime(std::size_t converterIndex) const;
+
+private:
+    std::size_t AssignRoundRobin(const std::vector<std::size_t> &queueSizes);
+
+    // the estimate used for the prediction, i.e. the average
+    // of the others for converters without a measurement
+    double EffectivePhotonsPerSecond(std::size_t converterIndex) const;
+
+    bool useThroughput_;
+    double smoothingFactor_;
+    std::size_t lastIndex_;
+
+    std::vector<uint64_t> assignedPhotons_;
+    std::vector<double> photonsPerSecond_;
+    std::vector<uint64_t> lastTotalNumPhotons_;
+    std::vector<double> lastTotalBusyTime_;
+};
+
+I3_POINTER_TYPEDEFS(I3CLSimStepBunchScheduler);
+
+#endif //I3CLSIMSTEPBUNCHSCHEDULER_H_INCLUDED
@@ -32,6 +32,19 @@
  * indexed by a photon multiplicity. Arbitrarily sized bunches 
  * of steps can be retrieved. They will be clustered by
  * multiplicity.
+ *
+ * The entries are kept in blocks of a fixed size that are
+ * taken from an arena owned by the store. Blocks that are
+ * emptied go back to the arena and are re-used, so once the
+ * store has seen its largest fill level, inserting and popping
+ * does not allocate any more memory.
+ *
+ * Each bucket holds a FIFO list of blocks. Small indices
+ * (below the initial size given to the constructor, but at
+ * least default_numLinearBins) get a bucket each. Larger
+ * indices share buckets radix-style: each power of two is
+ * split into 32 buckets, so the entries of one bucket
+ * differ by less than ~3% in their index.
  */
 
 #include "icetray/I3TrayHeaders.h"
@@ -40,19 +53,16 @@
 #include <stdint.h>
 
 #include <vector>
-#include <deque>
 #include <limits>
+#include <algorithm>
 
 #include <boost/static_assert.hpp>
-#include <boost/foreach.hpp>
-#include <boost/pool/pool_alloc.hpp> 
+#include <boost/noncopyable.hpp>
 
 template <typename U, class T>
-class I3CLSimTemplateStore 
+class I3CLSimTemplateStore : private boost::noncopyable
 {
 private:
-    typedef std::deque<T> TDequeType;
-    
     // static_assert: U==unsigned integer (8,16,32 or 64 bit)
     BOOST_STATIC_ASSERT((std::numeric_limits<U>::digits >= 8)
                         && std::numeric_limits<U>::is_specialized
@@ -61,30 +71,43 @@ private:
 
     // static_assert: max<U> <= max<std::size_t>
     BOOST_STATIC_ASSERT((std::numeric_limits<U>::digits <= std::numeric_limits<std::size_t>::digits));
-    
+
+    static const std::size_t numSubBinsBits = 5;
+    static const std::size_t numSubBins = 1 << numSubBinsBits;
+    static const std::size_t noBlock = static_cast<std::size_t>(-1);
+
 public:
-    I3CLSimTemplateStore(std::size_t initialSize):
-    bins_(initialSize, NULL),
-    currentSize_(0)
+    static const std::size_t default_numLinearBins = 64;
+    static const std::size_t default_blockSize = 64;
+
+    I3CLSimTemplateStore(std::size_t initialSize, std::size_t blockSize=default_blockSize)
+    :
+    numLinearBins_(std::max(initialSize, default_numLinearBins)),
+    blockSize_(blockSize),
+    currentSize_(0),
+    firstUsedBin_(0),
+    freeBlocks_(noBlock)
     {
-        for (std::size_t i=0;i<initialSize;++i)
-        {
-            bins_[i] = new TDequeType();
-        }
+        init();
     }
 
-    I3CLSimTemplateStore():
-    currentSize_(0)
+    I3CLSimTemplateStore()
+    :
+    numLinearBins_(default_numLinearBins),
+    blockSize_(default_blockSize),
+    currentSize_(0),
+    firstUsedBin_(0),
+    freeBlocks_(noBlock)
     {
+        init();
     }
     
     ~I3CLSimTemplateStore()
     {
-        BOOST_FOREACH(TDequeType *ptr, bins_)
+        for (std::size_t i=0;i<blocks_.size();++i)
         {
-            delete ptr; // NULL-pointer deletion is valid (and a no-op)
+            delete [] blocks_[i];
         }
-        
     }
     
     /**
@@ -101,24 +124,30 @@ public:
      */
     inline T &insert_new(U index)
     {
-        // re-size the number of bins if necessary
-        if (index >= bins_.size()) 
-        {
-            const std::size_t oldSize = bins_.size();
-            const std::size_t newSize = static_cast<std::size_t>(index+1);
+        const std::size_t binIndex = bin_index(index);
+        Bin_t &bin = bins_[binIndex];
 
-            bins_.resize(newSize, NULL);
-            
-            for (std::size_t i = oldSize; i < newSize; ++i)
-            {
-                bins_[i] = new TDequeType();
+        if ((bin.tail==noBlock) || (bin.tailPos==blockSize_))
+        {
+            const std::size_t block = allocate_block();
+            if (bin.tail==noBlock) {
+                bin.head = block;
+                bin.headPos = 0;
+            } else {
+                nextBlock_[bin.tail] = block;
             }
+            bin.tail = block;
+            bin.tailPos = 0;
         }
-        
-        bins_[index]->push_back(T());
+
+        T &value = blocks_[bin.tail][bin.tailPos];
+        ++bin.tailPos;
+        value = T();
+
+        if ((currentSize_==0) || (binIndex < firstUsedBin_)) firstUsedBin_=binIndex;
         ++currentSize_;
-        
-        return bins_[index]->back();
+
+        return value;
     }
     
     inline std::size_t size() const
@@ -130,58 +159,84 @@ public:
     {
         return (currentSize_==0);
     }
-    
-    inline TDequeType &operator[](U index)
-    {
-        return *(bins_[index]);
-    }
 
-    inline const TDequeType &operator[](U index) const
+    /**
+     * allocates enough blocks to hold the given number of
+     * entries (in addition to the ones in use right now)
+     */
+    void reserve(std::size_t numEntries)
     {
-        return *(bins_[index]);
+        std::size_t numFree=0;
+        for (std::size_t block=freeBlocks_;block!=noBlock;block=nextBlock_[block]) ++numFree;
+
+        const std::size_t numNeeded = (numEntries+blockSize_-1)/blockSize_;
+        for (;numFree<numNeeded;++numFree)
+        {
+            free_block(new_block());
+        }
     }
-    
-    inline TDequeType &at(U index)
+
+    /**
+     * the number of blocks allocated so far. This does not
+     * change as long as blocks can be re-used.
+     */
+    inline std::size_t num_blocks() const
     {
-        return *(bins_.at(index));
+        return blocks_.size();
     }
 
-    inline const TDequeType &at(U index) const
+    inline std::size_t block_size() const
     {
-        return *(bins_.at(index));
+        return blockSize_;
     }
-    
+
     /**
-     * takes a number of entries, copies them into a vector
-     * (sorted by index) and pops them from this container.
-     * If less than the specified number of entries exist in
-     * this container, it is fully emptied.
-     *
-     * All current entries in the vector are removed.
+     * takes a number of entries, copies them to a contiguous
+     * array (sorted by bucket, see above) and pops them from
+     * this container. Indices below the number of linear bins
+     * come out sorted, larger ones are only sorted to ~3% and
+     * in insertion order within a bucket.
+     * The array needs space for "size" entries.
+     * Returns the number of entries copied, which is less than
+     * "size" if the container has been emptied.
      */
-    inline void pop_bunch_to_vector(std::size_t size, std::vector<T> &vect)
+    std::size_t pop_bunch(std::size_t size, T *dest)
     {
         const std::size_t realSize = std::min(size, currentSize_);
-        vect.clear();
-        if (realSize==0) return;
 
         std::size_t itemsPopped=0;
-        
-        BOOST_FOREACH(TDequeType *ptr, bins_)
+        for (std::size_t binIndex=firstUsedBin_;
+             (itemsPopped<realSize) && (binIndex<bins_.size());
+             ++binIndex)
         {
-            TDequeType &currentQueue = *ptr;
+            Bin_t &bin = bins_[binIndex];
 
-            for (;;)
+            while ((itemsPopped<realSize) && (bin.head!=noBlock))
             {
-                if (currentQueue.empty()) break;
+                // copy as much of the head block as possible at once
+                const std::size_t blockEnd = (bin.head==bin.tail)?bin.tailPos:blockSize_;
+                const std::size_t num = std::min(blockEnd-bin.headPos, realSize-itemsPopped);
+                const T *src = blocks_[bin.head]+bin.headPos;
+                std::copy(src, src+num, dest+itemsPopped);
+                bin.headPos+=num;
+                itemsPopped+=num;
 
-                vect.push_back(currentQueue.front());   // insert into vector
-                currentQueue.pop_front();               // remove from deque
-                ++itemsPopped;
-                
-                if (itemsPopped>=realSize) break; // are we finished yet?
+                if (bin.headPos==blockEnd)
+                {
+                    // the block is used up, give it back
+                    const std::size_t block = bin.head;
+                    if (bin.head==bin.tail) {
+                        bin.head=noBlock;
+                        bin.tail=noBlock;
+                    } else {
+                        bin.head=nextBlock_[block];
+                    }
+                    bin.headPos=0;
+                    free_block(block);
+                }
             }
-            if (itemsPopped>=realSize) break; // are we finished yet?
+
+            if (bin.head!=noBlock) firstUsedBin_=binIndex;
         }
         
         if (itemsPopped > currentSize_)
@@ -191,11 +246,35 @@ public:
         }
         
         currentSize_ -= itemsPopped;
+
+        return itemsPopped;
     }
 
     /**
      * takes a number of entries, copies them into a vector
-     * (sorted by index) and pops them from this container.
+     * (sorted by bucket, like pop_bunch()) and pops them from
+     * this container.
+     * If less than the specified number of entries exist in
+     * this container, it is fully emptied.
+     *
+     * All current entries in the vector are removed.
+     * The vector is re-sized once, so re-using it does
+     * not allocate memory.
+     */
+    inline void pop_bunch_to_vector(std::size_t size, std::vector<T> &vect)
+    {
+        const std::size_t realSize = std::min(size, currentSize_);
+        vect.clear();
+        if (realSize==0) return;
+
+        vect.resize(realSize);
+        pop_bunch(realSize, &(vect[0]));
+    }
+
+    /**
+     * takes a number of entries, copies them into a vector
+     * (sorted by bucket, like pop_bunch()) and pops them from
+     * this container.
      * If less than the specified number of entries exist in
      * this container, the remaining entries are filled with
      * copies of a template.
@@ -204,24 +283,94 @@ public:
      */
     inline void pop_bunch_to_vector(std::size_t size, std::vector<T> &vect, const T &temp)
     {
-        vect.clear();
-        vect.reserve(size);
-        pop_bunch_to_vector(size, vect);
-        const std::size_t realEntries = vect.size();
+        vect.assign(size, temp);
+        if (size==0) return;
 
-        // fill the remainder of the vector with copies
-        // of the template
-        for (std::size_t i=realEntries; i<size; ++i)
-        {
-            vect.push_back(temp);
-        }
+        pop_bunch(size, &(vect[0]));
     }
     
 private:
-    std::vector<TDequeType *> bins_;
+    struct Bin_t
+    {
+        Bin_t() : head(noBlock), tail(noBlock), headPos(0), tailPos(0) {;}
+
+        std::size_t head;    // block with the oldest entries
+        std::size_t tail;    // block new entries are added to
+        std::size_t headPos; // first entry in the head block
+        std::size_t tailPos; // one past the last entry in the tail block
+    };
+
+    void init()
+    {
+        if (blockSize_==0) log_fatal("The block size must be > 0.");
+
+        // the linear bins, then 32 bins for each power of two above them
+        const std::size_t numBins = numLinearBins_ +
+            (std::numeric_limits<std::size_t>::digits-numSubBinsBits+1)*numSubBins;
+        bins_.resize(numBins);
+    }
+
+    inline std::size_t bin_index(U index) const
+    {
+        const std::size_t value = static_cast<std::size_t>(index);
+        if (value < numLinearBins_) return value;
+
+        // offset so that the first indices after the
+        // linear range still get a bin each
+        const std::size_t offset = value-numLinearBins_;
+        if (offset > std::numeric_limits<std::size_t>::max()-numSubBins) return bins_.size()-1;
+        const std::size_t shifted = offset+numSubBins;
+
+        std::size_t msb=numSubBinsBits;
+        while (shifted >> (msb+1)) ++msb;
+
+        return numLinearBins_ + (msb-numSubBinsBits)*numSubBins +
+            ((shifted >> (msb-numSubBinsBits)) & (numSubBins-1));
+    }
+
+    std::size_t new_block()
+    {
+        blocks_.push_back(new T[blockSize_]);
+        nextBlock_.push_back(noBlock);
+        return blocks_.size()-1;
+    }
+
+    inline std::size_t allocate_block()
+    {
+        if (freeBlocks_==noBlock) return new_block();
+
+        const std::size_t block = freeBlocks_;
+        freeBlocks_ = nextBlock_[block];
+        nextBlock_[block] = noBlock;
+        return block;
+    }
+
+    inline void free_block(std::size_t block)
+    {
+        nextBlock_[block] = freeBlocks_;
+        freeBlocks_ = block;
+    }
+
+    std::size_t numLinearBins_;
+    std::size_t blockSize_;
     std::size_t currentSize_;
+    std::size_t firstUsedBin_;
+
+    std::vector<Bin_t> bins_;
+
+    // the arena: the blocks and the index of the next block
+    // in the same bin (or in the list of free blocks)
+    std::vector<T *> blocks_;
+    std::vector<std::size_t> nextBlock_;
+    std::size_t freeBlocks_;
 };
 
+template <typename U, class T> const std::size_t I3CLSimTemplateStore<U, T>::numSubBinsBits;
+template <typename U, class T> const std::size_t I3CLSimTemplateStore<U, T>::numSubBins;
+template <typename U, class T> const std::size_t I3CLSimTemplateStore<U, T>::noBlock;
+template <typename U, class T> const std::size_t I3CLSimTemplateStore<U, T>::default_numLinearBins;
+template <typename U, class T> const std::size_t I3CLSimTemplateStore<U, T>::default_blockSize;
+
 
 typedef I3CLSimTemplateStore<uint32_t, I3CLSimStep> I3CLSimStepStore;
 
@@ -39,6 +39,7 @@
 #include "clsim/function/I3CLSimFunction.h"
 
 #include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
 
 #include <vector>
 #include <map>
@@ -84,6 +85,9 @@ public:
         I3CLSimPhotonSeriesPtr photons;
         I3CLSimPhotonHistorySeriesPtr photonHistories;
     };
+
+    // called with the identifier of a result once it can be retrieved
+    typedef boost::function<void (uint32_t)> ResultAvailableCallback_t;
     
     //virtual ~I3CLSimStepToPhotonConverter();
 
@@ -175,7 +179,36 @@ public:
      * Will throw if not initialized.
      */
     virtual ConversionResult_t GetConversionResult() = 0;
-    
+
+    /**
+     * Reports the total number of photons generated so far and
+     * the total time in seconds the converter was busy generating
+     * them. Used to estimate the throughput of the converter
+     * (see I3CLSimStepBunchScheduler).
+     *
+     * Returns false if the converter does not collect
+     * these statistics or has not done any work yet.
+     */
+    virtual bool GetThroughputStatistics(uint64_t &numPhotons, double &busyTime) {return false;}
+
+    /**
+     * Registers a function that is called every time a result
+     * becomes available, i.e. once GetConversionResult() would
+     * return it without blocking. Results still need to be
+     * retrieved with GetConversionResult() and come out in the
+     * order the steps were enqueued, but a single thread can wait
+     * for whichever of several converters finishes first
+     * (e.g. by binding the converter index and putting it on a
+     * shared I3CLSimQueue).
+     *
+     * The function is called from the converter's own thread, so
+     * it has to be thread-safe, should return quickly and must not
+     * call back into the converter. An empty function removes it.
+     *
+     * Returns false if the converter does not support this.
+     */
+    virtual bool SetResultAvailableCallback(const ResultAvailableCallback_t &callback) {return false;}
+
 protected:
 };
 
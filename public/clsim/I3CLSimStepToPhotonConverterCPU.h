@@ -0,0 +1,354 @@
+/**
+ * Copyright (c) 2018
+ * the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * @file I3CLSimStepToPhotonConverterCPU.h
+ */
+
+#ifndef I3CLSIMSTEPTOPHOTONCONVERTERCPU_H_INCLUDED
+#define I3CLSIMSTEPTOPHOTONCONVERTERCPU_H_INCLUDED
+
+#include "clsim/I3CLSimStepToPhotonConverter.h"
+
+#include "phys-services/I3RandomService.h"
+
+#include "dataclasses/I3Vector.h"
+#include "dataclasses/I3Position.h"
+
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "clsim/I3CLSimQueue.h"
+#include "clsim/I3CLSimLockFreeQueue.h"
+
+#include <vector>
+#include <string>
+
+/**
+ * @brief Creates photons from a given list of steps and propagates
+ * them to a DOM on the host, using a pool of native threads.
+ *
+ * The medium propagation uses the same code as the OpenCL kernel,
+ * resources/kernels/lib/, compiled as C++. Photon creation, scattering
+ * and the collision detection follow propagation_kernel.c.cl, such that
+ * the results are statistically equivalent to
+ * I3CLSimStepToPhotonConverterOpenCL.
+ *
+ * Each bunch of steps is split into chunks of a fixed number of steps.
+ * Every chunk has its own random number stream, seeded from the random
+ * service given to the constructor, so the results do not depend on the
+ * number of threads. Results are returned in the order the bunches were
+ * enqueued.
+ *
+ * Photon histories, "save all photons" mode and table-making are not
+ * supported.
+ */
+struct I3CLSimStepToPhotonConverterCPU : public I3CLSimStepToPhotonConverter
+{
+public:
+    static const std::size_t default_maxNumWorkitems;
+    static const std::size_t default_numStepsPerChunk;
+
+    I3CLSimStepToPhotonConverterCPU(I3RandomServicePtr randomService);
+    virtual ~I3CLSimStepToPhotonConverterCPU();
+
+    /**
+     * Sets the number of worker threads. A value of 0
+     * uses one thread per hardware thread.
+     *
+     * Will throw if already initialized.
+     */
+    void SetNumThreads(std::size_t val);
+
+    /**
+     * Gets the number of worker threads. Before
+     * Initialize(), this may be 0 (automatic).
+     */
+    std::size_t GetNumThreads() const;
+
+    /**
+     * Sets the maximum number of steps per bunch.
+     *
+     * Will throw if already initialized.
+     */
+    void SetMaxNumWorkitems(std::size_t val);
+
+    /**
+     * Gets the maximum number of steps per bunch.
+     */
+    std::size_t GetMaxNumWorkitems() const;
+
+    /**
+     * The number of steps in a bunch does not need to be a
+     * multiple of anything, so this is always 1. It exists
+     * to be interchangeable with the OpenCL converter.
+     */
+    std::size_t GetWorkgroupSize() const;
+
+    /**
+     * Sets the number of steps per chunk, i.e.
+     * the unit of work taken by a thread.
+     * The random number streams are tied to the
+     * chunks, so changing this changes the results
+     * (but not their distribution).
+     *
+     * Will throw if already initialized.
+     */
+    void SetNumStepsPerChunk(std::size_t val);
+
+    /**
+     * Gets the number of steps per chunk.
+     */
+    std::size_t GetNumStepsPerChunk() const;
+
+    /**
+     * Enables or disables stopping photons on detection.
+     * See I3CLSimStepToPhotonConverterOpenCL::SetStopDetectedPhotons.
+     *
+     * Will throw if already initialized.
+     */
+    void SetStopDetectedPhotons(bool value);
+
+    /**
+     * Returns true if photons are stopped on detection.
+     */
+    bool GetStopDetectedPhotons() const;
+
+    /**
+     * Sets the DOM pancake factor.
+     * See I3CLSimStepToPhotonConverterOpenCL::SetDOMPancakeFactor.
+     *
+     * Will throw if already initialized.
+     */
+    void SetDOMPancakeFactor(double value);
+
+    /**
+     * Returns the DOM pancake factor.
+     */
+    double GetDOMPancakeFactor() const;
+
+    /**
+     * Enables or disables the hole ice cylinders set
+     * with SetHoleIceCylinder*().
+     *
+     * Will throw if already initialized.
+     */
+    void SetSimulateHoleIce(bool value);
+
+    /**
+     * Returns true if hole ice is simulated.
+     */
+    bool GetSimulateHoleIce() const;
+
+    /**
+     * Set the hole ice cylinders. Unlike the OpenCL converter,
+     * they cannot be changed after initialization.
+     *
+     * Will throw if already initialized.
+     */
+    void SetHoleIceCylinderPositions(const I3Vector<I3Position> &positions);
+    void SetHoleIceCylinderRadii(const I3Vector<float> &radii);
+    void SetHoleIceCylinderScatteringLengths(const I3Vector<float> &scatteringLengths);
+    void SetHoleIceCylinderAbsorptionLengths(const I3Vector<float> &absorptionLengths);
+
+    /**
+     * The number of photons generated and the number of
+     * photons recorded at DOMs so far.
+     */
+    uint64_t GetTotalNumPhotonsGenerated() const;
+    uint64_t GetTotalNumPhotonsAtDOMs() const;
+
+    /**
+     * Sets the wavelength generators.
+     * The first generator (index 0) is assumed to return a Cherenkov
+     * spectrum that may have a bias applied to it. This bias factor
+     * needs to be set using SetWlenBias().
+     * All other generator indices are assumed to be for flasher/laser
+     * light generation. During generation, no Cherenkov angle
+     * rotation will be applied to those photons with indices >= 1.
+     * Will throw if used after the call to Initialize().
+     */
+    virtual void SetWlenGenerators(const std::vector<I3CLSimRandomValueConstPtr> &wlenGenerators);
+
+    /**
+     * Sets the wavelength weights. Set this to a constant value
+     * of 1 if you do not need biased photon generation.
+     * Will throw if used after the call to Initialize().
+     */
+    virtual void SetWlenBias(I3CLSimFunctionConstPtr wlenBias);
+
+    /**
+     * Sets the medium properties.
+     * Will throw if used after the call to Initialize().
+     */
+    virtual void SetMediumProperties(I3CLSimMediumPropertiesConstPtr mediumProperties);
+
+    /**
+     * Sets the geometry.
+     * Will throw if used after the call to Initialize().
+     */
+    virtual void SetGeometry(I3CLSimSimpleGeometryConstPtr geometry);
+
+    /**
+     * Initializes the simulation and starts the worker threads.
+     * Will throw if already initialized.
+     */
+    virtual void Initialize();
+
+    /**
+     * Returns true if initialized.
+     * Never throws.
+     */
+    virtual bool IsInitialized() const;
+
+    /**
+     * Adds a new I3CLSimStepSeries to the queue.
+     * The resulting I3CLSimPhotonSeries can be retrieved from the
+     * I3CLSimStepToPhotonConverter after some processing time.
+     *
+     * Will block while the worker threads are busy.
+     *
+     * Will throw if not initialized.
+     */
+    virtual void EnqueueSteps(I3CLSimStepSeriesConstPtr steps, uint32_t identifier);
+
+    /**
+     * Reports the number of chunks that are waiting
+     * for a worker thread.
+     *
+     * Will throw if not initialized.
+     */
+    virtual std::size_t QueueSize() const;
+
+    /**
+     * Returns true if more photons are available.
+     * If the return value is false, the current simulation is finished
+     * and a new step vector may be set.
+     *
+     * Will throw if not initialized.
+     */
+    virtual bool MorePhotonsAvailable() const;
+
+    /**
+     * Returns the photons of the oldest bunch.
+     *
+     * Blocks until all of its steps have been converted.
+     *
+     * Will throw if not initialized.
+     */
+    virtual I3CLSimStepToPhotonConverter::ConversionResult_t GetConversionResult();
+
+    /**
+     * Reports the photons generated so far and the time
+     * the worker threads spent converting chunks, divided
+     * by the number of threads.
+     */
+    virtual bool GetThroughputStatistics(uint64_t &numPhotons, double &busyTime);
+
+    /**
+     * Describes a string of the geometry for the
+     * collision detection. The DOMs are sorted by z.
+     */
+    struct String_t
+    {
+        double posX;
+        double posY;
+        double maxRadius; // largest DOM distance from (posX,posY), including the OM radius
+        double minZ;
+        double maxZ;
+        std::vector<double> domPosX;
+        std::vector<double> domPosY;
+        std::vector<double> domPosZ;
+        std::vector<int16_t> stringIDs;
+        std::vector<uint16_t> domIDs;
+    };
+
+private:
+    // a bunch of steps, as passed to EnqueueSteps()
+    struct Bunch_t
+    {
+        uint32_t identifier;
+        uint64_t sequenceNumber;
+        I3CLSimStepSeriesConstPtr steps;
+
+        // one photon series per chunk, filled by the worker threads
+        std::vector<I3CLSimPhotonSeries> photonsPerChunk;
+        std::size_t numChunksLeft;
+        boost::mutex mutex;
+        boost::condition_variable_any finished;
+    };
+    typedef boost::shared_ptr<Bunch_t> BunchPtr;
+
+    // the unit of work of the worker threads
+    struct Chunk_t
+    {
+        BunchPtr bunch;
+        std::size_t index;
+        std::size_t firstStep;
+        std::size_t numSteps;
+    };
+
+    // the medium and hole ice as seen by the kernel library,
+    // set up by each worker thread (see the .cxx file)
+    struct WorkerContext_t;
+
+    void WorkerThread();
+    void WorkerThread_impl(boost::this_thread::disable_interruption &di);
+    void ConvertChunk(const Chunk_t &chunk, const WorkerContext_t &context, I3CLSimPhotonSeries &photons);
+
+    void BuildStringList();
+
+    std::vector<boost::shared_ptr<boost::thread> > workerThreads_;
+    boost::shared_ptr<I3CLSimLockFreeQueue<Chunk_t> > queueToWorkers_;
+    boost::shared_ptr<I3CLSimQueue<BunchPtr> > pendingBunches_; // in the order they were enqueued
+
+    I3RandomServicePtr randomService_;
+    uint64_t randomSeed_;
+    uint64_t numBunchesEnqueued_;
+
+    bool initialized_;
+
+    std::size_t numThreads_;
+    std::size_t maxNumWorkitems_;
+    std::size_t numStepsPerChunk_;
+    bool stopDetectedPhotons_;
+    double pancakeFactor_;
+    bool simulateHoleIce_;
+
+    std::vector<I3CLSimRandomValueConstPtr> wlenGenerators_;
+    I3CLSimFunctionConstPtr wlenBias_;
+    I3CLSimMediumPropertiesConstPtr mediumProperties_;
+    I3CLSimSimpleGeometryConstPtr geometry_;
+
+    I3Vector<I3Position> holeIceCylinderPositions_;
+    I3Vector<float> holeIceCylinderRadii_;
+    I3Vector<float> holeIceCylinderScatteringLengths_;
+    I3Vector<float> holeIceCylinderAbsorptionLengths_;
+
+    // derived from the geometry in Initialize()
+    std::vector<String_t> strings_;
+    double omRadius_;
+
+    mutable boost::mutex statistics_mutex_;
+    uint64_t statistics_total_num_photons_generated_;
+    uint64_t statistics_total_num_photons_atDOMs_;
+    double statistics_total_conversion_time_; // in seconds, summed over all threads
+};
+
+I3_POINTER_TYPEDEFS(I3CLSimStepToPhotonConverterCPU);
+
+#endif //I3CLSIMSTEPTOPHOTONCONVERTERCPU_H_INCLUDED
@@ -36,6 +36,7 @@
 #include <boost/thread/locks.hpp>
 
 #include "clsim/I3CLSimQueue.h"
+#include "clsim/I3CLSimLockFreeQueue.h"
 
 #include "clsim/I3CLSimOpenCLDevice.h"
 
@@ -64,6 +65,30 @@ struct I3CLSimStepToPhotonConverterOpenCL : public I3CLSimStepToPhotonConverter
 public:
     static const bool default_useNativeMath;
 
+    /**
+     * Phases of the propagation kernel that are profiled
+     * with SetProfileKernel(true). Phases may be nested:
+     * the medium propagation includes the layer walk and
+     * the cylinder intersections, the collision check
+     * includes hit saving. The numbers need to match
+     * resources/kernels/lib/profiling/profiling.h.
+     */
+    enum KernelProfilePhase {
+        KernelProfilePhotonCreation = 0,
+        KernelProfileMediumPropagation = 1,
+        KernelProfileLayerWalk = 2,
+        KernelProfileCylinderIntersection = 3,
+        KernelProfileCollisionCheck = 4,
+        KernelProfileHitSaving = 5,
+        KernelProfileNumPhases = 6
+    };
+
+    /**
+     * Returns the name of a kernel profiling phase,
+     * e.g. "PhotonCreation".
+     */
+    static std::string GetKernelProfilePhaseName(KernelProfilePhase phase);
+
     I3CLSimStepToPhotonConverterOpenCL(I3RandomServicePtr randomService,
                                        bool useNativeMath=default_useNativeMath);
     virtual ~I3CLSimStepToPhotonConverterOpenCL();
@@ -94,6 +119,17 @@ public:
      */
     std::size_t GetMaxNumWorkitems() const;
 
+    /**
+     * Returns the number of steps a bunch should have at most.
+     * This is the maximum number of work items, or half of it
+     * if steps are split (see SetStepSplittingFactor()), so a
+     * full bunch still has room to be split. Bunches of up to
+     * the maximum number of work items are accepted either way.
+     *
+     * Will throw if not initialized.
+     */
+    std::size_t GetMaxNumStepsPerBunch() const;
+
     /**
      * Sets the OpenCL device.
      *
@@ -110,6 +146,15 @@ public:
      */
     uint64_t GetMaxWorkgroupSize() const;
 
+    /**
+     * Returns the private memory per work item
+     * (CL_KERNEL_PRIVATE_MEM_SIZE) the device
+     * compiler reports for the current kernel.
+     *
+     * Will throw if not compiled.
+     */
+    uint64_t GetKernelPrivateMemSize() const;
+
     /**
      * Disables or enables double-buffered
      * GPU usage. Double buffering will use
@@ -128,15 +173,45 @@ public:
      * results are always empty, so this error should be
      * easy to observe.
      *
+     * This is the same as setting the buffer ring
+     * depth to 2 (enabled) or 1 (disabled).
+     *
      * Will throw if already initialized.
      */
     void SetEnableDoubleBuffering(bool value);
 
     /**
-     * Returns true if double buffering is enabled.
+     * Returns true if more than one buffer is used.
      */
     bool GetEnableDoubleBuffering() const;
 
+    /**
+     * Sets the number of buffer sets (each with its
+     * own command queue, kernel, input and output buffers)
+     * the OpenCL worker thread cycles through.
+     *
+     * With a depth of N, up to N bunches of steps can
+     * be in flight at the same time: while the kernel
+     * works on the oldest one, the steps of the next ones
+     * are already being copied to the device and their
+     * kernels are queued behind it. With the default
+     * (MWC) random number generator the kernels still
+     * run one after the other, as they share its state.
+     * With the counter-based generator they may overlap.
+     *
+     * A depth of 1 disables buffering, a depth of 2
+     * is the same as double buffering.
+     *
+     * Will throw if already initialized.
+     */
+    void SetBufferRingDepth(std::size_t value);
+
+    /**
+     * Returns the number of buffer sets the OpenCL
+     * worker thread cycles through.
+     */
+    std::size_t GetBufferRingDepth() const;
+
     /**
      * Enables double-precision support in the
      * kernel. This slows down calculations and
@@ -205,6 +280,10 @@ public:
      * Multiply the photon memory allocation by this factor
      * when saving all photons. Default is 10000.
      *
+     * This only sets the initial size of the output buffers.
+     * They grow with the number of hits per step seen so far,
+     * and steps whose hits did not fit are simulated again.
+     *
      * Will throw if already initialized.
      */
     void SetMaxNumOutputPhotonsCorrectionFactor(double value);
@@ -323,6 +402,219 @@ public:
     I3Vector<float>      GetHoleIceCylinderScatteringLengths();
     I3Vector<float>      GetHoleIceCylinderAbsorptionLengths();
 
+    /**
+     * Replaces all hole ice cylinders at once.
+     *
+     * Unlike the setters above, this may also be called after
+     * Initialize(). The cylinders are kernel buffer arguments,
+     * so each buffer of the ring re-uploads them before its
+     * next kernel launch without recompiling the kernel.
+     */
+    void UpdateHoleIceCylinders(const I3Vector<I3Position> &holeIceCylinderPositions,
+                                const I3Vector<float> &holeIceCylinderRadii,
+                                const I3Vector<float> &holeIceCylinderScatteringLengths,
+                                const I3Vector<float> &holeIceCylinderAbsorptionLengths);
+
+    /**
+     * Keep the hole ice cylinder buffers in __constant instead of
+     * __global memory. This may be faster for few cylinders, but
+     * the size of constant memory is limited on most devices.
+     *
+     * Will throw if already initialized.
+     */
+    void SetHoleIceCylindersInConstantMemory(bool value);
+
+    /**
+     * Returns true if the hole ice cylinders are kept in __constant memory.
+     */
+    bool GetHoleIceCylindersInConstantMemory() const;
+
+    /**
+     * Look up the distance to the next scattering and absorption
+     * point in cumulative optical depth tables instead of walking
+     * through the ice layers one by one. The tables have this
+     * many rows between the minimum and maximum wavelength of the
+     * medium properties. Set to 0 (the default) to walk through
+     * the layers.
+     *
+     * Will throw if already initialized.
+     */
+    void SetOpticalDepthTableWavelengthBins(std::size_t value);
+
+    /**
+     * Returns the number of wavelength rows of the optical depth
+     * tables, or 0 if the layers are walked through one by one.
+     */
+    std::size_t GetOpticalDepthTableWavelengthBins() const;
+
+    /**
+     * Interpolate the scattering and absorption lengths in
+     * tables with this many values per layer, equidistant in
+     * wavelength, instead of evaluating the functions of the
+     * medium properties in the kernel. The tables are passed
+     * to the kernel in a __global buffer. Set to 0 (the default)
+     * to evaluate the functions.
+     *
+     * Will throw if already initialized.
+     */
+    void SetLengthTableWavelengthBins(std::size_t value);
+
+    /**
+     * Returns the number of values per layer of the scattering
+     * and absorption length tables, or 0 if the functions are
+     * evaluated directly.
+     */
+    std::size_t GetLengthTableWavelengthBins() const;
+
+    /**
+     * Use the counter-based Philox4x32-10 random number generator
+     * instead of one multiply-with-carry generator per work item.
+     * The random numbers of each photon are then determined by
+     * the seed (drawn from the random service on Initialize()),
+     * the step and the photon index alone. Results no longer
+     * depend on the number of work items, the bunch size or
+     * double buffering, and no generator state is kept on the
+     * device.
+     *
+     * Will throw if already initialized.
+     */
+    void SetUseCounterBasedRNG(bool value);
+
+    /**
+     * Returns true if the counter-based random number generator
+     * is used.
+     */
+    bool GetUseCounterBasedRNG() const;
+
+    /**
+     * Compile the kernel with PROFILE_KERNEL. Each work item
+     * then counts how often it enters each phase of the
+     * propagation (see KernelProfilePhase) and, on devices
+     * with a readable clock, the clock ticks spent there.
+     * The totals are available through GetKernelProfileCounts()
+     * and GetKernelProfileTicks(). This slows down the kernel.
+     *
+     * Will throw if already initialized.
+     */
+    void SetProfileKernel(bool value);
+
+    /**
+     * Returns true if the kernel is profiled.
+     */
+    bool GetProfileKernel() const;
+
+    /**
+     * Returns true if the device clock is read while profiling
+     * the kernel. Otherwise, only the counts are recorded and
+     * the ticks stay at zero. Only valid after Compile().
+     */
+    bool GetKernelProfileHasClock() const;
+
+    /**
+     * Launch a fixed number of persistent work items
+     * instead of one work item per step.
+     *
+     * The photons of each bunch are split into work units
+     * (a range of photons of a single step) on the host.
+     * The persistent work items take one work unit after
+     * the other from a global queue until all of them are
+     * done, so a few steps with many photons or photons
+     * with many scatters do not leave the rest of a work
+     * group idle.
+     *
+     * Disabled by default. The mode has not been benchmarked
+     * against the default one yet (benchmark.py
+     * --persistent-threads), so only use it to measure it.
+     *
+     * Will throw if already initialized.
+     */
+    void SetUsePersistentThreads(bool value);
+
+    /**
+     * Returns true if persistent work items are launched.
+     */
+    bool GetUsePersistentThreads() const;
+
+    /**
+     * Sets the number of persistent work items. It has to
+     * be a multiple of the workgroup size and may not exceed
+     * the maximum number of work items.
+     *
+     * Zero (the default) selects a number of work groups
+     * per compute unit of the device on Initialize().
+     *
+     * Will throw if already initialized.
+     */
+    void SetNumPersistentWorkItems(std::size_t value);
+
+    /**
+     * Returns the number of persistent work items.
+     * Zero means automatic before Initialize().
+     */
+    std::size_t GetNumPersistentWorkItems() const;
+
+    /**
+     * Split steps with many more photons than the others in
+     * their bunch into several steps, such that a single work
+     * item does not keep the device busy after the rest of the
+     * bunch is done. Steps are split if they have more than
+     * this factor times the median number of photons of the
+     * bunch. While bunches take longer per photon than the
+     * fastest one so far, the factor used is lowered (down to
+     * 1/1024 of this one), so steps are split further. Dummy
+     * steps without photons are removed, the bunch is only
+     * padded to a multiple of the workgroup size. To leave room
+     * for the split steps, GetMaxNumStepsPerBunch() is half the
+     * maximum number of work items.
+     *
+     * The sub-steps have the same identifier and weight as the
+     * original step. With the counter-based random number
+     * generator, the photons are exactly the same as without
+     * splitting.
+     *
+     * Not used with persistent work items, which already
+     * balance the photons. 0 disables splitting, the default is 4.
+     *
+     * Will throw if already initialized.
+     */
+    void SetStepSplittingFactor(double value);
+
+    /**
+     * Returns the step splitting factor.
+     */
+    double GetStepSplittingFactor() const;
+
+    /**
+     * Splits the steps of a bunch as described for SetStepSplittingFactor()
+     * and pads the bunch to a multiple of workgroupSize. Sub-step j
+     * of size 2^b has b in dummy1 and j in dummy2, all other steps
+     * are returned with these fields set to zero.
+     *
+     * Used by the converter before each bunch is uploaded, with
+     * the device limits it has determined during initialization.
+     */
+    static I3CLSimStepSeriesConstPtr SplitLargeSteps(const I3CLSimStepSeriesConstPtr &steps,
+                                                     double stepSplittingFactor,
+                                                     std::size_t workgroupSize,
+                                                     std::size_t maxNumDeviceWorkitems);
+
+    /**
+     * Returns the steps with dummy1 and dummy2 set to zero,
+     * or the steps themselves if they already are.
+     */
+    static I3CLSimStepSeriesConstPtr ClearSubStepFields(const I3CLSimStepSeriesConstPtr &steps);
+
+    /**
+     * Splits the photons of the steps into the work units taken by
+     * the persistent work items (see SetUsePersistentThreads()):
+     * (step index, first photon, number of photons, unused), in step
+     * order, with about numPhotons/numWorkUnits photons each. A step
+     * has at most one work unit more than its share of the photons.
+     */
+    static void MakeWorkUnits(const I3CLSimStepSeries &steps,
+                              uint64_t numWorkUnits,
+                              std::vector<cl_uint4> &workUnits);
+
     /**
      * Sets the wavelength generators.
      * The first generator (index 0) is assumed to return a Cherenkov
@@ -438,12 +730,38 @@ public:
      */
     virtual I3CLSimStepToPhotonConverter::ConversionResult_t GetConversionResult();
 
+    /**
+     * Reports the photons generated so far and the
+     * total kernel run time in seconds.
+     */
+    virtual bool GetThroughputStatistics(uint64_t &numPhotons, double &busyTime);
+
+    /**
+     * Calls the function from the OpenCL thread right after
+     * each result has been put on the output queue.
+     * Can be changed at any time.
+     */
+    virtual bool SetResultAvailableCallback(const ResultAvailableCallback_t &callback);
+
     inline double GetTotalDeviceTime() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return static_cast<double>(statistics_total_device_duration_in_nanoseconds_);}
     inline double GetTotalHostTime() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return static_cast<double>(statistics_total_host_duration_in_nanoseconds_);}
     inline uint64_t GetNumKernelCalls() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_total_kernel_calls_;}
     inline uint64_t GetTotalNumPhotonsGenerated() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_total_num_photons_generated_;}
     inline uint64_t GetTotalNumPhotonsAtDOMs() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_total_num_photons_atDOMs_;}
 
+    // time the device spent waiting between the end of one kernel and the start of the next one
+    inline double GetTotalDeviceIdleTime() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return static_cast<double>(statistics_total_device_idle_time_in_nanoseconds_);}
+
+    // number of kernels that were started only after the OpenCL thread had to wait for new steps
+    inline uint64_t GetNumStarvingKernelCalls() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_total_starving_kernel_calls_;}
+
+    // time the OpenCL thread spent preparing steps for the device and receiving photons from it
+    inline double GetTotalHostConversionTime() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return static_cast<double>(statistics_total_host_conversion_time_in_nanoseconds_);}
+
+    // totals over all work items and kernel calls, indexed by KernelProfilePhase
+    inline std::vector<uint64_t> GetKernelProfileCounts() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_kernel_profile_counts_;}
+    inline std::vector<uint64_t> GetKernelProfileTicks() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_kernel_profile_ticks_;}
+
 private:
     typedef std::pair<uint32_t, I3CLSimStepSeriesConstPtr> ToOpenCLPair_t;
 
@@ -459,18 +777,33 @@ private:
                                        uint32_t &out_stepsIdentifier,
                                        uint64_t &out_totalNumberOfPhotons,
                                        std::size_t &out_numberOfInputSteps,
+                                       I3CLSimStepSeriesConstPtr &out_steps,
                                        bool blocking=true
                                        );
+    void OpenCLThread_impl_uploadWorkUnits(unsigned int bufferIndex,
+                                           const I3CLSimStepSeries &steps);
     void OpenCLThread_impl_downloadPhotons(boost::this_thread::disable_interruption &di,
                                            bool &shouldBreak,
                                            unsigned int bufferIndex,
-                                           uint32_t stepsIdentifier);
+                                           uint32_t stepsIdentifier,
+                                           const I3CLSimStepSeriesConstPtr &steps);
     void OpenCLThread_impl_runKernel(unsigned int bufferIndex,
                                      cl::Event &kernelFinishEvent,
-                                     std::size_t numberOfInputSteps);
+                                     std::size_t numberOfInputSteps,
+                                     const cl::Event *previousKernelFinishEvent);
+    void OpenCLThread_impl_rerunSteps(unsigned int bufferIndex,
+                                      const I3CLSimStepSeries &steps);
+    void OpenCLThread_impl_adaptStepSplittingFactor(const cl::Event &kernelFinishEvent,
+                                                    const I3CLSimStepSeries &steps);
+    void OpenCLThread_impl_adaptOutputBufferSize(uint64_t numberOfHits,
+                                                 std::size_t numberOfSteps);
+    void OpenCLThread_impl_downloadKernelProfile(unsigned int bufferIndex,
+                                                 std::size_t numberOfInputSteps);
+    std::size_t OpenCLThread_impl_numberOfWorkItems(std::size_t numberOfInputSteps) const;
 
     boost::posix_time::ptime DumpStatistics(const cl::Event &kernelFinishEvent,
                                             const boost::posix_time::ptime &last_timestamp,
+                                            uint64_t &last_kernel_end_in_nanoseconds,
                                             uint64_t totalNumberOfPhotons,
                                             bool starving,
                                             const std::string &platformName,
@@ -483,6 +816,11 @@ private:
     uint64_t statistics_total_kernel_calls_;
     uint64_t statistics_total_num_photons_generated_;
     uint64_t statistics_total_num_photons_atDOMs_;
+    uint64_t statistics_total_device_idle_time_in_nanoseconds_;
+    uint64_t statistics_total_starving_kernel_calls_;
+    uint64_t statistics_total_host_conversion_time_in_nanoseconds_;
+    std::vector<uint64_t> statistics_kernel_profile_counts_;
+    std::vector<uint64_t> statistics_kernel_profile_ticks_;
 
 
     boost::shared_ptr<boost::thread> openCLThreadObj_;
@@ -490,9 +828,12 @@ private:
     boost::mutex openCLStarted_mutex_;
     bool openCLStarted_;
 
-    boost::shared_ptr<I3CLSimQueue<ToOpenCLPair_t> > queueToOpenCL_;
+    boost::shared_ptr<I3CLSimLockFreeQueue<ToOpenCLPair_t> > queueToOpenCL_;
     boost::shared_ptr<I3CLSimQueue<I3CLSimStepToPhotonConverter::ConversionResult_t> > queueFromOpenCL_;
 
+    boost::mutex resultAvailableCallback_mutex_;
+    ResultAvailableCallback_t resultAvailableCallback_;
+
     I3RandomServicePtr randomService_;
 
     bool initialized_;
@@ -506,7 +847,7 @@ private:
     bool useNativeMath_;
     bool deviceIsSelected_;
 
-    bool disableDoubleBuffering_;
+    std::size_t bufferRingDepth_;
     bool doublePrecision_;
     bool stopDetectedPhotons_;
     bool saveAllPhotons_;
@@ -515,6 +856,17 @@ private:
     bool simulateHoleIce_;
     double holeIceScatteringLengthFactor_;
     double holeIceAbsorptionLengthFactor_;
+    bool holeIceCylindersInConstantMemory_;
+    std::size_t opticalDepthTableWavelengthBins_;
+    std::size_t lengthTableWavelengthBins_;
+    bool useCounterBasedRNG_;
+    bool profileKernel_;
+    bool profileKernelHasClock_;
+    bool usePersistentThreads_;
+    std::size_t numPersistentWorkItems_;
+    double stepSplittingFactor_;
+    uint32_t counterBasedRNGKey0_;
+    uint32_t counterBasedRNGKey1_;
     double fixedNumberOfAbsorptionLengths_;
     double pancakeFactor_;
 
@@ -526,9 +878,28 @@ private:
     I3Vector<float>      holeIceCylinderScatteringLengths_;
     I3Vector<float>      holeIceCylinderAbsorptionLengths_;
 
+    // the cylinders may be replaced while the OpenCL thread is running,
+    // each buffer of the ring picks them up with its next kernel
+    boost::mutex holeIceCylinders_mutex_;
+    std::vector<bool> holeIceCylindersChanged_;
+
+    // index of the first hole ice kernel argument
+    unsigned int holeIceFirstKernelArg_;
+
+    // index of the output photon buffer and of the first
+    // random number generator kernel argument
+    unsigned int outputPhotonsFirstKernelArg_;
+    unsigned int rngFirstKernelArg_;
+
+    // (re-)allocates the output buffers of a buffer in the ring
+    void AllocateOutputPhotonBuffers(unsigned int bufferIndex, uint32_t maxNumOutputPhotons);
+
+    void UploadHoleIceCylinders(unsigned int bufferIndex);
+
     // some kernel sources loaded on construction
     std::string prependSource_;
     std::string mwcrngKernelSource_;
+    std::string counterBasedRNGKernelSource_;
     std::string wlenGeneratorSource_;
     std::string wlenBiasSource_;
     std::string mediumPropertiesSource_;
@@ -552,27 +923,86 @@ private:
     // maximum workgroup size for current kernel
     uint64_t maxWorkgroupSize_;
 
+    // private memory per work item for current kernel
+    uint64_t kernelPrivateMemSize_;
+
     // configured workgroup size and maximum number of work items
     std::size_t workgroupSize_;
     std::size_t maxNumWorkitems_;
 
+    // work items the device buffers are allocated for and the
+    // number of steps per bunch that leaves room to split them
+    std::size_t maxNumDeviceWorkitems_;
+    std::size_t maxNumStepsPerBunch_;
+
+    // the step splitting factor adapted to the kernel times (see
+    // OpenCLThread_impl_adaptStepSplittingFactor()) and the
+    // smallest kernel time per photon seen so far, 0 before the
+    // first kernel has been timed
+    double currentStepSplittingFactor_;
+    double minKernelTimePerPhoton_;
+    static const double stepSplittingTargetOccupancy;
+    static const double minStepSplittingFactorScale;
+    static const double stepSplittingFactorRecovery;
+
     // rng state per workitem
     std::vector<uint64_t> MWC_RNG_x;
     std::vector<uint32_t> MWC_RNG_a;
     boost::shared_ptr<cl::Buffer> deviceBuffer_MWC_RNG_x;
     boost::shared_ptr<cl::Buffer> deviceBuffer_MWC_RNG_a;
 
+    // The rng state each kernel started with, per buffer. Steps
+    // that overflowed the output buffer run again from there,
+    // using the rerun state, such that they produce the same
+    // photons and the shared state keeps moving on.
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_MWC_RNG_x_AtKernelStart;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_MWC_RNG_a_AtKernelStart;
+    boost::shared_ptr<cl::Buffer> deviceBuffer_MWC_RNG_x_Rerun;
+    boost::shared_ptr<cl::Buffer> deviceBuffer_MWC_RNG_a_Rerun;
+
+    // work units for persistent work items, per buffer.
+    // They are uploaded without blocking, so they are kept
+    // here until the kernel has finished.
+    static const std::size_t workUnitsPerPersistentWorkItem;
+    std::vector<std::vector<cl_uint> > workQueue_;
+    std::vector<std::vector<cl_uint4> > workUnits_;
+
     // Memory buffers on the device
     std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_InputSteps;
     std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_OutputPhotons;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_OutputPhotonSteps;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_OverflowedSteps;
     std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_CurrentNumOutputPhotons;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_KernelProfile;
     std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_PhotonHistory;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_WorkQueue;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_WorkUnits;
 
     // this one is constant, so we only need one
     boost::shared_ptr<cl::Buffer> deviceBuffer_GeoLayerToOMNumIndexPerStringSet;
 
-    // Size of output photon storage (maximum amount of photons per step bunch)
+    // the scattering and absorption length tables, see SetLengthTableWavelengthBins()
+    boost::shared_ptr<cl::Buffer> deviceBuffer_MediumLengthTable;
+
+    // hole ice cylinders of each buffer, replaced by UpdateHoleIceCylinders()
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_HoleIceCylinderPositionsAndRadii;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_HoleIceCylinderScatteringLengths;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_HoleIceCylinderAbsorptionLengths;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_HoleIceCylinderGridGeometry;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_HoleIceCylinderGridCellStartIndices;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_HoleIceCylinderGridCylinderIndices;
+
+    // Size of output photon storage (maximum amount of photons per step bunch).
+    // It grows with the number of hits per step (up to what the device can
+    // allocate), the buffers of the ring follow once their kernel is done.
+    static const double outputPhotonsHeadroom;
     uint32_t maxNumOutputPhotons_;
+    uint32_t maxNumOutputPhotonsLimit_;
+    double maxHitsPerStep_;
+    std::vector<uint32_t> maxNumOutputPhotonsPerBuffer_;
+
+    // source for clearing the overflow flags of the steps
+    std::vector<cl_uint> noOverflowedSteps_;
 
     SET_LOGGER("I3CLSimStepToPhotonConverterOpenCL");
 };
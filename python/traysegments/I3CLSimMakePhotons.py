@@ -48,6 +48,8 @@ def I3CLSimMakePhotons(tray, name,
                        UseCPUs=False,
                        UseGPUs=True,
                        UseOnlyDeviceNumber=None,
+                       UseNativeCPUConverter=False,
+                       NumCPUThreads=0,
                        MCTreeName="I3MCTree",
                        OutputMCTreeName=None,
                        FlasherInfoVectName=None,
@@ -107,6 +109,15 @@ def I3CLSimMakePhotons(tray, name,
         Use only a single device number, even if there is more than
         one device found matching the required description. The numbering
         starts at 0.
+    :param UseNativeCPUConverter:
+        Propagate photons on the host with the native multi-threaded
+        I3CLSimStepToPhotonConverterCPU instead of using OpenCL.
+        UseCPUs, UseGPUs, UseOnlyDeviceNumber, DoNotParallelize and
+        OverrideApproximateNumberOfWorkItems are ignored in that case.
+        Photon histories are not supported.
+    :param NumCPUThreads:
+        The number of threads used with UseNativeCPUConverter.
+        Set this to 0 to use one thread per hardware thread.
     :param MCTreeName:
         The name of the I3MCTree containing the particles to propagate.
     :param OutputMCTreeName:
@@ -377,13 +388,16 @@ def I3CLSimMakePhotons(tray, name,
         # no spectrum table is necessary when only using the Cherenkov spectrum
         spectrumTable = None
 
-    openCLDevices = configureOpenCLDevices(
-        UseGPUs=UseGPUs,
-        UseCPUs=UseCPUs,
-        OverrideApproximateNumberOfWorkItems=OverrideApproximateNumberOfWorkItems,
-        DoNotParallelize=DoNotParallelize,
-        UseOnlyDeviceNumber=UseOnlyDeviceNumber
-	)
+    if UseNativeCPUConverter:
+        openCLDevices = []
+    else:
+        openCLDevices = configureOpenCLDevices(
+            UseGPUs=UseGPUs,
+            UseCPUs=UseCPUs,
+            OverrideApproximateNumberOfWorkItems=OverrideApproximateNumberOfWorkItems,
+            DoNotParallelize=DoNotParallelize,
+            UseOnlyDeviceNumber=UseOnlyDeviceNumber
+            )
 
     tray.AddModule("I3CLSimModule", name + "_clsim",
                    MCTreeName=clSimMCTreeName,
@@ -405,6 +419,8 @@ def I3CLSimMakePhotons(tray, name,
                    MaxNumParallelEvents=ParallelEvents,
                    TotalEnergyToProcess=TotalEnergyToProcess,
                    OpenCLDeviceList=openCLDevices,
+                   UseCPUConverter=UseNativeCPUConverter,
+                   NumCPUThreads=NumCPUThreads,
                    #UseHardcodedDeepCoreSubdetector=False, # setting this to true saves GPU constant memory but will reduce performance
                    StopDetectedPhotons=StopDetectedPhotons,
                    PhotonHistoryEntries=PhotonHistoryEntries,
@@ -0,0 +1,51 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// Structure-of-arrays variants of the library functions, which handle
+// BATCH_WIDTH photons at once, one photon per vector lane.
+//
+// The scalar functions branch on the photon, which keeps compilers from
+// vectorizing them across work items. The batch variants compute all
+// branches for all lanes and combine the results with masks, such that
+// the lanes stay in lock step. Each lane gives the same result as the
+// scalar function for its photon.
+//
+// Like `floating_t` and `my_sqrt` for the scalar functions, the vector
+// types and functions are provided by the code including the library:
+//
+//   BATCH_WIDTH                 number of lanes, e.g. 8 or 16
+//   floating_batch_t            BATCH_WIDTH floating_t values, e.g. `double8`
+//   int_batch_t                 BATCH_WIDTH integers of the size of floating_t,
+//                               e.g. `long8`. Comparisons of floating_batch_t
+//                               values yield masks of this type, with -1 for
+//                               true and 0 for false.
+//   batch_splat(x)              floating_batch_t with `x` in all lanes
+//   int_batch_splat(x)          int_batch_t with `x` in all lanes
+//   batch_sqrt(v)
+//   batch_fabs(v)
+//   batch_trunc(v)              rounds towards zero
+//   batch_any(mask)             true if the mask is set in any lane
+//   batch_reduce_min(v)         smallest value of all lanes
+//   batch_reduce_max(v)         largest value of all lanes
+//
+// In OpenCL, these are the built-in vector types and functions, e.g.
+// `#define batch_sqrt sqrt`. On the host, gcc and clang vector extensions
+// can be used, see `hole_ice/batch_test.h`.
+//
+// Lanes are selected with the vector ternary operator `mask ? a : b`,
+// which both OpenCL C and the vector extensions support.
+//
+
+// A batch of photons.
+//
+typedef struct PhotonBatch {
+  floating_batch_t posX;
+  floating_batch_t posY;
+  floating_batch_t posZ;
+  floating_batch_t dirX;
+  floating_batch_t dirY;
+  floating_batch_t dirZ;
+  floating_batch_t wlen;
+} PhotonBatch_t;
+
+#endif
@@ -0,0 +1,405 @@
+// Equivalence tests of the batch (structure-of-arrays) variants
+// of the library functions, see `batch/batch.h`. Each lane has
+// to give the same result as the scalar function.
+
+#include "batch_test.h"
+#include "../ice_layers/ice_layers.c"
+#include "hole_ice.c"
+#include "../ice_layers/ice_layers_batch.c"
+#include "hole_ice_batch.c"
+#include "gtest/gtest.h"
+#include "math.h"
+#include <stdlib.h>
+#include <vector>
+
+inline floating_t my_sqrt(floating_t a) {return sqrt(a);}
+inline floating_t sqr(floating_t a) {return a * a;}
+inline floating_t my_nan() { return NAN; }
+inline bool my_is_nan(floating_t a) { return (a != a); }
+inline floating_t min(floating_t a, floating_t b) { return fmin(a, b); }
+inline floating_t max(floating_t a, floating_t b) { return fmax(a, b); }
+inline floating_t dot(floating4_t a, floating4_t b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+inline floating_t my_divide(floating_t a, floating_t b) { return a / b; }
+inline floating_t my_fabs(floating_t a) { return fabs(a); }
+
+inline int findLayerForGivenZPos(floating_t posZ)
+{
+  return (int)((posZ - MEDIUM_LAYER_BOTTOM_POS) / MEDIUM_LAYER_THICKNESS);
+}
+inline floating_t mediumLayerBoundary(int layer)
+{
+  return layer * MEDIUM_LAYER_THICKNESS + MEDIUM_LAYER_BOTTOM_POS;
+}
+inline floating_t getScatteringLength(unsigned int layer, floating_t /* wlen */)
+{
+  return 20.0 + layer;
+}
+inline floating_t getAbsorptionLength(unsigned int layer, floating_t /* wlen */)
+{
+  return 100.0 + layer;
+}
+
+inline floating_batch_t batch_splat(floating_t a)
+{
+  floating_batch_t v;
+  for (int lane = 0; lane < BATCH_WIDTH; lane++) v[lane] = a;
+  return v;
+}
+inline int_batch_t int_batch_splat(long a)
+{
+  int_batch_t v;
+  for (int lane = 0; lane < BATCH_WIDTH; lane++) v[lane] = a;
+  return v;
+}
+inline floating_batch_t batch_sqrt(floating_batch_t a)
+{
+  for (int lane = 0; lane < BATCH_WIDTH; lane++) a[lane] = sqrt(a[lane]);
+  return a;
+}
+inline floating_batch_t batch_fabs(floating_batch_t a)
+{
+  for (int lane = 0; lane < BATCH_WIDTH; lane++) a[lane] = fabs(a[lane]);
+  return a;
+}
+inline floating_batch_t batch_trunc(floating_batch_t a)
+{
+  for (int lane = 0; lane < BATCH_WIDTH; lane++) a[lane] = trunc(a[lane]);
+  return a;
+}
+inline bool batch_any(int_batch_t mask)
+{
+  for (int lane = 0; lane < BATCH_WIDTH; lane++) if (mask[lane]) return true;
+  return false;
+}
+inline floating_t batch_reduce_min(floating_batch_t a)
+{
+  floating_t m = a[0];
+  for (int lane = 1; lane < BATCH_WIDTH; lane++) m = fmin(m, a[lane]);
+  return m;
+}
+inline floating_t batch_reduce_max(floating_batch_t a)
+{
+  floating_t m = a[0];
+  for (int lane = 1; lane < BATCH_WIDTH; lane++) m = fmax(m, a[lane]);
+  return m;
+}
+
+const floating_t desired_numeric_accuracy = 1e-9;
+
+// NaN in the scalar result has to be NaN in the lane as well.
+#define EXPECT_SAME_VALUE(scalar, lane) \
+  if (my_is_nan(scalar)) { EXPECT_TRUE(my_is_nan(lane)); } \
+  else if (isinf(scalar)) { EXPECT_EQ(scalar, lane); } \
+  else { EXPECT_NEAR(scalar, lane, desired_numeric_accuracy); }
+
+floating_t uniform(floating_t low, floating_t high)
+{
+  return low + (high - low) * drand48();
+}
+
+floating4_t random_direction()
+{
+  const floating_t cos_theta = uniform(-1.0, 1.0);
+  const floating_t sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+  const floating_t phi = uniform(0.0, 2.0 * M_PI);
+  floating4_t direction = {sin_theta * cos(phi), sin_theta * sin(phi), cos_theta, 400e-9};
+  return direction;
+}
+
+struct Photon {
+  floating4_t posAndTime;
+  floating4_t dirAndWlen;
+  floating_t range;
+};
+
+std::vector<Photon> random_photons(int number, floating_t extent)
+{
+  std::vector<Photon> photons;
+  for (int i = 0; i < number; i++) {
+    Photon photon;
+    photon.posAndTime.x = uniform(-extent, extent);
+    photon.posAndTime.y = uniform(-extent, extent);
+    photon.posAndTime.z = uniform(-60.0, 60.0);
+    photon.posAndTime.w = 0.0;
+    photon.dirAndWlen = random_direction();
+    photon.range = uniform(0.0, 2.0 * extent);
+    photons.push_back(photon);
+  }
+
+  // Some special directions, which have no x-y projection
+  // or do not cross any ice layers.
+  floating4_t up = {0.0, 0.0, 1.0, 400e-9};
+  floating4_t down = {0.0, 0.0, -1.0, 400e-9};
+  floating4_t horizontal = {1.0, 0.0, 0.0, 400e-9};
+  photons[0].dirAndWlen = up;
+  photons[1].dirAndWlen = down;
+  photons[2].dirAndWlen = horizontal;
+
+  return photons;
+}
+
+PhotonBatch_t batch_of_photons(const std::vector<Photon> &photons, int first)
+{
+  PhotonBatch_t batch;
+  for (int lane = 0; lane < BATCH_WIDTH; lane++) {
+    const Photon &photon = photons[first + lane];
+    batch.posX[lane] = photon.posAndTime.x;
+    batch.posY[lane] = photon.posAndTime.y;
+    batch.posZ[lane] = photon.posAndTime.z;
+    batch.dirX[lane] = photon.dirAndWlen.x;
+    batch.dirY[lane] = photon.dirAndWlen.y;
+    batch.dirZ[lane] = photon.dirAndWlen.z;
+    batch.wlen[lane] = photon.dirAndWlen.w;
+  }
+  return batch;
+}
+
+floating_batch_t batch_of_ranges(const std::vector<Photon> &photons, int first)
+{
+  floating_batch_t ranges;
+  for (int lane = 0; lane < BATCH_WIDTH; lane++) ranges[lane] = photons[first + lane].range;
+  return ranges;
+}
+
+const int number_of_batches = 64;
+
+namespace {
+
+  TEST(IntersectionBatchTest, MatchesScalarVersion) {
+    srand48(1);
+    const std::vector<Photon> photons = random_photons(number_of_batches * BATCH_WIDTH, 5.0);
+
+    for (int first = 0; first < (int)photons.size(); first += BATCH_WIDTH) {
+      IntersectionProblemBatch_t batch;
+      std::vector<IntersectionProblemParameters_t> scalar(BATCH_WIDTH);
+      for (int lane = 0; lane < BATCH_WIDTH; lane++) {
+        const Photon &photon = photons[first + lane];
+        IntersectionProblemParameters_t p = {
+          photon.posAndTime.x, photon.posAndTime.y,   // A
+          uniform(-5.0, 5.0), uniform(-5.0, 5.0),     // M
+          uniform(0.1, 3.0),                          // r
+          photon.dirAndWlen,                          // direction
+          photon.range,                               // distance
+          0.0, 0.0, 0.0
+        };
+        scalar[lane] = p;
+
+        batch.ax[lane] = p.ax;
+        batch.ay[lane] = p.ay;
+        batch.mx[lane] = p.mx;
+        batch.my[lane] = p.my;
+        batch.r[lane] = p.r;
+        batch.direction_x[lane] = p.direction.x;
+        batch.direction_y[lane] = p.direction.y;
+        batch.direction_z[lane] = p.direction.z;
+        batch.distance[lane] = p.distance;
+      }
+
+      calculate_intersections_batch(&batch);
+
+      for (int lane = 0; lane < BATCH_WIDTH; lane++) {
+        calculate_intersections(&scalar[lane]);
+        EXPECT_SAME_VALUE(scalar[lane].discriminant, batch.discriminant[lane]);
+        EXPECT_SAME_VALUE(scalar[lane].s1, batch.s1[lane]);
+        EXPECT_SAME_VALUE(scalar[lane].s2, batch.s2[lane]);
+      }
+    }
+  }
+
+  TEST(IceLayersBatchTest, PhotonLayerMatchesScalarVersion) {
+    floating_batch_t z;
+    for (int lane = 0; lane < BATCH_WIDTH; lane++) z[lane] = -80.0 + 160.0 * lane / (BATCH_WIDTH - 1);
+    const floating_batch_t layers = photon_layer_batch(z);
+    for (int lane = 0; lane < BATCH_WIDTH; lane++) {
+      EXPECT_EQ(photon_layer(z[lane]), (int)layers[lane]);
+    }
+  }
+
+  TEST(IceLayersBatchTest, BoundariesMatchScalarVersion) {
+    srand48(2);
+    const std::vector<Photon> photons = random_photons(number_of_batches * BATCH_WIDTH, 50.0);
+
+    for (int first = 0; first < (int)photons.size(); first += BATCH_WIDTH) {
+      const PhotonBatch_t batch = batch_of_photons(photons, first);
+      const floating_batch_t ranges = batch_of_ranges(photons, first);
+
+      IceLayerBoundariesBatch_t batch_boundaries;
+      init_ice_layer_boundaries_on_photon_path_batch(batch, &batch_boundaries);
+
+      std::vector<IceLayerBoundaries_t> scalar_boundaries(BATCH_WIDTH);
+      for (int lane = 0; lane < BATCH_WIDTH; lane++) {
+        init_ice_layer_boundaries_on_photon_path(photons[first + lane].posAndTime, photons[first + lane].dirAndWlen, &scalar_boundaries[lane]);
+      }
+
+      // Walk through the boundaries until no lane has one left.
+      for (int boundary = 0; batch_any(batch_boundaries.has_next); boundary++) {
+        ASSERT_LT(boundary, 100);
+        for (int lane = 0; lane < BATCH_WIDTH; lane++) {
+          const IceLayerBoundaries_t &b = scalar_boundaries[lane];
+          EXPECT_EQ(b.has_next != 0, batch_boundaries.has_next[lane] != 0);
+          if (!b.has_next) continue;
+          EXPECT_SAME_VALUE(b.next_distance, batch_boundaries.next_distance[lane]);
+          EXPECT_SAME_VALUE(b.spacing, batch_boundaries.spacing[lane]);
+          EXPECT_EQ(b.next_layer, (int)batch_boundaries.next_layer[lane]);
+        }
+
+        advance_to_next_ice_layer_boundary_batch(batch, ranges, &batch_boundaries);
+        for (int lane = 0; lane < BATCH_WIDTH; lane++) {
+          if (!scalar_boundaries[lane].has_next) continue;
+          advance_to_next_ice_layer_boundary(photons[first + lane].posAndTime, photons[first + lane].dirAndWlen, photons[first + lane].range, &scalar_boundaries[lane]);
+        }
+      }
+      for (int lane = 0; lane < BATCH_WIDTH; lane++) {
+        EXPECT_FALSE(scalar_boundaries[lane].has_next);
+      }
+    }
+  }
+
+  const int max_cylinders = 64;
+  const int max_grid_cells = 256;
+
+  // A hole ice cylinder grid as generated on the host by
+  // `I3CLSimHelper::GenerateHoleIceCylinderGrid`.
+  //
+  struct CylinderGrid {
+    HoleIceCylinderGrid_t parameters;
+    unsigned int cell_start_indices[max_grid_cells + 1];
+    unsigned int cylinder_indices[max_cylinders];
+  };
+
+  CylinderGrid generate_cylinder_grid(unsigned int numberOfCylinders, const floating4_t *cylinderPositionsAndRadii, int numX, int numY)
+  {
+    CylinderGrid g;
+    floating_t min_x = 0.0, max_x = 0.0, min_y = 0.0, max_y = 0.0;
+    g.parameters.maxRadius = 0.0;
+    for (unsigned int i = 0; i < numberOfCylinders; i++) {
+      if (i == 0 || cylinderPositionsAndRadii[i].x < min_x) min_x = cylinderPositionsAndRadii[i].x;
+      if (i == 0 || cylinderPositionsAndRadii[i].x > max_x) max_x = cylinderPositionsAndRadii[i].x;
+      if (i == 0 || cylinderPositionsAndRadii[i].y < min_y) min_y = cylinderPositionsAndRadii[i].y;
+      if (i == 0 || cylinderPositionsAndRadii[i].y > max_y) max_y = cylinderPositionsAndRadii[i].y;
+      g.parameters.maxRadius = fmax(g.parameters.maxRadius, cylinderPositionsAndRadii[i].w);
+    }
+    g.parameters.numX = numX;
+    g.parameters.numY = numY;
+    g.parameters.startX = min_x;
+    g.parameters.startY = min_y;
+    g.parameters.widthX = fmax(max_x - min_x, 1.0) / numX;
+    g.parameters.widthY = fmax(max_y - min_y, 1.0) / numY;
+
+    unsigned int k = 0;
+    for (int cell = 0; cell < numX * numY; cell++) {
+      g.cell_start_indices[cell] = k;
+      for (unsigned int i = 0; i < numberOfCylinders; i++) {
+        const int cell_x = hole_ice_cylinder_grid_cell(cylinderPositionsAndRadii[i].x, g.parameters.startX, g.parameters.widthX, numX);
+        const int cell_y = hole_ice_cylinder_grid_cell(cylinderPositionsAndRadii[i].y, g.parameters.startY, g.parameters.widthY, numY);
+        if (cell_y * numX + cell_x == cell) {
+          g.cylinder_indices[k] = i;
+          k += 1;
+        }
+      }
+    }
+    g.cell_start_indices[numX * numY] = k;
+    return g;
+  }
+
+  // Follow the crossings of each photon with the cylinder surfaces,
+  // with the scalar function for each lane and with the batch function
+  // for all lanes at once.
+  //
+  void expect_same_crossings(unsigned int numberOfCylinders, const floating4_t *cylinderPositionsAndRadii, const CylinderGrid &grid, const std::vector<Photon> &photons)
+  {
+    for (int first = 0; first < (int)photons.size(); first += BATCH_WIDTH) {
+      const PhotonBatch_t batch = batch_of_photons(photons, first);
+      const floating_batch_t ranges = batch_of_ranges(photons, first);
+
+      HoleIceCylinderCrossingBatch_t batch_previous = {batch_splat(ZERO), int_batch_splat(-1), int_batch_splat(0)};
+      std::vector<HoleIceCylinderCrossing_t> scalar_previous(BATCH_WIDTH);
+      for (int lane = 0; lane < BATCH_WIDTH; lane++) {
+        HoleIceCylinderCrossing_t none = {ZERO, -1, 0};
+        scalar_previous[lane] = none;
+      }
+
+      for (int crossing = 0; crossing < 2 * max_cylinders + 1; crossing++) {
+        HoleIceCylinderCrossingBatch_t batch_next;
+        int_batch_t batch_innermost;
+        find_next_hole_ice_cylinder_crossing_batch(batch, ranges,
+            numberOfCylinders, cylinderPositionsAndRadii, grid.parameters,
+            grid.cell_start_indices, grid.cylinder_indices,
+            batch_previous, &batch_next, &batch_innermost);
+
+        bool any_crossing = false;
+        for (int lane = 0; lane < BATCH_WIDTH; lane++) {
+          HoleIceCylinderCrossing_t scalar_next;
+          int scalar_innermost;
+          find_next_hole_ice_cylinder_crossing(photons[first + lane].posAndTime, photons[first + lane].dirAndWlen,
+              photons[first + lane].range, numberOfCylinders, cylinderPositionsAndRadii, grid.parameters,
+              grid.cell_start_indices, grid.cylinder_indices,
+              scalar_previous[lane], &scalar_next, &scalar_innermost);
+
+          EXPECT_EQ(scalar_innermost, batch_innermost[lane]);
+          EXPECT_EQ(scalar_next.index, batch_next.index[lane]);
+          EXPECT_EQ(scalar_next.is_exit, batch_next.is_exit[lane]);
+          EXPECT_SAME_VALUE(scalar_next.distance, batch_next.distance[lane]);
+
+          scalar_previous[lane] = scalar_next;
+          if (scalar_next.index != -1) any_crossing = true;
+        }
+
+        // Lanes without a further crossing start over, which does no harm.
+        batch_previous = batch_next;
+        if (!any_crossing) break;
+      }
+    }
+  }
+
+  TEST(HoleIceBatchTest, CrossingsMatchScalarVersion) {
+    srand48(3);
+    floating4_t cylinderPositionsAndRadii[max_cylinders];
+    const unsigned int numberOfCylinders = 40;
+    for (unsigned int i = 0; i < numberOfCylinders; i++) {
+      floating4_t cylinder = {uniform(-20.0, 20.0), uniform(-20.0, 20.0), 0.0, uniform(0.1, 3.0)};
+      cylinderPositionsAndRadii[i] = cylinder;
+    }
+    const CylinderGrid grid = generate_cylinder_grid(numberOfCylinders, cylinderPositionsAndRadii, 4, 4);
+
+    expect_same_crossings(numberOfCylinders, cylinderPositionsAndRadii, grid,
+        random_photons(number_of_batches * BATCH_WIDTH, 25.0));
+  }
+
+  TEST(HoleIceBatchTest, NestedCylindersMatchScalarVersion) {
+    srand48(4);
+    // A cable within a bubble column, each with a z-range.
+    floating4_t cylinderPositionsAndRadii[max_cylinders] = {
+      {0.0, 0.0, 0.0, 0.3},
+      {0.1, 0.1, 0.0, 0.08},
+      {5.0, 0.0, 10.0, 1.0},
+      {5.0, 0.0, -10.0, 1.0}
+    };
+    const CylinderGrid grid = generate_cylinder_grid(4, cylinderPositionsAndRadii, 2, 1);
+
+    expect_same_crossings(4, cylinderPositionsAndRadii, grid,
+        random_photons(number_of_batches * BATCH_WIDTH, 2.0));
+  }
+
+  TEST(HoleIceBatchTest, NoCylinders) {
+    srand48(5);
+    const std::vector<Photon> photons = random_photons(BATCH_WIDTH, 2.0);
+    const PhotonBatch_t batch = batch_of_photons(photons, 0);
+    HoleIceCylinderGrid_t no_grid = {0.0, 0.0, 1.0, 1.0, 1, 1, 0.0};
+    HoleIceCylinderCrossingBatch_t previous = {batch_splat(ZERO), int_batch_splat(-1), int_batch_splat(0)};
+    HoleIceCylinderCrossingBatch_t next;
+    int_batch_t innermost;
+
+    find_next_hole_ice_cylinder_crossing_batch(batch, batch_of_ranges(photons, 0), 0, NULL, no_grid, NULL, NULL,
+        previous, &next, &innermost);
+
+    for (int lane = 0; lane < BATCH_WIDTH; lane++) {
+      EXPECT_EQ(-1, next.index[lane]);
+      EXPECT_EQ(-1, innermost[lane]);
+    }
+  }
+
+}
@@ -0,0 +1,57 @@
+#ifndef BATCH_TEST_H
+#define BATCH_TEST_H
+
+typedef double floating_t;
+
+struct floating4_t {
+  floating_t x;
+  floating_t y;
+  floating_t z;
+  floating_t w;
+};
+
+// On the host, there are no separate address spaces.
+#define __constant const
+#define HOLE_ICE_MEMORY
+
+#define ZERO 0.0
+#define ONE 1.0
+
+// A simple layered ice model: 10 layers of 10 meters each.
+#define MEDIUM_LAYERS 10
+#define MEDIUM_LAYER_THICKNESS 10.0
+#define MEDIUM_LAYER_BOTTOM_POS -50.0
+
+// The batch types as gcc/clang vector extensions.
+// Build with -DBATCH_WIDTH=16 to test 16 lanes.
+#ifndef BATCH_WIDTH
+  #define BATCH_WIDTH 8
+#endif
+typedef floating_t floating_batch_t __attribute__((vector_size(BATCH_WIDTH * sizeof(floating_t))));
+typedef long int_batch_t __attribute__((vector_size(BATCH_WIDTH * sizeof(long))));
+
+extern inline floating_t my_sqrt(floating_t);
+extern inline floating_t sqr(floating_t);
+extern inline floating_t my_nan();
+extern inline bool my_is_nan(floating_t);
+extern inline floating_t min(floating_t, floating_t);
+extern inline floating_t max(floating_t, floating_t);
+extern inline floating_t dot(floating4_t, floating4_t);
+extern inline floating_t my_divide(floating_t, floating_t);
+extern inline floating_t my_fabs(floating_t);
+
+extern inline int findLayerForGivenZPos(floating_t);
+extern inline floating_t mediumLayerBoundary(int);
+extern inline floating_t getScatteringLength(unsigned int, floating_t);
+extern inline floating_t getAbsorptionLength(unsigned int, floating_t);
+
+extern inline floating_batch_t batch_splat(floating_t);
+extern inline int_batch_t int_batch_splat(long);
+extern inline floating_batch_t batch_sqrt(floating_batch_t);
+extern inline floating_batch_t batch_fabs(floating_batch_t);
+extern inline floating_batch_t batch_trunc(floating_batch_t);
+extern inline bool batch_any(int_batch_t);
+extern inline floating_t batch_reduce_min(floating_batch_t);
+extern inline floating_t batch_reduce_max(floating_batch_t);
+
+#endif
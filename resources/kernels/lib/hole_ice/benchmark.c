@@ -0,0 +1,826 @@
+// Microbenchmarks for the medium propagation functions of the kernel
+// library, compiled on the host like the tests.
+//
+//     make benchmark
+//     ./benchmark [--filter <substring>] [--min-time <seconds>] [--json <file>]
+//
+// Every benchmark is run for a grid of scenarios: the number of hole ice
+// cylinders, whether the photon starts inside or outside of a cylinder,
+// the length of the photon path segment relative to the ice layer
+// thickness, and the number of medium changes on the photon path.
+//
+// The timings are host timings. They are meant to compare variants of
+// the library code against each other, not to predict the performance
+// on a gpu.
+
+#define HOLE_ICE
+#include "benchmark.h"
+#include "../propagation_through_media/propagation_through_media.c"
+#include "math.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+inline floating_t my_sqrt(floating_t a) {return sqrt(a);}
+inline floating_t sqr(floating_t a) {return a * a;}
+inline floating_t my_nan() { return NAN; }
+inline bool my_is_nan(floating_t a) { return (a != a); }
+inline floating_t min(floating_t a, floating_t b) { return fmin(a, b); }
+inline floating_t max(floating_t a, floating_t b) { return fmax(a, b); }
+inline floating_t dot(floating4_t a, floating4_t b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+inline floating_t my_divide(floating_t a, floating_t b) { return a / b; }
+inline floating_t my_fabs(floating_t a) { return fabs(a); }
+
+inline int findLayerForGivenZPos(floating_t posZ)
+{
+  return (int)((posZ - MEDIUM_LAYER_BOTTOM_POS) / MEDIUM_LAYER_THICKNESS);
+}
+inline floating_t mediumLayerBoundary(int layer)
+{
+  return layer * MEDIUM_LAYER_THICKNESS + MEDIUM_LAYER_BOTTOM_POS;
+}
+inline floating_t getScatteringLength(unsigned int layer, floating_t /* wlen */)
+{
+  return 20.0 + 0.1 * layer;
+}
+inline floating_t getAbsorptionLength(unsigned int layer, floating_t /* wlen */)
+{
+  return 100.0 + layer;
+}
+
+float mediumScatteringOpticalDepth[MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS * (MEDIUM_LAYERS + 1)];
+float mediumAbsorptionOpticalDepth[MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS * (MEDIUM_LAYERS + 1)];
+
+// Fill the optical depth tables like
+// `I3CLSimHelper::GenerateMediumPropertiesSource` does.
+//
+void fill_optical_depth_tables()
+{
+  for (int bin = 0; bin < MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS; bin++) {
+    const floating_t wlen = MEDIUM_MIN_WLEN + (MEDIUM_MAX_WLEN - MEDIUM_MIN_WLEN) * bin / (MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS - 1);
+    floating_t scattering_depth = 0.0;
+    floating_t absorption_depth = 0.0;
+    mediumScatteringOpticalDepth[bin * (MEDIUM_LAYERS + 1)] = 0.0;
+    mediumAbsorptionOpticalDepth[bin * (MEDIUM_LAYERS + 1)] = 0.0;
+    for (int layer = 0; layer < MEDIUM_LAYERS; layer++) {
+      scattering_depth += MEDIUM_LAYER_THICKNESS / getScatteringLength(layer, wlen);
+      absorption_depth += MEDIUM_LAYER_THICKNESS / getAbsorptionLength(layer, wlen);
+      mediumScatteringOpticalDepth[bin * (MEDIUM_LAYERS + 1) + layer + 1] = scattering_depth;
+      mediumAbsorptionOpticalDepth[bin * (MEDIUM_LAYERS + 1) + layer + 1] = absorption_depth;
+    }
+  }
+}
+
+const int max_cylinders = 5000;
+const int max_grid_cells = 71 * 71;
+
+// A hole ice cylinder grid as generated on the host by
+// `I3CLSimHelper::GenerateHoleIceCylinderGrid`.
+//
+struct CylinderGrid {
+  HoleIceCylinderGrid_t parameters;
+  unsigned int cell_start_indices[max_grid_cells + 1];
+  unsigned int cylinder_indices[max_cylinders];
+};
+
+CylinderGrid generate_cylinder_grid(unsigned int numberOfCylinders, const floating4_t *cylinderPositionsAndRadii, int numX, int numY)
+{
+  CylinderGrid g;
+  floating_t min_x = 0.0, max_x = 0.0, min_y = 0.0, max_y = 0.0;
+  g.parameters.maxRadius = 0.0;
+  for (unsigned int i = 0; i < numberOfCylinders; i++) {
+    if (i == 0 || cylinderPositionsAndRadii[i].x < min_x) min_x = cylinderPositionsAndRadii[i].x;
+    if (i == 0 || cylinderPositionsAndRadii[i].x > max_x) max_x = cylinderPositionsAndRadii[i].x;
+    if (i == 0 || cylinderPositionsAndRadii[i].y < min_y) min_y = cylinderPositionsAndRadii[i].y;
+    if (i == 0 || cylinderPositionsAndRadii[i].y > max_y) max_y = cylinderPositionsAndRadii[i].y;
+    g.parameters.maxRadius = fmax(g.parameters.maxRadius, cylinderPositionsAndRadii[i].w);
+  }
+  g.parameters.numX = numX;
+  g.parameters.numY = numY;
+  g.parameters.startX = min_x;
+  g.parameters.startY = min_y;
+  g.parameters.widthX = fmax(max_x - min_x, 1.0) / numX;
+  g.parameters.widthY = fmax(max_y - min_y, 1.0) / numY;
+
+  unsigned int k = 0;
+  for (int cell = 0; cell < numX * numY; cell++) {
+    g.cell_start_indices[cell] = k;
+    for (unsigned int i = 0; i < numberOfCylinders; i++) {
+      const int cell_x = hole_ice_cylinder_grid_cell(cylinderPositionsAndRadii[i].x, g.parameters.startX, g.parameters.widthX, numX);
+      const int cell_y = hole_ice_cylinder_grid_cell(cylinderPositionsAndRadii[i].y, g.parameters.startY, g.parameters.widthY, numY);
+      if (cell_y * numX + cell_x == cell) {
+        g.cylinder_indices[k] = i;
+        k += 1;
+      }
+    }
+  }
+  g.cell_start_indices[numX * numY] = k;
+  return g;
+}
+
+// SCENARIOS
+// -----------------------------------------------------------------------------
+
+// The inputs are precomputed and cycled through, such that the
+// random number generation is not part of the timing.
+//
+const int number_of_photons = 1024;
+
+struct Photon {
+  floating4_t posAndTime;
+  floating4_t dirAndWlen;
+  floating_t sca_step_left;
+  floating_t range;
+};
+
+struct Parameter {
+  std::string name;
+  std::string value;
+};
+
+// The medium changes on a photon path as three parallel arrays, in the
+// order the former kernel collected them: the start of the path, the
+// ice layer boundaries with ascending distance, then the hole ice
+// cylinder entry and exit points.
+//
+struct MediumChanges {
+  std::vector<floating_t> distances;
+  std::vector<floating_t> scattering_lengths;
+  std::vector<floating_t> absorption_lengths;
+};
+
+struct Scenario;
+typedef long (*BenchmarkFunction)(const Scenario &, long calls);
+
+struct Scenario {
+  std::string function;
+  std::vector<Parameter> parameters;
+  BenchmarkFunction run;
+
+  std::vector<Photon> photons;
+  std::vector<floating4_t> cylinders;
+  std::vector<floating_t> cylinderScatteringLengths;
+  std::vector<floating_t> cylinderAbsorptionLengths;
+  CylinderGrid grid;
+
+  // the medium changes on the path of each photon, see add_medium_changes()
+  std::vector<MediumChanges> medium_changes;
+};
+
+struct Result {
+  std::string name;
+  const Scenario *scenario;
+  long calls;
+  double ns_per_call;
+  double medium_changes_per_call; // negative if not counted
+};
+
+// Keeps the compiler from optimizing the benchmarked calls away.
+volatile floating_t sink;
+
+floating_t uniform(floating_t a, floating_t b)
+{
+  return a + (b - a) * drand48();
+}
+
+floating4_t random_direction()
+{
+  const floating_t cos_theta = uniform(-1.0, 1.0);
+  const floating_t sin_theta = sqrt(1.0 - sqr(cos_theta));
+  const floating_t phi = uniform(0.0, 2.0 * M_PI);
+  const floating4_t direction = {sin_theta * cos(phi), sin_theta * sin(phi), cos_theta, 400e-9};
+  return direction;
+}
+
+bool is_inside_any_cylinder(floating_t x, floating_t y, const std::vector<floating4_t> &cylinders)
+{
+  for (size_t i = 0; i < cylinders.size(); i++) {
+    if (sqr(x - cylinders[i].x) + sqr(y - cylinders[i].y) < sqr(cylinders[i].w)) return true;
+  }
+  return false;
+}
+
+// The cylinders are placed on a square lattice like the strings of the
+// detector, but closer together and with a larger radius, such that
+// long photon paths cross several of them.
+//
+const floating_t cylinder_spacing = 5.0;
+const floating_t cylinder_radius = 1.0;
+
+void place_cylinders_on_lattice(Scenario &s, int numberOfCylinders)
+{
+  const int n = (int)ceil(sqrt((floating_t)numberOfCylinders));
+  for (int i = 0; i < numberOfCylinders; i++) {
+    const floating4_t cylinder = {(i % n) * cylinder_spacing, (i / n) * cylinder_spacing, 0.0, cylinder_radius};
+    s.cylinders.push_back(cylinder);
+  }
+  const int cells = (n > 0) ? n : 1;
+  s.grid = generate_cylinder_grid(s.cylinders.size(), s.cylinders.empty() ? NULL : &s.cylinders[0], cells, cells);
+}
+
+// A photon path segment of `segment_length` meters, starting inside or
+// outside of a hole ice cylinder at a random position within the lattice.
+//
+void add_photons(Scenario &s, bool inside, floating_t segment_length)
+{
+  const int n = (int)ceil(sqrt((floating_t)s.cylinders.size()));
+  const floating_t extent = fmax(n - 1, 1) * cylinder_spacing;
+  for (int i = 0; i < number_of_photons; i++) {
+    Photon p;
+    if (inside) {
+      const floating4_t c = s.cylinders[lrand48() % s.cylinders.size()];
+      const floating_t r = 0.9 * c.w * sqrt(drand48());
+      const floating_t phi = uniform(0.0, 2.0 * M_PI);
+      p.posAndTime.x = c.x + r * cos(phi);
+      p.posAndTime.y = c.y + r * sin(phi);
+    } else {
+      do {
+        p.posAndTime.x = uniform(-0.5 * cylinder_spacing, extent + 0.5 * cylinder_spacing);
+        p.posAndTime.y = uniform(-0.5 * cylinder_spacing, extent + 0.5 * cylinder_spacing);
+      } while (is_inside_any_cylinder(p.posAndTime.x, p.posAndTime.y, s.cylinders));
+    }
+    p.posAndTime.z = uniform(-100.0, 100.0);
+    p.posAndTime.w = 0.0;
+    p.dirAndWlen = random_direction();
+    p.range = segment_length;
+    p.sca_step_left = segment_length / getScatteringLength(photon_layer(p.posAndTime.z), p.dirAndWlen.w);
+    s.photons.push_back(p);
+  }
+}
+
+void add_parameter(Scenario &s, const std::string &name, const std::string &value)
+{
+  Parameter p = {name, value};
+  s.parameters.push_back(p);
+}
+
+std::string to_string(floating_t value)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%g", value);
+  return buffer;
+}
+
+void set_up_cylinders(Scenario &s, int numberOfCylinders)
+{
+  place_cylinders_on_lattice(s, numberOfCylinders);
+  s.cylinderScatteringLengths.assign(max_cylinders, 0.5);
+  s.cylinderAbsorptionLengths.assign(max_cylinders, 50.0);
+}
+
+void add_medium_change(MediumChanges &m, floating_t distance, floating_t scattering_length, floating_t absorption_length)
+{
+  m.distances.push_back(distance);
+  m.scattering_lengths.push_back(scattering_length);
+  m.absorption_lengths.push_back(absorption_length);
+}
+
+// Collects the medium changes on the path of each photon with the walks
+// of the library, such that both sorting algorithms below see the same
+// streams as the former kernel.
+//
+void add_medium_changes(Scenario &s)
+{
+  for (int i = 0; i < number_of_photons; i++) {
+    const Photon &photon = s.photons[i];
+    MediumChanges m;
+    const int layer = photon_layer(photon.posAndTime.z);
+    add_medium_change(m, 0.0, getScatteringLength(layer, photon.dirAndWlen.w), getAbsorptionLength(layer, photon.dirAndWlen.w));
+
+    IceLayerBoundaries_t layers;
+    init_ice_layer_boundaries_on_photon_path(photon.posAndTime, photon.dirAndWlen, &layers);
+    while (layers.has_next && (layers.next_distance < photon.range)) {
+      add_medium_change(m, layers.next_distance,
+          getScatteringLength(layers.next_layer, photon.dirAndWlen.w), getAbsorptionLength(layers.next_layer, photon.dirAndWlen.w));
+      advance_to_next_ice_layer_boundary(photon.posAndTime, photon.dirAndWlen, photon.range, &layers);
+    }
+
+    HoleIceCylinderCrossing_t crossing = {ZERO, (int)s.cylinders.size(), 1};
+    int index_of_current_cylinder;
+    while (!s.cylinders.empty()) {
+      find_next_hole_ice_cylinder_crossing(photon.posAndTime, photon.dirAndWlen, photon.range,
+          s.cylinders.size(), &s.cylinders[0], s.grid.parameters,
+          s.grid.cell_start_indices, s.grid.cylinder_indices,
+          crossing, &crossing, &index_of_current_cylinder);
+      if (crossing.index == -1) break;
+      add_medium_change(m, crossing.distance,
+          s.cylinderScatteringLengths[crossing.index], s.cylinderAbsorptionLengths[crossing.index]);
+    }
+
+    s.medium_changes.push_back(m);
+  }
+}
+
+#define SCENARIO_HOLE_ICE_ARGS(s) \
+  (unsigned int)(s).cylinders.size(), \
+  (s).cylinders.empty() ? NULL : &(s).cylinders[0], \
+  &(s).cylinderScatteringLengths[0], \
+  &(s).cylinderAbsorptionLengths[0], \
+  (s).grid.parameters, \
+  (s).grid.cell_start_indices, \
+  (s).grid.cylinder_indices
+
+// BENCHMARKS
+// -----------------------------------------------------------------------------
+
+long benchmark_calculate_intersections(const Scenario &s, long calls)
+{
+  floating_t sum = 0.0;
+  const floating4_t c = s.cylinders[0];
+  for (long i = 0; i < calls; i++) {
+    const Photon &photon = s.photons[i & (number_of_photons - 1)];
+    IntersectionProblemParameters_t p = {
+      photon.posAndTime.x, photon.posAndTime.y, c.x, c.y, c.w,
+      photon.dirAndWlen, photon.range,
+      0, 0, 0
+    };
+    calculate_intersections(&p);
+    sum += p.s1 + p.s2;
+  }
+  sink = sum;
+  return -1;
+}
+
+long benchmark_find_next_hole_ice_cylinder_crossing(const Scenario &s, long calls)
+{
+  floating_t sum = 0.0;
+  const HoleIceCylinderCrossing_t start_of_photon_path = {ZERO, (int)s.cylinders.size(), 1};
+  for (long i = 0; i < calls; i++) {
+    const Photon &photon = s.photons[i & (number_of_photons - 1)];
+    HoleIceCylinderCrossing_t crossing;
+    int index_of_current_cylinder;
+    find_next_hole_ice_cylinder_crossing(photon.posAndTime, photon.dirAndWlen, photon.range,
+        s.cylinders.size(), &s.cylinders[0], s.grid.parameters,
+        s.grid.cell_start_indices, s.grid.cylinder_indices,
+        start_of_photon_path, &crossing, &index_of_current_cylinder);
+    sum += crossing.distance + index_of_current_cylinder;
+  }
+  sink = sum;
+  return -1;
+}
+
+long benchmark_hole_ice_cylinder_crossing_walk(const Scenario &s, long calls)
+{
+  floating_t sum = 0.0;
+  long crossings = 0;
+  const HoleIceCylinderCrossing_t start_of_photon_path = {ZERO, (int)s.cylinders.size(), 1};
+  for (long i = 0; i < calls; i++) {
+    const Photon &photon = s.photons[i & (number_of_photons - 1)];
+    HoleIceCylinderCrossing_t crossing = start_of_photon_path;
+    int index_of_current_cylinder;
+    while (true) {
+      find_next_hole_ice_cylinder_crossing(photon.posAndTime, photon.dirAndWlen, photon.range,
+          s.cylinders.size(), &s.cylinders[0], s.grid.parameters,
+          s.grid.cell_start_indices, s.grid.cylinder_indices,
+          crossing, &crossing, &index_of_current_cylinder);
+      if (crossing.index == -1) break;
+      sum += crossing.distance;
+      crossings++;
+    }
+  }
+  sink = sum;
+  return crossings;
+}
+
+long benchmark_ice_layer_boundary_walk(const Scenario &s, long calls)
+{
+  floating_t sum = 0.0;
+  long medium_changes = 0;
+  for (long i = 0; i < calls; i++) {
+    const Photon &photon = s.photons[i & (number_of_photons - 1)];
+    IceLayerBoundaries_t layers;
+    init_ice_layer_boundaries_on_photon_path(photon.posAndTime, photon.dirAndWlen, &layers);
+    while (layers.has_next && (layers.next_distance < photon.range)) {
+      sum += layers.next_distance + layers.next_layer;
+      medium_changes++;
+      advance_to_next_ice_layer_boundary(photon.posAndTime, photon.dirAndWlen, photon.range, &layers);
+    }
+  }
+  sink = sum;
+  return medium_changes;
+}
+
+long benchmark_medium_boundary_walk(const Scenario &s, long calls)
+{
+  floating_t sum = 0.0;
+  long medium_changes = 0;
+  for (long i = 0; i < calls; i++) {
+    const Photon &photon = s.photons[i & (number_of_photons - 1)];
+    MediumBoundaryIterator_t boundaries;
+    floating_t distance, scattering_length, absorption_length;
+    init_medium_boundaries_on_photon_path(photon.posAndTime, photon.dirAndWlen, photon.sca_step_left,
+        SCENARIO_HOLE_ICE_ARGS(s), &boundaries, &scattering_length, &absorption_length);
+    while (next_medium_boundary_on_photon_path(photon.posAndTime, photon.dirAndWlen,
+        SCENARIO_HOLE_ICE_ARGS(s), &boundaries, &distance, &scattering_length, &absorption_length)) {
+      sum += distance + scattering_length;
+      medium_changes++;
+    }
+  }
+  sink = sum;
+  return medium_changes;
+}
+
+// The double-loop swap sort the kernel used to order the medium changes
+// on every scattering step.
+//
+void swap_sort_medium_changes(int number_of_medium_changes, floating_t *distances_to_medium_changes,
+    floating_t *local_scattering_lengths, floating_t *local_absorption_lengths)
+{
+  for (int k = 0; k <= number_of_medium_changes; k++) {
+    for (int l = 0; l <= number_of_medium_changes; l++) {
+      if (distances_to_medium_changes[l] > distances_to_medium_changes[k]) {
+        floating_t tmp_distance = distances_to_medium_changes[k];
+        floating_t tmp_scattering = local_scattering_lengths[k];
+        floating_t tmp_absorption = local_absorption_lengths[k];
+
+        distances_to_medium_changes[k] = distances_to_medium_changes[l];
+        local_scattering_lengths[k] = local_scattering_lengths[l];
+        local_absorption_lengths[k] = local_absorption_lengths[l];
+
+        distances_to_medium_changes[l] = tmp_distance;
+        local_scattering_lengths[l] = tmp_scattering;
+        local_absorption_lengths[l] = tmp_absorption;
+      }
+    }
+  }
+}
+
+// The insertion merge that replaced it: the ice layer boundaries are
+// already in order, and the cylinder points are shifted into place.
+//
+void merge_medium_changes(int number_of_medium_changes, floating_t *distances_to_medium_changes,
+    floating_t *local_scattering_lengths, floating_t *local_absorption_lengths)
+{
+  for (int k = 1; k <= number_of_medium_changes; k++) {
+    const floating_t distance = distances_to_medium_changes[k];
+    if (distances_to_medium_changes[k - 1] <= distance) continue;
+
+    const floating_t scattering = local_scattering_lengths[k];
+    const floating_t absorption = local_absorption_lengths[k];
+
+    int l = k;
+    for (; (l > 0) && (distances_to_medium_changes[l - 1] > distance); l--) {
+      distances_to_medium_changes[l] = distances_to_medium_changes[l - 1];
+      local_scattering_lengths[l] = local_scattering_lengths[l - 1];
+      local_absorption_lengths[l] = local_absorption_lengths[l - 1];
+    }
+
+    distances_to_medium_changes[l] = distance;
+    local_scattering_lengths[l] = scattering;
+    local_absorption_lengths[l] = absorption;
+  }
+}
+
+typedef void (*SortMediumChanges)(int, floating_t *, floating_t *, floating_t *);
+
+// Both algorithms sort a copy of the unsorted arrays, such that the
+// copy is part of either timing.
+//
+long run_sort_medium_changes(const Scenario &s, long calls, SortMediumChanges sort)
+{
+  floating_t sum = 0.0;
+  long medium_changes = 0;
+  std::vector<floating_t> distances, scattering_lengths, absorption_lengths;
+  for (long i = 0; i < calls; i++) {
+    const MediumChanges &m = s.medium_changes[i & (number_of_photons - 1)];
+    distances = m.distances;
+    scattering_lengths = m.scattering_lengths;
+    absorption_lengths = m.absorption_lengths;
+    const int number_of_medium_changes = (int)distances.size() - 1;
+    sort(number_of_medium_changes, &distances[0], &scattering_lengths[0], &absorption_lengths[0]);
+    sum += distances[number_of_medium_changes] + scattering_lengths[number_of_medium_changes];
+    medium_changes += number_of_medium_changes;
+  }
+  sink = sum;
+  return medium_changes;
+}
+
+long benchmark_swap_sort_medium_changes(const Scenario &s, long calls)
+{
+  return run_sort_medium_changes(s, calls, swap_sort_medium_changes);
+}
+
+long benchmark_merge_medium_changes(const Scenario &s, long calls)
+{
+  return run_sort_medium_changes(s, calls, merge_medium_changes);
+}
+
+long benchmark_apply_propagation_through_different_media(const Scenario &s, long calls)
+{
+  floating_t sum = 0.0;
+  for (long i = 0; i < calls; i++) {
+    const Photon &photon = s.photons[i & (number_of_photons - 1)];
+    floating_t sca_step_left = photon.sca_step_left;
+    floating_t abs_lens_left = 1.0;
+    floating_t distancePropagated = 0.0;
+    floating_t distanceToAbsorption = 0.0;
+    apply_propagation_through_different_media(photon.posAndTime, photon.dirAndWlen,
+        SCENARIO_HOLE_ICE_ARGS(s),
+        &sca_step_left, &abs_lens_left, &distancePropagated, &distanceToAbsorption);
+    sum += distancePropagated + distanceToAbsorption;
+  }
+  sink = sum;
+  return -1;
+}
+
+long benchmark_apply_propagation_through_different_media_with_optical_depth_table(const Scenario &s, long calls)
+{
+  floating_t sum = 0.0;
+  for (long i = 0; i < calls; i++) {
+    const Photon &photon = s.photons[i & (number_of_photons - 1)];
+    floating_t sca_step_left = photon.sca_step_left;
+    floating_t abs_lens_left = 1.0;
+    floating_t distancePropagated = 0.0;
+    floating_t distanceToAbsorption = 0.0;
+    apply_propagation_through_different_media_with_optical_depth_table(photon.posAndTime, photon.dirAndWlen,
+        SCENARIO_HOLE_ICE_ARGS(s),
+        &sca_step_left, &abs_lens_left, &distancePropagated, &distanceToAbsorption);
+    sum += distancePropagated + distanceToAbsorption;
+  }
+  sink = sum;
+  return -1;
+}
+
+// SCENARIO GRID
+// -----------------------------------------------------------------------------
+
+const char *starts[] = {"outside", "inside"};
+const floating_t segment_lengths_in_layers[] = {0.1, 1.0, 10.0};
+
+Scenario *new_scenario(const std::string &function, BenchmarkFunction run)
+{
+  Scenario *s = new Scenario;
+  s->function = function;
+  s->run = run;
+  return s;
+}
+
+// Adds the cylinders, start and segment length parameters and the photons.
+//
+void set_up_photon_path(Scenario &s, int numberOfCylinders, int start, floating_t segment_length_in_layers)
+{
+  set_up_cylinders(s, numberOfCylinders);
+  add_parameter(s, "cylinders", to_string(numberOfCylinders));
+  add_parameter(s, "start", starts[start]);
+  add_parameter(s, "segment_length_in_layers", to_string(segment_length_in_layers));
+  add_photons(s, start == 1, segment_length_in_layers * MEDIUM_LAYER_THICKNESS);
+}
+
+std::vector<Scenario *> generate_scenarios()
+{
+  std::vector<Scenario *> scenarios;
+  const int numbers_of_cylinders[] = {2, 50, 500, 5000};
+
+  for (int start = 0; start < 2; start++) {
+    Scenario *s = new_scenario("calculate_intersections", benchmark_calculate_intersections);
+    set_up_photon_path(*s, 1, start, 1.0);
+    scenarios.push_back(s);
+  }
+
+  for (int c = 0; c < 4; c++) {
+    for (int start = 0; start < 2; start++) {
+      for (int l = 0; l < 3; l++) {
+        Scenario *s = new_scenario("find_next_hole_ice_cylinder_crossing", benchmark_find_next_hole_ice_cylinder_crossing);
+        set_up_photon_path(*s, numbers_of_cylinders[c], start, segment_lengths_in_layers[l]);
+        scenarios.push_back(s);
+      }
+    }
+  }
+
+  // All crossings of a step, as followed by the propagation functions.
+  // The photons are nearly horizontal, such that long steps cross
+  // many cylinders of the lattice.
+  //
+  for (int c = 0; c < 4; c++) {
+    for (int l = 0; l < 3; l++) {
+      Scenario *s = new_scenario("hole_ice_cylinder_crossing_walk", benchmark_hole_ice_cylinder_crossing_walk);
+      set_up_photon_path(*s, numbers_of_cylinders[c], 0, segment_lengths_in_layers[l]);
+      for (int i = 0; i < number_of_photons; i++) {
+        const floating_t dz = uniform(-0.05, 0.05);
+        const floating_t phi = uniform(0.0, 2.0 * M_PI);
+        const floating4_t direction = {sqrt(1.0 - sqr(dz)) * cos(phi), sqrt(1.0 - sqr(dz)) * sin(phi), dz, 400e-9};
+        s->photons[i].dirAndWlen = direction;
+      }
+      scenarios.push_back(s);
+    }
+  }
+
+  for (int l = 0; l < 3; l++) {
+    Scenario *s = new_scenario("ice_layer_boundary_walk", benchmark_ice_layer_boundary_walk);
+    set_up_cylinders(*s, 0);
+    add_parameter(*s, "segment_length_in_layers", to_string(segment_lengths_in_layers[l]));
+    add_photons(*s, false, segment_lengths_in_layers[l] * MEDIUM_LAYER_THICKNESS);
+    scenarios.push_back(s);
+  }
+
+  // A row of cylinders along the x axis. The photons pass through all
+  // of them almost horizontally within one ice layer, such that the
+  // number of medium changes is twice the number of cylinders, plus
+  // the closest ice layer boundary, which is always reported.
+  //
+  const int numbers_of_medium_changes[] = {0, 2, 8, 32, 128};
+  for (int m = 0; m < 5; m++) {
+    Scenario *s = new_scenario("medium_boundary_walk", benchmark_medium_boundary_walk);
+    const int numberOfCylinders = numbers_of_medium_changes[m] / 2;
+    for (int i = 0; i < numberOfCylinders; i++) {
+      const floating4_t cylinder = {2.0 * cylinder_radius * (i + 1), 0.0, 0.0, 0.5 * cylinder_radius};
+      s->cylinders.push_back(cylinder);
+    }
+    s->grid = generate_cylinder_grid(s->cylinders.size(), s->cylinders.empty() ? NULL : &s->cylinders[0], numberOfCylinders > 0 ? numberOfCylinders : 1, 1);
+    s->cylinderScatteringLengths.assign(max_cylinders, 0.5);
+    s->cylinderAbsorptionLengths.assign(max_cylinders, 50.0);
+    add_parameter(*s, "medium_changes", to_string(numbers_of_medium_changes[m]));
+    for (int i = 0; i < number_of_photons; i++) {
+      const floating_t dz = 1e-4;
+      const Photon p = {
+        {0.0, uniform(-0.2, 0.2) * cylinder_radius, uniform(1.0, 9.0), 0.0},
+        {sqrt(1.0 - sqr(dz)), 0.0, dz, 400e-9},
+        2.0 * cylinder_radius * (numberOfCylinders + 1) / getScatteringLength(photon_layer(5.0), 400e-9),
+        2.0 * cylinder_radius * (numberOfCylinders + 1)
+      };
+      s->photons.push_back(p);
+    }
+    scenarios.push_back(s);
+  }
+
+  // The former ordering of the medium changes on every scattering step.
+  //
+  for (int c = 0; c < 4; c++) {
+    for (int l = 0; l < 3; l++) {
+      Scenario *s = new_scenario("swap_sort_medium_changes", benchmark_swap_sort_medium_changes);
+      set_up_photon_path(*s, numbers_of_cylinders[c], 0, segment_lengths_in_layers[l]);
+      add_medium_changes(*s);
+      scenarios.push_back(s);
+
+      // the same photons for both algorithms
+      Scenario *t = new Scenario(*s);
+      t->function = "merge_medium_changes";
+      t->run = benchmark_merge_medium_changes;
+      scenarios.push_back(t);
+    }
+  }
+
+  const int numbers_of_cylinders_for_propagation[] = {0, 2, 50, 500, 5000};
+  for (int c = 0; c < 5; c++) {
+    for (int start = 0; start < 2; start++) {
+      if ((numbers_of_cylinders_for_propagation[c] == 0) && (start == 1)) continue;
+      for (int l = 0; l < 3; l++) {
+        Scenario *s = new_scenario("apply_propagation_through_different_media", benchmark_apply_propagation_through_different_media);
+        set_up_photon_path(*s, numbers_of_cylinders_for_propagation[c], start, segment_lengths_in_layers[l]);
+        scenarios.push_back(s);
+
+        Scenario *t = new_scenario("apply_propagation_through_different_media_with_optical_depth_table", benchmark_apply_propagation_through_different_media_with_optical_depth_table);
+        set_up_photon_path(*t, numbers_of_cylinders_for_propagation[c], start, segment_lengths_in_layers[l]);
+        scenarios.push_back(t);
+      }
+    }
+  }
+
+  return scenarios;
+}
+
+// MEASUREMENT
+// -----------------------------------------------------------------------------
+
+double seconds()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+std::string scenario_name(const Scenario &s)
+{
+  std::string name = s.function;
+  for (size_t i = 0; i < s.parameters.size(); i++) {
+    name += "/" + s.parameters[i].name + ":" + s.parameters[i].value;
+  }
+  return name;
+}
+
+// Doubles the number of calls until a run takes at least `min_time`
+// seconds and reports that run.
+//
+Result measure(const Scenario &s, double min_time)
+{
+  Result r;
+  r.name = scenario_name(s);
+  r.scenario = &s;
+
+  s.run(s, number_of_photons); // warm up
+
+  long calls = number_of_photons;
+  while (true) {
+    const double start = seconds();
+    const long medium_changes = s.run(s, calls);
+    const double elapsed = seconds() - start;
+    if ((elapsed >= min_time) || (calls > (1L << 40))) {
+      r.calls = calls;
+      r.ns_per_call = 1e9 * elapsed / calls;
+      r.medium_changes_per_call = (medium_changes < 0) ? -1.0 : (double)medium_changes / calls;
+      return r;
+    }
+    calls *= 2;
+  }
+}
+
+bool is_number(const std::string &value)
+{
+  char *end;
+  strtod(value.c_str(), &end);
+  return !value.empty() && (*end == '\0');
+}
+
+void write_json(FILE *f, const std::vector<Result> &results, double min_time)
+{
+  fprintf(f, "{\n");
+  fprintf(f, "  \"floating_t\": \"%s\",\n", (sizeof(floating_t) == sizeof(double)) ? "double" : "float");
+  fprintf(f, "  \"min_time\": %g,\n", min_time);
+  fprintf(f, "  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    const Scenario &s = *r.scenario;
+    fprintf(f, "    {\n");
+    fprintf(f, "      \"name\": \"%s\",\n", r.name.c_str());
+    fprintf(f, "      \"function\": \"%s\",\n", s.function.c_str());
+    fprintf(f, "      \"parameters\": {");
+    for (size_t j = 0; j < s.parameters.size(); j++) {
+      const char *quote = is_number(s.parameters[j].value) ? "" : "\"";
+      fprintf(f, "%s\"%s\": %s%s%s", (j > 0) ? ", " : "",
+          s.parameters[j].name.c_str(), quote, s.parameters[j].value.c_str(), quote);
+    }
+    fprintf(f, "},\n");
+    fprintf(f, "      \"calls\": %ld,\n", r.calls);
+    fprintf(f, "      \"ns_per_call\": %.3f,\n", r.ns_per_call);
+    if (r.medium_changes_per_call < 0) {
+      fprintf(f, "      \"medium_changes_per_call\": null\n");
+    } else {
+      fprintf(f, "      \"medium_changes_per_call\": %.3f\n", r.medium_changes_per_call);
+    }
+    fprintf(f, "    }%s\n", (i + 1 < results.size()) ? "," : "");
+  }
+  fprintf(f, "  ]\n");
+  fprintf(f, "}\n");
+}
+
+void usage(const char *program)
+{
+  fprintf(stderr, "Usage: %s [--filter <substring>] [--min-time <seconds>] [--json <file>]\n", program);
+}
+
+int main(int argc, char **argv)
+{
+  std::string filter;
+  std::string json_file;
+  double min_time = 0.1;
+
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "--filter") == 0) && (i + 1 < argc)) {
+      filter = argv[++i];
+    } else if ((strcmp(argv[i], "--min-time") == 0) && (i + 1 < argc)) {
+      min_time = atof(argv[++i]);
+    } else if ((strcmp(argv[i], "--json") == 0) && (i + 1 < argc)) {
+      json_file = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  srand48(42);
+  fill_optical_depth_tables();
+  const std::vector<Scenario *> scenarios = generate_scenarios();
+
+  std::vector<Result> results;
+  printf("%-110s %12s %14s\n", "benchmark", "ns/call", "changes/call");
+  for (size_t i = 0; i < scenarios.size(); i++) {
+    if (scenario_name(*scenarios[i]).find(filter) == std::string::npos) continue;
+    const Result r = measure(*scenarios[i], min_time);
+    if (r.medium_changes_per_call < 0) {
+      printf("%-110s %12.2f %14s\n", r.name.c_str(), r.ns_per_call, "-");
+    } else {
+      printf("%-110s %12.2f %14.2f\n", r.name.c_str(), r.ns_per_call, r.medium_changes_per_call);
+    }
+    fflush(stdout);
+    results.push_back(r);
+  }
+
+  if (!json_file.empty()) {
+    FILE *f = fopen(json_file.c_str(), "w");
+    if (!f) {
+      fprintf(stderr, "Could not open %s for writing.\n", json_file.c_str());
+      return 1;
+    }
+    write_json(f, results, min_time);
+    fclose(f);
+  }
+
+  for (size_t i = 0; i < scenarios.size(); i++) delete scenarios[i];
+  return 0;
+}
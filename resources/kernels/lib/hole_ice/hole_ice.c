@@ -4,118 +4,247 @@
 #include "hole_ice.h"
 #include "../intersection/intersection.c"
 
-inline void add_hole_ice_cylinders_on_photon_path_to_medium_changes(floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t photonRange, unsigned int numberOfCylinders, __constant floating4_t *cylinderPositionsAndRadii, int *number_of_medium_changes, floating_t *distances_to_medium_changes, floating_t *local_scattering_lengths, floating_t *local_absorption_lengths)
+inline void find_next_hole_ice_cylinder_crossing(floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t photonRange, unsigned int numberOfCylinders, HOLE_ICE_MEMORY const floating4_t *cylinderPositionsAndRadii, const HoleIceCylinderGrid_t cylinderGrid, HOLE_ICE_MEMORY const unsigned int *cylinderGridCellStartIndices, HOLE_ICE_MEMORY const unsigned int *cylinderGridCylinderIndices, const HoleIceCylinderCrossing_t previous_crossing, HoleIceCylinderCrossing_t *next_crossing, int *index_of_innermost_cylinder_containing_the_photon)
 {
-  // Find out which cylinders are in range in a separate loop
-  // in order to improve parallelism and thereby performance.
+  // Find the first crossing of the photon path with a cylinder surface
+  // after `previous_crossing`.
   //
-  // See: https://github.com/fiedl/hole-ice-study/issues/30
+  // Only the next crossing is kept rather than collecting all of them,
+  // such that the memory needed does not depend on the number of cylinders.
+  // The grid cells are walked along the photon path, starting at the
+  // previous crossing and stopping as soon as no cell further down the
+  // path can hold an earlier crossing. A step with several crossings
+  // therefore walks the cells on its path about once in total.
   //
-  #ifdef NUMBER_OF_CYLINDERS
-    // When running this on OpenCL, defining arrays using a constant
-    // as array size is not possible. Therefore, we need to use a
-    // pre-processor makro here.
-    //
-    // See: https://github.com/fiedl/hole-ice-study/issues/38
-    //
-    int indices_of_cylinders_in_range[NUMBER_OF_CYLINDERS];
-  #else
-    int indices_of_cylinders_in_range[numberOfCylinders];
-  #endif
-  {
-    unsigned int j = 0;
-    for (unsigned int i = 0; i < numberOfCylinders; i++) {
-      indices_of_cylinders_in_range[i] = -1;
-    }
-    for (unsigned int i = 0; i < numberOfCylinders; i++) {
-      if (sqr(photonPosAndTime.x - cylinderPositionsAndRadii[i].x) +
-          sqr(photonPosAndTime.y - cylinderPositionsAndRadii[i].y) <=
-          sqr(photonRange + cylinderPositionsAndRadii[i].w /* radius */))
-      {
-
-        // If the cylinder has a z-range check if we consider that cylinder
-        // to be in range. https://github.com/fiedl/hole-ice-study/issues/34
-        //
-        if ((cylinderPositionsAndRadii[i].z == 0) || ((cylinderPositionsAndRadii[i].z != 0) && !(((photonPosAndTime.z < cylinderPositionsAndRadii[i].z - 0.5) && (photonPosAndTime.z + photonRange * photonDirAndWlen.z < cylinderPositionsAndRadii[i].z - 0.5)) || ((photonPosAndTime.z > cylinderPositionsAndRadii[i].z + 0.5) && (photonPosAndTime.z + photonRange * photonDirAndWlen.z > cylinderPositionsAndRadii[i].z + 0.5)))))
-        {
-          indices_of_cylinders_in_range[j] = i;
-          j += 1;
-        }
+  next_crossing->distance = ZERO;
+  next_crossing->index = -1;
+  next_crossing->is_exit = 0;
+
+  // If the photon is within several nested cylinders, the innermost one,
+  // i.e. the one with the largest index, determines the current medium.
+  //
+  *index_of_innermost_cylinder_containing_the_photon = -1;
+
+  if (numberOfCylinders == 0) return;
+
+  // A cylinder can only change the medium on the photon path if its
+  // footprint touches the path in the x-y plane, i.e. if its center is
+  // within `margin` of the path. The path reaches at most
+  // `photonRange + maxRadius` in the x-y plane before the cylinders
+  // are out of range.
+  //
+  const floating_t xy_projection_factor = my_sqrt(max(ZERO, ONE - sqr(photonDirAndWlen.z)));
+  const floating_t margin = cylinderGrid.maxRadius + (floating_t)0.01;
+
+  floating_t inverse_xy_projection_factor = ZERO;
+  floating_t ux = ZERO;
+  floating_t uy = ZERO;
+  if (xy_projection_factor > ZERO) {
+    inverse_xy_projection_factor = my_divide(ONE, xy_projection_factor);
+    ux = photonDirAndWlen.x * inverse_xy_projection_factor;
+    uy = photonDirAndWlen.y * inverse_xy_projection_factor;
+  }
+
+  // The box of cells the path can reach.
+  //
+  const floating_t reachX = ux * (photonRange + cylinderGrid.maxRadius);
+  const floating_t reachY = uy * (photonRange + cylinderGrid.maxRadius);
+  const int lowCellX = hole_ice_cylinder_grid_cell(min(photonPosAndTime.x, photonPosAndTime.x + reachX) - margin,
+      cylinderGrid.startX, cylinderGrid.widthX, cylinderGrid.numX);
+  const int highCellX = hole_ice_cylinder_grid_cell(max(photonPosAndTime.x, photonPosAndTime.x + reachX) + margin,
+      cylinderGrid.startX, cylinderGrid.widthX, cylinderGrid.numX);
+  const int lowCellY = hole_ice_cylinder_grid_cell(min(photonPosAndTime.y, photonPosAndTime.y + reachY) - margin,
+      cylinderGrid.startY, cylinderGrid.widthY, cylinderGrid.numY);
+  const int highCellY = hole_ice_cylinder_grid_cell(max(photonPosAndTime.y, photonPosAndTime.y + reachY) + margin,
+      cylinderGrid.startY, cylinderGrid.widthY, cylinderGrid.numY);
+
+  // Short (or vertical) paths only reach a few cells. Up to a box of
+  // 3x3 cells, scanning all of them is cheaper than setting up the walk
+  // below (host benchmark, `make benchmark`).
+  //
+  if ((xy_projection_factor <= ZERO) || ((highCellX - lowCellX + 1) * (highCellY - lowCellY + 1) <= 9)) {
+    for (int cell_y = lowCellY; cell_y <= highCellY; cell_y++) {
+      for (int cell_x = lowCellX; cell_x <= highCellX; cell_x++) {
+        find_next_hole_ice_cylinder_crossing_in_cell(photonPosAndTime, photonDirAndWlen, photonRange,
+            cylinderPositionsAndRadii, cylinderGridCellStartIndices, cylinderGridCylinderIndices,
+            cell_y * cylinderGrid.numX + cell_x, previous_crossing, next_crossing,
+            index_of_innermost_cylinder_containing_the_photon);
       }
     }
+    return;
   }
 
-  // Now loop over all cylinders in range and calculate corrections
-  // for `*distancePropagated` and `*distanceToAbsorption`.
+  // Walk the cells column by column along the axis the path advances
+  // faster on (`a`), covering the cells within `margin` of the path on
+  // the other axis (`b`). Distances along the path in the x-y plane are
+  // called `t`. The crossings are at 3d distances `t / xy_projection_factor`.
+  //
+  const int major_axis_is_x = (my_fabs(ux) >= my_fabs(uy));
+
+  const floating_t posA = major_axis_is_x ? photonPosAndTime.x : photonPosAndTime.y;
+  const floating_t posB = major_axis_is_x ? photonPosAndTime.y : photonPosAndTime.x;
+  const floating_t uA = major_axis_is_x ? ux : uy;
+  const floating_t uB = major_axis_is_x ? uy : ux;
+  const floating_t startA = major_axis_is_x ? cylinderGrid.startX : cylinderGrid.startY;
+  const floating_t startB = major_axis_is_x ? cylinderGrid.startY : cylinderGrid.startX;
+  const floating_t widthA = major_axis_is_x ? cylinderGrid.widthX : cylinderGrid.widthY;
+  const floating_t widthB = major_axis_is_x ? cylinderGrid.widthY : cylinderGrid.widthX;
+  const int numA = major_axis_is_x ? cylinderGrid.numX : cylinderGrid.numY;
+  const int numB = major_axis_is_x ? cylinderGrid.numY : cylinderGrid.numX;
+
+  // A cylinder within `margin` of the path has its center within
+  // `marginB` of the path on the `b` axis, and the path passes its
+  // column within `marginT` of the center's projection onto the path.
+  // Its crossings are within `maxRadius` of that projection.
   //
-  for (unsigned int j = 0; j < numberOfCylinders; j++) {
-    const int i = indices_of_cylinders_in_range[j];
-    if (i == -1) {
-      break;
-    } else {
-
-      IntersectionProblemParameters_t p = {
-
-        // Input values
-        photonPosAndTime.x,
-        photonPosAndTime.y,
-        cylinderPositionsAndRadii[i].x,
-        cylinderPositionsAndRadii[i].y,
-        cylinderPositionsAndRadii[i].w, // radius
-        photonDirAndWlen,
-        1.0, // distance used to calculate s1 and s2 relative to
-
-        // Output values (will be calculated)
-        0, // discriminant
-        0, // s1
-        0  // s2
-
-      };
-
-      calculate_intersections(&p);
-
-      //printf("  intersection:\n");
-      //printf("    cylinder: i = %i\n", i);
-      //printf("    intersection_s1 = %f\n", intersection_s1(p));
-      //printf("    intersection_s2 = %f\n", intersection_s2(p));
-
-      if (intersection_discriminant(p) > 0) {
-        if ((intersection_s1(p) <= 0) && (intersection_s2(p) >= 0)) {
-          // The photon is already within the hole ice.
-          local_scattering_lengths[0] = cylinderScatteringLengths[i];
-          local_absorption_lengths[0] = cylinderAbsorptionLengths[i];
-        } else if (intersection_s1(p) > 0) {
-          // The photon enters the hole ice on its way.
-          *number_of_medium_changes += 1;
-          distances_to_medium_changes[*number_of_medium_changes] = intersection_s1(p);
-          local_scattering_lengths[*number_of_medium_changes] = cylinderScatteringLengths[i];
-          local_absorption_lengths[*number_of_medium_changes] = cylinderAbsorptionLengths[i];
+  const floating_t invUA = my_divide(ONE, uA);
+  const floating_t invWidthB = my_divide(ONE, widthB);
+  const floating_t marginB = margin * my_fabs(invUA);
+  const floating_t marginT = margin * my_fabs(uB * invUA);
+  const floating_t slack = marginT + margin;
+  const floating_t firstT = -(cylinderGrid.maxRadius + marginT);
+  const floating_t lastT = photonRange + cylinderGrid.maxRadius + marginT;
+
+  const int firstCellA = hole_ice_cylinder_grid_cell(posA + uA * firstT, startA, widthA, numA);
+  const int lastCellA = hole_ice_cylinder_grid_cell(posA + uA * lastT, startA, widthA, numA);
+  const int stepA = (lastCellA >= firstCellA) ? 1 : -1;
+
+  // The path enters the columns at `columnEntryT` and leaves them
+  // `columnStepT` later.
+  floating_t columnEntryT = (startA + (firstCellA + ((uA < ZERO) ? 1 : 0)) * widthA - posA) * invUA;
+  const floating_t columnStepT = widthA * my_fabs(invUA);
+
+  for (int cell_a = firstCellA; ; cell_a += stepA, columnEntryT += columnStepT) {
+    const floating_t columnFirstT = max(columnEntryT, firstT);
+    const floating_t columnLastT = min(columnEntryT + columnStepT, lastT);
+
+    // This column and all following ones only hold later crossings.
+    if ((next_crossing->index != -1) && (columnFirstT - slack > next_crossing->distance * xy_projection_factor)) break;
+
+    // Skip the columns the photon has passed already, except for the ones
+    // at the photon position, which hold the cylinders containing it.
+    if ((columnFirstT <= slack) || (columnLastT + slack >= previous_crossing.distance * xy_projection_factor)) {
+      const floating_t b0 = posB + uB * columnFirstT;
+      const floating_t b1 = posB + uB * columnLastT;
+      // Like `hole_ice_cylinder_grid_cell`, without dividing in every column.
+      const int lowCellB = (int)min(max((min(b0, b1) - marginB - startB) * invWidthB, ZERO), (floating_t)(numB - 1));
+      const int highCellB = (int)min(max((max(b0, b1) + marginB - startB) * invWidthB, ZERO), (floating_t)(numB - 1));
+      for (int cell_b = lowCellB; cell_b <= highCellB; cell_b++) {
+        const int cell = major_axis_is_x ? (cell_b * cylinderGrid.numX + cell_a) : (cell_a * cylinderGrid.numX + cell_b);
+        find_next_hole_ice_cylinder_crossing_in_cell(photonPosAndTime, photonDirAndWlen, photonRange,
+            cylinderPositionsAndRadii, cylinderGridCellStartIndices, cylinderGridCylinderIndices,
+            cell, previous_crossing, next_crossing,
+            index_of_innermost_cylinder_containing_the_photon);
+      }
+    }
+
+    if (cell_a == lastCellA) break;
+  }
+}
+
+inline void find_next_hole_ice_cylinder_crossing_in_cell(floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t photonRange, HOLE_ICE_MEMORY const floating4_t *cylinderPositionsAndRadii, HOLE_ICE_MEMORY const unsigned int *cylinderGridCellStartIndices, HOLE_ICE_MEMORY const unsigned int *cylinderGridCylinderIndices, int cell, const HoleIceCylinderCrossing_t previous_crossing, HoleIceCylinderCrossing_t *next_crossing, int *index_of_innermost_cylinder_containing_the_photon)
+{
+  for (unsigned int k = cylinderGridCellStartIndices[cell]; k < cylinderGridCellStartIndices[cell + 1]; k++) {
+    const int i = cylinderGridCylinderIndices[k];
+    if (sqr(photonPosAndTime.x - cylinderPositionsAndRadii[i].x) +
+        sqr(photonPosAndTime.y - cylinderPositionsAndRadii[i].y) >
+        sqr(photonRange + cylinderPositionsAndRadii[i].w /* radius */))
+    {
+      continue;
+    }
+
+    // If the cylinder has a z-range check if we consider that cylinder
+    // to be in range. https://github.com/fiedl/hole-ice-study/issues/34
+    //
+    if (!((cylinderPositionsAndRadii[i].z == 0) || ((cylinderPositionsAndRadii[i].z != 0) && !(((photonPosAndTime.z < cylinderPositionsAndRadii[i].z - 0.5) && (photonPosAndTime.z + photonRange * photonDirAndWlen.z < cylinderPositionsAndRadii[i].z - 0.5)) || ((photonPosAndTime.z > cylinderPositionsAndRadii[i].z + 0.5) && (photonPosAndTime.z + photonRange * photonDirAndWlen.z > cylinderPositionsAndRadii[i].z + 0.5))))))
+    {
+      continue;
+    }
+
+    IntersectionProblemParameters_t p = {
+
+      // Input values
+      photonPosAndTime.x,
+      photonPosAndTime.y,
+      cylinderPositionsAndRadii[i].x,
+      cylinderPositionsAndRadii[i].y,
+      cylinderPositionsAndRadii[i].w, // radius
+      photonDirAndWlen,
+      1.0, // distance used to calculate s1 and s2 relative to
+
+      // Output values (will be calculated)
+      0, // discriminant
+      0, // s1
+      0  // s2
+
+    };
+
+    calculate_intersections(&p);
+
+    //printf("  intersection:\n");
+    //printf("    cylinder: i = %i\n", i);
+    //printf("    intersection_s1 = %f\n", intersection_s1(p));
+    //printf("    intersection_s2 = %f\n", intersection_s2(p));
+
+    if (intersection_discriminant(p) > 0) {
+      if ((intersection_s1(p) <= 0) && (intersection_s2(p) >= 0)) {
+        // The photon is already within the hole ice.
+        if (i > *index_of_innermost_cylinder_containing_the_photon) {
+          *index_of_innermost_cylinder_containing_the_photon = i;
         }
-        if (intersection_s2(p) > 0) {
-          // The photon leaves the hole ice on its way.
-          *number_of_medium_changes += 1;
-          distances_to_medium_changes[*number_of_medium_changes] = intersection_s2(p);
-          if (i == 0) // there is no larger cylinder
-          {
-            const int photonLayerAtTheCylinderBorder =
-                photon_layer(photonPosAndTime.z + photonDirAndWlen.z * intersection_s2(p));
-            local_scattering_lengths[*number_of_medium_changes] =
-                getScatteringLength(photonLayerAtTheCylinderBorder, photonDirAndWlen.w);
-            local_absorption_lengths[*number_of_medium_changes] =
-                getAbsorptionLength(photonLayerAtTheCylinderBorder, photonDirAndWlen.w);
-          } else {
-            // There is a larger cylinder outside this one, which is the one before in the array.
-            // See: https://github.com/fiedl/hole-ice-study/issues/47
-            //
-            local_scattering_lengths[*number_of_medium_changes] = cylinderScatteringLengths[i - 1];
-            local_absorption_lengths[*number_of_medium_changes] = cylinderAbsorptionLengths[i - 1];
-          }
+      } else if ((intersection_s1(p) > 0) && is_later_hole_ice_cylinder_crossing(intersection_s1(p), i, 0, previous_crossing)) {
+        // The photon enters the hole ice on its way.
+        if ((next_crossing->index == -1) || !is_later_hole_ice_cylinder_crossing(intersection_s1(p), i, 0, *next_crossing)) {
+          next_crossing->distance = intersection_s1(p);
+          next_crossing->index = i;
+          next_crossing->is_exit = 0;
+        }
+      }
+      if ((intersection_s2(p) > 0) && is_later_hole_ice_cylinder_crossing(intersection_s2(p), i, 1, previous_crossing)) {
+        // The photon leaves the hole ice on its way.
+        if ((next_crossing->index == -1) || !is_later_hole_ice_cylinder_crossing(intersection_s2(p), i, 1, *next_crossing)) {
+          next_crossing->distance = intersection_s2(p);
+          next_crossing->index = i;
+          next_crossing->is_exit = 1;
         }
       }
-
     }
   }
+}
+
+inline int is_later_hole_ice_cylinder_crossing(floating_t distance, int index, int is_exit, const HoleIceCylinderCrossing_t previous_crossing)
+{
+  if (distance != previous_crossing.distance) return distance > previous_crossing.distance;
+  if (index != previous_crossing.index) return index > previous_crossing.index;
+  return is_exit > previous_crossing.is_exit;
+}
 
+inline void hole_ice_properties_behind_crossing(MEDIUM_ARGS floating4_t photonPosAndTime, floating4_t photonDirAndWlen, HOLE_ICE_MEMORY const floating_t *cylinderScatteringLengths, HOLE_ICE_MEMORY const floating_t *cylinderAbsorptionLengths, const HoleIceCylinderCrossing_t crossing, floating_t *scattering_length, floating_t *absorption_length)
+{
+  if (!crossing.is_exit) {
+    // The photon enters the hole ice.
+    *scattering_length = cylinderScatteringLengths[crossing.index];
+    *absorption_length = cylinderAbsorptionLengths[crossing.index];
+  } else if (crossing.index == 0) {
+    // The photon leaves the hole ice. There is no larger cylinder.
+    const int photonLayerAtTheCylinderBorder =
+        photon_layer(MEDIUM_ARGS_TO_CALL photonPosAndTime.z + photonDirAndWlen.z * crossing.distance);
+    *scattering_length = getScatteringLength(MEDIUM_ARGS_TO_CALL photonLayerAtTheCylinderBorder, photonDirAndWlen.w);
+    *absorption_length = getAbsorptionLength(MEDIUM_ARGS_TO_CALL photonLayerAtTheCylinderBorder, photonDirAndWlen.w);
+  } else {
+    // There is a larger cylinder outside this one, which is the one before in the array.
+    // See: https://github.com/fiedl/hole-ice-study/issues/47
+    //
+    *scattering_length = cylinderScatteringLengths[crossing.index - 1];
+    *absorption_length = cylinderAbsorptionLengths[crossing.index - 1];
+  }
+}
+
+inline int hole_ice_cylinder_grid_cell(floating_t pos, floating_t start, floating_t width, int num)
+{
+  // Clamp before converting to int in order to stay within the grid
+  // even for very long photon paths.
+  return (int)min(max(my_divide(pos - start, width), ZERO), (floating_t)(num - 1));
 }
 
 #endif
@@ -1,6 +1,71 @@
 #ifndef HOLE_ICE_H
 #define HOLE_ICE_H
 
-inline void add_hole_ice_cylinders_on_photon_path_to_medium_changes(floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t photonRange, unsigned int numberOfCylinders, __constant floating4_t *cylinderPositionsAndRadii, int *number_of_medium_changes, floating_t *distances_to_medium_changes, floating_t *local_scattering_lengths, floating_t *local_absorption_lengths);
+// The hole ice cylinders are passed to the kernel as buffer arguments
+// such that they can be replaced without recompiling the kernel.
+// They live in global memory unless the preamble says otherwise.
+//
+#ifndef HOLE_ICE_MEMORY
+  #define HOLE_ICE_MEMORY __global
+#endif
 
-#endif
\ No newline at end of file
+// A uniform 2D grid over the x/y extents of the hole-ice cylinders,
+// which is generated on the host.
+//
+// Each cylinder is registered in exactly one cell, the one containing
+// its center. The cylinder indices of cell `c` are stored in
+// `cylinderGridCylinderIndices[cylinderGridCellStartIndices[c]]` up to
+// (excluding) `cylinderGridCylinderIndices[cylinderGridCellStartIndices[c+1]]`.
+//
+typedef struct HoleIceCylinderGrid {
+  floating_t startX;
+  floating_t startY;
+  floating_t widthX;
+  floating_t widthY;
+  int numX;
+  int numY;
+  floating_t maxRadius;
+} HoleIceCylinderGrid_t;
+
+// The hole ice cylinders as passed through the propagation functions,
+// like RNG_ARGS for the random number generator state.
+//
+#define HOLE_ICE_ARGS \
+  unsigned int numberOfCylinders, \
+  HOLE_ICE_MEMORY const floating4_t *cylinderPositionsAndRadii, \
+  HOLE_ICE_MEMORY const floating_t *cylinderScatteringLengths, \
+  HOLE_ICE_MEMORY const floating_t *cylinderAbsorptionLengths, \
+  const HoleIceCylinderGrid_t cylinderGrid, \
+  HOLE_ICE_MEMORY const unsigned int *cylinderGridCellStartIndices, \
+  HOLE_ICE_MEMORY const unsigned int *cylinderGridCylinderIndices
+#define HOLE_ICE_ARGS_TO_CALL \
+  numberOfCylinders, \
+  cylinderPositionsAndRadii, \
+  cylinderScatteringLengths, \
+  cylinderAbsorptionLengths, \
+  cylinderGrid, \
+  cylinderGridCellStartIndices, \
+  cylinderGridCylinderIndices
+
+// A point where the photon path enters or leaves a hole ice cylinder.
+//
+// The crossings are ordered by distance. Crossings at the same
+// distance are ordered by cylinder index, entries before exits.
+//
+typedef struct HoleIceCylinderCrossing {
+  floating_t distance;
+  int index;    // cylinder index, -1 if there is no crossing
+  int is_exit;
+} HoleIceCylinderCrossing_t;
+
+inline void find_next_hole_ice_cylinder_crossing(floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t photonRange, unsigned int numberOfCylinders, HOLE_ICE_MEMORY const floating4_t *cylinderPositionsAndRadii, const HoleIceCylinderGrid_t cylinderGrid, HOLE_ICE_MEMORY const unsigned int *cylinderGridCellStartIndices, HOLE_ICE_MEMORY const unsigned int *cylinderGridCylinderIndices, const HoleIceCylinderCrossing_t previous_crossing, HoleIceCylinderCrossing_t *next_crossing, int *index_of_innermost_cylinder_containing_the_photon);
+
+inline void find_next_hole_ice_cylinder_crossing_in_cell(floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t photonRange, HOLE_ICE_MEMORY const floating4_t *cylinderPositionsAndRadii, HOLE_ICE_MEMORY const unsigned int *cylinderGridCellStartIndices, HOLE_ICE_MEMORY const unsigned int *cylinderGridCylinderIndices, int cell, const HoleIceCylinderCrossing_t previous_crossing, HoleIceCylinderCrossing_t *next_crossing, int *index_of_innermost_cylinder_containing_the_photon);
+
+inline int is_later_hole_ice_cylinder_crossing(floating_t distance, int index, int is_exit, const HoleIceCylinderCrossing_t previous_crossing);
+
+inline void hole_ice_properties_behind_crossing(MEDIUM_ARGS floating4_t photonPosAndTime, floating4_t photonDirAndWlen, HOLE_ICE_MEMORY const floating_t *cylinderScatteringLengths, HOLE_ICE_MEMORY const floating_t *cylinderAbsorptionLengths, const HoleIceCylinderCrossing_t crossing, floating_t *scattering_length, floating_t *absorption_length);
+
+inline int hole_ice_cylinder_grid_cell(floating_t pos, floating_t start, floating_t width, int num);
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef HOLE_ICE_BATCH_C
+#define HOLE_ICE_BATCH_C
+
+#include "hole_ice.h"
+#include "hole_ice_batch.h"
+#include "../intersection/intersection_batch.c"
+
+inline void find_next_hole_ice_cylinder_crossing_batch(PhotonBatch_t photons, floating_batch_t photonRange, unsigned int numberOfCylinders, HOLE_ICE_MEMORY const floating4_t *cylinderPositionsAndRadii, const HoleIceCylinderGrid_t cylinderGrid, HOLE_ICE_MEMORY const unsigned int *cylinderGridCellStartIndices, HOLE_ICE_MEMORY const unsigned int *cylinderGridCylinderIndices, const HoleIceCylinderCrossingBatch_t previous_crossing, HoleIceCylinderCrossingBatch_t *next_crossing, int_batch_t *index_of_innermost_cylinder_containing_the_photon)
+{
+  // See `find_next_hole_ice_cylinder_crossing()`.
+  //
+  // The photons share the loop over the cylinders: The grid cells of
+  // all lanes are scanned, and each cylinder is intersected with all
+  // photons at once. A lane only takes a cylinder into account if it is
+  // in one of the grid cells the scalar function would scan for that
+  // photon. The next crossing and the innermost cylinder do not depend
+  // on the order the cylinders are looked at, so each lane ends up with
+  // the same result as the scalar function.
+  //
+  next_crossing->distance = batch_splat(ZERO);
+  next_crossing->index = int_batch_splat(-1);
+  next_crossing->is_exit = int_batch_splat(0);
+
+  *index_of_innermost_cylinder_containing_the_photon = int_batch_splat(-1);
+
+  if (numberOfCylinders == 0) return;
+
+  const floating_batch_t xy_projection_factor_squared = ONE - photons.dirZ * photons.dirZ;
+  const floating_batch_t xy_projection_factor = batch_sqrt(
+      (xy_projection_factor_squared > ZERO) ? xy_projection_factor_squared : batch_splat(ZERO));
+  const int_batch_t has_xy_projection = xy_projection_factor > ZERO;
+  const floating_batch_t reachX = has_xy_projection ?
+      photons.dirX / xy_projection_factor * (photonRange + cylinderGrid.maxRadius) : batch_splat(ZERO);
+  const floating_batch_t reachY = has_xy_projection ?
+      photons.dirY / xy_projection_factor * (photonRange + cylinderGrid.maxRadius) : batch_splat(ZERO);
+  const floating_t margin = cylinderGrid.maxRadius + (floating_t)0.01;
+
+  const floating_batch_t endX = photons.posX + reachX;
+  const floating_batch_t endY = photons.posY + reachY;
+  const floating_batch_t lowCellX = hole_ice_cylinder_grid_cell_batch(((endX < photons.posX) ? endX : photons.posX) - margin,
+      cylinderGrid.startX, cylinderGrid.widthX, cylinderGrid.numX);
+  const floating_batch_t highCellX = hole_ice_cylinder_grid_cell_batch(((endX > photons.posX) ? endX : photons.posX) + margin,
+      cylinderGrid.startX, cylinderGrid.widthX, cylinderGrid.numX);
+  const floating_batch_t lowCellY = hole_ice_cylinder_grid_cell_batch(((endY < photons.posY) ? endY : photons.posY) - margin,
+      cylinderGrid.startY, cylinderGrid.widthY, cylinderGrid.numY);
+  const floating_batch_t highCellY = hole_ice_cylinder_grid_cell_batch(((endY > photons.posY) ? endY : photons.posY) + margin,
+      cylinderGrid.startY, cylinderGrid.widthY, cylinderGrid.numY);
+
+  // The cells of all lanes.
+  const int firstCellX = (int)batch_reduce_min(lowCellX);
+  const int lastCellX = (int)batch_reduce_max(highCellX);
+  const int firstCellY = (int)batch_reduce_min(lowCellY);
+  const int lastCellY = (int)batch_reduce_max(highCellY);
+
+  for (int cell_y = firstCellY; cell_y <= lastCellY; cell_y++) {
+    const int_batch_t lane_scans_row = (lowCellY <= (floating_t)cell_y) & (highCellY >= (floating_t)cell_y);
+    if (!batch_any(lane_scans_row)) continue;
+
+    for (int cell_x = firstCellX; cell_x <= lastCellX; cell_x++) {
+      const int_batch_t lane_scans_cell = lane_scans_row &
+          (lowCellX <= (floating_t)cell_x) & (highCellX >= (floating_t)cell_x);
+      if (!batch_any(lane_scans_cell)) continue;
+
+      const int cell = cell_y * cylinderGrid.numX + cell_x;
+      for (unsigned int k = cylinderGridCellStartIndices[cell]; k < cylinderGridCellStartIndices[cell + 1]; k++) {
+        const int i = cylinderGridCylinderIndices[k];
+        const floating4_t cylinder = cylinderPositionsAndRadii[i];
+
+        const floating_batch_t dx = photons.posX - cylinder.x;
+        const floating_batch_t dy = photons.posY - cylinder.y;
+        const floating_batch_t range = photonRange + cylinder.w /* radius */;
+        int_batch_t active = lane_scans_cell & ~(dx * dx + dy * dy > range * range);
+
+        // z-range of the cylinder, https://github.com/fiedl/hole-ice-study/issues/34
+        //
+        if (cylinder.z != 0) {
+          const floating_batch_t endZ = photons.posZ + photonRange * photons.dirZ;
+          const int_batch_t below = (photons.posZ < cylinder.z - 0.5) & (endZ < cylinder.z - 0.5);
+          const int_batch_t above = (photons.posZ > cylinder.z + 0.5) & (endZ > cylinder.z + 0.5);
+          active = active & ~(below | above);
+        }
+
+        if (!batch_any(active)) continue;
+
+        IntersectionProblemBatch_t p;
+        p.ax = photons.posX;
+        p.ay = photons.posY;
+        p.mx = batch_splat(cylinder.x);
+        p.my = batch_splat(cylinder.y);
+        p.r = batch_splat(cylinder.w);
+        p.direction_x = photons.dirX;
+        p.direction_y = photons.dirY;
+        p.direction_z = photons.dirZ;
+        p.distance = batch_splat(ONE);
+
+        calculate_intersections_batch(&p);
+
+        active = active & (p.discriminant > ZERO);
+
+        // The photon is already within the hole ice.
+        const int_batch_t inside = active & (p.s1 <= ZERO) & (p.s2 >= ZERO);
+        *index_of_innermost_cylinder_containing_the_photon =
+            (inside & (*index_of_innermost_cylinder_containing_the_photon < i)) ?
+            int_batch_splat(i) : *index_of_innermost_cylinder_containing_the_photon;
+
+        // The photon enters the hole ice on its way.
+        const int_batch_t enters = active & ~inside & (p.s1 > ZERO) &
+            is_later_hole_ice_cylinder_crossing_batch(p.s1, i, 0, previous_crossing) &
+            ((next_crossing->index == -1) | ~is_later_hole_ice_cylinder_crossing_batch(p.s1, i, 0, *next_crossing));
+        next_crossing->distance = enters ? p.s1 : next_crossing->distance;
+        next_crossing->index = enters ? int_batch_splat(i) : next_crossing->index;
+        next_crossing->is_exit = enters ? int_batch_splat(0) : next_crossing->is_exit;
+
+        // The photon leaves the hole ice on its way.
+        const int_batch_t leaves = active & (p.s2 > ZERO) &
+            is_later_hole_ice_cylinder_crossing_batch(p.s2, i, 1, previous_crossing) &
+            ((next_crossing->index == -1) | ~is_later_hole_ice_cylinder_crossing_batch(p.s2, i, 1, *next_crossing));
+        next_crossing->distance = leaves ? p.s2 : next_crossing->distance;
+        next_crossing->index = leaves ? int_batch_splat(i) : next_crossing->index;
+        next_crossing->is_exit = leaves ? int_batch_splat(1) : next_crossing->is_exit;
+      }
+    }
+  }
+}
+
+inline int_batch_t is_later_hole_ice_cylinder_crossing_batch(floating_batch_t distance, int index, int is_exit, const HoleIceCylinderCrossingBatch_t previous_crossing)
+{
+  // See `is_later_hole_ice_cylinder_crossing()`.
+  return (distance != previous_crossing.distance) ? (distance > previous_crossing.distance) :
+      ((previous_crossing.index != index) ? (previous_crossing.index < index) :
+      (previous_crossing.is_exit < is_exit));
+}
+
+inline floating_batch_t hole_ice_cylinder_grid_cell_batch(floating_batch_t pos, floating_t start, floating_t width, int num)
+{
+  // See `hole_ice_cylinder_grid_cell()`. The cells are returned as
+  // integral floating point values.
+  const floating_batch_t cell = (pos - start) / width;
+  const floating_batch_t lowest = batch_splat(ZERO);
+  const floating_batch_t highest = batch_splat((floating_t)(num - 1));
+  return batch_trunc((cell > ZERO) ? ((cell < (floating_t)(num - 1)) ? cell : highest) : lowest);
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef HOLE_ICE_BATCH_H
+#define HOLE_ICE_BATCH_H
+
+#include "../batch/batch.h"
+
+// `HoleIceCylinderCrossing_t` for a batch of photons.
+// See `batch/batch.h`.
+//
+typedef struct HoleIceCylinderCrossingBatch {
+  floating_batch_t distance;
+  int_batch_t index;    // cylinder index, -1 if there is no crossing
+  int_batch_t is_exit;  // 0 or 1, like `HoleIceCylinderCrossing_t::is_exit`
+} HoleIceCylinderCrossingBatch_t;
+
+inline void find_next_hole_ice_cylinder_crossing_batch(PhotonBatch_t photons, floating_batch_t photonRange, unsigned int numberOfCylinders, HOLE_ICE_MEMORY const floating4_t *cylinderPositionsAndRadii, const HoleIceCylinderGrid_t cylinderGrid, HOLE_ICE_MEMORY const unsigned int *cylinderGridCellStartIndices, HOLE_ICE_MEMORY const unsigned int *cylinderGridCylinderIndices, const HoleIceCylinderCrossingBatch_t previous_crossing, HoleIceCylinderCrossingBatch_t *next_crossing, int_batch_t *index_of_innermost_cylinder_containing_the_photon);
+
+inline int_batch_t is_later_hole_ice_cylinder_crossing_batch(floating_batch_t distance, int index, int is_exit, const HoleIceCylinderCrossingBatch_t previous_crossing);
+
+inline floating_batch_t hole_ice_cylinder_grid_cell_batch(floating_batch_t pos, floating_t start, floating_t width, int num);
+
+#endif
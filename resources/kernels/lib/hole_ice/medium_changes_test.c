@@ -0,0 +1,633 @@
+// #include <stdio.h>
+// #define PRINTF_ENABLED
+
+#define HOLE_ICE
+#include "medium_changes_test.h"
+#include "../propagation_through_media/propagation_through_media.c"
+#include "gtest/gtest.h"
+#include "math.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+inline floating_t my_sqrt(floating_t a) {return sqrt(a);}
+inline floating_t sqr(floating_t a) {return a * a;}
+inline floating_t my_nan() { return NAN; }
+inline bool my_is_nan(floating_t a) { return (a != a); }
+inline floating_t min(floating_t a, floating_t b) { return fmin(a, b); }
+inline floating_t max(floating_t a, floating_t b) { return fmax(a, b); }
+inline floating_t dot(floating4_t a, floating4_t b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+inline floating_t my_divide(floating_t a, floating_t b) { return a / b; }
+inline floating_t my_fabs(floating_t a) { return fabs(a); }
+
+inline int findLayerForGivenZPos(floating_t posZ)
+{
+  return (int)((posZ - MEDIUM_LAYER_BOTTOM_POS) / MEDIUM_LAYER_THICKNESS);
+}
+inline floating_t mediumLayerBoundary(int layer)
+{
+  return layer * MEDIUM_LAYER_THICKNESS + MEDIUM_LAYER_BOTTOM_POS;
+}
+inline floating_t getScatteringLength(unsigned int layer, floating_t /* wlen */)
+{
+  return 20.0 + layer;
+}
+inline floating_t getAbsorptionLength(unsigned int layer, floating_t /* wlen */)
+{
+  return 100.0 + layer;
+}
+
+float mediumScatteringOpticalDepth[MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS * (MEDIUM_LAYERS + 1)];
+float mediumAbsorptionOpticalDepth[MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS * (MEDIUM_LAYERS + 1)];
+
+// Fill the optical depth tables like
+// `I3CLSimHelper::GenerateMediumPropertiesSource` does.
+//
+void fill_optical_depth_tables()
+{
+  for (int bin = 0; bin < MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS; bin++) {
+    const floating_t wlen = MEDIUM_MIN_WLEN + (MEDIUM_MAX_WLEN - MEDIUM_MIN_WLEN) * bin / (MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS - 1);
+    floating_t scattering_depth = 0.0;
+    floating_t absorption_depth = 0.0;
+    mediumScatteringOpticalDepth[bin * (MEDIUM_LAYERS + 1)] = 0.0;
+    mediumAbsorptionOpticalDepth[bin * (MEDIUM_LAYERS + 1)] = 0.0;
+    for (int layer = 0; layer < MEDIUM_LAYERS; layer++) {
+      scattering_depth += MEDIUM_LAYER_THICKNESS / getScatteringLength(layer, wlen);
+      absorption_depth += MEDIUM_LAYER_THICKNESS / getAbsorptionLength(layer, wlen);
+      mediumScatteringOpticalDepth[bin * (MEDIUM_LAYERS + 1) + layer + 1] = scattering_depth;
+      mediumAbsorptionOpticalDepth[bin * (MEDIUM_LAYERS + 1) + layer + 1] = absorption_depth;
+    }
+  }
+}
+
+const int max_cylinders = 64;
+floating_t cylinderScatteringLengths[max_cylinders] = {0.5, 0.1};
+floating_t cylinderAbsorptionLengths[max_cylinders] = {50.0, 10.0};
+
+const int max_grid_cells = 256;
+
+// A hole ice cylinder grid as generated on the host by
+// `I3CLSimHelper::GenerateHoleIceCylinderGrid`.
+//
+struct CylinderGrid {
+  HoleIceCylinderGrid_t parameters;
+  unsigned int cell_start_indices[max_grid_cells + 1];
+  unsigned int cylinder_indices[max_cylinders];
+};
+
+CylinderGrid generate_cylinder_grid(unsigned int numberOfCylinders, const floating4_t *cylinderPositionsAndRadii, int numX, int numY)
+{
+  CylinderGrid g;
+  floating_t min_x = 0.0, max_x = 0.0, min_y = 0.0, max_y = 0.0;
+  g.parameters.maxRadius = 0.0;
+  for (unsigned int i = 0; i < numberOfCylinders; i++) {
+    if (i == 0 || cylinderPositionsAndRadii[i].x < min_x) min_x = cylinderPositionsAndRadii[i].x;
+    if (i == 0 || cylinderPositionsAndRadii[i].x > max_x) max_x = cylinderPositionsAndRadii[i].x;
+    if (i == 0 || cylinderPositionsAndRadii[i].y < min_y) min_y = cylinderPositionsAndRadii[i].y;
+    if (i == 0 || cylinderPositionsAndRadii[i].y > max_y) max_y = cylinderPositionsAndRadii[i].y;
+    g.parameters.maxRadius = fmax(g.parameters.maxRadius, cylinderPositionsAndRadii[i].w);
+  }
+  g.parameters.numX = numX;
+  g.parameters.numY = numY;
+  g.parameters.startX = min_x;
+  g.parameters.startY = min_y;
+  g.parameters.widthX = fmax(max_x - min_x, 1.0) / numX;
+  g.parameters.widthY = fmax(max_y - min_y, 1.0) / numY;
+
+  unsigned int k = 0;
+  for (int cell = 0; cell < numX * numY; cell++) {
+    g.cell_start_indices[cell] = k;
+    for (unsigned int i = 0; i < numberOfCylinders; i++) {
+      const int cell_x = hole_ice_cylinder_grid_cell(cylinderPositionsAndRadii[i].x, g.parameters.startX, g.parameters.widthX, numX);
+      const int cell_y = hole_ice_cylinder_grid_cell(cylinderPositionsAndRadii[i].y, g.parameters.startY, g.parameters.widthY, numY);
+      if (cell_y * numX + cell_x == cell) {
+        g.cylinder_indices[k] = i;
+        k += 1;
+      }
+    }
+  }
+  g.cell_start_indices[numX * numY] = k;
+  return g;
+}
+
+struct PropagationResult {
+  floating_t sca_step_left;
+  floating_t abs_lens_left;
+  floating_t distancePropagated;
+  floating_t distanceToAbsorption;
+};
+
+PropagationResult propagate(floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t sca_step_left, floating_t abs_lens_left, unsigned int numberOfCylinders, const floating4_t *cylinderPositionsAndRadii, const CylinderGrid &grid)
+{
+  PropagationResult r = {sca_step_left, abs_lens_left, 0.0, 0.0};
+  apply_propagation_through_different_media(photonPosAndTime, photonDirAndWlen,
+      numberOfCylinders, cylinderPositionsAndRadii,
+      cylinderScatteringLengths, cylinderAbsorptionLengths,
+      grid.parameters, grid.cell_start_indices, grid.cylinder_indices,
+      &r.sca_step_left, &r.abs_lens_left, &r.distancePropagated, &r.distanceToAbsorption);
+  return r;
+}
+
+PropagationResult propagate_with_optical_depth_table(floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t sca_step_left, floating_t abs_lens_left, unsigned int numberOfCylinders, const floating4_t *cylinderPositionsAndRadii, const CylinderGrid &grid)
+{
+  PropagationResult r = {sca_step_left, abs_lens_left, 0.0, 0.0};
+  apply_propagation_through_different_media_with_optical_depth_table(photonPosAndTime, photonDirAndWlen,
+      numberOfCylinders, cylinderPositionsAndRadii,
+      cylinderScatteringLengths, cylinderAbsorptionLengths,
+      grid.parameters, grid.cell_start_indices, grid.cylinder_indices,
+      &r.sca_step_left, &r.abs_lens_left, &r.distancePropagated, &r.distanceToAbsorption);
+  return r;
+}
+
+// The exact distance after which a photon in the layered ice has passed
+// `depth` scattering lengths, going through the layers one by one
+// without any range limit.
+//
+floating_t exact_scattering_distance(floating_t z, floating_t dz, floating_t depth)
+{
+  floating_t distance = 0.0;
+  while (true) {
+    const int layer = photon_layer(z);
+    const floating_t length = getScatteringLength(layer, 400e-9);
+
+    floating_t distance_to_boundary = INFINITY;
+    if ((dz > 0) && (layer < MEDIUM_LAYERS - 1)) {
+      distance_to_boundary = (mediumLayerBoundary(layer + 1) - z) / dz;
+    } else if ((dz < 0) && (layer > 0)) {
+      distance_to_boundary = (mediumLayerBoundary(layer) - z) / dz;
+    }
+    if (depth * length <= distance_to_boundary) return distance + depth * length;
+
+    depth -= distance_to_boundary / length;
+    distance += distance_to_boundary;
+    z += distance_to_boundary * dz + ((dz > 0) ? 1e-9 : -1e-9);
+  }
+}
+
+floating_t tolerance(floating_t distance)
+{
+  // The tables are stored in single precision.
+  return 1e-4 * fmax(1.0, fabs(distance));
+}
+
+// This is how the medium changes have been handled before they were
+// produced lazily: Collect all ice layer boundaries and all cylinder
+// crossings in arrays, sort them and walk through them.
+// It serves as reference.
+//
+struct MediumChange {
+  floating_t distance;
+  floating_t scattering_length;
+  floating_t absorption_length;
+};
+
+bool is_closer(const MediumChange &a, const MediumChange &b)
+{
+  return a.distance < b.distance;
+}
+
+PropagationResult reference_propagate(floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t sca_step_left, floating_t abs_lens_left, unsigned int numberOfCylinders, const floating4_t *cylinderPositionsAndRadii)
+{
+  PropagationResult r = {sca_step_left, abs_lens_left, 0.0, 0.0};
+  const floating_t wlen = photonDirAndWlen.w;
+
+  MediumChange current = {0.0,
+      getScatteringLength(photon_layer(photonPosAndTime.z), wlen),
+      getAbsorptionLength(photon_layer(photonPosAndTime.z), wlen)};
+  const floating_t photonRange = sca_step_left * current.scattering_length;
+
+  // ice layers
+  std::vector<MediumChange> changes;
+  floating_t z_of_closest_ice_layer_boundary = mediumLayerBoundary(photon_layer(photonPosAndTime.z));
+  if (photonDirAndWlen.z > 0) z_of_closest_ice_layer_boundary += MEDIUM_LAYER_THICKNESS;
+  floating_t distance = (z_of_closest_ice_layer_boundary - photonPosAndTime.z) / photonDirAndWlen.z;
+  int layer = photon_layer(z_of_closest_ice_layer_boundary + photonDirAndWlen.z);
+  MediumChange first = {distance, getScatteringLength(layer, wlen), getAbsorptionLength(layer, wlen)};
+  changes.push_back(first);
+  const floating_t spacing = MEDIUM_LAYER_THICKNESS / fabs(photonDirAndWlen.z);
+  while (distance + spacing < photonRange) {
+    distance += spacing;
+    layer = photon_layer(photonPosAndTime.z + (distance + 0.01) * photonDirAndWlen.z);
+    MediumChange c = {distance, getScatteringLength(layer, wlen), getAbsorptionLength(layer, wlen)};
+    changes.push_back(c);
+  }
+
+  // Boundaries behind the photon are skipped.
+  std::vector<MediumChange> ahead;
+  for (size_t k = 0; k < changes.size(); k++) {
+    if (changes[k].distance >= 0) ahead.push_back(changes[k]);
+  }
+  changes = ahead;
+
+  // hole ice cylinders, without grid
+  int innermost = -1;
+  for (unsigned int i = 0; i < numberOfCylinders; i++) {
+    const floating4_t c = cylinderPositionsAndRadii[i];
+    if (sqr(photonPosAndTime.x - c.x) + sqr(photonPosAndTime.y - c.y) > sqr(photonRange + c.w)) continue;
+    const floating_t z_end = photonPosAndTime.z + photonRange * photonDirAndWlen.z;
+    if ((c.z != 0) && (((photonPosAndTime.z < c.z - 0.5) && (z_end < c.z - 0.5)) ||
+                       ((photonPosAndTime.z > c.z + 0.5) && (z_end > c.z + 0.5)))) continue;
+
+    IntersectionProblemParameters_t p = {photonPosAndTime.x, photonPosAndTime.y, c.x, c.y, c.w,
+        photonDirAndWlen, 1.0, 0, 0, 0};
+    calculate_intersections(&p);
+    if (p.discriminant <= 0) continue;
+
+    if ((p.s1 <= 0) && (p.s2 >= 0)) {
+      innermost = std::max(innermost, (int)i);
+    } else if (p.s1 > 0) {
+      MediumChange entry = {p.s1, cylinderScatteringLengths[i], cylinderAbsorptionLengths[i]};
+      changes.push_back(entry);
+    }
+    if (p.s2 > 0) {
+      MediumChange exit = {p.s2, 0.0, 0.0};
+      if (i == 0) {
+        const int l = photon_layer(photonPosAndTime.z + photonDirAndWlen.z * p.s2);
+        exit.scattering_length = getScatteringLength(l, wlen);
+        exit.absorption_length = getAbsorptionLength(l, wlen);
+      } else {
+        exit.scattering_length = cylinderScatteringLengths[i - 1];
+        exit.absorption_length = cylinderAbsorptionLengths[i - 1];
+      }
+      changes.push_back(exit);
+    }
+  }
+  if (innermost != -1) {
+    current.scattering_length = cylinderScatteringLengths[innermost];
+    current.absorption_length = cylinderAbsorptionLengths[innermost];
+  }
+
+  std::stable_sort(changes.begin(), changes.end(), is_closer);
+  changes.insert(changes.begin(), current);
+
+  const int n = changes.size() - 1;
+  for (int j = 0; (j < n) && (r.sca_step_left > 0); j++) {
+    floating_t max_distance = changes[j + 1].distance - changes[j].distance;
+    if (r.sca_step_left * changes[j].scattering_length > max_distance) {
+      r.sca_step_left -= max_distance / changes[j].scattering_length;
+      r.distancePropagated += max_distance;
+    } else {
+      max_distance = r.sca_step_left * changes[j].scattering_length;
+      r.distancePropagated += max_distance;
+      r.sca_step_left = 0;
+    }
+    if (r.abs_lens_left * changes[j].absorption_length > max_distance) {
+      r.abs_lens_left -= max_distance / changes[j].absorption_length;
+      r.distanceToAbsorption += max_distance;
+    } else {
+      r.distanceToAbsorption += r.abs_lens_left * changes[j].absorption_length;
+      r.abs_lens_left = 0;
+    }
+  }
+  if (r.sca_step_left > 0) {
+    r.distancePropagated += r.sca_step_left * changes[n].scattering_length;
+    r.distanceToAbsorption += r.abs_lens_left * changes[n].absorption_length;
+    r.abs_lens_left -= r.distancePropagated / changes[n].absorption_length;
+  }
+  if (r.distanceToAbsorption < r.distancePropagated) {
+    r.distancePropagated = r.distanceToAbsorption;
+    r.distanceToAbsorption = 0;
+    r.abs_lens_left = 0;
+  }
+  return r;
+}
+
+void expect_same_result(PropagationResult expected, PropagationResult actual)
+{
+  EXPECT_DOUBLE_EQ(expected.sca_step_left, actual.sca_step_left);
+  EXPECT_DOUBLE_EQ(expected.abs_lens_left, actual.abs_lens_left);
+  EXPECT_DOUBLE_EQ(expected.distancePropagated, actual.distancePropagated);
+  EXPECT_DOUBLE_EQ(expected.distanceToAbsorption, actual.distanceToAbsorption);
+}
+
+floating_t random_between(floating_t a, floating_t b)
+{
+  return a + (floating_t)rand() / RAND_MAX * (b - a);
+}
+
+floating4_t random_direction()
+{
+  const floating_t cos_theta = random_between(-1.0, 1.0);
+  const floating_t sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+  const floating_t phi = random_between(0.0, 2.0 * M_PI);
+  const floating4_t photonDirAndWlen = {sin_theta * cos(phi), sin_theta * sin(phi), cos_theta, 400e-9};
+  return photonDirAndWlen;
+}
+
+// Pairs of nested cylinders: cylinder `i + 1` is within cylinder `i`.
+unsigned int random_nested_cylinders(floating4_t *cylinderPositionsAndRadii)
+{
+  const unsigned int numberOfCylinders = 2 * (1 + rand() % (max_cylinders / 2));
+  for (unsigned int i = 0; i < numberOfCylinders; i += 2) {
+    const floating_t x = random_between(-40.0, 40.0);
+    const floating_t y = random_between(-40.0, 40.0);
+    const floating_t z = (rand() % 4 == 0) ? random_between(-20.0, 20.0) : 0.0;
+    const floating_t r = random_between(0.1, 3.1);
+    const floating4_t outer = {x, y, z, r};
+    const floating4_t inner = {x, y, z, 0.3 * r};
+    cylinderPositionsAndRadii[i] = outer;
+    cylinderPositionsAndRadii[i + 1] = inner;
+  }
+  return numberOfCylinders;
+}
+
+class MediumBoundariesTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    for (int i = 0; i < max_cylinders; i++) {
+      cylinderScatteringLengths[i] = 0.01 * (i + 1);
+      cylinderAbsorptionLengths[i] = 1.0 * (i + 1);
+    }
+  }
+};
+
+namespace {
+
+  TEST_F(MediumBoundariesTest, MatchesReferenceWithoutCylinders) {
+    srand(42);
+    const CylinderGrid grid = generate_cylinder_grid(0, NULL, 1, 1);
+    for (int trial = 0; trial < 2000; trial++) {
+      const floating4_t photonPosAndTime = {0.0, 0.0, random_between(-49.0, 49.0), 0.0};
+      const floating4_t photonDirAndWlen = random_direction();
+      const floating_t sca_step_left = random_between(0.01, 5.0);
+      const floating_t abs_lens_left = random_between(0.01, 3.0);
+
+      expect_same_result(
+          reference_propagate(photonPosAndTime, photonDirAndWlen, sca_step_left, abs_lens_left, 0, NULL),
+          propagate(photonPosAndTime, photonDirAndWlen, sca_step_left, abs_lens_left, 0, NULL, grid));
+    }
+  }
+
+  TEST_F(MediumBoundariesTest, MatchesReferenceWithNestedCylinders) {
+    srand(7);
+    for (int trial = 0; trial < 2000; trial++) {
+      floating4_t cylinderPositionsAndRadii[max_cylinders];
+      const unsigned int numberOfCylinders = random_nested_cylinders(cylinderPositionsAndRadii);
+
+      // Start some photons right next to a cylinder in order to
+      // cover photons starting within the hole ice.
+      floating4_t photonPosAndTime = {random_between(-50.0, 50.0), random_between(-50.0, 50.0), random_between(-49.0, 49.0), 0.0};
+      if (trial % 3 == 0) {
+        photonPosAndTime.x = cylinderPositionsAndRadii[0].x + 0.1;
+        photonPosAndTime.y = cylinderPositionsAndRadii[0].y - 0.05;
+      }
+      const floating4_t photonDirAndWlen = random_direction();
+      const floating_t sca_step_left = random_between(0.01, 3.0);
+      const floating_t abs_lens_left = random_between(0.01, 3.0);
+
+      expect_same_result(
+          reference_propagate(photonPosAndTime, photonDirAndWlen, sca_step_left, abs_lens_left,
+              numberOfCylinders, cylinderPositionsAndRadii),
+          propagate(photonPosAndTime, photonDirAndWlen, sca_step_left, abs_lens_left,
+              numberOfCylinders, cylinderPositionsAndRadii,
+              generate_cylinder_grid(numberOfCylinders, cylinderPositionsAndRadii, 1 + rand() % 16, 1 + rand() % 16)));
+    }
+  }
+
+  TEST_F(MediumBoundariesTest, CrossesMoreBoundariesThanThereAreLayers) {
+    // With ten layers of ten meters, a long path crosses more medium
+    // boundaries than there are layers. This used to overflow the arrays
+    // of size MEDIUM_LAYERS.
+    const floating4_t cylinderPositionsAndRadii[] = {
+      {0.0, 2.0, 0.0, 1.0},
+      {0.0, 2.0, 0.0, 0.5},
+      {0.0, 6.0, 0.0, 1.0},
+      {0.0, 6.0, 0.0, 0.5}
+    };
+    const floating4_t photonPosAndTime = {0.0, 0.0, -49.0, 0.0};
+    const floating4_t photonDirAndWlen = {0.0, 0.1, 0.994987, 400e-9};
+
+    expect_same_result(
+        reference_propagate(photonPosAndTime, photonDirAndWlen, 20.0, 20.0, 4, cylinderPositionsAndRadii),
+        propagate(photonPosAndTime, photonDirAndWlen, 20.0, 20.0, 4, cylinderPositionsAndRadii,
+            generate_cylinder_grid(4, cylinderPositionsAndRadii, 2, 2)));
+  }
+
+  TEST_F(MediumBoundariesTest, SkipsBoundariesBehindThePhoton) {
+    // Below the layered region, the closest layer boundary is behind
+    // a downgoing photon.
+    const floating4_t photonPosAndTime = {0.0, 0.0, -70.0, 0.0};
+    const floating4_t photonDirAndWlen = {0.0, 0.6, -0.8, 400e-9};
+
+    PropagationResult r = propagate(photonPosAndTime, photonDirAndWlen, 1.5, 10.0, 0, NULL,
+        generate_cylinder_grid(0, NULL, 1, 1));
+    EXPECT_DOUBLE_EQ(1.5 * getScatteringLength(0, 400e-9), r.distancePropagated);
+  }
+
+  TEST_F(MediumBoundariesTest, UsesInnermostCylinderContainingThePhoton) {
+    const floating4_t cylinderPositionsAndRadii[] = {
+      {-30.0, -30.0, 0.0, 1.0},
+      {10.0, 0.0, 0.0, 2.0},
+      {10.0, 0.0, 0.0, 0.5},
+      {30.0, 30.0, 0.0, 1.0}
+    };
+    const floating4_t photonPosAndTime = {10.1, 0.1, 1.0, 0.0};
+    const floating4_t photonDirAndWlen = {0.0, 0.05, 0.99875, 400e-9};
+
+    // The photon scatters before leaving the inner cylinder.
+    PropagationResult r = propagate(photonPosAndTime, photonDirAndWlen, 1.0, 10.0, 4, cylinderPositionsAndRadii,
+        generate_cylinder_grid(4, cylinderPositionsAndRadii, 8, 8));
+    EXPECT_DOUBLE_EQ(cylinderScatteringLengths[2], r.distancePropagated);
+  }
+
+  TEST_F(MediumBoundariesTest, FineGridFindsTheSameCylindersAsASingleCell) {
+    srand(11);
+    for (int trial = 0; trial < 2000; trial++) {
+      floating4_t cylinderPositionsAndRadii[max_cylinders];
+      const unsigned int numberOfCylinders = random_nested_cylinders(cylinderPositionsAndRadii);
+
+      const floating4_t photonPosAndTime = {random_between(-50.0, 50.0), random_between(-50.0, 50.0), random_between(-60.0, 60.0), 0.0};
+      const floating4_t photonDirAndWlen = random_direction();
+      const floating_t sca_step_left = random_between(0.01, 3.0);
+      const floating_t abs_lens_left = random_between(0.01, 3.0);
+
+      expect_same_result(
+          propagate(photonPosAndTime, photonDirAndWlen, sca_step_left, abs_lens_left,
+              numberOfCylinders, cylinderPositionsAndRadii,
+              generate_cylinder_grid(numberOfCylinders, cylinderPositionsAndRadii, 1, 1)),
+          propagate(photonPosAndTime, photonDirAndWlen, sca_step_left, abs_lens_left,
+              numberOfCylinders, cylinderPositionsAndRadii,
+              generate_cylinder_grid(numberOfCylinders, cylinderPositionsAndRadii, 1 + rand() % 16, 1 + rand() % 16)));
+    }
+  }
+
+  TEST_F(MediumBoundariesTest, GridWalkFindsEveryCrossingOfALongPath) {
+    // A lattice of nested cylinders. Nearly horizontal photons with a
+    // long range cross many of them, such that the grid cells are walked
+    // from crossing to crossing.
+    floating4_t cylinderPositionsAndRadii[max_cylinders];
+    const unsigned int numberOfCylinders = max_cylinders;
+    for (unsigned int i = 0; i < numberOfCylinders; i += 2) {
+      const floating4_t outer = {4.0 * ((i / 2) % 6), 4.0 * ((i / 2) / 6), 0.0, 1.5};
+      const floating4_t inner = {outer.x, outer.y, 0.0, 0.5};
+      cylinderPositionsAndRadii[i] = outer;
+      cylinderPositionsAndRadii[i + 1] = inner;
+    }
+    const CylinderGrid single_cell = generate_cylinder_grid(numberOfCylinders, cylinderPositionsAndRadii, 1, 1);
+
+    srand(13);
+    for (int trial = 0; trial < 500; trial++) {
+      const CylinderGrid grid = generate_cylinder_grid(numberOfCylinders, cylinderPositionsAndRadii, 1 + rand() % 16, 1 + rand() % 16);
+      const floating4_t photonPosAndTime = {random_between(-5.0, 25.0), random_between(-5.0, 25.0), 0.0, 0.0};
+      const floating_t cos_theta = random_between(-0.2, 0.2);
+      const floating_t phi = random_between(0.0, 2.0 * M_PI);
+      const floating4_t photonDirAndWlen = {sqrt(1.0 - sqr(cos_theta)) * cos(phi), sqrt(1.0 - sqr(cos_theta)) * sin(phi), cos_theta, 400e-9};
+      const floating_t photonRange = random_between(1.0, 60.0);
+
+      HoleIceCylinderCrossing_t expected = {ZERO, (int)numberOfCylinders, 1};
+      HoleIceCylinderCrossing_t actual = expected;
+      for (int crossing = 0; crossing <= 2 * max_cylinders; crossing++) {
+        int expected_innermost, actual_innermost;
+        find_next_hole_ice_cylinder_crossing(photonPosAndTime, photonDirAndWlen, photonRange,
+            numberOfCylinders, cylinderPositionsAndRadii, single_cell.parameters,
+            single_cell.cell_start_indices, single_cell.cylinder_indices,
+            expected, &expected, &expected_innermost);
+        find_next_hole_ice_cylinder_crossing(photonPosAndTime, photonDirAndWlen, photonRange,
+            numberOfCylinders, cylinderPositionsAndRadii, grid.parameters,
+            grid.cell_start_indices, grid.cylinder_indices,
+            actual, &actual, &actual_innermost);
+
+        ASSERT_EQ(expected.index, actual.index);
+        EXPECT_EQ(expected.is_exit, actual.is_exit);
+        EXPECT_DOUBLE_EQ(expected.distance, actual.distance);
+        EXPECT_EQ(expected_innermost, actual_innermost);
+        if (expected.index == -1) break;
+      }
+    }
+  }
+
+  class OpticalDepthTableTest : public MediumBoundariesTest {
+   protected:
+    virtual void SetUp() {
+      MediumBoundariesTest::SetUp();
+      fill_optical_depth_tables();
+    }
+  };
+
+  TEST_F(OpticalDepthTableTest, InterpolatesBetweenWavelengthRows) {
+    OpticalDepthTableWavelength_t wlen = optical_depth_table_wavelength(350e-9);
+    EXPECT_EQ(0, wlen.bin);
+    EXPECT_NEAR(0.5, wlen.weight, 1e-9);
+
+    wlen = optical_depth_table_wavelength(MEDIUM_MAX_WLEN);
+    EXPECT_EQ(MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS - 2, wlen.bin);
+    EXPECT_NEAR(1.0, wlen.weight, 1e-9);
+
+    wlen = optical_depth_table_wavelength(100e-9);
+    EXPECT_EQ(0, wlen.bin);
+    EXPECT_NEAR(0.0, wlen.weight, 1e-9);
+  }
+
+  TEST_F(OpticalDepthTableTest, InverseLookupMatchesExactLayerWalk) {
+    srand(3);
+    const OpticalDepthTableWavelength_t wlen = optical_depth_table_wavelength(400e-9);
+    for (int trial = 0; trial < 10000; trial++) {
+      const floating_t z = random_between(-70.0, 70.0);
+      const floating_t dz = random_between(-1.0, 1.0);
+      const floating_t depth = random_between(0.01, 5.0);
+
+      const floating_t expected = exact_scattering_distance(z, dz, depth);
+      const floating_t distance = distance_for_optical_depth_on_photon_path(mediumScatteringOpticalDepth, wlen, z, dz, depth);
+      EXPECT_NEAR(expected, distance, tolerance(expected));
+      EXPECT_NEAR(depth, optical_depth_on_photon_path(mediumScatteringOpticalDepth, wlen, z, dz, distance), 1e-4);
+    }
+  }
+
+  TEST_F(OpticalDepthTableTest, HandlesHorizontalPhotons) {
+    const OpticalDepthTableWavelength_t wlen = optical_depth_table_wavelength(400e-9);
+    EXPECT_NEAR(2.0 * getScatteringLength(3, 400e-9),
+        distance_for_optical_depth_on_photon_path(mediumScatteringOpticalDepth, wlen, -15.0, 0.0, 2.0), 1e-4);
+    EXPECT_NEAR(2.0,
+        optical_depth_on_photon_path(mediumScatteringOpticalDepth, wlen, -15.0, 0.0, 2.0 * getScatteringLength(3, 400e-9)), 1e-6);
+  }
+
+  TEST_F(OpticalDepthTableTest, MatchesLayerWalkForDowngoingPhotons) {
+    // The layer walk only looks at boundaries within the range estimated
+    // from the scattering length at the photon position. Going down, the
+    // scattering lengths of this ice model get shorter, such that the
+    // walk sees all boundaries the photon crosses.
+    //
+    srand(5);
+    const CylinderGrid grid = generate_cylinder_grid(0, NULL, 1, 1);
+    for (int trial = 0; trial < 2000; trial++) {
+      const floating4_t photonPosAndTime = {0.0, 0.0, random_between(-49.0, 49.0), 0.0};
+      floating4_t photonDirAndWlen = random_direction();
+      photonDirAndWlen.z = -fabs(photonDirAndWlen.z);
+      const floating_t sca_step_left = random_between(0.01, 3.0);
+      const floating_t abs_lens_left = random_between(0.01, 3.0);
+
+      const PropagationResult walk = propagate(photonPosAndTime, photonDirAndWlen, sca_step_left, abs_lens_left, 0, NULL, grid);
+      const PropagationResult table = propagate_with_optical_depth_table(photonPosAndTime, photonDirAndWlen, sca_step_left, abs_lens_left, 0, NULL, grid);
+
+      EXPECT_NEAR(walk.distancePropagated, table.distancePropagated, tolerance(walk.distancePropagated));
+      EXPECT_EQ(walk.abs_lens_left == 0.0, table.abs_lens_left == 0.0);
+    }
+  }
+
+  TEST_F(OpticalDepthTableTest, MatchesLayerWalkWhenPassingThroughCylinders) {
+    const floating4_t cylinderPositionsAndRadii[] = {
+      {5.0, 0.0, 0.0, 1.0},
+      {5.0, 0.0, 0.0, 0.3},
+      {9.0, 0.2, 0.0, 1.0}
+    };
+    const CylinderGrid grid = generate_cylinder_grid(3, cylinderPositionsAndRadii, 2, 2);
+    const floating4_t photonPosAndTime = {0.0, 0.0, -15.0, 0.0};
+    const floating4_t photonDirAndWlen = {0.99995, 0.0, -0.01, 400e-9};
+
+    // Long enough for the photons to leave the cylinders again.
+    cylinderScatteringLengths[0] = 10.0;
+    cylinderScatteringLengths[1] = 5.0;
+    cylinderScatteringLengths[2] = 8.0;
+
+    for (int i = 1; i < 100; i++) {
+      const floating_t sca_step_left = 0.01 * i;
+      const floating_t abs_lens_left = (i % 2) ? 10.0 : 0.05;
+
+      const PropagationResult walk = propagate(photonPosAndTime, photonDirAndWlen, sca_step_left, abs_lens_left, 3, cylinderPositionsAndRadii, grid);
+      const PropagationResult table = propagate_with_optical_depth_table(photonPosAndTime, photonDirAndWlen, sca_step_left, abs_lens_left, 3, cylinderPositionsAndRadii, grid);
+
+      EXPECT_NEAR(walk.distancePropagated, table.distancePropagated, tolerance(walk.distancePropagated));
+      EXPECT_EQ(walk.abs_lens_left == 0.0, table.abs_lens_left == 0.0);
+    }
+  }
+
+  TEST_F(OpticalDepthTableTest, StaysInCylinderWhenCrossingAnIceLayerBoundary) {
+    // The layer walk switches to the layer properties at each layer
+    // boundary, even within a cylinder. With the tables, the layers
+    // only matter outside of the cylinders.
+    //
+    const floating4_t cylinderPositionsAndRadii[] = {{0.0, 0.0, 0.0, 1.0}};
+    const floating4_t photonPosAndTime = {0.0, 0.0, -9.9, 0.0};
+    const floating4_t photonDirAndWlen = {0.0, 0.05, -0.99875, 400e-9};
+
+    const PropagationResult r = propagate_with_optical_depth_table(photonPosAndTime, photonDirAndWlen, 1.0, 10.0, 1, cylinderPositionsAndRadii,
+        generate_cylinder_grid(1, cylinderPositionsAndRadii, 1, 1));
+    EXPECT_NEAR(cylinderScatteringLengths[0], r.distancePropagated, 1e-9);
+  }
+
+  TEST_F(OpticalDepthTableTest, SpendsAbsorptionLengthsOnThePathToTheScatteringPoint) {
+    const floating4_t photonPosAndTime = {0.0, 0.0, -15.0, 0.0};
+    const floating4_t photonDirAndWlen = {0.6, 0.0, 0.8, 400e-9};
+
+    const PropagationResult r = propagate_with_optical_depth_table(photonPosAndTime, photonDirAndWlen, 1.5, 10.0, 0, NULL,
+        generate_cylinder_grid(0, NULL, 1, 1));
+
+    const floating_t distance = exact_scattering_distance(photonPosAndTime.z, photonDirAndWlen.z, 1.5);
+    EXPECT_NEAR(distance, r.distancePropagated, tolerance(distance));
+    EXPECT_DOUBLE_EQ(0.0, r.sca_step_left);
+
+    // The absorption lengths grow by one meter per layer, like the
+    // scattering lengths.
+    floating_t absorption_depth = 0.0;
+    const int steps = 100000;
+    for (int i = 0; i < steps; i++) {
+      const floating_t z = photonPosAndTime.z + (i + 0.5) * distance / steps * photonDirAndWlen.z;
+      absorption_depth += distance / steps / getAbsorptionLength(photon_layer(z), 400e-9);
+    }
+    EXPECT_NEAR(10.0 - absorption_depth, r.abs_lens_left, 1e-5);
+  }
+
+}
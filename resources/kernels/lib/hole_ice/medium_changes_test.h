@@ -0,0 +1,48 @@
+#ifndef MEDIUM_CHANGES_TEST_H
+#define MEDIUM_CHANGES_TEST_H
+
+typedef double floating_t;
+
+struct floating4_t {
+  floating_t x;
+  floating_t y;
+  floating_t z;
+  floating_t w;
+};
+
+// On the host, there are no separate address spaces.
+#define __constant const
+#define HOLE_ICE_MEMORY
+
+#define ZERO 0.0
+#define ONE 1.0
+
+// A simple layered ice model: 10 layers of 10 meters each.
+#define MEDIUM_LAYERS 10
+#define MEDIUM_LAYER_THICKNESS 10.0
+#define MEDIUM_LAYER_BOTTOM_POS -50.0
+
+// Cumulative optical depth tables, filled by the tests.
+#define MEDIUM_MIN_WLEN 300e-9
+#define MEDIUM_MAX_WLEN 600e-9
+#define MEDIUM_OPTICAL_DEPTH_TABLE
+#define MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS 4
+extern float mediumScatteringOpticalDepth[MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS * (MEDIUM_LAYERS + 1)];
+extern float mediumAbsorptionOpticalDepth[MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS * (MEDIUM_LAYERS + 1)];
+
+extern inline floating_t my_sqrt(floating_t);
+extern inline floating_t sqr(floating_t);
+extern inline floating_t my_nan();
+extern inline bool my_is_nan(floating_t);
+extern inline floating_t min(floating_t, floating_t);
+extern inline floating_t max(floating_t, floating_t);
+extern inline floating_t dot(floating4_t, floating4_t);
+extern inline floating_t my_divide(floating_t, floating_t);
+extern inline floating_t my_fabs(floating_t);
+
+extern inline int findLayerForGivenZPos(floating_t);
+extern inline floating_t mediumLayerBoundary(int);
+extern inline floating_t getScatteringLength(unsigned int, floating_t);
+extern inline floating_t getAbsorptionLength(unsigned int, floating_t);
+
+#endif
@@ -3,67 +3,160 @@
 
 #include "ice_layers.h"
 
-inline void add_ice_layers_on_photon_path_to_medium_changes(floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t photonRange, int *number_of_medium_changes, floating_t *distances_to_medium_changes, floating_t *local_scattering_lengths, floating_t *local_absorption_lengths)
+inline void init_ice_layer_boundaries_on_photon_path(MEDIUM_ARGS floating4_t photonPosAndTime, floating4_t photonDirAndWlen, IceLayerBoundaries_t *boundaries)
 {
 
   // The closest ice layer is special, because we need to check how far
   // it is away from the photon. After that, all photon layers are equidistant.
   //
   floating_t z_of_closest_ice_layer_boundary =
-      mediumLayerBoundary(photon_layer(photonPosAndTime.z));
+      mediumLayerBoundary(MEDIUM_ARGS_TO_CALL photon_layer(MEDIUM_ARGS_TO_CALL photonPosAndTime.z));
   if (photonDirAndWlen.z > ZERO) z_of_closest_ice_layer_boundary +=
       (floating_t)MEDIUM_LAYER_THICKNESS;
 
-  *number_of_medium_changes += 1;
-  distances_to_medium_changes[*number_of_medium_changes] =
+  boundaries->next_distance =
       my_divide(z_of_closest_ice_layer_boundary - photonPosAndTime.z, photonDirAndWlen.z);
-  int next_photon_layer =
-      photon_layer(z_of_closest_ice_layer_boundary + photonDirAndWlen.z);
-  local_scattering_lengths[*number_of_medium_changes] =
-      getScatteringLength(next_photon_layer, photonDirAndWlen.w);
-  local_absorption_lengths[*number_of_medium_changes] =
-      getAbsorptionLength(next_photon_layer, photonDirAndWlen.w);
+  boundaries->next_layer =
+      photon_layer(MEDIUM_ARGS_TO_CALL z_of_closest_ice_layer_boundary + photonDirAndWlen.z);
+  boundaries->spacing =
+      my_divide((floating_t)MEDIUM_LAYER_THICKNESS, my_fabs(photonDirAndWlen.z));
+
+  // The closest boundary is always considered, even if it is out of range.
+  boundaries->has_next = 1;
 
   // printf("ICE LAYER DEBUG\n");
   // printf("  photonPosAndTime.z = %f\n", photonPosAndTime.z);
   // printf("  photonDirAndWlen.z = %f\n", photonDirAndWlen.z);
   // printf("  z_of_closest_ice_layer_boundary = %f\n", z_of_closest_ice_layer_boundary);
-  // printf("  distance to boundary = %f\n", distances_to_medium_changes[*number_of_medium_changes]);
+  // printf("  distance to boundary = %f\n", boundaries->next_distance);
   // printf("  current photon layer = %i\n", photon_layer(photonPosAndTime.z));
-  // printf("  next_photon_layer = %i\n", next_photon_layer);
+  // printf("  next_photon_layer = %i\n", boundaries->next_layer);
 
-  // Now loop through the equidistant layers in range.
+}
+
+inline void advance_to_next_ice_layer_boundary(MEDIUM_ARGS floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t photonRange, IceLayerBoundaries_t *boundaries)
+{
+  // Step through the equidistant layers in range.
   //
-  const floating_t max_trajectory_length_between_two_layers =
-      my_divide((floating_t)MEDIUM_LAYER_THICKNESS, my_fabs(photonDirAndWlen.z));
-  while (distances_to_medium_changes[*number_of_medium_changes] + max_trajectory_length_between_two_layers < photonRange)
-  {
-    *number_of_medium_changes += 1;
-    distances_to_medium_changes[*number_of_medium_changes] =
-        distances_to_medium_changes[*number_of_medium_changes - 1]
-        + max_trajectory_length_between_two_layers;
-    next_photon_layer = photon_layer(photonPosAndTime.z
-        + (distances_to_medium_changes[*number_of_medium_changes] + 0.01) * photonDirAndWlen.z);
-    local_scattering_lengths[*number_of_medium_changes] =
-        getScatteringLength(next_photon_layer, photonDirAndWlen.w);
-    local_absorption_lengths[*number_of_medium_changes] =
-        getAbsorptionLength(next_photon_layer, photonDirAndWlen.w);
+  boundaries->next_distance += boundaries->spacing;
+  if (boundaries->next_distance < photonRange) {
+    boundaries->next_layer = photon_layer(MEDIUM_ARGS_TO_CALL photonPosAndTime.z
+        + (boundaries->next_distance + 0.01) * photonDirAndWlen.z);
+  } else {
+    boundaries->has_next = 0;
+  }
+}
+
+inline int photon_layer(MEDIUM_ARGS floating_t z)
+{
+  return min(max(findLayerForGivenZPos(MEDIUM_ARGS_TO_CALL z), 0), MEDIUM_LAYERS-1);
+}
+
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLE
+
+inline OpticalDepthTableWavelength_t optical_depth_table_wavelength(floating_t wavelength)
+{
+  // The table rows are equidistant in wavelength, from MEDIUM_MIN_WLEN
+  // to MEDIUM_MAX_WLEN. Interpolate linearly between the two rows
+  // around the photon wavelength.
+  //
+  const floating_t row = min(max(
+      (wavelength - (floating_t)MEDIUM_MIN_WLEN) * (floating_t)(MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS - 1)
+          / ((floating_t)MEDIUM_MAX_WLEN - (floating_t)MEDIUM_MIN_WLEN),
+      ZERO), (floating_t)(MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS - 1));
+
+  OpticalDepthTableWavelength_t wlen;
+  wlen.bin = min((int)row, MEDIUM_OPTICAL_DEPTH_TABLE_WLEN_BINS - 2);
+  wlen.weight = row - (floating_t)wlen.bin;
+  return wlen;
+}
+
+inline floating_t cumulative_optical_depth_at_ice_layer_boundary(MEDIUM_ARGS __constant float *table, OpticalDepthTableWavelength_t wlen, int boundary)
+{
+  const int row = wlen.bin * (MEDIUM_LAYERS + 1);
+  return (ONE - wlen.weight) * (floating_t)table[row + boundary]
+      + wlen.weight * (floating_t)table[row + MEDIUM_LAYERS + 1 + boundary];
+}
+
+inline floating_t cumulative_optical_depth(MEDIUM_ARGS __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t z)
+{
+  const int layer = photon_layer(MEDIUM_ARGS_TO_CALL z);
+  const floating_t depth_at_bottom = cumulative_optical_depth_at_ice_layer_boundary(MEDIUM_ARGS_TO_CALL table, wlen, layer);
+  const floating_t depth_at_top = cumulative_optical_depth_at_ice_layer_boundary(MEDIUM_ARGS_TO_CALL table, wlen, layer + 1);
+
+  return depth_at_bottom + (z - mediumLayerBoundary(MEDIUM_ARGS_TO_CALL layer))
+      * my_divide(depth_at_top - depth_at_bottom, (floating_t)MEDIUM_LAYER_THICKNESS);
+}
+
+inline floating_t z_for_cumulative_optical_depth(MEDIUM_ARGS __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t depth)
+{
+  // Binary search for the last layer starting below `depth`.
+  // The cumulative optical depth grows monotonically with z.
+  //
+  int low = 0;
+  int high = MEDIUM_LAYERS - 1;
+  while (low < high) {
+    const int middle = (low + high + 1) / 2;
+    if (cumulative_optical_depth_at_ice_layer_boundary(MEDIUM_ARGS_TO_CALL table, wlen, middle) <= depth) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
   }
 
-  // printf("  *number_of_medium_chnages = %i\n", *number_of_medium_changes);
-  // for (int i = 0; i <= *number_of_medium_changes; i++)
-  // {
-  //   printf("  i = %i\n", i);
-  //   printf("    distance = %f\n", distances_to_medium_changes[i]);
-  //   printf("    scattering length = %f\n", local_scattering_lengths[i]);
-  //   printf("    absorption length = %f\n", local_absorption_lengths[i]);
-  // }
+  const floating_t depth_at_bottom = cumulative_optical_depth_at_ice_layer_boundary(MEDIUM_ARGS_TO_CALL table, wlen, low);
+  const floating_t depth_at_top = cumulative_optical_depth_at_ice_layer_boundary(MEDIUM_ARGS_TO_CALL table, wlen, low + 1);
+
+  return mediumLayerBoundary(MEDIUM_ARGS_TO_CALL low) + (depth - depth_at_bottom)
+      * my_divide((floating_t)MEDIUM_LAYER_THICKNESS, depth_at_top - depth_at_bottom);
+}
+
+inline floating_t optical_depth_on_photon_path(MEDIUM_ARGS __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t z, floating_t dz, floating_t distance)
+{
+  // Number of scattering (or absorption) lengths between the photon
+  // position and the point at `distance` on the photon path.
+  //
+  const int layer = photon_layer(MEDIUM_ARGS_TO_CALL z);
+  if (photon_layer(MEDIUM_ARGS_TO_CALL z + distance * dz) == layer) {
+    // Within one layer, use the local length directly. This avoids the
+    // cancellation of the large cumulative values for almost horizontal
+    // photons.
+    //
+    return distance * my_divide(
+        cumulative_optical_depth_at_ice_layer_boundary(MEDIUM_ARGS_TO_CALL table, wlen, layer + 1) -
+        cumulative_optical_depth_at_ice_layer_boundary(MEDIUM_ARGS_TO_CALL table, wlen, layer),
+        (floating_t)MEDIUM_LAYER_THICKNESS);
+  }
 
+  return my_divide(
+      my_fabs(cumulative_optical_depth(MEDIUM_ARGS_TO_CALL table, wlen, z + distance * dz) - cumulative_optical_depth(MEDIUM_ARGS_TO_CALL table, wlen, z)),
+      my_fabs(dz));
 }
 
-inline int photon_layer(floating_t z)
+inline floating_t distance_for_optical_depth_on_photon_path(MEDIUM_ARGS __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t z, floating_t dz, floating_t depth)
 {
-  return min(max(findLayerForGivenZPos(z), 0), MEDIUM_LAYERS-1);
+  // Inverse of `optical_depth_on_photon_path`: The distance on the photon
+  // path after which the photon has passed `depth` scattering (or absorption)
+  // lengths.
+  //
+  const int layer = photon_layer(MEDIUM_ARGS_TO_CALL z);
+  const floating_t depth_at_bottom = cumulative_optical_depth_at_ice_layer_boundary(MEDIUM_ARGS_TO_CALL table, wlen, layer);
+  const floating_t depth_in_layer = cumulative_optical_depth_at_ice_layer_boundary(MEDIUM_ARGS_TO_CALL table, wlen, layer + 1) - depth_at_bottom;
+
+  // The optical depth of the target point above the bottom of the current
+  // layer, measured along z.
+  //
+  const floating_t target = (z - mediumLayerBoundary(MEDIUM_ARGS_TO_CALL layer))
+      * my_divide(depth_in_layer, (floating_t)MEDIUM_LAYER_THICKNESS) + depth * dz;
+
+  if (((target >= ZERO) || (layer == 0)) && ((target <= depth_in_layer) || (layer == MEDIUM_LAYERS - 1))) {
+    // The target point is within the current layer.
+    return depth * my_divide((floating_t)MEDIUM_LAYER_THICKNESS, depth_in_layer);
+  }
+
+  return my_divide(z_for_cumulative_optical_depth(MEDIUM_ARGS_TO_CALL table, wlen, depth_at_bottom + target) - z, dz);
 }
 
-#endif
\ No newline at end of file
+#endif
+
+#endif
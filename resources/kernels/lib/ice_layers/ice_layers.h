@@ -1,8 +1,70 @@
 #ifndef ICE_LAYERS_H
 #define ICE_LAYERS_H
 
-inline void add_ice_layers_on_photon_path_to_medium_changes(floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t photonRange, int *number_of_medium_changes, floating_t *distances_to_medium_changes, floating_t *local_scattering_lengths, floating_t *local_absorption_lengths);
+// The medium description the ice layer functions read their
+// `MEDIUM_*` values from. In the kernel, the medium properties are
+// compiled in and these only carry the scattering and absorption length
+// tables, if any. Hosts that evaluate several media at once, like the
+// CPU converter, define them to pass the medium along. Both include the
+// trailing comma like KERNEL_PROFILE_ARGS.
+#ifndef MEDIUM_ARGS
+#define MEDIUM_ARGS
+#define MEDIUM_ARGS_TO_CALL
+#endif
 
-inline int photon_layer(floating_t z);
+// The ice layer boundaries on the photon path.
+//
+// Rather than collecting all boundaries in range in an array, they are
+// produced one at a time in the order the photon crosses them. Only the
+// next boundary is kept, such that the memory needed does not depend
+// on the number of ice layers.
+//
+typedef struct IceLayerBoundaries {
+  floating_t next_distance;   // distance to the next boundary along the photon path
+  floating_t spacing;         // distance between two boundaries along the photon path
+  int next_layer;             // layer the photon enters at the next boundary
+  int has_next;               // false when there are no more boundaries in range
+} IceLayerBoundaries_t;
 
-#endif
\ No newline at end of file
+inline void init_ice_layer_boundaries_on_photon_path(MEDIUM_ARGS floating4_t photonPosAndTime, floating4_t photonDirAndWlen, IceLayerBoundaries_t *boundaries);
+
+inline void advance_to_next_ice_layer_boundary(MEDIUM_ARGS floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t photonRange, IceLayerBoundaries_t *boundaries);
+
+inline int photon_layer(MEDIUM_ARGS floating_t z);
+
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLE
+
+// Cumulative optical depth tables, generated on the host by
+// `I3CLSimHelper::GenerateMediumPropertiesSource`.
+//
+// For each wavelength in the table, entry `l` holds the number of
+// scattering (or absorption) lengths between the bottom of the layered
+// region and the lower boundary of layer `l`. Within a layer, the optical
+// depth grows linearly in z. Below the bottom and above the top of the
+// layered region, the outermost layers are extended, like `photon_layer`
+// does.
+//
+// With these tables, the distance to the next scattering or absorption
+// point is found by an inverse lookup rather than by walking through the
+// layers one by one.
+//
+typedef struct OpticalDepthTableWavelength {
+  int bin;              // table row below the photon wavelength
+  floating_t weight;    // interpolation weight of the row above
+} OpticalDepthTableWavelength_t;
+
+inline OpticalDepthTableWavelength_t optical_depth_table_wavelength(floating_t wavelength);
+
+inline floating_t cumulative_optical_depth_at_ice_layer_boundary(MEDIUM_ARGS __constant float *table, OpticalDepthTableWavelength_t wlen, int boundary);
+
+inline floating_t cumulative_optical_depth(MEDIUM_ARGS __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t z);
+
+inline floating_t z_for_cumulative_optical_depth(MEDIUM_ARGS __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t depth);
+
+inline floating_t optical_depth_on_photon_path(MEDIUM_ARGS __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t z, floating_t dz, floating_t distance);
+
+inline floating_t distance_for_optical_depth_on_photon_path(MEDIUM_ARGS __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t z, floating_t dz, floating_t depth);
+
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef ICE_LAYERS_BATCH_C
+#define ICE_LAYERS_BATCH_C
+
+#include "ice_layers_batch.h"
+
+inline void init_ice_layer_boundaries_on_photon_path_batch(PhotonBatch_t photons, IceLayerBoundariesBatch_t *boundaries)
+{
+  // See `init_ice_layer_boundaries_on_photon_path()`.
+  //
+  floating_batch_t z_of_closest_ice_layer_boundary =
+      photon_layer_batch(photons.posZ) * (floating_t)MEDIUM_LAYER_THICKNESS + (floating_t)MEDIUM_LAYER_BOTTOM_POS;
+  z_of_closest_ice_layer_boundary = (photons.dirZ > ZERO) ?
+      z_of_closest_ice_layer_boundary + (floating_t)MEDIUM_LAYER_THICKNESS : z_of_closest_ice_layer_boundary;
+
+  boundaries->next_distance =
+      (z_of_closest_ice_layer_boundary - photons.posZ) / photons.dirZ;
+  boundaries->next_layer =
+      photon_layer_batch(z_of_closest_ice_layer_boundary + photons.dirZ);
+  boundaries->spacing =
+      (floating_t)MEDIUM_LAYER_THICKNESS / batch_fabs(photons.dirZ);
+
+  // The closest boundary is always considered, even if it is out of range.
+  boundaries->has_next = int_batch_splat(-1);
+}
+
+inline void advance_to_next_ice_layer_boundary_batch(PhotonBatch_t photons, floating_batch_t photonRange, IceLayerBoundariesBatch_t *boundaries)
+{
+  // See `advance_to_next_ice_layer_boundary()`.
+  // Lanes without a next boundary are left alone.
+  //
+  boundaries->next_distance = boundaries->has_next ?
+      boundaries->next_distance + boundaries->spacing : boundaries->next_distance;
+
+  const int_batch_t in_range = boundaries->has_next & (boundaries->next_distance < photonRange);
+  boundaries->next_layer = in_range ?
+      photon_layer_batch(photons.posZ + (boundaries->next_distance + (floating_t)0.01) * photons.dirZ) : boundaries->next_layer;
+  boundaries->has_next = in_range;
+}
+
+inline floating_batch_t photon_layer_batch(floating_batch_t z)
+{
+  // Like `photon_layer()`, with the layer search of the propagation kernel
+  // (`findLayerForGivenZPos`).
+  //
+  const floating_batch_t layer = batch_trunc((z - (floating_t)MEDIUM_LAYER_BOTTOM_POS) / (floating_t)MEDIUM_LAYER_THICKNESS);
+  const floating_batch_t lowest = batch_splat(ZERO);
+  const floating_batch_t highest = batch_splat((floating_t)(MEDIUM_LAYERS - 1));
+  return (layer < ZERO) ? lowest : ((layer > (floating_t)(MEDIUM_LAYERS - 1)) ? highest : layer);
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef ICE_LAYERS_BATCH_H
+#define ICE_LAYERS_BATCH_H
+
+#include "../batch/batch.h"
+
+// `IceLayerBoundaries_t` for a batch of photons.
+// See `batch/batch.h`.
+//
+// The layer numbers are kept as integral floating point values,
+// such that they live in the same lanes as the distances.
+//
+typedef struct IceLayerBoundariesBatch {
+  floating_batch_t next_distance;
+  floating_batch_t spacing;
+  floating_batch_t next_layer;
+  int_batch_t has_next;       // mask, -1 if there is a next boundary in range
+} IceLayerBoundariesBatch_t;
+
+inline void init_ice_layer_boundaries_on_photon_path_batch(PhotonBatch_t photons, IceLayerBoundariesBatch_t *boundaries);
+
+inline void advance_to_next_ice_layer_boundary_batch(PhotonBatch_t photons, floating_batch_t photonRange, IceLayerBoundariesBatch_t *boundaries);
+
+inline floating_batch_t photon_layer_batch(floating_batch_t z);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef INTERSECTION_BATCH_C
+#define INTERSECTION_BATCH_C
+
+#include "intersection_batch.h"
+
+inline void calculate_intersections_batch(IntersectionProblemBatch_t *p)
+{
+  // Same steps as `calculate_intersections()`.
+  // There are no branches, so all lanes are computed alike.
+
+  // Step 1
+  const floating_batch_t AMx = p->mx - p->ax;
+  const floating_batch_t AMy = p->my - p->ay;
+  const floating_batch_t xy_projection_factor = batch_sqrt(ONE - p->direction_z * p->direction_z);
+  const floating_batch_t length_AMprime = (AMx * p->direction_x + AMy * p->direction_y) / xy_projection_factor;
+
+  // Step 2
+  p->discriminant = p->r * p->r - (AMx * AMx + AMy * AMy) + length_AMprime * length_AMprime;
+
+  // Step 3
+  const floating_batch_t length_XMprime = batch_sqrt(p->discriminant);
+
+  // Step 4
+  const floating_batch_t length_AX1 = length_AMprime - length_XMprime;
+  const floating_batch_t length_AX2 = length_AMprime + length_XMprime;
+  p->s1 = length_AX1 / p->distance / xy_projection_factor;
+  p->s2 = length_AX2 / p->distance / xy_projection_factor;
+}
+
+#endif
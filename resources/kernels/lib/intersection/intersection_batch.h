@@ -0,0 +1,34 @@
+#ifndef INTERSECTION_BATCH_H
+#define INTERSECTION_BATCH_H
+
+#include "../batch/batch.h"
+
+// `IntersectionProblemParameters_t` for a batch of photons.
+// See `batch/batch.h`.
+//
+typedef struct IntersectionProblemBatch {
+
+  // Input values
+  //
+  floating_batch_t ax;
+  floating_batch_t ay;
+  floating_batch_t mx;
+  floating_batch_t my;
+  floating_batch_t r;
+  floating_batch_t direction_x;
+  floating_batch_t direction_y;
+  floating_batch_t direction_z;
+  floating_batch_t distance;
+
+  // Output values, which will be calculated in
+  // `calculate_intersections_batch()`.
+  //
+  floating_batch_t discriminant;
+  floating_batch_t s1;
+  floating_batch_t s2;
+
+} IntersectionProblemBatch_t;
+
+inline void calculate_intersections_batch(IntersectionProblemBatch_t *p);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef PHILOX_C
+#define PHILOX_C
+
+#include "philox.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+inline void philox4x32_10(const uint *counter, const uint *key, uint *output)
+{
+  uint c0 = counter[0];
+  uint c1 = counter[1];
+  uint c2 = counter[2];
+  uint c3 = counter[3];
+  uint k0 = key[0];
+  uint k1 = key[1];
+
+  for (int round = 0; round < 10; round++) {
+    if (round > 0) {
+      // bump the key between rounds
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+    }
+
+    const uint hi0 = mul_hi(PHILOX_M0, c0);
+    const uint lo0 = PHILOX_M0 * c0;
+    const uint hi1 = mul_hi(PHILOX_M1, c2);
+    const uint lo1 = PHILOX_M1 * c2;
+
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+  }
+
+  output[0] = c0;
+  output[1] = c1;
+  output[2] = c2;
+  output[3] = c3;
+}
+
+inline void philox_init(PhiloxState_t *state, uint key0, uint key1, uint stream0, uint stream1, uint stream2)
+{
+  state->counter[0] = 0;
+  state->counter[1] = stream0;
+  state->counter[2] = stream1;
+  state->counter[3] = stream2;
+  state->key[0] = key0;
+  state->key[1] = key1;
+  state->remaining = 0;
+}
+
+inline uint philox_next_uint(PhiloxState_t *state)
+{
+  if (state->remaining == 0) {
+    philox4x32_10(state->counter, state->key, state->output);
+    state->counter[0]++;
+    state->remaining = 4;
+  }
+  return state->output[4 - state->remaining--];
+}
+
+inline float philox_uniform_co(PhiloxState_t *state)
+{
+  // Use the upper 24 bits, which a float holds exactly. This avoids
+  // rounding up to 1.
+  return (float)(philox_next_uint(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+inline float philox_uniform_oc(PhiloxState_t *state)
+{
+  return 1.0f - philox_uniform_co(state);
+}
+
+#endif
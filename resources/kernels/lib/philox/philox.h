@@ -0,0 +1,30 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+// Counter-based random number generator Philox4x32-10, see
+// J. K. Salmon et al., "Parallel random numbers: as easy as 1, 2, 3",
+// SC11 (2011), doi:10.1145/2063384.2063405
+//
+// Each block of four random numbers is a keyed bijection of a 128 bit
+// counter. There is no state to carry from one kernel launch to the
+// next: a stream is fully determined by the key and the counter it
+// starts from.
+//
+typedef struct PhiloxState {
+  uint counter[4];    // counter[0] counts the blocks, the others select the stream
+  uint key[2];
+  uint output[4];     // the current block of random numbers
+  uint remaining;     // number of unused values in `output`
+} PhiloxState_t;
+
+inline void philox4x32_10(const uint *counter, const uint *key, uint *output);
+
+inline void philox_init(PhiloxState_t *state, uint key0, uint key1, uint stream0, uint stream1, uint stream2);
+
+inline uint philox_next_uint(PhiloxState_t *state);
+
+inline float philox_uniform_co(PhiloxState_t *state);
+
+inline float philox_uniform_oc(PhiloxState_t *state);
+
+#endif
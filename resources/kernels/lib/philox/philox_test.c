@@ -0,0 +1,92 @@
+#include "philox_test.h"
+#include "philox.c"
+#include "gtest/gtest.h"
+#include <set>
+
+inline uint mul_hi(uint a, uint b) { return (uint)(((uint64_t)a * (uint64_t)b) >> 32); }
+
+namespace {
+
+  // Known answer tests from the Random123 distribution (kat_vectors).
+  //
+  void expect_philox4x32_10(uint c0, uint c1, uint c2, uint c3, uint k0, uint k1,
+      uint o0, uint o1, uint o2, uint o3)
+  {
+    const uint counter[4] = {c0, c1, c2, c3};
+    const uint key[2] = {k0, k1};
+    uint output[4];
+    philox4x32_10(counter, key, output);
+    EXPECT_EQ(o0, output[0]);
+    EXPECT_EQ(o1, output[1]);
+    EXPECT_EQ(o2, output[2]);
+    EXPECT_EQ(o3, output[3]);
+  }
+
+  TEST(PhiloxTest, MatchesKnownAnswerForZeros)
+  {
+    expect_philox4x32_10(0, 0, 0, 0, 0, 0,
+        0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8);
+  }
+
+  TEST(PhiloxTest, MatchesKnownAnswerForOnes)
+  {
+    expect_philox4x32_10(0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+        0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd);
+  }
+
+  TEST(PhiloxTest, MatchesKnownAnswerForPi)
+  {
+    expect_philox4x32_10(0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822, 0x299f31d0,
+        0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1);
+  }
+
+  TEST(PhiloxTest, StreamIsReproducible)
+  {
+    PhiloxState_t a;
+    PhiloxState_t b;
+    philox_init(&a, 1, 2, 3, 4, 5);
+    philox_init(&b, 1, 2, 3, 4, 5);
+    for (int i = 0; i < 100; i++) {
+      EXPECT_EQ(philox_next_uint(&a), philox_next_uint(&b));
+    }
+  }
+
+  TEST(PhiloxTest, StreamsDiffer)
+  {
+    // Streams that differ in any counter word or in the key
+    // should not share a value within the first few blocks.
+    std::set<uint> values;
+    const uint streams[5][5] = {
+      {1, 2, 3, 4, 5},
+      {0, 2, 3, 4, 5},
+      {1, 2, 0, 4, 5},
+      {1, 2, 3, 0, 5},
+      {1, 2, 3, 4, 0}
+    };
+    for (int s = 0; s < 5; s++) {
+      PhiloxState_t state;
+      philox_init(&state, streams[s][0], streams[s][1], streams[s][2], streams[s][3], streams[s][4]);
+      for (int i = 0; i < 16; i++) values.insert(philox_next_uint(&state));
+    }
+    EXPECT_EQ(5u * 16u, values.size());
+  }
+
+  TEST(PhiloxTest, UniformNumbersAreInRange)
+  {
+    PhiloxState_t state;
+    philox_init(&state, 42, 0, 0, 0, 0);
+    double sum = 0;
+    const int n = 100000;
+    for (int i = 0; i < n; i++) {
+      const float co = philox_uniform_co(&state);
+      EXPECT_GE(co, 0.0f);
+      EXPECT_LT(co, 1.0f);
+      const float oc = philox_uniform_oc(&state);
+      EXPECT_GT(oc, 0.0f);
+      EXPECT_LE(oc, 1.0f);
+      sum += co + oc;
+    }
+    EXPECT_NEAR(0.5, sum / (2 * n), 0.005);
+  }
+
+}
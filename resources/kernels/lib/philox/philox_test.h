@@ -0,0 +1,10 @@
+#ifndef PHILOX_TEST_H
+#define PHILOX_TEST_H
+
+#include <stdint.h>
+
+typedef uint32_t uint;
+
+extern inline uint mul_hi(uint, uint);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef PROFILING_H
+#define PROFILING_H
+
+// Per-phase profiling of the propagation kernel, see
+// `I3CLSimStepToPhotonConverterOpenCL::SetProfileKernel`.
+//
+// With `PROFILE_KERNEL` defined, each work item counts how often it
+// enters each phase and, if the device has a clock we can read, how many
+// clock ticks it spends there. At the end of the kernel, the work item
+// writes both to its slot of the profiling buffer, which is reduced on
+// the host. Without a device clock, only the counts are recorded.
+//
+// Phases may be nested: The medium propagation includes the layer walk
+// and the cylinder intersections, the collision check includes saving
+// the hits it finds.
+//
+// The phase numbers need to match
+// `I3CLSimStepToPhotonConverterOpenCL::KernelProfilePhase`.
+//
+#define KERNEL_PROFILE_PHOTON_CREATION 0
+#define KERNEL_PROFILE_MEDIUM_PROPAGATION 1
+#define KERNEL_PROFILE_LAYER_WALK 2
+#define KERNEL_PROFILE_CYLINDER_INTERSECTION 3
+#define KERNEL_PROFILE_COLLISION_CHECK 4
+#define KERNEL_PROFILE_HIT_SAVING 5
+#define KERNEL_PROFILE_NUM_PHASES 6
+
+#ifdef PROFILE_KERNEL
+
+typedef struct KernelProfile {
+  ulong ticks[KERNEL_PROFILE_NUM_PHASES];
+  ulong counts[KERNEL_PROFILE_NUM_PHASES];
+} KernelProfile_t;
+
+#ifdef PROFILE_KERNEL_PTX_CLOCK
+// nvidia devices expose their cycle counter through inline PTX.
+// See also: https://stackoverflow.com/a/34252109/2066546
+inline ulong kernel_profile_clock()
+{
+  ulong clock;
+  asm volatile("mov.u64 %0, %%clock64;" : "=l" (clock)); // make sure the compiler will not reorder this
+  return clock;
+}
+#else
+inline ulong kernel_profile_clock() { return 0; }
+#endif
+
+// Like HOLE_ICE_ARGS, but including the trailing comma, such that
+// the arguments vanish from the argument lists without profiling.
+#define KERNEL_PROFILE_ARGS KernelProfile_t *profile,
+#define KERNEL_PROFILE_ARGS_TO_CALL profile,
+
+#define KERNEL_PROFILE_START(name) \
+  const ulong kernel_profile_start_##name = kernel_profile_clock()
+#define KERNEL_PROFILE_STOP(name, phase) do { \
+  profile->ticks[phase] += kernel_profile_clock() - kernel_profile_start_##name; \
+  profile->counts[phase]++; \
+} while (0)
+
+#else
+
+#define KERNEL_PROFILE_ARGS
+#define KERNEL_PROFILE_ARGS_TO_CALL
+#define KERNEL_PROFILE_START(name)
+#define KERNEL_PROFILE_STOP(name, phase)
+
+#endif
+
+#endif
@@ -21,181 +21,50 @@
 // and `abs_lens_left` to geometrical distances in order to determine
 // where the next interaction point is, i.e. how far to propagate
 // the photon in this step.
+//
+// The medium boundaries are not collected in arrays. They are produced
+// one at a time, in the order the photon crosses them, by a
+// `MediumBoundaryIterator_t`. This keeps the private memory per work item
+// independent of the number of ice layers, and we stop looking for
+// boundaries as soon as the photon scatters.
 
 inline void apply_propagation_through_different_media(
+  MEDIUM_ARGS
   floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
   #ifdef HOLE_ICE
-    unsigned int numberOfCylinders, __constant floating4_t *cylinderPositionsAndRadii,
-    __constant floating_t *cylinderScatteringLengths, __constant floating_t *cylinderAbsorptionLengths,
+    HOLE_ICE_ARGS,
   #endif
-  floating_t *distances_to_medium_changes, floating_t *local_scattering_lengths, floating_t *local_absorption_lengths,
+  KERNEL_PROFILE_ARGS
   floating_t *sca_step_left, floating_t *abs_lens_left,
   floating_t *distancePropagated, floating_t *distanceToAbsorption)
 {
+  MediumBoundaryIterator_t boundaries;
+  floating_t local_scattering_length;
+  floating_t local_absorption_length;
 
-  //clock_t t0 = clock();
-
-  int number_of_medium_changes = 0;
-  //clock_t t01 = clock();
-  distances_to_medium_changes[0] = 0.0;
-  //clock_t t02 = clock();
-  int currentPhotonLayer = min(max(findLayerForGivenZPos(photonPosAndTime.z), 0), MEDIUM_LAYERS-1);
-  //clock_t t03 = clock();
-  local_scattering_lengths[0] = getScatteringLength(currentPhotonLayer, photonDirAndWlen.w);
-  //clock_t t04 = clock();
-  local_absorption_lengths[0] = getAbsorptionLength(currentPhotonLayer, photonDirAndWlen.w);
-  //clock_t t05 = clock();
-
-  // int number_of_medium_changes = 1;
-  // floating_t distances_to_medium_changes[MEDIUM_LAYERS] = {0.0, 1.0};
-  // int currentPhotonLayer = min(max(findLayerForGivenZPos(photonPosAndTime.z), 0), MEDIUM_LAYERS-1);
-  // floating_t local_scattering_lengths[MEDIUM_LAYERS] = {getScatteringLength(currentPhotonLayer, photonDirAndWlen.w), 100.0};
-  // floating_t local_absorption_lengths[MEDIUM_LAYERS] = {getAbsorptionLength(currentPhotonLayer, photonDirAndWlen.w), 100.0};
-
-  //floating_t local_scattering_lengths[MEDIUM_LAYERS] = {1000.0};
-  //floating_t local_absorption_lengths[MEDIUM_LAYERS] = {1000.0};
-
-
-  // To check which medium boundaries are in range, we need to estimate
-  // how far the photon can travel in this step.
-  //
-  const floating_t photonRange = *sca_step_left * local_scattering_lengths[0];
+  init_medium_boundaries_on_photon_path(
+    MEDIUM_ARGS_TO_CALL
+    photonPosAndTime,
+    photonDirAndWlen,
+    *sca_step_left,
+    #ifdef HOLE_ICE
+      HOLE_ICE_ARGS_TO_CALL,
+    #endif
+    KERNEL_PROFILE_ARGS_TO_CALL
+
+    // These values will be set within this function:
+    &boundaries,
+    &local_scattering_length,
+    &local_absorption_length
+  );
 
   //printf("MEDIUM CHANGES 2018 DEBUG:\n");
-  //printf("  photonRange = %f\n", photonRange);
+  //printf("  photonRange = %f\n", boundaries.photonRange);
   //printf("  distancePropagated = %f\n", *distancePropagated);
   //printf("  distanceToAbsorption = %f\n", *distanceToAbsorption);
   //printf("  sca_step_left = %f\n", *sca_step_left);
   //printf("  abs_lens_left = %f\n", *abs_lens_left);
 
-  //clock_t t1 = clock();
-  add_ice_layers_on_photon_path_to_medium_changes(
-    photonPosAndTime,
-    photonDirAndWlen,
-    photonRange,
-
-    // These values will be updates within this function:
-    &number_of_medium_changes,
-    distances_to_medium_changes,
-    local_scattering_lengths,
-    local_absorption_lengths
-  );
-
-  //clock_t t2 = clock();
-  #ifdef HOLE_ICE
-    add_hole_ice_cylinders_on_photon_path_to_medium_changes(
-      photonPosAndTime,
-      photonDirAndWlen,
-      photonRange,
-      numberOfCylinders,
-      cylinderPositionsAndRadii,
-
-      // These values will be updates within this function:
-      &number_of_medium_changes,
-      distances_to_medium_changes,
-      local_scattering_lengths,
-      local_absorption_lengths
-    );
-  #endif
-
-  // number_of_medium_changes = 1;
-  // distances_to_medium_changes[0] = 0.0;
-  // distances_to_medium_changes[1] = 1.0;
-  // currentPhotonLayer = min(max(findLayerForGivenZPos(photonPosAndTime.z), 0), MEDIUM_LAYERS-1);
-  // local_scattering_lengths[0] = getScatteringLength(currentPhotonLayer, photonDirAndWlen.w);
-  // local_scattering_lengths[1] = 100.0;
-  // local_absorption_lengths[0] = getAbsorptionLength(currentPhotonLayer, photonDirAndWlen.w);
-  // local_absorption_lengths[1] = 100.0;
-
-  //clock_t t3 = clock();
-  sort_medium_changes_by_ascending_distance(
-    number_of_medium_changes,
-
-    // These values will be updates within this function:
-    distances_to_medium_changes,
-    local_scattering_lengths,
-    local_absorption_lengths
-  );
-
-  //clock_t t4 = clock();
-  loop_over_media_and_calculate_geometrical_distances_up_to_the_next_scattering_point(
-    number_of_medium_changes,
-    distances_to_medium_changes,
-    local_scattering_lengths,
-    local_absorption_lengths,
-
-    // These values will be updates within this function:
-    sca_step_left,
-    abs_lens_left,
-    distancePropagated,
-    distanceToAbsorption
-  );
-  //clock_t t5 = clock();
-
-  //printf("  after:\n");
-  //printf("    distancePropagated = %f\n", *distancePropagated);
-  //printf("    distanceToAbsorption = %f\n", *distanceToAbsorption);
-  //printf("    sca_step_left = %f\n", *sca_step_left);
-  //printf("    abs_lens_left = %f\n", *abs_lens_left);
-  //printf("    number_of_medium_chnages = %i\n", number_of_medium_changes);
-  //for (int i = 0; i <= number_of_medium_changes; i++)
-  //{
-  //  printf("    i = %i\n", i);
-  //  printf("      distance = %f\n", distances_to_medium_changes[i]);
-  //  printf("      scattering length = %f\n", local_scattering_lengths[i]);
-  //  printf("      absorption length = %f\n", local_absorption_lengths[i]);
-  //}
-
-  //printf("  after:\n");
-  //printf("    *distancePropagated = %f\n", *distancePropagated);
-  //printf("    *distanceToAbsorption = %f\n", *distanceToAbsorption);
-  //printf("    *sca_step_left = %f\n", *sca_step_left);
-  //printf("    *abs_lens_left = %f\n", *abs_lens_left);
-
-  //printf("PROFILING start %lu\n", t1 - t0);
-  //printf("PROFILING start_01 %lu\n", t01 - t0);
-  //printf("PROFILING start_02 %lu\n", t02 - t01);
-  //printf("PROFILING start_03 %lu\n", t03 - t02);
-  //printf("PROFILING start_04 %lu\n", t04 - t03);
-  //printf("PROFILING start_05 %lu\n", t05 - t04);
-  //printf("PROFILING start_1 %lu\n", t1 - t05);
-  //printf("PROFILING add_ice_layers %lu\n", t2 - t1);
-  //printf("PROFILING add_hole_ice %lu\n", t3 - t2);
-  //printf("PROFILING sort %lu\n", t4 - t3);
-  //printf("PROFILING loop_over_media %lu\n", t5 - t4);
-  //printf("PROFILING total %lu\n", t5 - t0);
-
-}
-
-inline void sort_medium_changes_by_ascending_distance(int number_of_medium_changes, floating_t *distances_to_medium_changes, floating_t *local_scattering_lengths, floating_t *local_absorption_lengths)
-{
-  // Sort the arrays `distances_to_medium_changes`, `local_scattering_lengths` and
-  // `local_absorption_lengths` by ascending distance to have the medium changes
-  // in the right order.
-  //
-  // https://en.wikiversity.org/wiki/C_Source_Code/Sorting_array_in_ascending_and_descending_order
-  //
-  for (int k = 0; k <= number_of_medium_changes; k++) {
-    for (int l = 0; l <= number_of_medium_changes; l++) {
-      if (distances_to_medium_changes[l] > distances_to_medium_changes[k]) {
-        floating_t tmp_distance = distances_to_medium_changes[k];
-        floating_t tmp_scattering = local_scattering_lengths[k];
-        floating_t tmp_absorption = local_absorption_lengths[k];
-
-        distances_to_medium_changes[k] = distances_to_medium_changes[l];
-        local_scattering_lengths[k] = local_scattering_lengths[l];
-        local_absorption_lengths[k] = local_absorption_lengths[l];
-
-        distances_to_medium_changes[l] = tmp_distance;
-        local_scattering_lengths[l] = tmp_scattering;
-        local_absorption_lengths[l] = tmp_absorption;
-      }
-    }
-  }
-}
-
-inline void loop_over_media_and_calculate_geometrical_distances_up_to_the_next_scattering_point(int number_of_medium_changes, floating_t *distances_to_medium_changes, floating_t *local_scattering_lengths, floating_t *local_absorption_lengths, floating_t *sca_step_left, floating_t *abs_lens_left, floating_t *distancePropagated, floating_t *distanceToAbsorption)
-{
   // We know how many scattering lengths (`sca_step_left`) and how many
   // absorption lengths (`abs_lens_left`) we may spend when propagating
   // through the different media.
@@ -208,44 +77,64 @@ inline void loop_over_media_and_calculate_geometrical_distances_up_to_the_next_s
   // At this point, `abs_lens_left` may still be greater than zero, because
   // the photon may be scattered several times until it is absorbed.
   //
-  for (int j = 0; (j < number_of_medium_changes) && (*sca_step_left > 0); j++) {
-    floating_t max_distance_in_current_medium = distances_to_medium_changes[j+1] - distances_to_medium_changes[j];
+  floating_t distance_to_current_medium = ZERO;
+  floating_t distance_to_next_medium;
+  floating_t next_scattering_length;
+  floating_t next_absorption_length;
+
+  while ((*sca_step_left > 0) && next_medium_boundary_on_photon_path(
+    MEDIUM_ARGS_TO_CALL
+    photonPosAndTime,
+    photonDirAndWlen,
+    #ifdef HOLE_ICE
+      HOLE_ICE_ARGS_TO_CALL,
+    #endif
+    KERNEL_PROFILE_ARGS_TO_CALL
+    &boundaries,
+    &distance_to_next_medium,
+    &next_scattering_length,
+    &next_absorption_length))
+  {
+    floating_t max_distance_in_current_medium = distance_to_next_medium - distance_to_current_medium;
 
-    //printf("  j = %i\n", j);
     //printf("    sca: max_distance_in_current_medium = %f\n", max_distance_in_current_medium);
 
-    if (*sca_step_left * local_scattering_lengths[j] > max_distance_in_current_medium) {
+    if (*sca_step_left * local_scattering_length > max_distance_in_current_medium) {
       //printf("    The photon scatters after leaving this medium.\n");
       // The photon scatters after leaving this medium.
-      *sca_step_left -= my_divide(max_distance_in_current_medium, local_scattering_lengths[j]);
+      *sca_step_left -= my_divide(max_distance_in_current_medium, local_scattering_length);
       *distancePropagated += max_distance_in_current_medium;
     } else {
       //printf("    The photon scatters within this medium.\n");
       // The photon scatters within this medium.
-      max_distance_in_current_medium = *sca_step_left * local_scattering_lengths[j];
+      max_distance_in_current_medium = *sca_step_left * local_scattering_length;
       *distancePropagated += max_distance_in_current_medium;
       *sca_step_left = 0;
     }
 
     //printf("    abs: max_distance_in_current_medium = %f\n", max_distance_in_current_medium);
-    if (*abs_lens_left * local_absorption_lengths[j] > max_distance_in_current_medium) {
+    if (*abs_lens_left * local_absorption_length > max_distance_in_current_medium) {
       //printf("    The photon is absorbed after leaving this medium.\n");
       // The photon is absorbed after leaving this medium.
-      *abs_lens_left -= my_divide(max_distance_in_current_medium, local_absorption_lengths[j]);
+      *abs_lens_left -= my_divide(max_distance_in_current_medium, local_absorption_length);
       *distanceToAbsorption += max_distance_in_current_medium;
     } else {
       //printf("    The photon is absorbed within this medium.\n");
       // The photon is absorbed within this medium.
-      *distanceToAbsorption += *abs_lens_left * local_absorption_lengths[j];
+      *distanceToAbsorption += *abs_lens_left * local_absorption_length;
       *abs_lens_left = 0;
     }
+
+    distance_to_current_medium = distance_to_next_medium;
+    local_scattering_length = next_scattering_length;
+    local_absorption_length = next_absorption_length;
   }
 
   // Spend the rest of the budget with the last medium properties.
   if (*sca_step_left > 0) {
-    *distancePropagated += *sca_step_left * local_scattering_lengths[number_of_medium_changes];
-    *distanceToAbsorption += *abs_lens_left * local_absorption_lengths[number_of_medium_changes];
-    *abs_lens_left -= my_divide(*distancePropagated, local_absorption_lengths[number_of_medium_changes]);
+    *distancePropagated += *sca_step_left * local_scattering_length;
+    *distanceToAbsorption += *abs_lens_left * local_absorption_length;
+    *abs_lens_left -= my_divide(*distancePropagated, local_absorption_length);
   }
 
   // If the photon is absorbed, only propagate up to the absorption point.
@@ -254,6 +143,312 @@ inline void loop_over_media_and_calculate_geometrical_distances_up_to_the_next_s
     *distanceToAbsorption = ZERO;
     *abs_lens_left = ZERO;
   }
+
+  //printf("  after:\n");
+  //printf("    *distancePropagated = %f\n", *distancePropagated);
+  //printf("    *distanceToAbsorption = %f\n", *distanceToAbsorption);
+  //printf("    *sca_step_left = %f\n", *sca_step_left);
+  //printf("    *abs_lens_left = %f\n", *abs_lens_left);
 }
 
+inline void init_medium_boundaries_on_photon_path(
+  MEDIUM_ARGS
+  floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t sca_step_left,
+  #ifdef HOLE_ICE
+    HOLE_ICE_ARGS,
+  #endif
+  KERNEL_PROFILE_ARGS
+  MediumBoundaryIterator_t *boundaries, floating_t *scattering_length, floating_t *absorption_length)
+{
+  // The medium at the photon position.
+  //
+  const int currentPhotonLayer = photon_layer(MEDIUM_ARGS_TO_CALL photonPosAndTime.z);
+  *scattering_length = getScatteringLength(MEDIUM_ARGS_TO_CALL currentPhotonLayer, photonDirAndWlen.w);
+  *absorption_length = getAbsorptionLength(MEDIUM_ARGS_TO_CALL currentPhotonLayer, photonDirAndWlen.w);
+
+  // To check which medium boundaries are in range, we need to estimate
+  // how far the photon can travel in this step.
+  //
+  boundaries->photonRange = sca_step_left * *scattering_length;
+
+  KERNEL_PROFILE_START(layers);
+  init_ice_layer_boundaries_on_photon_path(
+    MEDIUM_ARGS_TO_CALL
+    photonPosAndTime,
+    photonDirAndWlen,
+    &boundaries->ice_layer_boundaries
+  );
+  KERNEL_PROFILE_STOP(layers, KERNEL_PROFILE_LAYER_WALK);
+
+  #ifdef HOLE_ICE
+    // Start looking for crossings right after the photon position.
+    // This excludes crossings at zero distance for all cylinders.
+    //
+    const HoleIceCylinderCrossing_t start_of_photon_path = {ZERO, (int)numberOfCylinders, 1};
+    int index_of_innermost_cylinder_containing_the_photon;
+
+    KERNEL_PROFILE_START(cylinders);
+    find_next_hole_ice_cylinder_crossing(
+      photonPosAndTime,
+      photonDirAndWlen,
+      boundaries->photonRange,
+      numberOfCylinders,
+      cylinderPositionsAndRadii,
+      cylinderGrid,
+      cylinderGridCellStartIndices,
+      cylinderGridCylinderIndices,
+      start_of_photon_path,
+
+      // These values will be set within this function:
+      &boundaries->next_cylinder_crossing,
+      &index_of_innermost_cylinder_containing_the_photon
+    );
+    KERNEL_PROFILE_STOP(cylinders, KERNEL_PROFILE_CYLINDER_INTERSECTION);
+
+    if (index_of_innermost_cylinder_containing_the_photon != -1) {
+      *scattering_length = cylinderScatteringLengths[index_of_innermost_cylinder_containing_the_photon];
+      *absorption_length = cylinderAbsorptionLengths[index_of_innermost_cylinder_containing_the_photon];
+    }
+  #endif
+}
+
+inline int next_medium_boundary_on_photon_path(
+  MEDIUM_ARGS
+  floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
+  #ifdef HOLE_ICE
+    HOLE_ICE_ARGS,
+  #endif
+  KERNEL_PROFILE_ARGS
+  MediumBoundaryIterator_t *boundaries, floating_t *distance, floating_t *scattering_length, floating_t *absorption_length)
+{
+  // When the photon is outside of the layered region, ice layer boundaries
+  // may lie behind the photon. Skip them.
+  //
+  IceLayerBoundaries_t *layers = &boundaries->ice_layer_boundaries;
+  while (layers->has_next && (layers->next_distance < ZERO)) {
+    advance_to_next_ice_layer_boundary(MEDIUM_ARGS_TO_CALL photonPosAndTime, photonDirAndWlen, boundaries->photonRange, layers);
+  }
+
+  #ifdef HOLE_ICE
+    // Merge the two ordered streams. If an ice layer boundary and a
+    // cylinder crossing are at the same distance, the layer comes first.
+    //
+    const HoleIceCylinderCrossing_t crossing = boundaries->next_cylinder_crossing;
+    if ((crossing.index != -1) && (!layers->has_next || (crossing.distance < layers->next_distance))) {
+      *distance = crossing.distance;
+      hole_ice_properties_behind_crossing(MEDIUM_ARGS_TO_CALL photonPosAndTime, photonDirAndWlen,
+          cylinderScatteringLengths, cylinderAbsorptionLengths, crossing,
+          scattering_length, absorption_length);
+
+      int index_of_innermost_cylinder_containing_the_photon;
+      KERNEL_PROFILE_START(cylinders);
+      find_next_hole_ice_cylinder_crossing(
+        photonPosAndTime,
+        photonDirAndWlen,
+        boundaries->photonRange,
+        numberOfCylinders,
+        cylinderPositionsAndRadii,
+        cylinderGrid,
+        cylinderGridCellStartIndices,
+        cylinderGridCylinderIndices,
+        crossing,
+        &boundaries->next_cylinder_crossing,
+        &index_of_innermost_cylinder_containing_the_photon
+      );
+      KERNEL_PROFILE_STOP(cylinders, KERNEL_PROFILE_CYLINDER_INTERSECTION);
+      return 1;
+    }
+  #endif
+
+  if (!layers->has_next) return 0;
+
+  KERNEL_PROFILE_START(layers);
+  *distance = layers->next_distance;
+  *scattering_length = getScatteringLength(MEDIUM_ARGS_TO_CALL layers->next_layer, photonDirAndWlen.w);
+  *absorption_length = getAbsorptionLength(MEDIUM_ARGS_TO_CALL layers->next_layer, photonDirAndWlen.w);
+  advance_to_next_ice_layer_boundary(MEDIUM_ARGS_TO_CALL photonPosAndTime, photonDirAndWlen, boundaries->photonRange, layers);
+  KERNEL_PROFILE_STOP(layers, KERNEL_PROFILE_LAYER_WALK);
+  return 1;
+}
+
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLE
+
+// PROPAGATION THROUGH DIFFERENT MEDIA WITH OPTICAL DEPTH TABLES
+// -----------------------------------------------------------------------------
+
+// Same as `apply_propagation_through_different_media`, but the ice layers
+// are not walked one by one. The distance to the next scattering or
+// absorption point in the layered ice is looked up in the cumulative
+// optical depth tables instead.
+//
+// The only medium boundaries left to walk through are the hole ice
+// cylinder crossings.
+//
+// Both variants can be selected side by side on the host, see
+// `I3CLSimStepToPhotonConverterOpenCL::SetOpticalDepthTableWavelengthBins`.
+
+inline void apply_propagation_through_different_media_with_optical_depth_table(
+  MEDIUM_ARGS
+  floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
+  #ifdef HOLE_ICE
+    HOLE_ICE_ARGS,
+  #endif
+  KERNEL_PROFILE_ARGS
+  floating_t *sca_step_left, floating_t *abs_lens_left,
+  floating_t *distancePropagated, floating_t *distanceToAbsorption)
+{
+  const OpticalDepthTableWavelength_t wlen = optical_depth_table_wavelength(photonDirAndWlen.w);
+
+  // The photon starts in the layered ice unless it is within a cylinder.
+  floating_t local_scattering_length = ZERO;
+  floating_t local_absorption_length = ZERO;
+  floating_t distance_to_current_medium = ZERO;
+
+  #ifdef HOLE_ICE
+    // Without hole ice, the photon would scatter after this distance.
+    // Only cylinders within this range are taken into account.
+    //
+    const floating_t photonRange = distance_for_optical_depth_on_photon_path(
+        MEDIUM_ARGS_TO_CALL
+        mediumScatteringOpticalDepth, wlen, photonPosAndTime.z, photonDirAndWlen.z, *sca_step_left);
+
+    const HoleIceCylinderCrossing_t start_of_photon_path = {ZERO, (int)numberOfCylinders, 1};
+    HoleIceCylinderCrossing_t crossing;
+    int index_of_current_cylinder;
+
+    KERNEL_PROFILE_START(cylinders);
+    find_next_hole_ice_cylinder_crossing(
+      photonPosAndTime,
+      photonDirAndWlen,
+      photonRange,
+      numberOfCylinders,
+      cylinderPositionsAndRadii,
+      cylinderGrid,
+      cylinderGridCellStartIndices,
+      cylinderGridCylinderIndices,
+      start_of_photon_path,
+
+      // These values will be set within this function:
+      &crossing,
+      &index_of_current_cylinder
+    );
+    KERNEL_PROFILE_STOP(cylinders, KERNEL_PROFILE_CYLINDER_INTERSECTION);
+
+    while (crossing.index != -1) {
+      if (index_of_current_cylinder != -1) {
+        local_scattering_length = cylinderScatteringLengths[index_of_current_cylinder];
+        local_absorption_length = cylinderAbsorptionLengths[index_of_current_cylinder];
+      } else {
+        local_scattering_length = ZERO;
+        local_absorption_length = ZERO;
+      }
+
+      const floating_t scattering_depth = optical_depth_in_current_medium(
+          MEDIUM_ARGS_TO_CALL
+          mediumScatteringOpticalDepth, wlen, local_scattering_length,
+          photonPosAndTime, photonDirAndWlen, distance_to_current_medium, crossing.distance);
+      const floating_t absorption_depth = optical_depth_in_current_medium(
+          MEDIUM_ARGS_TO_CALL
+          mediumAbsorptionOpticalDepth, wlen, local_absorption_length,
+          photonPosAndTime, photonDirAndWlen, distance_to_current_medium, crossing.distance);
+
+      // The photon scatters or is absorbed within this medium.
+      if ((*sca_step_left <= scattering_depth) || (*abs_lens_left <= absorption_depth)) break;
+
+      *sca_step_left -= scattering_depth;
+      *abs_lens_left -= absorption_depth;
+      distance_to_current_medium = crossing.distance;
+
+      // Entering a cylinder, leaving it into the enclosing cylinder,
+      // or leaving the outermost cylinder into the layered ice.
+      index_of_current_cylinder = crossing.is_exit ? crossing.index - 1 : crossing.index;
+
+      const HoleIceCylinderCrossing_t previous_crossing = crossing;
+      int index_of_innermost_cylinder_containing_the_photon;
+      KERNEL_PROFILE_START(cylinders);
+      find_next_hole_ice_cylinder_crossing(
+        photonPosAndTime,
+        photonDirAndWlen,
+        photonRange,
+        numberOfCylinders,
+        cylinderPositionsAndRadii,
+        cylinderGrid,
+        cylinderGridCellStartIndices,
+        cylinderGridCylinderIndices,
+        previous_crossing,
+        &crossing,
+        &index_of_innermost_cylinder_containing_the_photon
+      );
+      KERNEL_PROFILE_STOP(cylinders, KERNEL_PROFILE_CYLINDER_INTERSECTION);
+    }
+
+    if (index_of_current_cylinder != -1) {
+      local_scattering_length = cylinderScatteringLengths[index_of_current_cylinder];
+      local_absorption_length = cylinderAbsorptionLengths[index_of_current_cylinder];
+    } else {
+      local_scattering_length = ZERO;
+      local_absorption_length = ZERO;
+    }
+  #endif
+
+  // The photon scatters or is absorbed within the current medium.
+  //
+  KERNEL_PROFILE_START(layers);
+  const floating_t distance_to_scattering = distance_to_current_medium +
+      distance_for_optical_depth_in_current_medium(
+          MEDIUM_ARGS_TO_CALL
+          mediumScatteringOpticalDepth, wlen, local_scattering_length,
+          photonPosAndTime, photonDirAndWlen, distance_to_current_medium, *sca_step_left);
+  const floating_t distance_to_absorption = distance_to_current_medium +
+      distance_for_optical_depth_in_current_medium(
+          MEDIUM_ARGS_TO_CALL
+          mediumAbsorptionOpticalDepth, wlen, local_absorption_length,
+          photonPosAndTime, photonDirAndWlen, distance_to_current_medium, *abs_lens_left);
+
+  if (distance_to_absorption < distance_to_scattering) {
+    // If the photon is absorbed, only propagate up to the absorption point.
+    *distancePropagated = distance_to_absorption;
+    *distanceToAbsorption = ZERO;
+    *abs_lens_left = ZERO;
+  } else {
+    *abs_lens_left -= optical_depth_in_current_medium(
+        MEDIUM_ARGS_TO_CALL
+        mediumAbsorptionOpticalDepth, wlen, local_absorption_length,
+        photonPosAndTime, photonDirAndWlen, distance_to_current_medium, distance_to_scattering);
+    *distancePropagated = distance_to_scattering;
+    *distanceToAbsorption = distance_to_scattering;
+    *sca_step_left = ZERO;
+  }
+  KERNEL_PROFILE_STOP(layers, KERNEL_PROFILE_LAYER_WALK);
+}
+
+inline floating_t optical_depth_in_current_medium(
+  MEDIUM_ARGS
+  __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t length_in_cylinder,
+  floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
+  floating_t start, floating_t end)
+{
+  // Within a hole ice cylinder, the medium is homogeneous.
+  // `length_in_cylinder` is zero in the layered ice.
+  //
+  if (length_in_cylinder > ZERO) return my_divide(end - start, length_in_cylinder);
+
+  return optical_depth_on_photon_path(MEDIUM_ARGS_TO_CALL table, wlen,
+      photonPosAndTime.z + start * photonDirAndWlen.z, photonDirAndWlen.z, end - start);
+}
+
+inline floating_t distance_for_optical_depth_in_current_medium(
+  MEDIUM_ARGS
+  __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t length_in_cylinder,
+  floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
+  floating_t start, floating_t depth)
+{
+  if (length_in_cylinder > ZERO) return depth * length_in_cylinder;
+
+  return distance_for_optical_depth_on_photon_path(MEDIUM_ARGS_TO_CALL table, wlen,
+      photonPosAndTime.z + start * photonDirAndWlen.z, photonDirAndWlen.z, depth);
+}
+
+#endif
+
 #endif
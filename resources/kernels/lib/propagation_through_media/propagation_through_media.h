@@ -1,18 +1,79 @@
 #ifndef PROPAGATION_THROUGH_MEDIA_H
 #define PROPAGATION_THROUGH_MEDIA_H
 
+#include "../ice_layers/ice_layers.h"
+#include "../profiling/profiling.h"
+#ifdef HOLE_ICE
+  #include "../hole_ice/hole_ice.h"
+#endif
+
+// Produces the medium boundaries on the photon path one at a time,
+// in the order the photon crosses them.
+//
+// The state has a fixed size, independent of the number of ice layers
+// and hole ice cylinders: It only holds the next ice layer boundary
+// and the next cylinder crossing.
+//
+typedef struct MediumBoundaryIterator {
+  floating_t photonRange;
+  IceLayerBoundaries_t ice_layer_boundaries;
+  #ifdef HOLE_ICE
+    HoleIceCylinderCrossing_t next_cylinder_crossing;
+  #endif
+} MediumBoundaryIterator_t;
+
 inline void apply_propagation_through_different_media(
+  MEDIUM_ARGS
   floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
   #ifdef HOLE_ICE
-    unsigned int numberOfCylinders, __constant floating4_t *cylinderPositionsAndRadii,
-    __constant floating_t *cylinderScatteringLengths, __constant floating_t *cylinderAbsorptionLengths,
+    HOLE_ICE_ARGS,
   #endif
-  floating_t *distances_to_medium_changes, floating_t *local_scattering_lengths, floating_t *local_absorption_lengths,
+  KERNEL_PROFILE_ARGS
   floating_t *sca_step_left, floating_t *abs_lens_left,
   floating_t *distancePropagated, floating_t *distanceToAbsorption);
 
-inline void sort_medium_changes_by_ascending_distance(int number_of_medium_changes, floating_t *distances_to_medium_changes, floating_t *local_scattering_lengths, floating_t *local_absorption_lengths);
+inline void init_medium_boundaries_on_photon_path(
+  MEDIUM_ARGS
+  floating4_t photonPosAndTime, floating4_t photonDirAndWlen, floating_t sca_step_left,
+  #ifdef HOLE_ICE
+    HOLE_ICE_ARGS,
+  #endif
+  KERNEL_PROFILE_ARGS
+  MediumBoundaryIterator_t *boundaries, floating_t *scattering_length, floating_t *absorption_length);
+
+inline int next_medium_boundary_on_photon_path(
+  MEDIUM_ARGS
+  floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
+  #ifdef HOLE_ICE
+    HOLE_ICE_ARGS,
+  #endif
+  KERNEL_PROFILE_ARGS
+  MediumBoundaryIterator_t *boundaries, floating_t *distance, floating_t *scattering_length, floating_t *absorption_length);
+
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLE
 
-inline void loop_over_media_and_calculate_geometrical_distances_up_to_the_next_scattering_point(int number_of_medium_changes, floating_t *distances_to_medium_changes, floating_t *local_scattering_lengths, floating_t *local_absorption_lengths, floating_t *sca_step_left, floating_t *abs_lens_left, floating_t *distancePropagated, floating_t *distanceToAbsorption);
+inline void apply_propagation_through_different_media_with_optical_depth_table(
+  MEDIUM_ARGS
+  floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
+  #ifdef HOLE_ICE
+    HOLE_ICE_ARGS,
+  #endif
+  KERNEL_PROFILE_ARGS
+  floating_t *sca_step_left, floating_t *abs_lens_left,
+  floating_t *distancePropagated, floating_t *distanceToAbsorption);
+
+inline floating_t optical_depth_in_current_medium(
+  MEDIUM_ARGS
+  __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t length_in_cylinder,
+  floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
+  floating_t start, floating_t end);
+
+inline floating_t distance_for_optical_depth_in_current_medium(
+  MEDIUM_ARGS
+  __constant float *table, OpticalDepthTableWavelength_t wlen, floating_t length_in_cylinder,
+  floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
+  floating_t start, floating_t depth);
+
+#endif
 
 #endif
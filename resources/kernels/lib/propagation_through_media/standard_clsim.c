@@ -8,7 +8,7 @@
 #define STANDARD_CLSIM_C
 
 inline void apply_propagation_through_different_media_with_standard_clsim(
-    floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
+    MEDIUM_ARGS floating4_t photonPosAndTime, floating4_t photonDirAndWlen,
     floating_t *sca_step_left, floating_t *abs_lens_left,
     floating_t *distancePropagated, floating_t *distanceToAbsorption) {
 
@@ -21,7 +21,7 @@ inline void apply_propagation_through_different_media_with_standard_clsim(
     const floating_t effective_z =
         photonPosAndTime.z - getTiltZShift(photonPosAndTime);
     int currentPhotonLayer =
-        min(max(findLayerForGivenZPos(effective_z), 0), MEDIUM_LAYERS - 1);
+        min(max(findLayerForGivenZPos(MEDIUM_ARGS_TO_CALL effective_z), 0), MEDIUM_LAYERS - 1);
 #endif
 
     const floating_t photon_dz = photonDirAndWlen.z;
@@ -38,8 +38,8 @@ inline void apply_propagation_through_different_media_with_standard_clsim(
     // the "next" medium boundary (either top or bottom, depending on step
     // direction)
     floating_t mediumBoundary = (photon_dz < ZERO)
-                                    ? (mediumLayerBoundary(currentPhotonLayer))
-                                    : (mediumLayerBoundary(currentPhotonLayer) +
+                                    ? (mediumLayerBoundary(MEDIUM_ARGS_TO_CALL currentPhotonLayer))
+                                    : (mediumLayerBoundary(MEDIUM_ARGS_TO_CALL currentPhotonLayer) +
                                        (floating_t)MEDIUM_LAYER_THICKNESS);
 
     // track this thing to the next scattering point
@@ -48,9 +48,9 @@ inline void apply_propagation_through_different_media_with_standard_clsim(
 #endif
 
     floating_t currentScaLen =
-        getScatteringLength(currentPhotonLayer, photonDirAndWlen.w);
+        getScatteringLength(MEDIUM_ARGS_TO_CALL currentPhotonLayer, photonDirAndWlen.w);
     floating_t currentAbsLen =
-        getAbsorptionLength(currentPhotonLayer, photonDirAndWlen.w);
+        getAbsorptionLength(MEDIUM_ARGS_TO_CALL currentPhotonLayer, photonDirAndWlen.w);
 
     floating_t ais =
         (photon_dz * *sca_step_left -
@@ -71,15 +71,15 @@ inline void apply_propagation_through_different_media_with_standard_clsim(
     if (photon_dz < 0) {
       for (; (j > 0) && (ais < ZERO) && (aia < ZERO);
            mediumBoundary -= (floating_t)MEDIUM_LAYER_THICKNESS,
-           currentScaLen = getScatteringLength(j, photonDirAndWlen.w),
-           currentAbsLen = getAbsorptionLength(j, photonDirAndWlen.w),
+           currentScaLen = getScatteringLength(MEDIUM_ARGS_TO_CALL j, photonDirAndWlen.w),
+           currentAbsLen = getAbsorptionLength(MEDIUM_ARGS_TO_CALL j, photonDirAndWlen.w),
            ais += my_recip(currentScaLen), aia += my_recip(currentAbsLen))
         --j;
     } else {
       for (; (j < MEDIUM_LAYERS - 1) && (ais > ZERO) && (aia > ZERO);
            mediumBoundary += (floating_t)MEDIUM_LAYER_THICKNESS,
-           currentScaLen = getScatteringLength(j, photonDirAndWlen.w),
-           currentAbsLen = getAbsorptionLength(j, photonDirAndWlen.w),
+           currentScaLen = getScatteringLength(MEDIUM_ARGS_TO_CALL j, photonDirAndWlen.w),
+           currentAbsLen = getAbsorptionLength(MEDIUM_ARGS_TO_CALL j, photonDirAndWlen.w),
            ais -= my_recip(currentScaLen), aia -= my_recip(currentAbsLen))
         ++j;
     }
@@ -30,7 +30,12 @@ __kernel void testKernel(__global ulong* MWC_RNG_x,
                          __global float* xValues,
                          __global float* yValues,
                          uint layer,
-                         uint mode)
+                         uint mode
+#ifdef MEDIUM_LENGTH_TABLE
+                         ,
+                         __global const float *mediumLengthTable
+#endif
+                         )
 {
     //dbg_printf("Start kernel... (work item %u of %u)\n", get_global_id(0), get_global_size(0));
 
@@ -53,9 +58,9 @@ __kernel void testKernel(__global ulong* MWC_RNG_x,
     } else if (mode==2) {
         yValues[i] = getGroupVelocity(layer, xValues[i]);
     } else if (mode==3) {
-        yValues[i] = getAbsorptionLength(layer, xValues[i]);
+        yValues[i] = getAbsorptionLength(MEDIUM_ARGS_TO_CALL layer, xValues[i]);
     } else if (mode==4) {
-        yValues[i] = getScatteringLength(layer, xValues[i]);
+        yValues[i] = getScatteringLength(MEDIUM_ARGS_TO_CALL layer, xValues[i]);
     } else if (mode==5) {
         // this ignores the input data and just generates random numbers
         yValues[i] = makeScatteringCosAngle(RNG_ARGS_TO_CALL);
@@ -0,0 +1,14 @@
+// Counter-based random number generator for OpenCL (Philox4x32-10).
+// Used instead of mwcrng_kernel.cl if the converter is configured with
+// SetUseCounterBasedRNG(true). The kernel keys the generator on a seed
+// and derives the counter from the step and the photon, see
+// propagation_kernel.c.cl. No generator state needs to be kept between
+// kernel launches.
+
+#include "__CLSIM_DIR__/resources/kernels/lib/philox/philox.c"
+
+// typedefs for later use
+#define RNG_ARGS PhiloxState_t *rnd_state
+#define RNG_ARGS_TO_CALL rnd_state
+#define RNG_CALL_UNIFORM_CO philox_uniform_co(rnd_state)
+#define RNG_CALL_UNIFORM_OC philox_uniform_oc(rnd_state)
@@ -70,12 +70,12 @@ inline floating_t my_nan() { return NAN; }
 inline bool my_is_nan(floating_t a) { return (a != a); }
 
 
-inline int findLayerForGivenZPos(floating_t posZ)
+inline int findLayerForGivenZPos(MEDIUM_ARGS floating_t posZ)
 {
     return convert_int((posZ-(floating_t)MEDIUM_LAYER_BOTTOM_POS)/(floating_t)MEDIUM_LAYER_THICKNESS);
 }
 
-inline floating_t mediumLayerBoundary(int layer)
+inline floating_t mediumLayerBoundary(MEDIUM_ARGS int layer)
 {
     return (convert_floating_t(layer)*((floating_t)MEDIUM_LAYER_THICKNESS)) + (floating_t)MEDIUM_LAYER_BOTTOM_POS;
 }
@@ -129,7 +129,32 @@ void scatterDirectionByAngle(floating_t cosa,
 }
 
 
-inline void createPhotonFromTrack(struct I3CLSimStep *step,
+#ifdef COUNTER_BASED_RNG
+// The counter-based random number stream of a step does not depend on
+// the work item or the bunch the step ends up in. It is keyed on the
+// sequence number the light source to step converter gave the step
+// when it was created, so steps with identical contents still get
+// independent streams.
+inline void counterBasedRNGStepId(const struct I3CLSimStep *step,
+    uint *stepId0, uint *stepId1)
+{
+    *stepId0 = step->sequenceNumber;
+    *stepId1 = step->identifier;
+}
+
+// A step split on the host (see SplitLargeSteps() in
+// I3CLSimStepToPhotonConverterOpenCL) continues the photon
+// count of the original step: sub-step dummy2 has at most
+// 2^dummy1 photons. The host sets both fields to zero for
+// all other steps, whatever the step producer left in them.
+inline uint counterBasedRNGPhotonOffset(const struct I3CLSimStep *step)
+{
+    return ((uint)step->dummy2) << step->dummy1;
+}
+#endif
+
+inline void createPhotonFromTrack(MEDIUM_ARGS
+    struct I3CLSimStep *step,
     const floating4_t stepDir,
     RNG_ARGS,
     floating4_t *photonPosAndTime,
@@ -148,7 +173,7 @@ inline void createPhotonFromTrack(struct I3CLSimStep *step,
         );
 
     // determine the photon layer (clamp if necessary)
-    unsigned int layer = min(max(findLayerForGivenZPos( (*photonPosAndTime).z ), 0), MEDIUM_LAYERS-1);
+    unsigned int layer = min(max(findLayerForGivenZPos(MEDIUM_ARGS_TO_CALL (*photonPosAndTime).z ), 0), MEDIUM_LAYERS-1);
 
 #ifndef NO_FLASHER
     if (step->sourceType == 0) {
@@ -305,6 +330,7 @@ inline bool savePath(
 
 // Record a photon on a DOM
 inline void saveHit(
+    KERNEL_PROFILE_ARGS
     const floating4_t photonPosAndTime,
     const floating4_t photonDirAndWlen,
     const floating_t thisStepLength,
@@ -317,6 +343,7 @@ inline void saveHit(
     const struct I3CLSimStep *step,
     unsigned short hitOnString,
     unsigned short hitOnDom,
+    HIT_OVERFLOW_ARGS
     __global uint* hitIndex,
     uint maxHitIndex,
     __global struct I3CLSimPhoton *outputPhotons
@@ -326,6 +353,8 @@ inline void saveHit(
 #endif
     )
 {
+    KERNEL_PROFILE_START(hit);
+
     uint myIndex = atom_inc(hitIndex);
     if (myIndex < maxHitIndex)
     {
@@ -364,6 +393,8 @@ inline void saveHit(
 
         outputPhotons[myIndex].distInAbsLens = distanceTraveledInAbsorptionLengths;
 
+        outputPhotonSteps[myIndex] = stepIndex;
+
 #ifdef SAVE_PHOTON_HISTORY
         for (uint i=0;i<NUM_PHOTONS_IN_HISTORY;++i)
         {
@@ -379,11 +410,17 @@ inline void saveHit(
 #endif
 
     }
+    else
+    {
+        // The output buffer is full, this step has to run again.
+        overflowedSteps[stepIndex] = 1;
+    }
 
-
+    KERNEL_PROFILE_STOP(hit, KERNEL_PROFILE_HIT_SAVING);
 }
 
 
+
 #ifdef DOUBLE_PRECISION
     #define EPSILON 0.00000001
 #else
@@ -391,22 +428,69 @@ inline void saveHit(
 #endif
 
 
-// // Profiling
-// // https://github.com/fiedl/hole-ice-study/issues/69
-// //
-// typedef unsigned long clock_t;
-//
-// // When running on the CPU, the `clock()` function is already defined.
-// // When running on nvidia GPUs, define the `clock()` function here.
-// // See also: https://stackoverflow.com/a/34252109/2066546
-// //
-// inline clock_t clock()
-// {
-//   clock_t n_clock;
-//   asm volatile("mov.u64 %0, %%clock64;" : "=l" (n_clock)); // make sure the compiler will not reorder this
-//   return n_clock;
-// }
 
+// Copy a step from the input buffer and calculate its direction
+inline void downloadStep(
+    __global struct I3CLSimStep *inputSteps,
+    uint stepIndex,
+    struct I3CLSimStep *step,
+    floating4_t *stepDir)
+{
+    step->posAndTime = inputSteps[stepIndex].posAndTime;
+    step->dirAndLengthAndBeta = inputSteps[stepIndex].dirAndLengthAndBeta;
+    step->numPhotons = inputSteps[stepIndex].numPhotons;
+    step->weight = inputSteps[stepIndex].weight;
+    step->identifier = inputSteps[stepIndex].identifier;
+#ifndef NO_FLASHER
+    // only needed for flashers
+    step->sourceType = inputSteps[stepIndex].sourceType;
+#endif
+#ifdef COUNTER_BASED_RNG
+    // only needed for the random number streams
+    step->sequenceNumber = inputSteps[stepIndex].sequenceNumber;
+    step->dummy1 = inputSteps[stepIndex].dummy1;
+    step->dummy2 = inputSteps[stepIndex].dummy2;
+#endif
+    //*step = inputSteps[stepIndex]; // Intel OpenCL does not like this
+
+    const floating_t rho = my_sin(step->dirAndLengthAndBeta.x); // sin(theta)
+    *stepDir = (floating4_t)(rho*my_cos(step->dirAndLengthAndBeta.y), // rho*cos(phi)
+        rho*my_sin(step->dirAndLengthAndBeta.y), // rho*sin(phi)
+        my_cos(step->dirAndLengthAndBeta.x),    // cos(phi)
+        ZERO);
+}
+
+#ifdef PERSISTENT_THREADS
+// Take the next work unit from the queue and download its step.
+//
+// A work unit is a range of photons of a single step, prepared on the
+// host. Returns false once all work units of the bunch have been taken.
+inline bool takeWorkUnit(
+    __global uint *workQueue,
+    __global const uint4 *workUnits,
+    __global struct I3CLSimStep *inputSteps,
+    uint *stepIndex,
+    struct I3CLSimStep *step,
+    floating4_t *stepDir,
+    uint *photonsLeftToPropagate,
+    uint *photonsLeftInWorkUnit)
+{
+    const uint workUnitIndex = atom_inc(&workQueue[0]);
+    if (workUnitIndex >= workQueue[1]) return false;
+
+    // step index, first photon, number of photons
+    const uint4 workUnit = workUnits[workUnitIndex];
+    *stepIndex = workUnit.x;
+    downloadStep(inputSteps, workUnit.x, step, stepDir);
+
+    // Photons are counted down like when a work item propagates the
+    // whole step, such that both modes use the same random numbers
+    // with the counter-based generator.
+    *photonsLeftToPropagate = step->numPhotons - workUnit.y;
+    *photonsLeftInWorkUnit = workUnit.z;
+    return true;
+}
+#endif
 
 // `__CLSIM_DIR__` is replaced in `I3CLSimStepToPhotonConverterOpenCL::loadKernel`.
 #include "__CLSIM_DIR__/resources/kernels/lib/propagation_through_media/propagation_through_media.c"
@@ -428,6 +512,8 @@ __kernel void propKernel(
 #ifdef SAVE_PHOTON_HISTORY
     __global float4 *photonHistory,
 #endif
+    __global uint *outputPhotonSteps, // deviceBuffer_OutputPhotonSteps
+    __global uint *overflowedSteps,   // deviceBuffer_OverflowedSteps
 
 #else // TABULATE
     __global struct I3CLSimReferenceParticle *referenceParticle,
@@ -435,8 +521,39 @@ __kernel void propKernel(
     __global uint *numOutputEntries,
 #endif
 
+#ifdef COUNTER_BASED_RNG
+    const uint counterBasedRNGKey0,
+    const uint counterBasedRNGKey1
+#else
     __global ulong* MWC_RNG_x,
-    __global uint* MWC_RNG_a)
+    __global uint* MWC_RNG_a
+#endif
+#ifdef PROFILE_KERNEL
+    ,
+    __global ulong *kernelProfile // deviceBuffer_KernelProfile
+#endif
+#ifdef PERSISTENT_THREADS
+    ,
+    __global uint *workQueue,       // deviceBuffer_WorkQueue: next work unit, number of work units
+    __global const uint4 *workUnits // deviceBuffer_WorkUnits: step index, first photon, number of photons
+#endif
+#ifdef MEDIUM_LENGTH_TABLE
+    ,
+    __global const float *mediumLengthTable // deviceBuffer_MediumLengthTable
+#endif
+#ifdef HOLE_ICE
+    ,
+    const uint numberOfCylinders,
+    HOLE_ICE_MEMORY const floating4_t *cylinderPositionsAndRadii,
+    HOLE_ICE_MEMORY const floating_t *cylinderScatteringLengths,
+    HOLE_ICE_MEMORY const floating_t *cylinderAbsorptionLengths,
+    HOLE_ICE_MEMORY const floating_t *holeIceCylinderGridGeometry, // startX, startY, widthX, widthY, maxRadius
+    const uint holeIceCylinderGridNumX,
+    const uint holeIceCylinderGridNumY,
+    HOLE_ICE_MEMORY const uint *holeIceCylinderGridCellStartIndices,
+    HOLE_ICE_MEMORY const uint *holeIceCylinderGridCylinderIndices
+#endif
+    )
 {
     unsigned int i = get_global_id(0);
 
@@ -463,47 +580,67 @@ __kernel void propKernel(
     float4 currentPhotonHistory[NUM_PHOTONS_IN_HISTORY];
 #endif
 
-    // Prepare some large arrays here because declaring them
-    // for each scattering step locally is really expensive.
-    // https://github.com/fiedl/hole-ice-study/issues/70
-    floating_t distances_to_medium_changes[MEDIUM_LAYERS] = {};
-    floating_t local_scattering_lengths[MEDIUM_LAYERS] = {};
-    floating_t local_absorption_lengths[MEDIUM_LAYERS] = {};
+#ifdef HOLE_ICE
+    // spatial grid used to find the hole ice cylinders near the photon path
+    const HoleIceCylinderGrid_t cylinderGrid = {
+      holeIceCylinderGridGeometry[0],
+      holeIceCylinderGridGeometry[1],
+      holeIceCylinderGridGeometry[2],
+      holeIceCylinderGridGeometry[3],
+      (int)holeIceCylinderGridNumX,
+      (int)holeIceCylinderGridNumY,
+      holeIceCylinderGridGeometry[4]
+    };
+#endif
 
+#ifdef PROFILE_KERNEL
+    // per-phase profiling, stored in kernelProfile at the end
+    KernelProfile_t real_profile;
+    KernelProfile_t *profile = &real_profile;
+    for (int phase = 0; phase < KERNEL_PROFILE_NUM_PHASES; ++phase) {
+        profile->ticks[phase] = 0;
+        profile->counts[phase] = 0;
+    }
+#endif
+
+#ifndef COUNTER_BASED_RNG
     //download MWC RNG state
     ulong real_rnd_x = MWC_RNG_x[i];
     uint real_rnd_a = MWC_RNG_a[i];
     ulong *rnd_x = &real_rnd_x;
     uint *rnd_a = &real_rnd_a;
+#endif
 
-    // download the step
     struct I3CLSimStep step;
-    step.posAndTime = inputSteps[i].posAndTime;
-    step.dirAndLengthAndBeta = inputSteps[i].dirAndLengthAndBeta;
-    step.numPhotons = inputSteps[i].numPhotons;
-    step.weight = inputSteps[i].weight;
-    step.identifier = inputSteps[i].identifier;
-#ifndef NO_FLASHER
-    // only needed for flashers
-    step.sourceType = inputSteps[i].sourceType;
+    floating4_t stepDir;
+#ifdef PERSISTENT_THREADS
+    // The steps are taken from the work queue, see takeWorkUnit().
+    // This work item does not belong to any particular step.
+    uint stepIndex=0;
+    uint photonsLeftInWorkUnit=0;
+    bool workQueueIsEmpty=false;
+#else
+    // download the step
+    const uint stepIndex=i;
+    downloadStep(inputSteps, i, &step, &stepDir);
+#endif
+
+#ifdef COUNTER_BASED_RNG
+    // The random number stream of each photon is keyed on the seed
+    // and counts from (step id, photon index). It is set up again
+    // whenever a new photon is created.
+    PhiloxState_t real_rnd_state;
+    PhiloxState_t *rnd_state = &real_rnd_state;
+    uint stepId0, stepId1;
+#ifndef PERSISTENT_THREADS
+    counterBasedRNGStepId(&step, &stepId0, &stepId1);
+#endif
 #endif
-    //step.dummy1 = inputSteps[i].dummy1;  // NOT USED
-    //step.dummy2 = inputSteps[i].dummy2;  // NOT USED
-    //step = inputSteps[i]; // Intel OpenCL does not like this
 
 #ifdef TABULATE
     struct I3CLSimReferenceParticle refParticle = *referenceParticle;
 #endif
 
-    floating4_t stepDir;
-    {
-        const floating_t rho = my_sin(step.dirAndLengthAndBeta.x); // sin(theta)
-        stepDir = (floating4_t)(rho*my_cos(step.dirAndLengthAndBeta.y), // rho*cos(phi)
-            rho*my_sin(step.dirAndLengthAndBeta.y), // rho*sin(phi)
-            my_cos(step.dirAndLengthAndBeta.x),    // cos(phi)
-            ZERO);
-    }
-
 #ifdef PRINTF_ENABLED
     //dbg_printf("Step at: p=(%f,%f,%f), d=(%f,%f,%f), t=%f, l=%f, N=%u\n",
     //    step.posAndTime.x,
@@ -515,7 +652,11 @@ __kernel void propKernel(
     //    step.numPhotons);
 #endif
 
+#ifdef PERSISTENT_THREADS
+    uint photonsLeftToPropagate=0;
+#else
     uint photonsLeftToPropagate=step.numPhotons;
+#endif
     floating_t abs_lens_left=ZERO;
     floating_t abs_lens_initial=ZERO;
 
@@ -538,27 +679,59 @@ __kernel void propKernel(
     floating_t inv_groupvel=ZERO;
 
 #ifdef TABULATE
+#ifndef COUNTER_BASED_RNG
     ulong prev_rnd_x;
     uint prev_rnd_a;
+#endif
     floating_t prevStepRemainder=ZERO;
 #endif // TABULATE
 
-    while (photonsLeftToPropagate > 0)
+#ifdef PERSISTENT_THREADS
+#define WORK_ITEM_IS_BUSY (!workQueueIsEmpty)
+#else
+#define WORK_ITEM_IS_BUSY (photonsLeftToPropagate > 0)
+#endif
+
+    while (WORK_ITEM_IS_BUSY)
     {
+#ifdef PERSISTENT_THREADS
+        if (photonsLeftInWorkUnit == 0)
+        {
+            // the last photon is done, continue with the next work unit
+            if (!takeWorkUnit(workQueue, workUnits, inputSteps,
+                &stepIndex, &step, &stepDir, &photonsLeftToPropagate, &photonsLeftInWorkUnit))
+            {
+                workQueueIsEmpty = true;
+                break;
+            }
+#ifdef COUNTER_BASED_RNG
+            counterBasedRNGStepId(&step, &stepId0, &stepId1);
+#endif
+        }
+#endif
+
         if (abs_lens_left < EPSILON)
         {
-#ifdef TABULATE
+#ifdef COUNTER_BASED_RNG
+            // Photons are counted down, such that a restarted step
+            // continues with the same streams.
+            philox_init(rnd_state, counterBasedRNGKey0, counterBasedRNGKey1,
+                photonsLeftToPropagate + counterBasedRNGPhotonOffset(&step), stepId0, stepId1);
+#elif defined(TABULATE)
             // cache RNG state in case we need to restart this photon with
             // an empty output buffer
             prev_rnd_x = real_rnd_x;
             prev_rnd_a = real_rnd_a;
 #endif
             // create a new photon
-            createPhotonFromTrack(&step,
+            KERNEL_PROFILE_START(creation);
+            createPhotonFromTrack(MEDIUM_ARGS_TO_CALL
+                &step,
                 stepDir,
                 RNG_ARGS_TO_CALL,
                 &photonPosAndTime,
                 &photonDirAndWlen);
+            KERNEL_PROFILE_STOP(creation, KERNEL_PROFILE_PHOTON_CREATION);
 
             // save the start position and time
             photonStartPosAndTime=photonPosAndTime;
@@ -582,7 +755,7 @@ __kernel void propKernel(
 #endif
 
 #ifdef getTiltZShift_IS_CONSTANT
-            currentPhotonLayer = min(max(findLayerForGivenZPos(photonPosAndTime.z), 0), MEDIUM_LAYERS-1);
+            currentPhotonLayer = min(max(findLayerForGivenZPos(MEDIUM_ARGS_TO_CALL photonPosAndTime.z), 0), MEDIUM_LAYERS-1);
 #endif
 
             inv_groupvel = my_recip(getGroupVelocity(0, photonDirAndWlen.w));
@@ -605,9 +778,6 @@ __kernel void propKernel(
 #endif
         }
 
-        //// start profiling the simulation step here
-        //clock_t t0 = clock();
-
         floating_t sca_step_left = -my_log(RNG_CALL_UNIFORM_OC);
 
         // Propagation throuh different media
@@ -628,9 +798,13 @@ __kernel void propKernel(
         floating_t distancePropagated = 0;
         floating_t distanceToAbsorption = 0;
 
-        //clock_t t1 = clock();
-        //clock_t t2 = clock();
+        KERNEL_PROFILE_START(media);
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLE
+        apply_propagation_through_different_media_with_optical_depth_table(
+#else
         apply_propagation_through_different_media(
+#endif
+          MEDIUM_ARGS_TO_CALL
           photonPosAndTime,
           photonDirAndWlen,
           #ifdef HOLE_ICE
@@ -638,21 +812,20 @@ __kernel void propKernel(
             cylinderPositionsAndRadii,
             cylinderScatteringLengths,
             cylinderAbsorptionLengths,
+            cylinderGrid,
+            holeIceCylinderGridCellStartIndices,
+            holeIceCylinderGridCylinderIndices,
           #endif
-          distances_to_medium_changes,
-          local_scattering_lengths,
-          local_absorption_lengths,
+          KERNEL_PROFILE_ARGS_TO_CALL
           &sca_step_left,
           &abs_lens_left,
           &distancePropagated,
           &distanceToAbsorption
         );
-        //clock_t t3 = clock();
-        //clock_t t4 = clock();
+        KERNEL_PROFILE_STOP(media, KERNEL_PROFILE_MEDIUM_PROPAGATION);
 
-        // clock_t t1 = clock();
-        // clock_t t2 = clock();
         // apply_propagation_through_different_media_with_standard_clsim(
+        //   MEDIUM_ARGS_TO_CALL
         //   photonPosAndTime,
         //   photonDirAndWlen,
         //   &sca_step_left,
@@ -660,8 +833,6 @@ __kernel void propKernel(
         //   &distancePropagated,
         //   &distanceToAbsorption
         // );
-        // clock_t t3 = clock();
-        // clock_t t4 = clock();
 
 
 #ifndef SAVE_ALL_PHOTONS
@@ -669,6 +840,7 @@ __kernel void propKernel(
 
         // the photon is now either being absorbed or scattered.
         // Check for collisions in its way
+        KERNEL_PROFILE_START(collision);
 #ifdef STOP_PHOTONS_ON_DETECTION
 #ifdef DEBUG_STORE_GENERATED_PHOTONS
         bool collided;
@@ -692,6 +864,7 @@ __kernel void propKernel(
 #else //STOP_PHOTONS_ON_DETECTION
             distancePropagated,
 #endif //STOP_PHOTONS_ON_DETECTION
+            HIT_OVERFLOW_ARGS_TO_CALL
             hitIndex,
             maxHitIndex,
             outputPhotons,
@@ -699,8 +872,10 @@ __kernel void propKernel(
             photonHistory,
             currentPhotonHistory,
 #endif //SAVE_PHOTON_HISTORY
+            KERNEL_PROFILE_ARGS_TO_CALL
             geoLayerToOMNumIndexPerStringSetLocal
             );
+        KERNEL_PROFILE_STOP(collision, KERNEL_PROFILE_COLLISION_CHECK);
 
 #ifdef STOP_PHOTONS_ON_DETECTION
 #ifdef DEBUG_STORE_GENERATED_PHOTONS
@@ -742,8 +917,10 @@ __kernel void propKernel(
             // was spawned.
             //dbg_printf("Ran out of space after %u photons\n", inputSteps[i].numPhotons-photonsLeftToPropagate);
             inputSteps[i].numPhotons = photonsLeftToPropagate;
+#ifndef COUNTER_BASED_RNG
             MWC_RNG_x[i] = prev_rnd_x;
             MWC_RNG_a[i] = prev_rnd_a;
+#endif
             return;
         } else if (stop) {
             //dbg_printf("Photon ran off the end of the table\n");
@@ -765,12 +942,16 @@ __kernel void propKernel(
             // photon was absorbed.
             // a new one will be generated at the begin of the loop.
             --photonsLeftToPropagate;
+#ifdef PERSISTENT_THREADS
+            --photonsLeftInWorkUnit;
+#endif
 
 #if defined(SAVE_ALL_PHOTONS) && !defined(TABULATE)
             // save every. single. photon.
 
             if (RNG_CALL_UNIFORM_CO < SAVE_ALL_PHOTONS_PRESCALE) {
                 saveHit(
+                    KERNEL_PROFILE_ARGS_TO_CALL
                     photonPosAndTime,
                     photonDirAndWlen,
                     0., // photon has already been propagated to the next position
@@ -783,6 +964,7 @@ __kernel void propKernel(
                     &step,
                     0, // string id (not used in this case)
                     0, // dom id (not used in this case)
+                    HIT_OVERFLOW_ARGS_TO_CALL
                     hitIndex,
                     maxHitIndex,
                     outputPhotons
@@ -846,13 +1028,8 @@ __kernel void propKernel(
             //dbg_printf("    . the photon has now been scattered %u time(s).\n", photonNumScatters);
 #endif
         }
-
-        //clock_t t5 = clock();
-        //printf("PROFILING propagation_kernel_simulation_step %lu\n", t5 - t0);
-        //printf("PROFILING apply_propagation_through_different_media %lu\n", t3 - t2);
-        //printf("PROFILING apply_propagation_through_different_media_outer %lu\n", t4 - t1);
-
     }
+#undef WORK_ITEM_IS_BUSY
 
 #ifdef PRINTF_ENABLED
     //dbg_printf("Stop kernel... (work item %u of %u)\n", i, global_size);
@@ -864,7 +1041,17 @@ __kernel void propKernel(
     inputSteps[i].numPhotons = 0;
 #endif
 
+#ifdef PROFILE_KERNEL
+    // store the profile of this work item, it is reduced on the host
+    for (int phase = 0; phase < KERNEL_PROFILE_NUM_PHASES; ++phase) {
+        kernelProfile[i*2*KERNEL_PROFILE_NUM_PHASES + phase] = profile->ticks[phase];
+        kernelProfile[i*2*KERNEL_PROFILE_NUM_PHASES + KERNEL_PROFILE_NUM_PHASES + phase] = profile->counts[phase];
+    }
+#endif
+
+#ifndef COUNTER_BASED_RNG
     //upload MWC RNG state
     MWC_RNG_x[i] = real_rnd_x;
     MWC_RNG_a[i] = real_rnd_a;
+#endif
 }
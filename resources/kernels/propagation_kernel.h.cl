@@ -47,6 +47,23 @@
 
 // ZERO and ONE will be defined as either 0.f/1.f or 0./1. depending on DOUBLE_PRECISION
 
+// phase numbers and macros for PROFILE_KERNEL
+#include "__CLSIM_DIR__/resources/kernels/lib/profiling/profiling.h"
+
+// this will be (optionally) defined by the main code:
+//#define PERSISTENT_THREADS
+
+// Tables restart unfinished steps by the index of their work item.
+#ifdef TABULATE
+#undef PERSISTENT_THREADS
+#endif
+
+// Each stored hit is tagged with the index of its step. Steps that
+// lose a hit because the output buffer is full are flagged, the host
+// throws away the rest of their hits and runs them again.
+#define HIT_OVERFLOW_ARGS uint stepIndex, __global uint *outputPhotonSteps, __global uint *overflowedSteps,
+#define HIT_OVERFLOW_ARGS_TO_CALL stepIndex, outputPhotonSteps, overflowedSteps,
+
 /////////////////// struct definitions
 
 struct __attribute__ ((packed)) I3CLSimStep 
@@ -56,10 +73,11 @@ struct __attribute__ ((packed)) I3CLSimStep
     uint numPhotons;                                        //    32bit unsigned
     float weight;                                           //    32bit float
     uint identifier;                                        //    32bit unsigned
+    uint sequenceNumber;                                    //    32bit unsigned
     uchar sourceType;                                       //     8bit unsigned
-    uchar dummy1;                                           //     8bit unsigned
-    ushort dummy2;                                          //    16bit unsigned
-                                                            // total: 12x 32bit float = 48 bytes
+    uchar dummy1;                                           //     8bit unsigned (log2 of the sub-step size of split steps)
+    ushort dummy2;                                          //    16bit unsigned (sub-step index of split steps)
+                                                            // total: 13x 32bit float = 52 bytes
 };
 
 struct __attribute__ ((packed)) I3CLSimPhoton 
@@ -95,16 +113,17 @@ struct __attribute__ ((packed)) I3CLSimReferenceParticle
 
 ///////////////// forward declarations
 
-inline int findLayerForGivenZPos(floating_t posZ);
+inline int findLayerForGivenZPos(MEDIUM_ARGS floating_t posZ);
 
-inline floating_t mediumLayerBoundary(int layer);
+inline floating_t mediumLayerBoundary(MEDIUM_ARGS int layer);
 
 void scatterDirectionByAngle(floating_t cosa,
     floating_t sina,
     floating4_t *direction,
     floating_t randomNumber);
 
-inline void createPhotonFromTrack(struct I3CLSimStep *step,
+inline void createPhotonFromTrack(MEDIUM_ARGS
+    struct I3CLSimStep *step,
     const floating4_t stepDir,
     RNG_ARGS,
     floating4_t *photonPosAndTime,
@@ -117,6 +136,7 @@ inline float2 sphDirFromCar(float4 carDir);
 #endif
 
 inline void saveHit(
+    KERNEL_PROFILE_ARGS
     const floating4_t photonPosAndTime,
     const floating4_t photonDirAndWlen,
     const floating_t thisStepLength,
@@ -129,6 +149,7 @@ inline void saveHit(
     const struct I3CLSimStep *step,
     unsigned short hitOnString,
     unsigned short hitOnDom,
+    HIT_OVERFLOW_ARGS
     __global uint* hitIndex,
     uint maxHitIndex,
     __global struct I3CLSimPhoton *outputPhotons
@@ -43,6 +43,7 @@ inline void checkForCollision_OnString(
     const floating4_t photonStartPosAndTime,
     const floating4_t photonStartDirAndWlen,
     const struct I3CLSimStep *step,
+    HIT_OVERFLOW_ARGS
     __global uint* hitIndex,
     uint maxHitIndex,
     __global struct I3CLSimPhoton *outputPhotons,
@@ -51,6 +52,7 @@ inline void checkForCollision_OnString(
     float4 *currentPhotonHistory,
 #endif
 #endif
+    KERNEL_PROFILE_ARGS
     __local const unsigned short *geoLayerToOMNumIndexPerStringSetLocal
     )
 {
@@ -164,7 +166,8 @@ inline void checkForCollision_OnString(
             // (in that case, no hit will be saved for this one)
 #else //STOP_PHOTONS_ON_DETECTION
             // save the hit right here
-            saveHit(photonPosAndTime,
+            saveHit(KERNEL_PROFILE_ARGS_TO_CALL
+                    photonPosAndTime,
                     photonDirAndWlen,
                     smin1, // this is the limited thisStepLength
                     inv_groupvel,
@@ -176,6 +179,7 @@ inline void checkForCollision_OnString(
                     step,
                     stringNum,
                     domNum,
+                    HIT_OVERFLOW_ARGS_TO_CALL
                     hitIndex,
                     maxHitIndex,
                     outputPhotons
@@ -209,6 +213,7 @@ inline void checkForCollision_InCell(
     const floating4_t photonStartPosAndTime,
     const floating4_t photonStartDirAndWlen,
     const struct I3CLSimStep *step,
+    HIT_OVERFLOW_ARGS
     __global uint* hitIndex,
     uint maxHitIndex,
     __global struct I3CLSimPhoton *outputPhotons,
@@ -217,6 +222,7 @@ inline void checkForCollision_InCell(
     float4 *currentPhotonHistory,
 #endif
 #endif
+    KERNEL_PROFILE_ARGS
     __local const unsigned short *geoLayerToOMNumIndexPerStringSetLocal,
     
     __constant unsigned short *this_geoCellIndex,
@@ -287,6 +293,7 @@ inline void checkForCollision_InCell(
                 photonStartPosAndTime,
                 photonStartDirAndWlen,
                 step,
+                HIT_OVERFLOW_ARGS_TO_CALL
                 hitIndex,
                 maxHitIndex,
                 outputPhotons,
@@ -295,6 +302,7 @@ inline void checkForCollision_InCell(
                 currentPhotonHistory,
 #endif // SAVE_PHOTON_HISTORY
 #endif // STOP_PHOTONS_ON_DETECTION
+                KERNEL_PROFILE_ARGS_TO_CALL
                 geoLayerToOMNumIndexPerStringSetLocal
                 );
         }
@@ -320,6 +328,7 @@ inline void checkForCollision_InCells(
     const floating4_t photonStartPosAndTime,
     const floating4_t photonStartDirAndWlen,
     const struct I3CLSimStep *step,
+    HIT_OVERFLOW_ARGS
     __global uint* hitIndex,
     uint maxHitIndex,
     __global struct I3CLSimPhoton *outputPhotons,
@@ -328,6 +337,7 @@ inline void checkForCollision_InCells(
     float4 *currentPhotonHistory,
 #endif
 #endif
+    KERNEL_PROFILE_ARGS
     __local const unsigned short *geoLayerToOMNumIndexPerStringSetLocal
     )
 {
@@ -345,6 +355,7 @@ inline void checkForCollision_InCells(
         hitRecorded,                            \
         hitOnString,                            \
         hitOnDom,                               \
+        KERNEL_PROFILE_ARGS_TO_CALL             \
         geoLayerToOMNumIndexPerStringSetLocal,  \
                                                 \
         geoCellIndex_ ## subdetectorNum,        \
@@ -370,11 +381,13 @@ inline void checkForCollision_InCells(
         photonStartPosAndTime,                  \
         photonStartDirAndWlen,                  \
         step,                                   \
+        HIT_OVERFLOW_ARGS_TO_CALL               \
         hitIndex,                               \
         maxHitIndex,                            \
         outputPhotons,                          \
         photonHistory,                          \
         currentPhotonHistory,                   \
+        KERNEL_PROFILE_ARGS_TO_CALL             \
         geoLayerToOMNumIndexPerStringSetLocal,  \
                                                 \
         geoCellIndex_ ## subdetectorNum,        \
@@ -399,9 +412,11 @@ inline void checkForCollision_InCells(
         photonStartPosAndTime,                  \
         photonStartDirAndWlen,                  \
         step,                                   \
+        HIT_OVERFLOW_ARGS_TO_CALL               \
         hitIndex,                               \
         maxHitIndex,                            \
         outputPhotons,                          \
+        KERNEL_PROFILE_ARGS_TO_CALL             \
         geoLayerToOMNumIndexPerStringSetLocal,  \
                                                 \
         geoCellIndex_ ## subdetectorNum,        \
@@ -473,6 +488,7 @@ inline bool checkForCollision(const floating4_t photonPosAndTime,
 #else
     floating_t thisStepLength,
 #endif
+    HIT_OVERFLOW_ARGS
     __global uint* hitIndex,
     uint maxHitIndex,
     __global struct I3CLSimPhoton *outputPhotons,
@@ -480,11 +496,13 @@ inline bool checkForCollision(const floating4_t photonPosAndTime,
     __global float4 *photonHistory,
    float4 *currentPhotonHistory,
 #endif
+    KERNEL_PROFILE_ARGS
     __local const unsigned short *geoLayerToOMNumIndexPerStringSetLocal
     )
 {
 #ifdef DEBUG_STORE_GENERATED_PHOTONS
-    saveHit(photonPosAndTime,
+    saveHit(KERNEL_PROFILE_ARGS_TO_CALL
+            photonPosAndTime,
             photonDirAndWlen,
             ZERO,
             inv_groupvel,
@@ -496,6 +514,7 @@ inline bool checkForCollision(const floating4_t photonPosAndTime,
             step,
             0,
             0,
+            HIT_OVERFLOW_ARGS_TO_CALL
             hitIndex,
             maxHitIndex,
             outputPhotons
@@ -535,6 +554,7 @@ inline bool checkForCollision(const floating4_t photonPosAndTime,
         photonStartPosAndTime,
         photonStartDirAndWlen,
         step,
+        HIT_OVERFLOW_ARGS_TO_CALL
         hitIndex,
         maxHitIndex,
         outputPhotons,
@@ -543,6 +563,7 @@ inline bool checkForCollision(const floating4_t photonPosAndTime,
         currentPhotonHistory,
 #endif // SAVE_PHOTON_HISTORY
 #endif // STOP_PHOTONS_ON_DETECTION
+        KERNEL_PROFILE_ARGS_TO_CALL
         geoLayerToOMNumIndexPerStringSetLocal);
 
 #ifdef STOP_PHOTONS_ON_DETECTION
@@ -555,7 +576,8 @@ inline bool checkForCollision(const floating4_t photonPosAndTime,
     // the intersection detection further down in
     // checkForCollision_*().
     if (hitRecorded) {
-        saveHit(photonPosAndTime,
+        saveHit(KERNEL_PROFILE_ARGS_TO_CALL
+                photonPosAndTime,
                 photonDirAndWlen,
                 *thisStepLength,
                 inv_groupvel,
@@ -567,6 +589,7 @@ inline bool checkForCollision(const floating4_t photonPosAndTime,
                 step,
                 hitOnString,
                 hitOnDom,
+                HIT_OVERFLOW_ARGS_TO_CALL
                 hitIndex,
                 maxHitIndex,
                 outputPhotons
@@ -43,6 +43,7 @@ inline void checkForCollision_OnString(
     const floating4_t photonStartPosAndTime,
     const floating4_t photonStartDirAndWlen,
     const struct I3CLSimStep *step,
+    HIT_OVERFLOW_ARGS
     __global uint* hitIndex,
     uint maxHitIndex,
     __global struct I3CLSimPhoton *outputPhotons,
@@ -51,6 +52,7 @@ inline void checkForCollision_OnString(
     float4 *currentPhotonHistory,
 #endif
 #endif
+    KERNEL_PROFILE_ARGS
     __local const unsigned short *geoLayerToOMNumIndexPerStringSetLocal
     );
     
@@ -72,6 +74,7 @@ inline void checkForCollision_InCell(
     const floating4_t photonStartPosAndTime,
     const floating4_t photonStartDirAndWlen,
     const struct I3CLSimStep *step,
+    HIT_OVERFLOW_ARGS
     __global uint* hitIndex,
     uint maxHitIndex,
     __global struct I3CLSimPhoton *outputPhotons,
@@ -80,6 +83,7 @@ inline void checkForCollision_InCell(
     float4 *currentPhotonHistory,
 #endif
 #endif
+    KERNEL_PROFILE_ARGS
     __local const unsigned short *geoLayerToOMNumIndexPerStringSetLocal,
     
     __constant unsigned short *this_geoCellIndex,
@@ -109,6 +113,7 @@ inline void checkForCollision_InCells(
     const floating4_t photonStartPosAndTime,
     const floating4_t photonStartDirAndWlen,
     const struct I3CLSimStep *step,
+    HIT_OVERFLOW_ARGS
     __global uint* hitIndex,
     uint maxHitIndex,
     __global struct I3CLSimPhoton *outputPhotons,
@@ -117,6 +122,7 @@ inline void checkForCollision_InCells(
     float4 *currentPhotonHistory,
 #endif
 #endif
+    KERNEL_PROFILE_ARGS
     __local const unsigned short *geoLayerToOMNumIndexPerStringSetLocal
     );
 
@@ -134,6 +140,7 @@ inline bool checkForCollision(const floating4_t photonPosAndTime,
 #else
     floating_t thisStepLength,
 #endif
+    HIT_OVERFLOW_ARGS
     __global uint* hitIndex,
     uint maxHitIndex,
     __global struct I3CLSimPhoton *outputPhotons,
@@ -141,6 +148,7 @@ inline bool checkForCollision(const floating4_t photonPosAndTime,
     __global float4 *photonHistory,
     float4 *currentPhotonHistory,
 #endif
+    KERNEL_PROFILE_ARGS
     __local const unsigned short *geoLayerToOMNumIndexPerStringSetLocal
     );
 
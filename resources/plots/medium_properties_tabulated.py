@@ -0,0 +1,67 @@
+#!/usr/bin/env python
+
+# Compares the tabulated scattering and absorption lengths
+# (see I3CLSimStepToPhotonConverterOpenCL.SetLengthTableWavelengthBins)
+# to the analytic functions of the medium properties for all layers.
+#
+# usage: medium_properties_tabulated.py [wavelength bins]
+
+from __future__ import print_function
+
+import sys
+
+import numpy
+
+from icecube import icetray, dataclasses, clsim, phys_services
+from I3Tray import I3Units
+
+if len(sys.argv) > 1:
+    wavelengthBins = int(sys.argv[1])
+else:
+    wavelengthBins = 128
+
+# get OpenCL CPU devices
+openCLDevices = [device for device in clsim.I3CLSimOpenCLDevice.GetAllDevices() if device.cpu]
+if len(openCLDevices)==0:
+    raise RuntimeError("No CPU OpenCL devices available!")
+openCLDevice = openCLDevices[0]
+
+openCLDevice.useNativeMath=False
+workgroupSize = 1
+workItemsPerIteration = 10240
+print("           using platform:", openCLDevice.platform)
+print("             using device:", openCLDevice.device)
+print("   wavelength bins/layer :", wavelengthBins)
+
+mediumProps = clsim.MakeIceCubeMediumProperties()
+
+def makeTester(lengthTableWavelengthBins):
+    return clsim.I3CLSimMediumPropertiesTester(device=openCLDevice,
+                                               workgroupSize=workgroupSize,
+                                               workItemsPerIteration=workItemsPerIteration,
+                                               mediumProperties=mediumProps,
+                                               randomService=None,
+                                               lengthTableWavelengthBins=lengthTableWavelengthBins)
+
+analyticTester = makeTester(0)
+tabulatedTester = makeTester(wavelengthBins)
+
+# do not sample the table nodes only
+wlens = numpy.linspace(mediumProps.MinWavelength/I3Units.nanometer, mediumProps.MaxWavelength/I3Units.nanometer, num=997)
+vector = dataclasses.I3VectorFloat(wlens*I3Units.nanometer)
+
+for name, evaluate, reference in [("scattering length", "EvaluateScatteringLength", mediumProps.GetScatteringLength),
+                                  ("absorption length", "EvaluateAbsorptionLength", mediumProps.GetAbsorptionLength)]:
+    maxDeviationToAnalytic = 0.
+    maxDeviationToReference = 0.
+    for layer in range(mediumProps.LayersNum):
+        analytic = numpy.array(getattr(analyticTester, evaluate)(vector, layer))
+        tabulated = numpy.array(getattr(tabulatedTester, evaluate)(vector, layer))
+        function = reference(layer)
+        exact = numpy.array([function.GetValue(wlen*I3Units.nanometer) for wlen in wlens])
+
+        maxDeviationToAnalytic = max(maxDeviationToAnalytic, numpy.max(numpy.abs(tabulated/analytic - 1.)))
+        maxDeviationToReference = max(maxDeviationToReference, numpy.max(numpy.abs(tabulated/exact - 1.)))
+
+    print("%s: max. relative deviation to the OpenCL functions: %g, to the host functions: %g" %
+          (name, maxDeviationToAnalytic, maxDeviationToReference))
@@ -25,6 +25,12 @@ parser.add_option("--use-cpu",  action="store_true", default=False,
 parser.add_option("--minimal-gcd",  action="store_true", default=False,
                   dest="MINIMALGCD", help="generate a trivial GCD from scratch with only 24 DOMs. There are fewer collision checks, so usually things are faster, but unrealistic.")
 
+parser.add_option("--buffer-ring-depth", type="int", default=2,
+                  dest="BUFFERRINGDEPTH", help="Number of bunches of steps that can be in flight at the same time")
+parser.add_option("--persistent-threads", action="store_true", default=False,
+                  dest="PERSISTENTTHREADS", help="launch persistent work items that take photons from a work queue instead of one work item per step")
+parser.add_option("--persistent-work-items", type="int", default=0,
+                  dest="PERSISTENTWORKITEMS", help="number of persistent work items (0: a few work groups per compute unit)")
 parser.add_option("-d", "--device", type="int", default=None,
                   dest="DEVICE", help="device number")
 
@@ -308,7 +314,10 @@ tray.AddSegment(clsim.I3CLSimMakeHits, "makeCLSimHits",
     UseCPUs=options.USECPU,
     UseOnlyDeviceNumber=options.DEVICE,
     IceModelLocation=options.ICEMODEL,
-    ExtraArgumentsToI3CLSimModule={"EnableDoubleBuffering":True}
+    ExtraArgumentsToI3CLSimModule={"EnableDoubleBuffering":True,
+                                   "BufferRingDepth":options.BUFFERRINGDEPTH,
+                                   "UsePersistentThreads":options.PERSISTENTTHREADS,
+                                   "NumPersistentWorkItems":options.PERSISTENTWORKITEMS}
     )
 
 tray.AddModule("TrashCan", "the can")
@@ -328,6 +337,7 @@ root = tree.getroot()
 ns_per_photon = [float(item.find('second').text) for item in root.find('I3XMLSummaryService').find('map').findall('item') if item.find('first').text=="I3CLSimModule_makeCLSimHits_makePhotons_clsim_AverageDeviceTimePerPhoton"][0]
 ns_per_photon_with_util = [float(item.find('second').text) for item in root.find('I3XMLSummaryService').find('map').findall('item') if item.find('first').text=="I3CLSimModule_makeCLSimHits_makePhotons_clsim_AverageHostTimePerPhoton"][0]
 device_util = [float(item.find('second').text) for item in root.find('I3XMLSummaryService').find('map').findall('item') if item.find('first').text=="I3CLSimModule_makeCLSimHits_makePhotons_clsim_DeviceUtilization"][0]
+device_idle_time = [float(item.find('second').text) for item in root.find('I3XMLSummaryService').find('map').findall('item') if item.find('first').text=="I3CLSimModule_makeCLSimHits_makePhotons_clsim_TotalDeviceIdleTime"][0]
 
 print(" ")
 print("# these numbers are performance figures for the GPU:")
@@ -340,4 +350,5 @@ print("time per photon (actual, including under-utilization):", ns_per_photon_wi
 print("photons per second (actual, including under-utilization):", 1e9/ns_per_photon_with_util, "photons per second")
 
 print("device utilization:", device_util*100., "%")
+print("device idle time between kernels (buffer ring depth %i):" % options.BUFFERRINGDEPTH, device_idle_time/I3Units.ms, "ms")
 
@@ -0,0 +1,154 @@
+#!/usr/bin/env python
+
+"""
+Compare I3CLSimStepToPhotonConverterCPU to I3CLSimStepToPhotonConverterOpenCL:
+the same steps in the same medium and geometry have to give statistically
+compatible numbers of hits (in total and per DOM) and the same
+distributions of photon travel times and arrival directions, both
+without and with hole ice cylinders around the DOMs.
+
+Exits without testing if there is no OpenCL device.
+"""
+
+from __future__ import print_function
+
+import sys
+import math
+import random
+import numpy
+
+from icecube import icetray, dataclasses, clsim, phys_services
+from I3Tray import I3Units
+
+devices = list(clsim.I3CLSimOpenCLDevice.GetAllDevices())
+if len(devices) == 0:
+    print("no OpenCL device, skipping test")
+    sys.exit(0)
+device = devices[0]
+device.useNativeMath = False
+
+workgroupSize = 64
+numStepsPerBunch = 8*workgroupSize
+numBunches = 8
+
+medium = clsim.MakeIceCubeMediumProperties()
+bias = clsim.GetIceCubeDOMAcceptance()
+
+def make_geometry():
+    # a single string of DOMs along the z axis
+    numOMs = 60
+    geometry = clsim.I3CLSimSimpleGeometryUserConfigurable(OMRadius=0.16510*icetray.I3Units.m, numOMs=numOMs)
+    for i in range(numOMs):
+        geometry.SetStringID(i, 1)
+        geometry.SetDomID(i, i+1)
+        geometry.SetPosX(i, 0.)
+        geometry.SetPosY(i, 0.)
+        geometry.SetPosZ(i, 500.*I3Units.m - 17.*i*I3Units.m)
+        geometry.SetSubdetector(i, "IceCube")
+    return geometry
+
+def make_hole_ice_cylinders():
+    # one cylinder around the string, and one next to it
+    positions = dataclasses.I3VectorI3Position([dataclasses.I3Position(0., 0., 0.), dataclasses.I3Position(3.*I3Units.m, 0., 0.)])
+    radii = dataclasses.I3VectorFloat([0.5*I3Units.m, 1.*I3Units.m])
+    scatteringLengths = dataclasses.I3VectorFloat([0.5*I3Units.m, 2.*I3Units.m])
+    absorptionLengths = dataclasses.I3VectorFloat([50.*I3Units.m, 10.*I3Units.m])
+    return positions, radii, scatteringLengths, absorptionLengths
+
+def setup(converter):
+    converter.SetWlenBias(bias)
+    converter.SetWlenGenerators([clsim.makeCherenkovWavelengthGenerator(bias, False, medium)])
+    converter.SetMediumProperties(medium)
+    converter.SetGeometry(make_geometry())
+    converter.Initialize()
+    return converter
+
+def make_opencl_converter(holeIce=False):
+    converter = clsim.I3CLSimStepToPhotonConverterOpenCL(RandomService=phys_services.I3GSLRandomService(1), UseNativeMath=False)
+    converter.SetDevice(device)
+    converter.SetWorkgroupSize(workgroupSize)
+    converter.SetMaxNumWorkitems(numStepsPerBunch)
+    if holeIce:
+        converter.SetSimulateHoleIce(True)
+        converter.UpdateHoleIceCylinders(*make_hole_ice_cylinders())
+    return setup(converter)
+
+def make_cpu_converter(holeIce=False):
+    converter = clsim.I3CLSimStepToPhotonConverterCPU(RandomService=phys_services.I3GSLRandomService(2))
+    converter.SetMaxNumWorkitems(numStepsPerBunch)
+    if holeIce:
+        positions, radii, scatteringLengths, absorptionLengths = make_hole_ice_cylinders()
+        converter.SetSimulateHoleIce(True)
+        converter.SetHoleIceCylinderPositions(positions)
+        converter.SetHoleIceCylinderRadii(radii)
+        converter.SetHoleIceCylinderScatteringLengths(scatteringLengths)
+        converter.SetHoleIceCylinderAbsorptionLengths(absorptionLengths)
+    return setup(converter)
+
+def make_bunches(rng):
+    bunches = []
+    for b in range(numBunches):
+        series = clsim.I3CLSimStepSeries()
+        for i in range(numStepsPerBunch):
+            step = clsim.I3CLSimStep()
+            step.pos = dataclasses.I3Position(rng.uniform(-5., 5.)*I3Units.m, rng.uniform(-5., 5.)*I3Units.m, rng.uniform(-200., 200.)*I3Units.m)
+            step.dir = dataclasses.I3Direction(math.acos(rng.uniform(-1., 1.)), rng.uniform(0., 2.*math.pi))
+            step.time = rng.uniform(0., 100.)*I3Units.ns
+            step.length = 1.*I3Units.m
+            step.beta = 1.
+            step.weight = 1.
+            step.sourceType = 0
+            step.id = 1 + b*numStepsPerBunch + i
+            step.num = rng.randint(100, 1000)
+            series.append(step)
+        bunches.append(series)
+    return bunches
+
+def convert(converter, bunches):
+    for identifier, series in enumerate(bunches):
+        converter.EnqueueSteps(series, identifier)
+    hits = []
+    for i in range(len(bunches)):
+        result = converter.GetConversionResult()
+        for p in result.photons:
+            hits.append((p.omID, p.time - p.startTime, math.cos(p.theta), p.numScatters))
+    return numpy.array(hits)
+
+def ks_statistic(a, b):
+    a = numpy.sort(a)
+    b = numpy.sort(b)
+    values = numpy.concatenate([a, b])
+    cdf_a = numpy.searchsorted(a, values, side='right')/float(len(a))
+    cdf_b = numpy.searchsorted(b, values, side='right')/float(len(b))
+    return numpy.max(numpy.abs(cdf_a - cdf_b))
+
+def assert_same_distribution(name, a, b):
+    # two-sample Kolmogorov-Smirnov test at a 0.1% significance level
+    d = ks_statistic(a, b)
+    critical = 1.949*math.sqrt(float(len(a)+len(b))/(len(a)*len(b)))
+    print("%s: KS distance %g (critical %g)" % (name, d, critical))
+    assert d < critical, "%s distributions differ" % name
+
+def compare(name, opencl, cpu):
+    print("%s: %u hits (OpenCL), %u (CPU)" % (name, len(opencl), len(cpu)))
+    assert len(opencl) > 1000, "enough photons are detected"
+    assert abs(len(opencl)-len(cpu)) < 5.*math.sqrt(len(opencl)+len(cpu)), "the total number of hits agrees"
+
+    # hits per DOM
+    bins = numpy.arange(0.5, 61.5)
+    perDOM_opencl = numpy.histogram(opencl[:,0], bins=bins)[0].astype(float)
+    perDOM_cpu = numpy.histogram(cpu[:,0], bins=bins)[0].astype(float)
+    filled = (perDOM_opencl + perDOM_cpu) >= 20.
+    chi2 = numpy.sum((perDOM_opencl[filled]-perDOM_cpu[filled])**2/(perDOM_opencl[filled]+perDOM_cpu[filled]))
+    ndf = numpy.count_nonzero(filled)
+    print("%s hits per DOM: chi2 %g for %u DOMs" % (name, chi2, ndf))
+    assert chi2 < ndf + 5.*math.sqrt(2.*ndf), "the number of hits per DOM agrees"
+
+    assert_same_distribution(name + " travel time", opencl[:,1], cpu[:,1])
+    assert_same_distribution(name + " arrival direction", opencl[:,2], cpu[:,2])
+    assert_same_distribution(name + " number of scatters", opencl[:,3], cpu[:,3])
+
+bunches = make_bunches(random.Random(3))
+
+compare("bulk ice", convert(make_opencl_converter(), bunches), convert(make_cpu_converter(), bunches))
+compare("hole ice", convert(make_opencl_converter(holeIce=True), bunches), convert(make_cpu_converter(holeIce=True), bunches))
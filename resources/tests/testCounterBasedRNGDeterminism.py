@@ -0,0 +1,118 @@
+#!/usr/bin/env python
+
+"""
+Test the counter-based random number generator of
+I3CLSimStepToPhotonConverterOpenCL: the same steps give exactly the
+same photons, whether they are converted in one bunch or in several,
+in a different order, split into sub-steps or not, and whatever the
+step producer left in the sub-step fields (dummy1, dummy2). Steps
+with the same contents but different sequence numbers give
+independent photons.
+
+Exits without testing if there is no OpenCL device.
+"""
+
+import sys
+import copy
+import random
+
+from icecube import icetray, dataclasses, clsim, phys_services
+
+devices = list(clsim.I3CLSimOpenCLDevice.GetAllDevices())
+if len(devices) == 0:
+    print("no OpenCL device, skipping test")
+    sys.exit(0)
+device = devices[0]
+device.useNativeMath = False
+
+def make_geometry():
+    # a single string of DOMs along the z axis
+    numOMs = 60
+    geometry = clsim.I3CLSimSimpleGeometryUserConfigurable(OMRadius=0.16510*icetray.I3Units.m, numOMs=numOMs)
+    for i in range(numOMs):
+        geometry.SetStringID(i, 1)
+        geometry.SetDomID(i, i+1)
+        geometry.SetPosX(i, 0.)
+        geometry.SetPosY(i, 0.)
+        geometry.SetPosZ(i, 500.*icetray.I3Units.m - 17.*i*icetray.I3Units.m)
+        geometry.SetSubdetector(i, "IceCube")
+    return geometry
+
+def make_converter(stepSplittingFactor):
+    medium = clsim.MakeIceCubeMediumProperties()
+    bias = clsim.GetIceCubeDOMAcceptance()
+
+    converter = clsim.I3CLSimStepToPhotonConverterOpenCL(RandomService=phys_services.I3GSLRandomService(42), UseNativeMath=False)
+    converter.SetDevice(device)
+    converter.SetWorkgroupSize(min(64, converter.GetMaxWorkgroupSize()))
+    converter.SetMaxNumWorkitems(10*converter.GetWorkgroupSize())
+    converter.SetWlenBias(bias)
+    converter.SetWlenGenerators([clsim.makeCherenkovWavelengthGenerator(bias, False, medium)])
+    converter.SetMediumProperties(medium)
+    converter.SetGeometry(make_geometry())
+    converter.useCounterBasedRNG = True
+    converter.stepSplittingFactor = stepSplittingFactor
+    converter.Initialize()
+    return converter
+
+def make_steps(rng):
+    steps = []
+    for i in range(2*64):
+        step = clsim.I3CLSimStep()
+        step.pos = dataclasses.I3Position(rng.uniform(-20., 20.), rng.uniform(-20., 20.), rng.uniform(-300., 300.))
+        step.dir = dataclasses.I3Direction(rng.uniform(-1., 1.), rng.uniform(-1., 1.), rng.uniform(-1., 1.))
+        step.time = 0.
+        step.length = 1.*icetray.I3Units.m
+        step.beta = 1.
+        step.weight = 1.
+        step.sourceType = 0
+        step.id = i
+        step.sequenceNumber = 1000 + i
+        # a few very bright steps, which are split
+        step.num = 100000 if i % 40 == 0 else rng.randint(1, 300)
+        # garbage in the sub-step fields of some steps
+        step.dummy1 = 0x5a if i % 3 == 0 else 0
+        step.dummy2 = 0xbeef if i % 5 == 0 else 0
+        steps.append(step)
+    return steps
+
+def convert(converter, bunches):
+    photons = []
+    for identifier, bunch in enumerate(bunches):
+        series = clsim.I3CLSimStepSeries()
+        for step in bunch:
+            series.append(step)
+        converter.EnqueueSteps(series, identifier)
+    for i in range(len(bunches)):
+        result = converter.GetConversionResult()
+        for p in result.photons:
+            photons.append((p.id, p.stringID, p.omID, p.time, p.x, p.y, p.z,
+                            p.theta, p.phi, p.wavelength, p.numScatters))
+    return sorted(photons)
+
+steps = make_steps(random.Random(1))
+
+converter = make_converter(stepSplittingFactor=4.)
+reference = convert(converter, [steps])
+assert len(reference) > 0, "some photons are detected"
+
+# the same steps again, in the same bunch
+assert convert(converter, [steps]) == reference, "same photons for the same bunch"
+
+# in reverse order, spread over several bunches
+reverse = list(reversed(steps))
+assert convert(converter, [reverse[:50], reverse[50:60], reverse[60:]]) == reference, "same photons for other bunches"
+
+# without splitting the bright steps
+converter = make_converter(stepSplittingFactor=0.)
+assert convert(converter, [steps]) == reference, "same photons without step splitting"
+
+# a duplicated step only differs in its sequence number
+original = steps[0]
+duplicate = copy.copy(original)
+duplicate.sequenceNumber = 1000 + len(steps)
+photonsOriginal = convert(converter, [[original]])
+photonsDuplicate = convert(converter, [[duplicate]])
+assert len(photonsOriginal) > 0 and len(photonsDuplicate) > 0, "the bright step is detected"
+assert photonsOriginal != photonsDuplicate, "independent photons for duplicated steps"
+assert not set(photonsOriginal) & set(photonsDuplicate), "no photon of a duplicated step is repeated"
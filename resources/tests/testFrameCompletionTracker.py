@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+
+"""
+Test the per-frame bookkeeping of I3CLSimFrameCompletionTracker:
+a frame is complete once a marker after its light sources has been
+reached and all bunches with its steps have returned, and frames
+leave the tracker in order.
+"""
+
+from icecube import icetray, dataclasses, clsim
+
+def make_bunch(ids):
+    # steps with id 0 are padding
+    steps = clsim.I3CLSimStepSeries()
+    for id in ids:
+        step = clsim.I3CLSimStep()
+        step.id = id
+        step.num = 10 if id > 0 else 0
+        step.weight = 1. if id > 0 else 0.
+        steps.append(step)
+    return steps
+
+tracker = clsim.I3CLSimFrameCompletionTracker(True)
+assert tracker.GetNumFrames() == 0
+assert not tracker.HeadFrameComplete()
+
+# frame 0: light sources 1..3, frame 1: none, frame 2: 4..5
+assert tracker.AddFrame(1, 3) == 0
+assert tracker.AddFrame(4, 0) == 1
+assert tracker.AddFrame(4, 2) == 2
+tracker.AddMarker()
+assert tracker.GetNumFramesAdded() == 3
+
+# steps of frames 0 and 2 are mixed in a bunch, padding is ignored
+tracker.BunchSent(0, 1, 100, make_bunch([1, 4, 2, 0, 0]))
+tracker.BunchSent(1, 0, 50, make_bunch([5]))
+assert tracker.GetNumBunchesInFlight() == 2
+
+assert not tracker.HeadFrameHasAllSteps(), "the marker has not been reached"
+assert tracker.GetConverterToWaitFor() == 1
+
+tracker.MarkerReached()
+assert tracker.HeadFrameHasAllSteps()
+assert not tracker.HeadFrameComplete(), "bunch 0 is still in flight"
+
+assert tracker.BunchReturned(1) == (0, 50)
+assert tracker.BunchReturned(1) is None, "bunches only return once"
+assert not tracker.HeadFrameComplete()
+
+assert tracker.BunchReturned(0) == (1, 100)
+assert tracker.HeadFrameComplete()
+assert tracker.GetConverterToWaitFor() is None
+
+num, weightSum = tracker.PopHeadFrame()
+assert num == [10, 10, 0], "photons generated per light source"
+assert weightSum == [10., 10., 0.]
+
+# the frame without light sources is complete right away
+assert tracker.HeadFrameComplete()
+assert tracker.PopHeadFrame() == ([], [])
+
+num, weightSum = tracker.PopHeadFrame()
+assert num == [10, 10]
+assert tracker.GetNumFrames() == 0
+
+# a frame behind an incomplete one has to wait
+tracker.AddFrame(6, 1)
+tracker.AddMarker()
+tracker.AddFrame(7, 1)
+tracker.AddMarker()
+tracker.BunchSent(2, 0, 10, make_bunch([6]))
+tracker.BunchSent(3, 0, 10, make_bunch([7]))
+tracker.MarkerReached()
+tracker.MarkerReached()
+tracker.BunchReturned(3)
+assert not tracker.HeadFrameComplete()
+tracker.BunchReturned(2)
+assert tracker.HeadFrameComplete()
+tracker.PopHeadFrame()
+assert tracker.HeadFrameComplete()
+tracker.PopHeadFrame()
+
+# without statistics, nothing is summed up
+tracker = clsim.I3CLSimFrameCompletionTracker()
+tracker.AddFrame(1, 2)
+tracker.AddMarker()
+tracker.MarkerReached()
+assert not tracker.WaitForChange(0.01), "nothing happens"
+assert tracker.PopHeadFrame() == ([], [])
@@ -0,0 +1,46 @@
+#!/usr/bin/env python
+
+"""
+Test the photon numbers I3CLSimModule predicts for light sources
+to decide how many frames fit into "HostMemoryBudget".
+"""
+
+from icecube import icetray, dataclasses, clsim
+from icecube.icetray import I3Units
+from math import log
+
+photonsPerMeter = 250.
+density = 0.9216*I3Units.g/I3Units.cm3
+
+def predict(source):
+    return clsim.PredictedNumberOfPhotons(source, photonsPerMeter, density)
+
+def make_particle(type, energy, length=float('nan')):
+    p = dataclasses.I3Particle()
+    p.type = type
+    p.energy = energy
+    p.length = length
+    return clsim.I3CLSimLightSource(p)
+
+def near(a, b):
+    return abs(a-b) <= 1e-9*abs(b)
+
+# cascades scale with energy, hadrons get the e-m light yield
+em = photonsPerMeter*5.21*0.924/0.9216*10.
+assert near(predict(make_particle(dataclasses.I3Particle.EMinus, 10.*I3Units.GeV)), em)
+assert near(predict(make_particle(dataclasses.I3Particle.Hadrons, 10.*I3Units.GeV)), em)
+assert near(predict(make_particle(dataclasses.I3Particle.EMinus, 20.*I3Units.GeV)), 2.*em)
+
+# tracks scale with length
+E = 100.*I3Units.GeV
+muon = photonsPerMeter*500.*(1.+0.1720+0.0324*log(100.))
+assert near(predict(make_particle(dataclasses.I3Particle.MuMinus, E, 500.*I3Units.m)), muon)
+assert near(predict(make_particle(dataclasses.I3Particle.MuMinus, E)), muon*4.), "muons without length get 2000m"
+
+# neutrinos do not emit light
+assert predict(make_particle(dataclasses.I3Particle.NuMu, E)) == 0.
+
+# flashers know their number of photons
+pulse = clsim.I3CLSimFlasherPulse()
+pulse.numberOfPhotonsNoBias = 1.5e9
+assert predict(clsim.I3CLSimLightSource(pulse)) == 1.5e9
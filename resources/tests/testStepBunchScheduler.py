@@ -0,0 +1,142 @@
+#!/usr/bin/env python
+
+"""
+Test the assignment of step bunches to converters of different speed
+by I3CLSimStepBunchScheduler, using simulated converters.
+"""
+
+import random
+
+from icecube import icetray, dataclasses, clsim
+
+class SimulatedConverter(object):
+    """
+    Converts photons at a fixed rate and keeps the same
+    cumulative statistics as the real converters.
+    """
+    def __init__(self, photonsPerSecond):
+        self.photonsPerSecond = photonsPerSecond
+        self.queuedPhotons = 0
+        self.totalNumPhotons = 0
+        self.totalBusyTime = 0.
+
+    def EnqueuePhotons(self, numPhotons):
+        self.queuedPhotons += numPhotons
+
+    def Finish(self):
+        # returns the time needed for this round
+        busyTime = float(self.queuedPhotons)/self.photonsPerSecond
+        self.totalNumPhotons += self.queuedPhotons
+        self.totalBusyTime += busyTime
+        self.queuedPhotons = 0
+        return busyTime
+
+def run_round(scheduler, converters, bunches):
+    """
+    Sends all bunches and returns the time until
+    the slowest converter is done (the FlushFrameCache barrier).
+    """
+    scheduler.StartRound()
+    numBunches = [0]*len(converters)
+    for numPhotons in bunches:
+        index = scheduler.Assign(numPhotons, numBunches)
+        converters[index].EnqueuePhotons(numPhotons)
+        numBunches[index] += 1
+
+    makespan = max([c.Finish() for c in converters])
+
+    for i, c in enumerate(converters):
+        scheduler.SetCumulativeStatistics(i, c.totalNumPhotons, c.totalBusyTime)
+
+    return makespan
+
+rng = random.Random(42)
+speeds = [1e6, 4e6, 2e6]
+rounds = [[rng.randint(1000, 20000) for i in range(300)] for j in range(5)]
+
+def ideal_makespan(bunches):
+    return float(sum(bunches))/sum(speeds)
+
+# without measurements, bunches are distributed evenly
+scheduler = clsim.I3CLSimStepBunchScheduler(3)
+assert not scheduler.HasThroughputEstimates()
+assert [scheduler.Assign(1, [0,0,0]) for i in range(6)] == [1,2,0,1,2,0], "round-robin without estimates"
+assert scheduler.Assign(1, [3,0,3]) == 1, "fallback prefers the shortest queue"
+assert scheduler.GetPredictedCompletionTime(0) == 0.
+
+# fill level round-robin
+converters = [SimulatedConverter(s) for s in speeds]
+scheduler = clsim.I3CLSimStepBunchScheduler(3)
+scheduler.SetUseThroughput(False)
+roundRobinMakespans = [run_round(scheduler, converters, bunches) for bunches in rounds]
+
+# throughput-aware
+converters = [SimulatedConverter(s) for s in speeds]
+scheduler = clsim.I3CLSimStepBunchScheduler(3)
+throughputMakespans = [run_round(scheduler, converters, bunches) for bunches in rounds]
+
+for i in range(3):
+    assert abs(scheduler.GetPhotonsPerSecond(i)/speeds[i] - 1.) < 1e-6, "throughput is measured correctly"
+
+# the first round has no measurements yet and is scheduled like before
+assert abs(throughputMakespans[0]/roundRobinMakespans[0] - 1.) < 1e-9
+
+for bunches, rr, tp in list(zip(rounds, roundRobinMakespans, throughputMakespans))[1:]:
+    ideal = ideal_makespan(bunches)
+    print("round-robin: %.4fs, throughput-aware: %.4fs, ideal: %.4fs" % (rr, tp, ideal))
+    assert tp < 0.6*rr, "throughput-aware scheduling is faster than round-robin"
+    assert tp < 1.02*ideal, "throughput-aware scheduling is close to ideal"
+
+# predictions match the simulated converters
+scheduler.StartRound()
+for numPhotons in rounds[0]:
+    scheduler.Assign(numPhotons, [0,0,0])
+for i in range(3):
+    predicted = scheduler.GetPredictedCompletionTime(i)
+    assert abs(predicted - float(scheduler.GetAssignedPhotons(i))/speeds[i]) < 1e-9
+
+# a converter without measurement is assumed to be average
+scheduler = clsim.I3CLSimStepBunchScheduler(2)
+scheduler.SetCumulativeStatistics(0, 1000000, 1.)
+scheduler.SetCumulativeStatistics(0, 1000000, 1.) # no progress, ignored
+assert scheduler.GetPhotonsPerSecond(0) == 1e6
+assert scheduler.GetPhotonsPerSecond(1) == 0.
+assert [scheduler.Assign(1000, [0,0]) for i in range(4)] == [1,0,1,0], "unmeasured converters take their share"
+
+# streaming: results are collected continuously and each returned bunch
+# is released, so the prediction only covers the photons still in flight
+scheduler = clsim.I3CLSimStepBunchScheduler(3)
+for i, s in enumerate(speeds):
+    scheduler.SetCumulativeStatistics(i, int(s), 1.)
+
+scheduler.Assign(5000, [0,0,0])
+index = scheduler.Assign(7000, [0,0,0])
+assigned = scheduler.GetAssignedPhotons(index)
+scheduler.Release(index, 7000)
+assert scheduler.GetAssignedPhotons(index) == assigned-7000, "released photons are booked off"
+scheduler.StartRound()
+scheduler.Release(index, 7000) # returned after a new round started
+assert scheduler.GetAssignedPhotons(index) == 0
+
+maxBunchesInFlight = 6
+for bunches in rounds[1:]:
+    pending = list(bunches)
+    inFlight = [] # (finish time, converter index, photons)
+    lastFinish = [0.]*len(speeds)
+    numQueued = [0]*len(speeds)
+    now = 0.
+    while pending or inFlight:
+        while pending and len(inFlight) < maxBunchesInFlight:
+            numPhotons = pending.pop(0)
+            index = scheduler.Assign(numPhotons, numQueued)
+            lastFinish[index] = max(now, lastFinish[index]) + float(numPhotons)/speeds[index]
+            numQueued[index] += 1
+            inFlight.append((lastFinish[index], index, numPhotons))
+        inFlight.sort()
+        now, index, numPhotons = inFlight.pop(0)
+        numQueued[index] -= 1
+        scheduler.Release(index, numPhotons)
+    ideal = ideal_makespan(bunches)
+    print("streaming: %.4fs, ideal: %.4fs" % (now, ideal))
+    assert now < 1.1*ideal, "streaming with released bunches is close to ideal"
+    assert [scheduler.GetAssignedPhotons(i) for i in range(3)] == [0,0,0], "all photons are booked off"
@@ -0,0 +1,111 @@
+#!/usr/bin/env python
+
+"""
+Test I3CLSimStepToPhotonConverterOpenCL.SplitLargeSteps: large steps are
+split into sub-steps that together cover the photons of the original
+step, and whatever was left in the sub-step fields (dummy1, dummy2)
+of the input steps never reaches the kernel.
+
+Also test I3CLSimStepToPhotonConverterOpenCL.MakeWorkUnits, which splits
+the photons of a bunch for the persistent work items.
+"""
+
+from icecube import icetray, dataclasses, clsim
+
+SplitLargeSteps = clsim.I3CLSimStepToPhotonConverterOpenCL.SplitLargeSteps
+
+stepSplittingFactor = 4.
+workgroupSize = 64
+maxNumDeviceWorkitems = 4096
+
+def make_step(num, id, dummy1=0x5a, dummy2=0xbeef):
+    # non-zero sub-step fields, as left behind in a recycled step
+    step = clsim.I3CLSimStep()
+    step.num = num
+    step.id = id
+    step.weight = 1.
+    step.dummy1 = dummy1
+    step.dummy2 = dummy2
+    return step
+
+def make_series(steps):
+    series = clsim.I3CLSimStepSeries()
+    for step in steps:
+        series.append(step)
+    return series
+
+def split(steps):
+    return SplitLargeSteps(make_series(steps),
+                           stepSplittingFactor=stepSplittingFactor,
+                           workgroupSize=workgroupSize,
+                           maxNumDeviceWorkitems=maxNumDeviceWorkitems)
+
+# default-constructed steps have no sub-step fields set
+step = clsim.I3CLSimStep()
+assert (step.dummy1, step.dummy2) == (0, 0)
+
+# nothing to split: the steps are passed on with cleared fields
+steps = [make_step(100, i) for i in range(4*workgroupSize)]
+result = split(steps)
+assert [(s.num, s.id) for s in result] == [(s.num, s.id) for s in steps]
+assert all((s.dummy1, s.dummy2) == (0, 0) for s in result), "sub-step fields are cleared"
+
+# one step is much larger than the rest of the bunch
+bigStep = make_step(100000, 4*workgroupSize)
+result = split(steps + [bigStep])
+assert len(result) % workgroupSize == 0, "the bunch is padded to the workgroup size"
+assert len(result) <= maxNumDeviceWorkitems
+
+subSteps = [s for s in result if s.id == bigStep.id and s.num > 0]
+assert len(subSteps) > 1, "the large step is split"
+assert sum(s.num for s in subSteps) == bigStep.num
+subStepSize = 1 << subSteps[0].dummy1
+assert subStepSize < bigStep.num
+nextPhoton = 0
+for index, subStep in enumerate(subSteps):
+    assert subStep.dummy1 == subSteps[0].dummy1
+    assert subStep.dummy2 == index
+    assert subStep.num <= subStepSize
+    # the photon offset the kernel adds for the counter-based generator
+    assert (subStep.dummy2 << subStep.dummy1) == nextPhoton
+    nextPhoton += subStep.num
+assert nextPhoton == bigStep.num, "the sub-steps cover all photons of the step"
+
+for s in result:
+    if s.id == bigStep.id and s.num > 0: continue
+    assert (s.dummy1, s.dummy2) == (0, 0), "steps that are not split have cleared fields"
+assert sorted(s.id for s in result if s.id != bigStep.id and s.num > 0) == list(range(len(steps)))
+
+# a bunch of dummy steps only
+result = split([make_step(0, 0) for i in range(workgroupSize)])
+assert all((s.num, s.dummy1, s.dummy2) == (0, 0, 0) for s in result)
+
+# steps re-using the blocks of an I3CLSimStepStore have cleared fields
+store = clsim.I3CLSimStepStore(300)
+for round in range(2):
+    for i in range(3*store.block_size()):
+        if round == 0:
+            store.insert_copy(7, make_step(7, i))
+        else:
+            step = store.insert_new(7)
+            assert (step.dummy1, step.dummy2) == (0, 0), "recycled steps are reset"
+    bunch = store.pop_bunch(3*store.block_size())
+    assert store.empty()
+assert all((s.dummy1, s.dummy2) == (0, 0) for s in bunch)
+
+# work units of the persistent work items cover every photon exactly once
+MakeWorkUnits = clsim.I3CLSimStepToPhotonConverterOpenCL.MakeWorkUnits
+steps = [make_step(100, i) for i in range(4*workgroupSize)] + [make_step(0, 1000), bigStep]
+numWorkUnits = 2048
+workUnits = MakeWorkUnits(make_series(steps), numWorkUnits=numWorkUnits)
+totalPhotons = sum(s.num for s in steps)
+photonsPerWorkUnit = (totalPhotons + numWorkUnits - 1)//numWorkUnits
+assert len(workUnits) <= len(steps) + numWorkUnits
+assert [u for u in workUnits if u[0] == len(steps)-2] == [], "steps without photons have no work units"
+for index, step in enumerate(steps):
+    units = [u for u in workUnits if u[0] == index]
+    assert [u[1] for u in units] == list(range(0, step.num, photonsPerWorkUnit))
+    assert sum(u[2] for u in units) == step.num
+    assert all(0 < u[2] <= photonsPerWorkUnit for u in units)
+assert len([u for u in workUnits if u[0] == len(steps)-1]) > 1, "the large step is spread over several work units"
+assert sorted(workUnits) == list(workUnits), "work units are in step order"
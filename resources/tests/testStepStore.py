@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+
+"""
+Test I3CLSimStepStore: bunches are clustered by multiplicity,
+steps with the same multiplicity come out in the order they went in,
+and a steady stream of steps does not allocate new blocks.
+"""
+
+import random
+
+from icecube import icetray, dataclasses, clsim
+
+def make_step(num, id):
+    step = clsim.I3CLSimStep()
+    step.num = num
+    step.id = id
+    return step
+
+def fill(store, rng, numSteps, firstId):
+    for i in range(numSteps):
+        if rng.random() < 0.1:
+            num = rng.randint(300, 100000) # above the linear bins
+        else:
+            num = rng.randint(0, 299)
+        store.insert_copy(num, make_step(num, firstId+i))
+
+def drain(store, bunchSize):
+    bunches = []
+    while not store.empty():
+        bunch = store.pop_bunch(bunchSize)
+        assert len(bunch) == min(bunchSize, len(bunch)+len(store))
+        bunches.append(bunch)
+    return bunches
+
+numSteps = 5000
+bunchSize = 1000
+
+store = clsim.I3CLSimStepStore(300)
+assert store.empty()
+
+numBlocks = None
+for round in range(10):
+    # the same steps in every round
+    fill(store, random.Random(42), numSteps, round*numSteps)
+    assert len(store) == numSteps
+
+    lastId = dict()
+    numPopped = 0
+    for bunch in drain(store, bunchSize):
+        for previous, step in zip(bunch[:-1], bunch[1:]):
+            if step.num < 300:
+                assert step.num >= previous.num, "steps are sorted by multiplicity"
+            else:
+                assert step.num >= 0.96*previous.num, "larger multiplicities are clustered"
+        for step in bunch:
+            assert lastId.get(step.num, -1) < step.id, "steps with the same multiplicity keep their order"
+            lastId[step.num] = step.id
+        numPopped += len(bunch)
+    assert numPopped == numSteps
+
+    if round == 1:
+        numBlocks = store.num_blocks()
+    elif round > 1:
+        assert store.num_blocks() == numBlocks, "no blocks are allocated in the steady state"
+
+# partial bunches span several blocks of the same bin
+for i in range(3*store.block_size()):
+    store.insert_copy(7, make_step(7, i))
+first = store.pop_bunch(store.block_size()+10)
+second = store.pop_bunch(store.block_size())
+assert [s.id for s in first] + [s.id for s in second] == list(range(2*store.block_size()+10))
+assert len(store) == store.block_size()-10
+drain(store, bunchSize)
+
+# the rest of the bunch is filled with the template
+for i in range(3):
+    store.insert_copy(5, make_step(5, i))
+bunch = store.pop_bunch(8, make_step(0, 999))
+assert [s.id for s in bunch] == [0, 1, 2] + [999]*5
+assert store.empty()
+
+# reserved blocks are used first
+store = clsim.I3CLSimStepStore(300)
+store.reserve(10*store.block_size())
+numBlocks = store.num_blocks()
+assert numBlocks == 10
+for i in range(10*store.block_size()):
+    store.insert_copy(17, make_step(17, i))
+assert store.num_blocks() == numBlocks